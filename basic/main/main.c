@@ -12,6 +12,8 @@
 #include "esp_log.h"
 
 #include <cc1101.h>
+#include "dutycycle.h"
+#include "dlog.h"
 
 static const char *TAG = "MAIN";
 
@@ -19,9 +21,13 @@ static const char *TAG = "MAIN";
 void tx_task(void *pvParameter)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	AIRTIME_CONFIG_t airtime;
+	airtime_read_config(&airtime);
 	CCPACKET packet;
 	while(1) {
 		packet.length = sprintf((char *)packet.data, "Hello World %"PRIu32, xTaskGetTickCount());
+		// Wait while the sub-band is over its duty cycle
+		dutycycle_wait(airtime.frequency, airtime_us(&airtime, packet.length), portMAX_DELAY);
 		sendData(packet);
 		ESP_LOGI(pcTaskGetName(NULL), "Sent packet. length=%d", packet.length);
 		vTaskDelay(1000/portTICK_PERIOD_MS);
@@ -58,15 +64,15 @@ void rx_task(void *pvParameter)
 	while(1) {
 		if(packet_available()) {
 			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
+				DLOGI(pcTaskGetName(NULL), "Received packet...");
 				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
+					DLOGE(pcTaskGetName(NULL), "crc not ok");
 				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
+					DLOGI(pcTaskGetName(NULL), "packet.lqi: %d", lqi(packet.lqi));
+					DLOGI(pcTaskGetName(NULL), "packet.rssi: %ddBm", rssi(packet.rssi));
+					DLOGI(pcTaskGetName(NULL), "packet.length: %d", packet.length);
 					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *) packet.data);
+						DLOG_TEXT(pcTaskGetName(NULL), "data: %.*s", packet.data, packet.length, ESP_LOG_INFO);
 					}
 				}
 			} // end receiveData
@@ -81,6 +87,9 @@ void rx_task(void *pvParameter)
 
 void app_main()
 {
+	// Print the logs of the packets in the background
+	ESP_ERROR_CHECK(dlog_init());
+
 	uint8_t freq;
 #if CONFIG_CC1101_FREQ_315
 	freq = CFREQ_315;
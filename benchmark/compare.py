@@ -0,0 +1,95 @@
+#!/usr/bin/python3
+#-*- encoding: utf-8 -*-
+# Compare the results of two benchmark runs.
+# Each file is the serial output of the primary, in CSV or JSON.
+# The log lines of ESP-IDF are skipped.
+#
+# python3 compare.py before.txt after.txt
+import sys
+import argparse
+import csv
+import json
+
+KEY = ('speed_bps', 'power', 'length', 'interval_ms')
+COLUMNS = (
+	('per', 'PER', '{:.4f}'),
+	('goodput_bps', 'goodput', '{:.0f}'),
+	('rtt_p50_us', 'RTT p50', '{:.0f}'),
+	('rtt_p99_us', 'RTT p99', '{:.0f}'),
+	('rssi_p50', 'RSSI p50', '{:.0f}'),
+)
+
+def flatten(result):
+	row = {}
+	for name, value in result.items():
+		if isinstance(value, dict):
+			# "rtt_us":{"p50":1} --> "rtt_p50_us"
+			prefix, _, unit = name.partition('_')
+			for stat, v in value.items():
+				if unit == 'us':
+					row['{}_{}_us'.format(prefix, stat)] = v
+				else:
+					row['{}_{}'.format(prefix, stat)] = v
+		else:
+			row[name] = value
+	return row
+
+def load(path):
+	results = {}
+	header = None
+	version = None
+	with open(path, errors='replace') as f:
+		for line in f:
+			line = line.strip()
+			if line.startswith('{'):
+				try:
+					row = flatten(json.loads(line))
+				except ValueError:
+					continue
+			elif line.startswith('version,'):
+				header = line.split(',')
+				continue
+			elif header and line.count(',') == len(header) - 1:
+				row = dict(zip(header, next(csv.reader([line]))))
+			else:
+				continue
+			version = row.get('version')
+			results[tuple(str(row[k]) for k in KEY)] = row
+	return version, results
+
+def number(row, name):
+	try:
+		return float(row[name])
+	except (KeyError, TypeError, ValueError):
+		return None
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('before', help='Results of the first run')
+	parser.add_argument('after', help='Results of the second run')
+	args = parser.parse_args()
+
+	version1, before = load(args.before)
+	version2, after = load(args.after)
+	if not before or not after:
+		print('No results found')
+		sys.exit(1)
+	print('{} --> {}'.format(version1, version2))
+	title = '{:>6} {:>4} {:>4} {:>5}'.format('bps', 'pwr', 'len', 'intvl')
+	for _, label, _ in COLUMNS:
+		title += ' {:>21}'.format(label)
+	print(title)
+	for key in before:
+		if key not in after: continue
+		line = '{:>6} {:>4} {:>4} {:>5}'.format(*key)
+		for name, _, fmt in COLUMNS:
+			x = number(before[key], name)
+			y = number(after[key], name)
+			if x is None or y is None:
+				line += ' {:>21}'.format('-')
+			else:
+				line += ' {:>21}'.format((fmt + '->' + fmt).format(x, y))
+		print(line)
+
+if __name__ == '__main__':
+	main()
@@ -0,0 +1,561 @@
+/* Radio link benchmark of CC1101
+ *
+ * The primary runs a test plan with the secondary.
+ * For each speed, power level, payload size and interval of the plan,
+ * the primary sends CONFIG_BENCH_COUNT packets and the secondary sends them back.
+ * The results are printed as CSV or JSON lines.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_app_desc.h"
+#include "esp_idf_version.h"
+
+#include <cc1101.h>
+#include "dutycycle.h"
+
+static const char *TAG = "MAIN";
+
+// A control packet starts with two 0xFF bytes.
+// A test packet starts with its sequence number, which never reaches 0xFFFF.
+#define CONTROL_MARK	0xFF
+#define CONTROL_START	'S'		// Switch to the speed and power of a test. Sent back before switching.
+#define CONTROL_END		'E'		// Back to the base speed and power. Not sent back.
+#define CONTROL_LENGTH	6
+
+// The secondary goes back to the base speed and power when no packet arrives for this long
+#define IDLE_TIMEOUT_MS	2000
+
+// The speed and power of menuconfig. Control packets are sent with them.
+static uint8_t base_speed;
+static uint8_t base_power;
+
+static const int speed_bps[CSPEED_LAST] = {4800, 9600, 19200, 38400};
+static const char *power_name[POWER_LAST] = {"min", "0", "max"};
+
+// Get signal strength indicator in dBm.
+// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
+static int rssi(char raw) {
+	uint8_t rssi_dec;
+	uint8_t rssi_offset = 74;
+	rssi_dec = (uint8_t) raw;
+	if (rssi_dec >= 128)
+		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
+	else
+		return (rssi_dec / 2) - rssi_offset;
+}
+
+// Settings for the airtime of the packets. Read again when the speed changes.
+static AIRTIME_CONFIG_t airtime_config;
+
+static void radio_set(uint8_t speed, uint8_t power)
+{
+	setSpeed(speed);
+	setTxPowerAmp(power);
+	airtime_read_config(&airtime_config);
+}
+
+// Wait while the sub-band is over its duty cycle, then send.
+// sent_time is the start of sendData() in microseconds since boot. NULL when not needed.
+static bool send_packet(CCPACKET *packet, int64_t *sent_time)
+{
+	if (dutycycle_wait(airtime_config.frequency, airtime_us(&airtime_config, packet->length), portMAX_DELAY) != ESP_OK) return false;
+	if (sent_time) *sent_time = esp_timer_get_time();
+	bool ret = sendData(*packet);
+	// GDO0 also falls at the end of the transmission
+	packet_available();
+	ulTaskNotifyTake(pdTRUE, 0);
+	return ret;
+}
+
+// Wait for a packet until deadline. Returns the length, or 0 at the deadline.
+// time is the end of the packet in microseconds since boot.
+static uint8_t wait_packet(CCPACKET *packet, int64_t deadline, int64_t *time)
+{
+	while(1) {
+		int64_t now = esp_timer_get_time();
+		if (now >= deadline) return 0;
+		ulTaskNotifyTake(pdTRUE, (deadline - now) / 1000 / portTICK_PERIOD_MS + 1);
+		if (!packet_available()) continue;
+		*time = getPacketTime();
+		if (receiveData(packet) > 0) return packet->length;
+	}
+}
+
+#if CONFIG_PRIMARY
+typedef struct {
+	int test;
+	uint8_t speed;
+	uint8_t power;
+	uint8_t length;
+	int interval_ms;
+	bool linked;			// The secondary followed to the speed and power of the test
+	uint32_t sent;
+	uint32_t received;		// Replies with the same data
+	uint32_t crc_errors;
+	uint32_t send_failures;	// sendData() returned false
+	uint32_t airtime_us;	// Time on air of one packet
+	int64_t elapsed_us;
+	int32_t *rtt;			// [received] From sendData() to the end of the reply, in microseconds
+	int16_t *rssi;			// [received] dBm
+	int16_t *lqi;			// [received] As read from the CC1101. Lower is better.
+} RESULT_t;
+
+typedef struct {
+	bool valid;
+	int32_t min;
+	int32_t p10;
+	int32_t p50;
+	int32_t p90;
+	int32_t p99;
+	int32_t max;
+} DISTRIBUTION_t;
+
+static int compare32(const void *a, const void *b)
+{
+	int32_t x = *(const int32_t *)a;
+	int32_t y = *(const int32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static int compare16(const void *a, const void *b)
+{
+	return *(const int16_t *)a - *(const int16_t *)b;
+}
+
+// Sorts the values
+static void distribution32(int32_t *values, uint32_t count, DISTRIBUTION_t *d)
+{
+	d->valid = count > 0;
+	if (count == 0) return;
+	qsort(values, count, sizeof(int32_t), compare32);
+	d->min = values[0];
+	d->p10 = values[(10 * (count - 1) + 50) / 100];
+	d->p50 = values[(50 * (count - 1) + 50) / 100];
+	d->p90 = values[(90 * (count - 1) + 50) / 100];
+	d->p99 = values[(99 * (count - 1) + 50) / 100];
+	d->max = values[count - 1];
+}
+
+static void distribution16(int16_t *values, uint32_t count, DISTRIBUTION_t *d)
+{
+	d->valid = count > 0;
+	if (count == 0) return;
+	qsort(values, count, sizeof(int16_t), compare16);
+	d->min = values[0];
+	d->p10 = values[(10 * (count - 1) + 50) / 100];
+	d->p50 = values[(50 * (count - 1) + 50) / 100];
+	d->p90 = values[(90 * (count - 1) + 50) / 100];
+	d->p99 = values[(99 * (count - 1) + 50) / 100];
+	d->max = values[count - 1];
+}
+
+static int parse_speed(const char *s)
+{
+	for (int i=0;i<CSPEED_LAST;i++) {
+		if (atoi(s) == speed_bps[i]) return i;
+	}
+	return -1;
+}
+
+static int parse_power(const char *s)
+{
+	for (int i=0;i<POWER_LAST;i++) {
+		if (strcmp(s, power_name[i]) == 0) return i;
+	}
+	return -1;
+}
+
+static int parse_length(const char *s)
+{
+	int length = atoi(s);
+	if (length < 1 || length > (CCPACKET_DATA_LEN)) return -1;
+	return length;
+}
+
+static int parse_interval(const char *s)
+{
+	int interval = atoi(s);
+	if (interval < 0) return -1;
+	// The secondary would go back to the base speed and power between the packets
+	if (interval >= IDLE_TIMEOUT_MS) return -1;
+	return interval;
+}
+
+// Parse a comma separated list of menuconfig. Returns the number of items.
+static int parse_list(const char *name, const char *list, int *items, int max, int (*parse)(const char *))
+{
+	char buffer[64];
+	strlcpy(buffer, list, sizeof(buffer));
+	int count = 0;
+	char *save;
+	for (char *item = strtok_r(buffer, ", ", &save); item != NULL; item = strtok_r(NULL, ", ", &save)) {
+		int value = parse(item);
+		if (value < 0) {
+			ESP_LOGE(TAG, "%s: [%s] is not valid", name, item);
+		} else if (count < max) {
+			items[count++] = value;
+		}
+	}
+	return count;
+}
+
+static void fill_packet(CCPACKET *packet, uint8_t length, uint16_t seq)
+{
+	packet->length = length;
+	packet->data[0] = seq & 0xFF;
+	if (length > 1) packet->data[1] = seq >> 8;
+	for (int i=2;i<length;i++) packet->data[i] = (uint8_t)(seq + i);
+}
+
+// Ask the secondary to switch, then switch
+static bool start_test(RESULT_t *result)
+{
+	CCPACKET packet;
+	CCPACKET reply;
+	packet.length = CONTROL_LENGTH;
+	packet.data[0] = CONTROL_MARK;
+	packet.data[1] = CONTROL_MARK;
+	packet.data[2] = CONTROL_START;
+	packet.data[3] = result->test & 0xFF;
+	packet.data[4] = result->speed;
+	packet.data[5] = result->power;
+
+	int64_t timeout_us = 2LL * airtime_us(&airtime_config, CONTROL_LENGTH) + CONFIG_BENCH_TIMEOUT * 1000;
+	// Keep trying until the secondary has given up a test it did not finish
+	int64_t give_up = esp_timer_get_time() + (IDLE_TIMEOUT_MS + 1000) * 1000LL;
+	while (esp_timer_get_time() < give_up) {
+		send_packet(&packet, NULL);
+		int64_t deadline = esp_timer_get_time() + timeout_us;
+		int64_t time;
+		while (wait_packet(&reply, deadline, &time)) {
+			if (reply.crc_ok && reply.length == packet.length && memcmp(reply.data, packet.data, packet.length) == 0) {
+				radio_set(result->speed, result->power);
+				// Give the secondary time to switch
+				vTaskDelay(pdMS_TO_TICKS(10));
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static void end_test(RESULT_t *result)
+{
+	CCPACKET packet;
+	packet.length = CONTROL_LENGTH;
+	packet.data[0] = CONTROL_MARK;
+	packet.data[1] = CONTROL_MARK;
+	packet.data[2] = CONTROL_END;
+	packet.data[3] = result->test & 0xFF;
+	packet.data[4] = base_speed;
+	packet.data[5] = base_power;
+	send_packet(&packet, NULL);
+	radio_set(base_speed, base_power);
+	vTaskDelay(pdMS_TO_TICKS(10));
+}
+
+static void run_test(RESULT_t *result)
+{
+	result->airtime_us = airtime_us(&airtime_config, result->length);
+	int64_t timeout_us = 2LL * result->airtime_us + CONFIG_BENCH_TIMEOUT * 1000;
+
+	CCPACKET packet;
+	CCPACKET reply;
+	int64_t start = esp_timer_get_time();
+	TickType_t wake = xTaskGetTickCount();
+	for (int seq=0;seq<CONFIG_BENCH_COUNT;seq++) {
+		if (seq && result->interval_ms) xTaskDelayUntil(&wake, pdMS_TO_TICKS(result->interval_ms));
+		fill_packet(&packet, result->length, seq);
+		int64_t sent_time;
+		result->sent++;
+		if (send_packet(&packet, &sent_time) == false) {
+			result->send_failures++;
+			continue;
+		}
+
+		int64_t deadline = esp_timer_get_time() + timeout_us;
+		int64_t time;
+		while (wait_packet(&reply, deadline, &time)) {
+			if (!reply.crc_ok) {
+				result->crc_errors++;
+				continue;
+			}
+			// A late reply to an earlier packet does not match
+			if (reply.length != packet.length || memcmp(reply.data, packet.data, packet.length) != 0) continue;
+			result->rtt[result->received] = time - sent_time;
+			result->rssi[result->received] = rssi(reply.rssi);
+			result->lqi[result->received] = reply.lqi;
+			result->received++;
+			break;
+		}
+	}
+	result->elapsed_us = esp_timer_get_time() - start;
+}
+
+#if CONFIG_BENCH_CSV
+static void print_distribution(const DISTRIBUTION_t *d, bool p99)
+{
+	if (d->valid) {
+		printf(",%"PRId32",%"PRId32",%"PRId32",%"PRId32, d->min, d->p10, d->p50, d->p90);
+		if (p99) printf(",%"PRId32, d->p99);
+		printf(",%"PRId32, d->max);
+	} else {
+		printf(p99 ? ",,,,,," : ",,,,,");
+	}
+}
+
+static void print_header(void)
+{
+	printf("version,idf,test,speed_bps,power,length,interval_ms,linked,sent,received,crc_errors,send_failures,"
+		"per,goodput_bps,airtime_us,elapsed_ms,"
+		"rtt_min_us,rtt_p10_us,rtt_p50_us,rtt_p90_us,rtt_p99_us,rtt_max_us,"
+		"rssi_min,rssi_p10,rssi_p50,rssi_p90,rssi_max,"
+		"lqi_min,lqi_p10,lqi_p50,lqi_p90,lqi_max\n");
+}
+
+static void print_result(const RESULT_t *r, double per, double goodput,
+	const DISTRIBUTION_t *rtt_d, const DISTRIBUTION_t *rssi_d, const DISTRIBUTION_t *lqi_d)
+{
+	printf("%s,%s,%d,%d,%s,%d,%d,%d,%"PRIu32",%"PRIu32",%"PRIu32",%"PRIu32",%.4f,%.0f,%"PRIu32",%"PRId64,
+		esp_app_get_description()->version, esp_get_idf_version(),
+		r->test, speed_bps[r->speed], power_name[r->power], r->length, r->interval_ms, r->linked,
+		r->sent, r->received, r->crc_errors, r->send_failures,
+		per, goodput, r->airtime_us, r->elapsed_us / 1000);
+	print_distribution(rtt_d, true);
+	print_distribution(rssi_d, false);
+	print_distribution(lqi_d, false);
+	printf("\n");
+}
+#endif // CONFIG_BENCH_CSV
+
+#if CONFIG_BENCH_JSON
+static void print_distribution(const char *name, const DISTRIBUTION_t *d, bool p99)
+{
+	if (d->valid == false) {
+		printf(",\"%s\":null", name);
+		return;
+	}
+	printf(",\"%s\":{\"min\":%"PRId32",\"p10\":%"PRId32",\"p50\":%"PRId32",\"p90\":%"PRId32,
+		name, d->min, d->p10, d->p50, d->p90);
+	if (p99) printf(",\"p99\":%"PRId32, d->p99);
+	printf(",\"max\":%"PRId32"}", d->max);
+}
+
+static void print_header(void)
+{
+}
+
+static void print_result(const RESULT_t *r, double per, double goodput,
+	const DISTRIBUTION_t *rtt_d, const DISTRIBUTION_t *rssi_d, const DISTRIBUTION_t *lqi_d)
+{
+	printf("{\"version\":\"%s\",\"idf\":\"%s\",\"test\":%d,\"speed_bps\":%d,\"power\":\"%s\",\"length\":%d,\"interval_ms\":%d,"
+		"\"linked\":%s,\"sent\":%"PRIu32",\"received\":%"PRIu32",\"crc_errors\":%"PRIu32",\"send_failures\":%"PRIu32","
+		"\"per\":%.4f,\"goodput_bps\":%.0f,\"airtime_us\":%"PRIu32",\"elapsed_ms\":%"PRId64,
+		esp_app_get_description()->version, esp_get_idf_version(),
+		r->test, speed_bps[r->speed], power_name[r->power], r->length, r->interval_ms,
+		r->linked ? "true" : "false", r->sent, r->received, r->crc_errors, r->send_failures,
+		per, goodput, r->airtime_us, r->elapsed_us / 1000);
+	print_distribution("rtt_us", rtt_d, true);
+	print_distribution("rssi_dbm", rssi_d, false);
+	print_distribution("lqi", lqi_d, false);
+	printf("}\n");
+}
+#endif // CONFIG_BENCH_JSON
+
+static void report(RESULT_t *r)
+{
+	// PER of the round trip. A packet counts as received when its reply arrives intact.
+	double per = r->sent ? 1.0 - (double)r->received / r->sent : 1.0;
+	// Payload bits of the replies per second
+	double goodput = r->elapsed_us ? r->received * r->length * 8 * 1e6 / r->elapsed_us : 0;
+	DISTRIBUTION_t rtt_d, rssi_d, lqi_d;
+	distribution32(r->rtt, r->received, &rtt_d);
+	distribution16(r->rssi, r->received, &rssi_d);
+	distribution16(r->lqi, r->received, &lqi_d);
+	print_result(r, per, goodput, &rtt_d, &rssi_d, &lqi_d);
+	fflush(stdout);
+}
+
+void primary_task(void *pvParameter)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	int speeds[CSPEED_LAST];
+	int powers[POWER_LAST];
+	int lengths[16];
+	int intervals[16];
+	int speed_count = parse_list("Speeds", CONFIG_BENCH_SPEEDS, speeds, CSPEED_LAST, parse_speed);
+	int power_count = parse_list("Power levels", CONFIG_BENCH_POWERS, powers, POWER_LAST, parse_power);
+	int length_count = parse_list("Payload sizes", CONFIG_BENCH_LENGTHS, lengths, 16, parse_length);
+	int interval_count = parse_list("Intervals", CONFIG_BENCH_INTERVALS, intervals, 16, parse_interval);
+	int tests = speed_count * power_count * length_count * interval_count;
+	ESP_LOGI(pcTaskGetName(NULL), "%d tests of %d packets", tests, CONFIG_BENCH_COUNT);
+
+	RESULT_t result;
+	result.rtt = malloc(CONFIG_BENCH_COUNT * sizeof(int32_t));
+	result.rssi = malloc(CONFIG_BENCH_COUNT * sizeof(int16_t));
+	result.lqi = malloc(CONFIG_BENCH_COUNT * sizeof(int16_t));
+	if (result.rtt == NULL || result.rssi == NULL || result.lqi == NULL) {
+		ESP_LOGE(pcTaskGetName(NULL), "Not enough memory for %d packets", CONFIG_BENCH_COUNT);
+		vTaskDelete(NULL);
+	}
+
+	setPacketNotify(xTaskGetCurrentTaskHandle());
+	// The driver logs every power change
+	esp_log_level_set("CC1101", ESP_LOG_WARN);
+	esp_log_level_set("AIRTIME", ESP_LOG_WARN);
+	print_header();
+	int test = 0;
+	for (int s=0;s<speed_count;s++) {
+		for (int p=0;p<power_count;p++) {
+			for (int l=0;l<length_count;l++) {
+				for (int i=0;i<interval_count;i++) {
+					result.test = test++;
+					result.speed = speeds[s];
+					result.power = powers[p];
+					result.length = lengths[l];
+					result.interval_ms = intervals[i];
+					result.sent = result.received = result.crc_errors = result.send_failures = 0;
+					result.airtime_us = 0;
+					result.elapsed_us = 0;
+					result.linked = start_test(&result);
+					if (result.linked) {
+						run_test(&result);
+						end_test(&result);
+					} else {
+						ESP_LOGE(pcTaskGetName(NULL), "No responce from the secondary");
+					}
+					report(&result);
+				}
+			}
+		}
+	}
+	ESP_LOGI(pcTaskGetName(NULL), "Finish");
+
+	free(result.rtt);
+	free(result.rssi);
+	free(result.lqi);
+	vTaskDelete( NULL );
+}
+#endif // CONFIG_PRIMARY
+
+#if CONFIG_SECONDARY
+static bool is_control(const CCPACKET *packet)
+{
+	return packet->length == CONTROL_LENGTH && packet->data[0] == CONTROL_MARK && packet->data[1] == CONTROL_MARK;
+}
+
+void secondary_task(void *pvParameter)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	setPacketNotify(xTaskGetCurrentTaskHandle());
+	esp_log_level_set("CC1101", ESP_LOG_WARN);
+	CCPACKET packet;
+	bool base = true;
+	uint32_t received = 0;
+	while(1) {
+		int64_t time;
+		if (wait_packet(&packet, esp_timer_get_time() + IDLE_TIMEOUT_MS * 1000LL, &time) == 0) {
+			if (!base) {
+				ESP_LOGW(pcTaskGetName(NULL), "No packet for %dms. Back to %dbps", IDLE_TIMEOUT_MS, speed_bps[base_speed]);
+				radio_set(base_speed, base_power);
+				base = true;
+			}
+			continue;
+		}
+		if (!packet.crc_ok) continue;
+
+		if (is_control(&packet)) {
+			uint8_t speed = packet.data[4];
+			uint8_t power = packet.data[5];
+			if (speed >= CSPEED_LAST || power >= POWER_LAST) continue;
+			if (packet.data[2] == CONTROL_START) {
+				send_packet(&packet, NULL);
+				ESP_LOGI(pcTaskGetName(NULL), "Test %d: %dbps power %s", packet.data[3], speed_bps[speed], power_name[power]);
+				radio_set(speed, power);
+				base = false;
+				received = 0;
+			} else if (packet.data[2] == CONTROL_END) {
+				ESP_LOGI(pcTaskGetName(NULL), "Test %d: %"PRIu32" packets sent back", packet.data[3], received);
+				radio_set(base_speed, base_power);
+				base = true;
+			}
+			continue;
+		}
+
+		// Send back as it is
+		received++;
+		send_packet(&packet, NULL);
+	}
+
+	// never reach here
+	vTaskDelete( NULL );
+}
+#endif // CONFIG_SECONDARY
+
+void app_main()
+{
+	uint8_t freq;
+#if CONFIG_CC1101_FREQ_315
+	freq = CFREQ_315;
+	ESP_LOGW(TAG, "Set frequency to 315MHz");
+#elif CONFIG_CC1101_FREQ_433
+	freq = CFREQ_433;
+	ESP_LOGW(TAG, "Set frequency to 433MHz");
+#elif CONFIG_CC1101_FREQ_868
+	freq = CFREQ_868;
+	ESP_LOGW(TAG, "Set frequency to 868MHz");
+#elif CONFIG_CC1101_FREQ_915
+	freq = CFREQ_915;
+	ESP_LOGW(TAG, "Set frequency to 915MHz");
+#endif
+
+#if CONFIG_CC1101_SPEED_4800
+	base_speed = CSPEED_4800;
+#elif CONFIG_CC1101_SPEED_9600
+	base_speed = CSPEED_9600;
+#elif CONFIG_CC1101_SPEED_19200
+	base_speed = CSPEED_19200;
+#elif CONFIG_CC1101_SPEED_38400
+	base_speed = CSPEED_38400;
+#endif
+	ESP_LOGW(TAG, "Set speed to %dbps", speed_bps[base_speed]);
+
+	esp_err_t ret = init(freq, base_speed);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "CC1101 not installed");
+		while(1) { vTaskDelay(1); }
+	}
+
+	uint8_t syncWord[2] = {199, 10};
+	setSyncWordArray(syncWord);
+	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
+	setChannel(CONFIG_CC1101_CHANNEL);
+	disableAddressCheck();
+#if CONFIG_CC1101_POWER_MIN
+	base_power = POWER_MIN;
+#elif CONFIG_CC1101_POWER_0db
+	base_power = POWER_0db;
+#elif CONFIG_CC1101_POWER_MAX
+	base_power = POWER_MAX;
+#endif
+	ESP_LOGW(TAG, "Set %s power level", power_name[base_power]);
+	setTxPowerAmp(base_power);
+	airtime_read_config(&airtime_config);
+
+#if CONFIG_PRIMARY
+	xTaskCreate(&primary_task, "PRIMARY", 1024*4, NULL, 5, NULL);
+#endif
+#if CONFIG_SECONDARY
+	xTaskCreate(&secondary_task, "SECONDARY", 1024*3, NULL, 5, NULL);
+#endif
+}
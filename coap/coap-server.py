@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# CoAP receiver for the coap example.
+# Confirmable requests are acknowledged with 2.04 Changed.
+# The number of packets per second and the number of bytes per packet on the wire are reported.
+# The bytes on the wire include the IP and UDP headers.
+# Envelopes (Content-Format 63, application/cbor-seq) are decoded with envelope.py.
+#
+# python3 ./coap-server.py --verbose
+
+import argparse
+import os
+import socket
+import sys
+import time
+
+# Decoder of the binary envelope
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '../components/envelope'))
+import envelope
+
+UDP_IP_HEADER_SIZE = 28
+
+COAP_TYPE_CON = 0
+COAP_TYPE_NON = 1
+COAP_TYPE_ACK = 2
+COAP_CODE_POST = 0x02
+COAP_CODE_CHANGED = 0x44
+COAP_OPTION_URI_PATH = 11
+COAP_OPTION_CONTENT_FORMAT = 12
+COAP_FORMAT_CBOR_SEQ = 63
+
+def parse_coap(data):
+	if len(data) < 4 or (data[0] >> 6) != 1:
+		return None
+	type = (data[0] >> 4) & 0x03
+	tkl = data[0] & 0x0F
+	code = data[1]
+	mid = (data[2] << 8) | data[3]
+	token = data[4:4+tkl]
+	index = 4 + tkl
+	number = 0
+	path = []
+	format = None
+	payload = b''
+	while index < len(data):
+		if data[index] == 0xFF:
+			payload = data[index+1:]
+			break
+		delta = data[index] >> 4
+		length = data[index] & 0x0F
+		index += 1
+		if delta == 13:
+			delta = data[index] + 13
+			index += 1
+		elif delta == 14:
+			delta = ((data[index] << 8) | data[index+1]) + 269
+			index += 2
+		if length == 13:
+			length = data[index] + 13
+			index += 1
+		elif length == 14:
+			length = ((data[index] << 8) | data[index+1]) + 269
+			index += 2
+		number += delta
+		if number == COAP_OPTION_URI_PATH:
+			path.append(data[index:index+length].decode('utf-8', 'replace'))
+		if number == COAP_OPTION_CONTENT_FORMAT:
+			format = int.from_bytes(data[index:index+length], 'big')
+		index += length
+	return type, code, mid, token, "/".join(path), format, payload
+
+# Each packet is a length byte followed by the data
+def split_packets(payload):
+	packets = []
+	index = 0
+	while index < len(payload):
+		length = payload[index]
+		packets.append(payload[index+1:index+1+length])
+		index += 1 + length
+	return packets
+
+if __name__=='__main__':
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--port', type=int, help='udp port', default=5683)
+	parser.add_argument('--interval', type=int, help='statistics interval', default=10)
+	parser.add_argument('--verbose', action='store_true', help='print packets')
+	args = parser.parse_args()
+	print("args.port={}".format(args.port))
+
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.bind(('0.0.0.0', args.port))
+	sock.settimeout(1.0)
+	print("Listening on port {}".format(args.port))
+
+	start = time.time()
+	datagrams = 0
+	packets = 0
+	wire_bytes = 0
+	last_mid = {}
+	while True:
+		try:
+			data, addr = sock.recvfrom(2048)
+		except socket.timeout:
+			data = None
+
+		if data:
+			message = parse_coap(data)
+			if message is None:
+				print("{} not a CoAP message".format(addr))
+				continue
+			type, code, mid, token, path, format, payload = message
+			if type == COAP_TYPE_CON:
+				# Piggybacked response
+				response = bytes([(1 << 6) | (COAP_TYPE_ACK << 4) | len(token), COAP_CODE_CHANGED, mid >> 8, mid & 0xFF]) + token
+				sock.sendto(response, addr)
+				# A retransmitted request is acknowledged again, but not counted
+				if last_mid.get(addr) == mid:
+					continue
+				last_mid[addr] = mid
+			if code != COAP_CODE_POST:
+				continue
+			datagrams += 1
+			wire_bytes += len(data) + UDP_IP_HEADER_SIZE
+			if format == COAP_FORMAT_CBOR_SEQ:
+				for item in envelope.decode_seq(payload):
+					packets += 1
+					if args.verbose:
+						print("{} /{} ".format(addr[0], path), end='')
+						envelope.print_envelope(item)
+			else:
+				for packet in split_packets(payload):
+					packets += 1
+					if args.verbose:
+						print("{} /{} {}".format(addr[0], path, packet.decode('utf-8', 'replace')))
+
+		elapsed = time.time() - start
+		if elapsed >= args.interval:
+			if packets:
+				print("{:.1f} packets/s {:.1f} datagrams/s {:.1f} bytes/packet on the wire".format(
+					packets / elapsed, datagrams / elapsed, wire_bytes / packets))
+			start = time.time()
+			datagrams = 0
+			packets = 0
+			wire_bytes = 0
@@ -0,0 +1,448 @@
+/*	CoAP client over UDP
+
+	Radio packets are sent with the POST method.
+	Several packets are aggregated into one datagram.
+	Each packet is stored as a length byte followed by the data.
+	With CONFIG_BRIDGE_ENVELOPE, the payload is a CBOR sequence of envelopes.
+
+	This example code is in the Public Domain (or CC0 licensed, at your option.)
+
+	Unless required by applicable law or agreed to in writing, this
+	software is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR
+	CONDITIONS OF ANY KIND, either express or implied.
+*/
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#if CONFIG_COAP_DTLS
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#endif
+
+#include "bridge.h"
+#include "resolver.h"
+
+static const char *TAG = "COAP";
+
+#define COAP_VERSION				1
+#define COAP_TYPE_CON				0
+#define COAP_TYPE_NON				1
+#define COAP_TYPE_ACK				2
+#define COAP_TYPE_RST				3
+#define COAP_CODE_POST				0x02
+#define COAP_OPTION_URI_PATH		11
+#define COAP_OPTION_CONTENT_FORMAT	12
+#define COAP_FORMAT_OCTET_STREAM	42
+#define COAP_FORMAT_CBOR_SEQ		63
+#define COAP_PAYLOAD_MARKER			0xFF
+
+#if CONFIG_BRIDGE_ENVELOPE
+#define COAP_FORMAT COAP_FORMAT_CBOR_SEQ
+#define COAP_PAYLOAD_MAX (CONFIG_COAP_PACKETS_PER_DATAGRAM * BRIDGE_ENCODED_MAX)
+#else
+#define COAP_FORMAT COAP_FORMAT_OCTET_STREAM
+#define COAP_PAYLOAD_MAX (CONFIG_COAP_PACKETS_PER_DATAGRAM * (1 + BRIDGE_PAYLOAD_MAX))
+#endif
+#define COAP_BUFFER_SIZE (4 + 3 * sizeof(CONFIG_COAP_URI_PATH) + 3 + 1 + COAP_PAYLOAD_MAX)
+#define UDP_IP_HEADER_SIZE 28
+
+static int coap_sock = -1;
+static uint16_t coap_message_id;
+static uint8_t coap_payload[COAP_PAYLOAD_MAX];
+static uint8_t coap_tx_buffer[COAP_BUFFER_SIZE];
+#if CONFIG_COAP_CON
+static uint8_t coap_rx_buffer[64];
+#endif
+
+// Statistics
+static int64_t stats_start;
+static uint32_t stats_datagrams;
+static uint32_t stats_packets;
+static uint32_t stats_bytes;
+static uint32_t stats_retransmits;
+
+#if CONFIG_COAP_DTLS
+static mbedtls_ssl_context ssl;
+static mbedtls_ssl_config conf;
+static bool dtls_initialized;
+
+typedef struct {
+	int64_t start;
+	uint32_t int_ms;
+	uint32_t fin_ms;
+} DTLS_TIMER_t;
+
+static DTLS_TIMER_t dtls_timer;
+
+static void dtls_set_delay(void *data, uint32_t int_ms, uint32_t fin_ms)
+{
+	DTLS_TIMER_t *timer = (DTLS_TIMER_t *)data;
+	timer->start = esp_timer_get_time();
+	timer->int_ms = int_ms;
+	timer->fin_ms = fin_ms;
+}
+
+static int dtls_get_delay(void *data)
+{
+	DTLS_TIMER_t *timer = (DTLS_TIMER_t *)data;
+	if (timer->fin_ms == 0) return -1;
+	int64_t elapsed = (esp_timer_get_time() - timer->start) / 1000;
+	if (elapsed >= timer->fin_ms) return 2;
+	if (elapsed >= timer->int_ms) return 1;
+	return 0;
+}
+
+static int dtls_random(void *ctx, unsigned char *buf, size_t len)
+{
+	esp_fill_random(buf, len);
+	return 0;
+}
+
+static int dtls_bio_send(void *ctx, const unsigned char *buf, size_t len)
+{
+	int ret = send(coap_sock, buf, len, 0);
+	if (ret < 0) return MBEDTLS_ERR_NET_SEND_FAILED;
+	return ret;
+}
+
+static int dtls_bio_recv_timeout(void *ctx, unsigned char *buf, size_t len, uint32_t timeout)
+{
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(coap_sock, &rfds);
+	struct timeval tv = { .tv_sec = timeout / 1000, .tv_usec = (timeout % 1000) * 1000 };
+	int ret = select(coap_sock + 1, &rfds, NULL, NULL, timeout ? &tv : NULL);
+	if (ret == 0) return MBEDTLS_ERR_SSL_TIMEOUT;
+	if (ret < 0) return MBEDTLS_ERR_NET_RECV_FAILED;
+	ret = recv(coap_sock, buf, len, 0);
+	if (ret < 0) return MBEDTLS_ERR_NET_RECV_FAILED;
+	return ret;
+}
+
+static esp_err_t dtls_handshake(void)
+{
+	if (dtls_initialized == false) {
+		mbedtls_ssl_init(&ssl);
+		mbedtls_ssl_config_init(&conf);
+		int ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_DATAGRAM, MBEDTLS_SSL_PRESET_DEFAULT);
+		if (ret != 0) {
+			ESP_LOGE(TAG, "mbedtls_ssl_config_defaults fail -0x%x", -ret);
+			return ESP_FAIL;
+		}
+		mbedtls_ssl_conf_rng(&conf, dtls_random, NULL);
+		ret = mbedtls_ssl_conf_psk(&conf,
+			(const unsigned char *)CONFIG_COAP_PSK_KEY, strlen(CONFIG_COAP_PSK_KEY),
+			(const unsigned char *)CONFIG_COAP_PSK_IDENTITY, strlen(CONFIG_COAP_PSK_IDENTITY));
+		if (ret != 0) {
+			ESP_LOGE(TAG, "mbedtls_ssl_conf_psk fail -0x%x", -ret);
+			return ESP_FAIL;
+		}
+		ret = mbedtls_ssl_setup(&ssl, &conf);
+		if (ret != 0) {
+			ESP_LOGE(TAG, "mbedtls_ssl_setup fail -0x%x", -ret);
+			return ESP_FAIL;
+		}
+		mbedtls_ssl_set_timer_cb(&ssl, &dtls_timer, dtls_set_delay, dtls_get_delay);
+		mbedtls_ssl_set_bio(&ssl, NULL, dtls_bio_send, NULL, dtls_bio_recv_timeout);
+		dtls_initialized = true;
+	}
+
+	mbedtls_ssl_session_reset(&ssl);
+	int ret;
+	do {
+		ret = mbedtls_ssl_handshake(&ssl);
+	} while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+	if (ret != 0) {
+		ESP_LOGE(TAG, "mbedtls_ssl_handshake fail -0x%x", -ret);
+		return ESP_FAIL;
+	}
+	ESP_LOGI(TAG, "DTLS handshake done. %s", mbedtls_ssl_get_ciphersuite(&ssl));
+	return ESP_OK;
+}
+#endif
+
+static void coap_close(void)
+{
+	if (coap_sock < 0) return;
+#if CONFIG_COAP_DTLS
+	mbedtls_ssl_close_notify(&ssl);
+#endif
+	close(coap_sock);
+	coap_sock = -1;
+}
+
+static esp_err_t coap_open(void)
+{
+	// Resolve mDNS host name
+	char host[128];
+	resolver_resolve(CONFIG_COAP_SERVER_HOST, host, sizeof(host));
+
+	char port[8];
+	sprintf(port, "%d", CONFIG_COAP_SERVER_PORT);
+	struct addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_DGRAM,
+	};
+	struct addrinfo *res = NULL;
+	int err = getaddrinfo(host, port, &hints, &res);
+	if (err != 0 || res == NULL) {
+		ESP_LOGE(TAG, "getaddrinfo fail host=[%s] err=%d", host, err);
+		return ESP_FAIL;
+	}
+	coap_sock = socket(res->ai_family, res->ai_socktype, 0);
+	if (coap_sock < 0) {
+		ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+		freeaddrinfo(res);
+		return ESP_FAIL;
+	}
+	// A connected UDP socket only receives datagrams from the server
+	err = connect(coap_sock, res->ai_addr, res->ai_addrlen);
+	freeaddrinfo(res);
+	if (err != 0) {
+		ESP_LOGE(TAG, "Unable to connect: errno %d", errno);
+		close(coap_sock);
+		coap_sock = -1;
+		return ESP_FAIL;
+	}
+	ESP_LOGI(TAG, "Server is %s:%s", host, port);
+	coap_message_id = esp_random();
+
+#if CONFIG_COAP_DTLS
+	if (dtls_handshake() != ESP_OK) {
+		close(coap_sock);
+		coap_sock = -1;
+		return ESP_FAIL;
+	}
+#endif
+	return ESP_OK;
+}
+
+static int coap_send_raw(const uint8_t *buf, size_t len)
+{
+#if CONFIG_COAP_DTLS
+	int ret = mbedtls_ssl_write(&ssl, buf, len);
+	if (ret < 0) {
+		ESP_LOGE(TAG, "mbedtls_ssl_write fail -0x%x", -ret);
+		return -1;
+	}
+	stats_bytes += len + mbedtls_ssl_get_record_expansion(&ssl) + UDP_IP_HEADER_SIZE;
+#else
+	int ret = send(coap_sock, buf, len, 0);
+	if (ret < 0) {
+		ESP_LOGE(TAG, "send fail errno %d", errno);
+		return -1;
+	}
+	stats_bytes += len + UDP_IP_HEADER_SIZE;
+#endif
+	stats_datagrams++;
+	return 0;
+}
+
+#if CONFIG_COAP_CON
+// Return the length of the received datagram, 0 on timeout, -1 on error
+static int coap_recv_raw(uint8_t *buf, size_t size, int timeout_ms)
+{
+#if CONFIG_COAP_DTLS
+	mbedtls_ssl_conf_read_timeout(&conf, timeout_ms);
+	int ret;
+	do {
+		ret = mbedtls_ssl_read(&ssl, buf, size);
+	} while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+	if (ret == MBEDTLS_ERR_SSL_TIMEOUT) return 0;
+	if (ret < 0) {
+		ESP_LOGE(TAG, "mbedtls_ssl_read fail -0x%x", -ret);
+		return -1;
+	}
+	return ret;
+#else
+	fd_set rfds;
+	FD_ZERO(&rfds);
+	FD_SET(coap_sock, &rfds);
+	struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+	int ret = select(coap_sock + 1, &rfds, NULL, NULL, &tv);
+	if (ret == 0) return 0;
+	if (ret > 0) ret = recv(coap_sock, buf, size, 0);
+	if (ret < 0) {
+		ESP_LOGE(TAG, "recv fail errno %d", errno);
+		return -1;
+	}
+	return ret;
+#endif
+}
+#endif
+
+// Put one option. The delta and the length use the extended forms when needed.
+static size_t coap_put_option(uint8_t *buf, uint16_t delta, const uint8_t *value, uint16_t length)
+{
+	uint8_t *p = buf + 1;
+	uint8_t delta_nibble = delta;
+	if (delta >= 269) {
+		delta_nibble = 14;
+		*p++ = (delta - 269) >> 8;
+		*p++ = (delta - 269) & 0xFF;
+	} else if (delta >= 13) {
+		delta_nibble = 13;
+		*p++ = delta - 13;
+	}
+	uint8_t length_nibble = length;
+	if (length >= 269) {
+		length_nibble = 14;
+		*p++ = (length - 269) >> 8;
+		*p++ = (length - 269) & 0xFF;
+	} else if (length >= 13) {
+		length_nibble = 13;
+		*p++ = length - 13;
+	}
+	buf[0] = (delta_nibble << 4) | length_nibble;
+	memcpy(p, value, length);
+	p += length;
+	return p - buf;
+}
+
+static size_t coap_build_post(uint8_t *buf, uint8_t type, uint16_t mid, const uint8_t *payload, size_t payload_len)
+{
+	uint8_t *p = buf;
+	*p++ = (COAP_VERSION << 6) | (type << 4);	// No token
+	*p++ = COAP_CODE_POST;
+	*p++ = mid >> 8;
+	*p++ = mid & 0xFF;
+
+	// One Uri-Path option for each path segment
+	uint16_t last = 0;
+	const char *path = CONFIG_COAP_URI_PATH;
+	while (*path) {
+		const char *end = strchr(path, '/');
+		if (end == NULL) end = path + strlen(path);
+		if (end > path) {
+			p += coap_put_option(p, COAP_OPTION_URI_PATH - last, (const uint8_t *)path, end - path);
+			last = COAP_OPTION_URI_PATH;
+		}
+		path = (*end) ? end + 1 : end;
+	}
+	uint8_t format = COAP_FORMAT;
+	p += coap_put_option(p, COAP_OPTION_CONTENT_FORMAT - last, &format, 1);
+
+	*p++ = COAP_PAYLOAD_MARKER;
+	memcpy(p, payload, payload_len);
+	p += payload_len;
+	return p - buf;
+}
+
+static esp_err_t coap_post(const uint8_t *payload, size_t payload_len)
+{
+	uint16_t mid = coap_message_id++;
+#if CONFIG_COAP_NON
+	size_t len = coap_build_post(coap_tx_buffer, COAP_TYPE_NON, mid, payload, payload_len);
+	if (coap_send_raw(coap_tx_buffer, len) != 0) return ESP_FAIL;
+	return ESP_OK;
+#else
+	size_t len = coap_build_post(coap_tx_buffer, COAP_TYPE_CON, mid, payload, payload_len);
+	// ACK_RANDOM_FACTOR of RFC7252 is 1.5
+	int timeout = CONFIG_COAP_ACK_TIMEOUT + esp_random() % (CONFIG_COAP_ACK_TIMEOUT / 2);
+	for (int retransmit=0;retransmit<=CONFIG_COAP_MAX_RETRANSMIT;retransmit++) {
+		if (retransmit) {
+			ESP_LOGW(TAG, "Retransmit mid=%d retransmit=%d", mid, retransmit);
+			stats_retransmits++;
+		}
+		if (coap_send_raw(coap_tx_buffer, len) != 0) return ESP_FAIL;
+		int64_t deadline = esp_timer_get_time() + timeout * 1000LL;
+		while (1) {
+			int remain = (deadline - esp_timer_get_time()) / 1000;
+			if (remain <= 0) break;
+			int ret = coap_recv_raw(coap_rx_buffer, sizeof(coap_rx_buffer), remain);
+			if (ret < 0) return ESP_FAIL;
+			if (ret == 0) break;
+			if (ret < 4 || (coap_rx_buffer[0] >> 6) != COAP_VERSION) continue;
+			// Ignore late acknowledgements of earlier messages
+			uint16_t rx_mid = (coap_rx_buffer[2] << 8) | coap_rx_buffer[3];
+			if (rx_mid != mid) continue;
+			uint8_t rx_type = (coap_rx_buffer[0] >> 4) & 0x03;
+			uint8_t rx_code = coap_rx_buffer[1];
+			if (rx_type == COAP_TYPE_RST) {
+				ESP_LOGE(TAG, "Reset by the server mid=%d", mid);
+				return ESP_FAIL;
+			}
+			if (rx_type != COAP_TYPE_ACK) continue;
+			// An empty ACK means the response is sent separately. The packets were delivered.
+			if (rx_code == 0 || (rx_code >> 5) == 2) return ESP_OK;
+			ESP_LOGE(TAG, "Response %d.%02d mid=%d", rx_code >> 5, rx_code & 0x1F, mid);
+			return ESP_FAIL;
+		}
+		timeout = timeout * 2;
+	}
+	ESP_LOGE(TAG, "No acknowledgement mid=%d", mid);
+	return ESP_ERR_TIMEOUT;
+#endif
+}
+
+// Aggregate the packets into as few datagrams as possible.
+// When a datagram fails, the bridge retries the whole batch,
+// so the datagrams already sent may be delivered twice.
+static esp_err_t coap_send_batch(const BRIDGE_PACKET_t *packets, int count, void *ctx)
+{
+	if (coap_sock < 0) {
+		if (coap_open() != ESP_OK) return ESP_FAIL;
+		stats_start = esp_timer_get_time();
+	}
+
+	int index = 0;
+	while (index < count) {
+		size_t len = 0;
+		int packets_in_datagram = 0;
+		while (index < count && packets_in_datagram < CONFIG_COAP_PACKETS_PER_DATAGRAM) {
+#if CONFIG_BRIDGE_ENVELOPE
+			len += bridge_encode(&packets[index], &coap_payload[len], sizeof(coap_payload) - len);
+#else
+			coap_payload[len++] = packets[index].length;
+			memcpy(&coap_payload[len], packets[index].data, packets[index].length);
+			len += packets[index].length;
+#endif
+			packets_in_datagram++;
+			index++;
+		}
+		ESP_LOGD(TAG, "packets=%d payload=%d", packets_in_datagram, (int)len);
+		esp_err_t err = coap_post(coap_payload, len);
+		if (err != ESP_OK) {
+			// The server may have moved to another address
+			resolver_invalidate(CONFIG_COAP_SERVER_HOST);
+			coap_close();
+			return err;
+		}
+		stats_packets += packets_in_datagram;
+	}
+
+	int64_t elapsed = esp_timer_get_time() - stats_start;
+	if (elapsed >= 10000000) {
+		ESP_LOGI(TAG, "%"PRIu32" packets/s %"PRIu32" datagrams/s %"PRIu32" bytes/packet on the wire retransmits=%"PRIu32,
+			(uint32_t)(stats_packets * 1000000LL / elapsed), (uint32_t)(stats_datagrams * 1000000LL / elapsed),
+			stats_packets ? stats_bytes / stats_packets : 0, stats_retransmits);
+		stats_start += elapsed;
+		stats_datagrams = 0;
+		stats_packets = 0;
+		stats_bytes = 0;
+		stats_retransmits = 0;
+	}
+	return ESP_OK;
+}
+
+static bool coap_connected(void *ctx)
+{
+	wifi_ap_record_t ap_info;
+	return esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
+}
+
+const BRIDGE_TRANSPORT_t coap_client_transport = {
+	.name = "coap_client",
+	.send_batch = coap_send_batch,
+	.connected = coap_connected,
+};
@@ -0,0 +1,179 @@
+/* Frequency offset tracking
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "afc.h"
+
+static const char *TAG = "AFC";
+
+// FSCTRL0 and FREQEST count in this step
+#define AFC_STEP_HZ	(CC1101_XOSC_HZ / 16384)
+
+typedef struct {
+	int16_t offset;		// Offset from FSCTRL0=0, in 1/16 of a step
+	uint16_t packets;
+} AFC_NODE_t;
+
+static AFC_NODE_t afc_nodes[AFC_NODES];
+static int8_t afc_rx_offset;	// FSCTRL0 while receiving
+static int8_t afc_base_offset;	// FSCTRL0 at afc_init()
+static uint32_t afc_bandwidth;	// Channel filter set by afc_adjust_rx()
+static uint32_t afc_max_bandwidth;	// Channel filter of the working mode
+
+static int8_t afc_round(int16_t offset)
+{
+	int16_t value = offset >= 0 ? (offset + 8) / 16 : (offset - 8) / 16;
+	if (value > 127) value = 127;
+	if (value < -128) value = -128;
+	return value;
+}
+
+// Start over with the current FSCTRL0 and channel filter of the radio
+void afc_init(void)
+{
+	memset(afc_nodes, 0, sizeof(afc_nodes));
+	afc_rx_offset = afc_base_offset = getFreqOffset();
+	afc_bandwidth = afc_max_bandwidth = getRxBandwidth();
+}
+
+// Call for each packet received from the node.
+// FREQEST is relative to the carrier of the receiver, which includes FSCTRL0.
+void afc_update(uint8_t node, const CCPACKET *packet)
+{
+	if (!packet->crc_ok) return;
+	AFC_NODE_t *entry = &afc_nodes[node];
+	int16_t offset = (afc_rx_offset + packet->freqest) * 16;
+	if (entry->packets == 0) {
+		entry->offset = offset;
+	} else {
+		// Average over the last packets. FREQEST of one packet is noisy.
+		entry->offset += (offset - entry->offset) / 4;
+	}
+	if (entry->packets < UINT16_MAX) entry->packets++;
+	ESP_LOGD(TAG, "node=%d freqest=%d offset=%d packets=%d", node, packet->freqest, afc_round(entry->offset), entry->packets);
+}
+
+// The offset to put in FSCTRL0 to transmit on the frequency of the node
+bool afc_get_offset(uint8_t node, int8_t *offset)
+{
+	const AFC_NODE_t *entry = &afc_nodes[node];
+	if (entry->packets < AFC_MIN_PACKETS) return false;
+	*offset = afc_round(entry->offset);
+	return true;
+}
+
+// The node is gone. afc_adjust_rx() no longer keeps the filter wide for it.
+void afc_forget(uint8_t node)
+{
+	afc_nodes[node].packets = 0;
+}
+
+// Call before sendData() to the node.
+// A node with an unknown offset gets the carrier of the receiver.
+void afc_tx_begin(uint8_t node)
+{
+	int8_t offset;
+	if (afc_get_offset(node, &offset) == false) offset = afc_rx_offset;
+	if (offset != getFreqOffset()) setFreqOffset(offset);
+}
+
+// Call after sendData()
+void afc_tx_end(void)
+{
+	if (getFreqOffset() != afc_rx_offset) setFreqOffset(afc_rx_offset);
+}
+
+// Carson bandwidth of the signal: twice the deviation and the data rate
+static uint32_t afc_signal_hz(void)
+{
+	uint8_t mdmcfg4 = readConfigReg(CC1101_MDMCFG4);
+	uint8_t mdmcfg3 = readConfigReg(CC1101_MDMCFG3);
+	uint8_t deviatn = readConfigReg(CC1101_DEVIATN);
+	uint64_t rate = ((uint64_t)(256 + mdmcfg3) << (mdmcfg4 & 0x0F)) * CC1101_XOSC_HZ >> 28;
+	uint64_t deviation = ((uint64_t)(8 + (deviatn & 0x07)) << ((deviatn >> 4) & 0x07)) * CC1101_XOSC_HZ >> 17;
+	return 2 * deviation + rate;
+}
+
+// Channel filter that holds the signal of every known node with the receiver at center
+static uint32_t afc_needed_hz(int8_t center, int16_t min, int16_t max, uint32_t *spread_hz)
+{
+	// The farthest node from the center, with half a step of rounding
+	int16_t spread = max - center * 16;
+	if (center * 16 - min > spread) spread = center * 16 - min;
+	*spread_hz = (spread + 8) * AFC_STEP_HZ / 16;
+	return afc_signal_hz() + 2 * (*spread_hz + AFC_GUARD_HZ);
+}
+
+// Set the narrowest channel filter that still holds the signal of every known node.
+// The receiver moves to the middle of the nodes only when that gives a narrower filter
+// than staying. Moving it alone would help the nodes on one side, and hurt the weak nodes on the other.
+// A new node far from the others is not heard until afc_init() is called.
+// Returns true when the receiver changed.
+bool afc_adjust_rx(void)
+{
+	int16_t min = INT16_MAX;
+	int16_t max = INT16_MIN;
+	for (int i=0;i<AFC_NODES;i++) {
+		if (afc_nodes[i].packets < AFC_MIN_PACKETS) continue;
+		if (afc_nodes[i].offset < min) min = afc_nodes[i].offset;
+		if (afc_nodes[i].offset > max) max = afc_nodes[i].offset;
+	}
+	if (min > max) return false;
+
+	int8_t center = afc_rx_offset;
+	uint32_t spread_hz;
+	uint32_t needed = afc_needed_hz(center, min, max, &spread_hz);
+	int8_t middle = afc_round((min + max) / 2);
+	uint32_t middle_spread_hz;
+	uint32_t middle_needed = afc_needed_hz(middle, min, max, &middle_spread_hz);
+	if (middle != center && fitRxBandwidth(middle_needed) < fitRxBandwidth(needed)) {
+		center = middle;
+		needed = middle_needed;
+		spread_hz = middle_spread_hz;
+	}
+	if (needed > afc_max_bandwidth) {
+		needed = afc_max_bandwidth;
+		center = afc_base_offset;
+	}
+
+	bool changed = false;
+	if (center != afc_rx_offset) {
+		afc_rx_offset = center;
+		setFreqOffset(center);
+		changed = true;
+	}
+	uint32_t bandwidth = setRxBandwidth(needed);
+	if (bandwidth != afc_bandwidth) {
+		afc_bandwidth = bandwidth;
+		changed = true;
+	}
+	if (changed) {
+		ESP_LOGI(TAG, "rx_offset=%d (%"PRId32"Hz) spread=%"PRIu32"Hz bandwidth=%"PRIu32"Hz",
+			afc_rx_offset, (int32_t)(afc_rx_offset * AFC_STEP_HZ), spread_hz, bandwidth);
+	}
+	return changed;
+}
+
+void afc_get_status(AFC_STATUS_t *status)
+{
+	memset(status, 0, sizeof(AFC_STATUS_t));
+	status->rx_offset = afc_rx_offset;
+	status->bandwidth = getRxBandwidth();
+	status->min_offset = INT8_MAX;
+	status->max_offset = INT8_MIN;
+	for (int i=0;i<AFC_NODES;i++) {
+		if (afc_nodes[i].packets < AFC_MIN_PACKETS) continue;
+		int8_t offset = afc_round(afc_nodes[i].offset);
+		status->nodes++;
+		if (offset < status->min_offset) status->min_offset = offset;
+		if (offset > status->max_offset) status->max_offset = offset;
+	}
+	if (status->nodes == 0) status->min_offset = status->max_offset = 0;
+}
@@ -0,0 +1,42 @@
+/* Frequency offset tracking
+ *
+ * The crystal of a cheap module is off by 10-20ppm, so the carriers of two nodes
+ * at 868 MHz differ by up to 35kHz, and a narrow channel filter cuts off the signal.
+ * The offset of each node is learned from FREQEST of its good packets.
+ * - afc_tx_begin() moves the carrier to the frequency of the node before sendData().
+ * - afc_adjust_rx() centers the receiver on the nodes, and narrows the channel filter
+ *   to what their spread needs.
+ * All the functions must be called from the task that accesses the radio.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _AFC_H
+#define _AFC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cc1101.h"
+
+#define AFC_NODES		256		// One for each address
+#define AFC_MIN_PACKETS	4		// Good packets of a node before its offset is used
+#define AFC_GUARD_HZ	4000	// Drift of the crystals with temperature
+
+typedef struct {
+	int8_t rx_offset;		// FSCTRL0 while receiving
+	uint32_t bandwidth;		// Channel filter in Hz
+	int nodes;				// Nodes with a known offset
+	int8_t min_offset;		// Of the nodes with a known offset
+	int8_t max_offset;
+} AFC_STATUS_t;
+
+void afc_init(void);
+void afc_update(uint8_t node, const CCPACKET *packet);
+bool afc_get_offset(uint8_t node, int8_t *offset);
+void afc_forget(uint8_t node);
+void afc_tx_begin(uint8_t node);
+void afc_tx_end(void);
+bool afc_adjust_rx(void);
+void afc_get_status(AFC_STATUS_t *status);
+
+#endif
@@ -0,0 +1,614 @@
+/* Radio bridge core
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+
+#include "cc1101.h"
+#include "bridge.h"
+#include "bridge_store.h"
+#include "bridge_bench.h"
+#include "dutycycle.h"
+#include "trace.h"
+#include "profile.h"
+
+static const char *TAG = "BRIDGE";
+
+static const BRIDGE_TRANSPORT_t *bridge_transport;
+static QueueHandle_t uplink_queue;		// Radio to transport
+static QueueHandle_t downlink_queue;	// Transport to radio
+static BRIDGE_STATS_t bridge_stats;
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t radio_task_handle;
+static AIRTIME_CONFIG_t airtime_config;	// Read by the radio task
+static uint32_t downlink_seq;			// Trace id of the packets to the radio
+static CC1101_PROFILE_t next_profile;	// Applied by the radio task
+static bool profile_pending;
+static uint32_t node_id;				// Lower 4 bytes of the factory MAC address
+static uint32_t boot_id;				// Random at each boot
+
+static BRIDGE_LAYOUT_t bridge_layout = {
+	.radio_core = CONFIG_BRIDGE_RADIO_CORE,
+	.radio_priority = CONFIG_BRIDGE_RADIO_PRIORITY,
+	.network_core = CONFIG_BRIDGE_NETWORK_CORE,
+	.network_priority = CONFIG_BRIDGE_NETWORK_PRIORITY,
+};
+
+#define STATS_ADD(field, n) do { \
+	taskENTER_CRITICAL(&stats_mux); \
+	bridge_stats.field += (n); \
+	taskEXIT_CRITICAL(&stats_mux); \
+} while (0)
+
+// The profile stored in NVS, or the defaults of CC1101 Configuration.
+// When the ESP32 restarts while the CC1101 keeps its power, the CC1101 is not reset.
+static esp_err_t bridge_radio_setup(void)
+{
+	int64_t start = esp_timer_get_time();
+	uint8_t mac[6];
+	esp_efuse_mac_get_default(mac);
+	node_id = ((uint32_t)mac[2] << 24) | (mac[3] << 16) | (mac[4] << 8) | mac[5];
+	while (boot_id == 0) boot_id = esp_random();
+	ESP_LOGI(TAG, "node_id=0x%08"PRIx32" boot_id=0x%08"PRIx32, node_id, boot_id);
+	CC1101_PROFILE_t profile;
+	if (profile_load(&profile) != ESP_OK) ESP_LOGI(TAG, "Use the default profile");
+	ESP_LOGI(TAG, "Set frequency %d speed %d channel %d power %d", profile.freq, profile.mode, profile.channel, profile.paLevel);
+	bool warm;
+	esp_err_t ret = initProfile(&profile, &warm);
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "CC1101 not installed");
+		return ret;
+	}
+	ESP_LOGI(TAG, "%s start. RX ready %"PRId64"us after the reset, %"PRId64"us for the CC1101",
+		warm ? "Warm" : "Cold", esp_timer_get_time(), esp_timer_get_time() - start);
+	return ESP_OK;
+}
+
+typedef struct {
+	TaskHandle_t caller;
+	esp_err_t ret;
+} RADIO_SETUP_t;
+
+static void bridge_radio_setup_task(void *pvParameters)
+{
+	RADIO_SETUP_t *setup = pvParameters;
+	setup->ret = bridge_radio_setup();
+	xTaskNotifyGive(setup->caller);
+	vTaskDelete(NULL);
+}
+
+// The GDO0 interrupt is allocated on the core that initializes the radio,
+// so the radio is initialized on the core of the radio task.
+esp_err_t bridge_radio_init(void)
+{
+	int core = bridge_layout.radio_core;
+	if (core < 0 || core == xPortGetCoreID()) return bridge_radio_setup();
+	RADIO_SETUP_t setup = {
+		.caller = xTaskGetCurrentTaskHandle(),
+		.ret = ESP_FAIL,
+	};
+	if (xTaskCreatePinnedToCore(&bridge_radio_setup_task, "RADIO_SETUP", 1024*3, &setup, uxTaskPriorityGet(NULL), NULL, core) != pdPASS) {
+		return ESP_ERR_NO_MEM;
+	}
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	return setup.ret;
+}
+
+// Get signal strength indicator in dBm.
+// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
+int bridge_rssi(uint8_t raw)
+{
+	// The typical RSSI_offset of the CC1101 data sheet (Table 31) is 74 dB
+	// for every speed of this driver at 433 MHz and 868 MHz.
+	int rssi_offset = 74;
+	if (raw >= 128)
+		return ((int)(raw - 256) / 2) - rssi_offset;
+	else
+		return (raw / 2) - rssi_offset;
+}
+
+// Get link quality indicator.
+int bridge_lqi(uint8_t raw)
+{
+	return 0x3F - (raw & 0x7F);
+}
+
+static void bridge_add_latency(uint32_t latency)
+{
+	int bucket = 0;
+	while (bucket < BRIDGE_LATENCY_BUCKETS - 1 && latency >= (2U << bucket)) bucket++;
+	taskENTER_CRITICAL(&stats_mux);
+	bridge_stats.rx_latency_count++;
+	bridge_stats.rx_latency_sum += latency;
+	if (latency > bridge_stats.rx_latency_max) bridge_stats.rx_latency_max = latency;
+	bridge_stats.rx_latency_histogram[bucket]++;
+	taskEXIT_CRITICAL(&stats_mux);
+}
+
+// Time until the packet fits in the duty cycle of the sub-band.
+// 0 when it can be sent now, -1 when it never fits.
+static int64_t bridge_tx_delay(uint8_t length)
+{
+#if CONFIG_BRIDGE_DUTYCYCLE
+	return dutycycle_delay_us(airtime_config.frequency, airtime_us(&airtime_config, length));
+#else
+	return 0;
+#endif
+}
+
+static void bridge_tx_charge(uint8_t length)
+{
+#if CONFIG_BRIDGE_DUTYCYCLE
+	dutycycle_charge(airtime_config.frequency, airtime_us(&airtime_config, length));
+#endif
+}
+
+// The only task that accesses the radio.
+// Woken by the GDO0 interrupt, or by a packet queued to send.
+static void bridge_radio_task(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start core=%d priority=%d", xPortGetCoreID(), (int)uxTaskPriorityGet(NULL));
+	CCPACKET packet;
+	BRIDGE_PACKET_t item;
+	uint32_t seq = 0;
+	bool deferred = false;
+	TickType_t wait = pdMS_TO_TICKS(100);
+	setPacketNotify(xTaskGetCurrentTaskHandle());
+	airtime_read_config(&airtime_config);
+	while(1) {
+		// The timeout covers a lost interrupt and a deferred packet
+		ulTaskNotifyTake(pdTRUE, wait);
+		wait = pdMS_TO_TICKS(100);
+		if (profile_pending) {
+			CC1101_PROFILE_t profile;
+			taskENTER_CRITICAL(&stats_mux);
+			profile = next_profile;
+			profile_pending = false;
+			taskEXIT_CRITICAL(&stats_mux);
+			if (setProfile(&profile) == ESP_OK) {
+				airtime_read_config(&airtime_config);
+				ESP_LOGI(pcTaskGetName(NULL), "Profile changed");
+			} else {
+				ESP_LOGE(pcTaskGetName(NULL), "setProfile fail");
+			}
+		}
+		if (packet_available()) {
+			// Time from the interrupt to the task
+			int64_t rx_time = getPacketTime();
+			int64_t wakeup_time = esp_timer_get_time();
+			uint32_t latency = wakeup_time - rx_time;
+			if (receiveData(&packet) > 0) {
+				bridge_add_latency(latency);
+				if (!packet.crc_ok) {
+					// Counted in the statistics. A log line for each packet would limit the capture rate.
+					ESP_LOGD(pcTaskGetName(NULL), "crc not ok");
+					STATS_ADD(rx_crc_errors, 1);
+				} else if (packet.length > 0 && packet.length <= BRIDGE_PAYLOAD_MAX) {
+					item.rx_time = rx_time;
+					item.seq = seq++;
+					item.boot = boot_id;
+					TRACE_STAMP_AT(item.seq, TRACE_RX_ISR, rx_time);
+					TRACE_STAMP_AT(item.seq, TRACE_RX_WAKEUP, wakeup_time);
+					TRACE_STAMP(item.seq, TRACE_RX_READ);
+					item.length = packet.length;
+					memcpy(item.data, packet.data, packet.length);
+					item.rssi = bridge_rssi(packet.rssi);
+					item.lqi = bridge_lqi(packet.lqi);
+					ESP_LOGD(pcTaskGetName(NULL), "length=%d rssi=%ddBm lqi=%d", item.length, item.rssi, item.lqi);
+					STATS_ADD(rx_packets, 1);
+					if (uplink_queue) {
+						TRACE_STAMP(item.seq, TRACE_RX_QUEUE);
+						// Never block the radio. Drop the oldest packet to make room.
+						if (xQueueSend(uplink_queue, &item, 0) != pdTRUE) {
+							BRIDGE_PACKET_t oldest;
+							xQueueReceive(uplink_queue, &oldest, 0);
+							xQueueSend(uplink_queue, &item, 0);
+							STATS_ADD(rx_drops, 1);
+						}
+					}
+				}
+			}
+		}
+
+		if (xQueuePeek(downlink_queue, &item, 0) == pdTRUE) {
+			int64_t delay = bridge_tx_delay(item.length);
+			if (delay > 0) {
+				// Keep the packet in the queue and keep receiving
+				if (deferred == false) STATS_ADD(tx_deferred, 1);
+				deferred = true;
+				TickType_t ticks = pdMS_TO_TICKS(delay / 1000) + 1;
+				if (ticks < wait) wait = ticks;
+				continue;
+			}
+			xQueueReceive(downlink_queue, &item, 0);
+			TRACE_STAMP(item.seq, TRACE_TX_START);
+			deferred = false;
+			packet.length = item.length;
+			memcpy(packet.data, item.data, item.length);
+			if (delay < 0) {
+				ESP_LOGE(pcTaskGetName(NULL), "Packet is longer than the duty cycle allows. length=%d", packet.length);
+				STATS_ADD(tx_errors, 1);
+			} else if (sendData(packet)) {
+				bridge_tx_charge(packet.length);
+				STATS_ADD(tx_packets, 1);
+			} else {
+				ESP_LOGW(pcTaskGetName(NULL), "sendData fail length=%d", packet.length);
+				STATS_ADD(tx_errors, 1);
+			}
+			TRACE_STAMP(item.seq, TRACE_TX_DONE);
+			// One packet at a time, so a received packet does not wait behind a downlink burst
+			if (uxQueueMessagesWaiting(downlink_queue)) xTaskNotifyGive(xTaskGetCurrentTaskHandle());
+		}
+	}
+	vTaskDelete(NULL);
+}
+
+static void bridge_trace_batch(const BRIDGE_PACKET_t *batch, int count, TRACE_STAGE_t stage)
+{
+#if CONFIG_TRACE
+	int64_t now = esp_timer_get_time();
+	for (int i=0;i<count;i++) {
+		TRACE_STAMP_AT(batch[i].seq, stage, now);
+	}
+#endif
+}
+
+static bool bridge_connected(void)
+{
+	if (bridge_transport->connected == NULL) return true;
+	return bridge_transport->connected(bridge_transport->ctx);
+}
+
+static esp_err_t bridge_send_batch(BRIDGE_PACKET_t *batch, int count, int retry_max)
+{
+	esp_err_t err = ESP_FAIL;
+	for (int retry=0;retry<=retry_max;retry++) {
+		if (retry) {
+			STATS_ADD(uplink_retries, 1);
+			vTaskDelay(pdMS_TO_TICKS(100 << retry));
+		}
+		err = bridge_transport->send_batch(batch, count, bridge_transport->ctx);
+		if (err == ESP_OK) break;
+		ESP_LOGW(TAG, "send_batch fail count=%d retry=%d %s", count, retry, esp_err_to_name(err));
+	}
+	if (err == ESP_OK) {
+		static bool delivered = false;
+		if (delivered == false) {
+			ESP_LOGI(TAG, "First packet delivered %"PRId64"ms after boot", esp_timer_get_time() / 1000);
+			delivered = true;
+		}
+		STATS_ADD(uplink_packets, count);
+		STATS_ADD(uplink_batches, 1);
+	}
+	return err;
+}
+
+#if CONFIG_BRIDGE_STORE
+static void bridge_store_packets(BRIDGE_PACKET_t *batch, int count)
+{
+	for (int i=0;i<count;i++) {
+		if (bridge_store_append(&batch[i]) != ESP_OK) {
+			STATS_ADD(uplink_drops, 1);
+			continue;
+		}
+		STATS_ADD(stored, 1);
+	}
+}
+
+// While the log has packets, new packets are appended behind them to keep the order.
+// The log is replayed in full batches without lingering.
+static void bridge_replay(BRIDGE_PACKET_t *batch)
+{
+	BRIDGE_PACKET_t item;
+	TickType_t wait = bridge_connected() ? 0 : pdMS_TO_TICKS(100);
+	while (xQueueReceive(uplink_queue, &item, wait) == pdTRUE) {
+		bridge_store_packets(&item, 1);
+		wait = 0;
+	}
+	if (bridge_connected() == false) {
+		bridge_store_flush();
+		return;
+	}
+
+	int count = bridge_store_peek(batch, CONFIG_BRIDGE_BATCH_MAX);
+	if (count == 0) {
+		// Only packets in RAM. Write them to keep the order.
+		bridge_store_flush();
+		count = bridge_store_peek(batch, CONFIG_BRIDGE_BATCH_MAX);
+		if (count == 0) return;
+	}
+	if (bridge_send_batch(batch, count, 0) == ESP_OK) {
+		bridge_store_consume(count);
+		STATS_ADD(replayed, count);
+		if (bridge_store_pending() == false) {
+			ESP_LOGI(TAG, "Replay completed");
+		}
+	} else {
+		// Keep the packets in the log and try again later
+		vTaskDelay(pdMS_TO_TICKS(1000));
+	}
+}
+#endif
+
+static void bridge_uplink_task(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start transport=%s", bridge_transport->name);
+	BRIDGE_PACKET_t *batch = calloc(CONFIG_BRIDGE_BATCH_MAX, sizeof(BRIDGE_PACKET_t));
+	assert(batch != NULL);
+	while(1) {
+#if CONFIG_BRIDGE_STORE
+		if (bridge_connected() == false || bridge_store_pending()) {
+			bridge_replay(batch);
+			continue;
+		}
+		// Wake up periodically to notice the link going down
+		TickType_t wait = pdMS_TO_TICKS(1000);
+#else
+		// Hold the packets in the queue while the link is down
+		while (bridge_connected() == false) {
+			vTaskDelay(pdMS_TO_TICKS(100));
+		}
+		TickType_t wait = portMAX_DELAY;
+#endif
+
+		int count = 0;
+		if (xQueueReceive(uplink_queue, &batch[count], wait) != pdTRUE) continue;
+		TRACE_STAMP(batch[count].seq, TRACE_UP_DEQUEUE);
+		count++;
+		TickType_t linger = pdMS_TO_TICKS(CONFIG_BRIDGE_BATCH_LINGER);
+		while (count < CONFIG_BRIDGE_BATCH_MAX) {
+			if (xQueueReceive(uplink_queue, &batch[count], linger) != pdTRUE) break;
+			TRACE_STAMP(batch[count].seq, TRACE_UP_DEQUEUE);
+			count++;
+		}
+
+		bridge_trace_batch(batch, count, TRACE_UP_SEND);
+		if (bridge_send_batch(batch, count, CONFIG_BRIDGE_RETRY_MAX) == ESP_OK) {
+			bridge_trace_batch(batch, count, TRACE_UP_DONE);
+		} else {
+#if CONFIG_BRIDGE_STORE
+			bridge_store_packets(batch, count);
+			bridge_store_flush();
+#else
+			STATS_ADD(uplink_drops, count);
+#endif
+		}
+	}
+	vTaskDelete(NULL);
+}
+
+static void bridge_downlink_task(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start transport=%s", bridge_transport->name);
+	BRIDGE_PACKET_t *batch = calloc(CONFIG_BRIDGE_BATCH_MAX, sizeof(BRIDGE_PACKET_t));
+	assert(batch != NULL);
+	while(1) {
+		int count = bridge_transport->receive_batch(batch, CONFIG_BRIDGE_BATCH_MAX, portMAX_DELAY, bridge_transport->ctx);
+		for (int i=0;i<count;i++) {
+			batch[i].seq = __atomic_fetch_add(&downlink_seq, 1, __ATOMIC_RELAXED);
+			TRACE_STAMP(batch[i].seq, TRACE_TX_QUEUE);
+			// Wait for the radio. The transport can slow down its peer.
+			xQueueSend(downlink_queue, &batch[i], portMAX_DELAY);
+			xTaskNotifyGive(radio_task_handle);
+		}
+	}
+	vTaskDelete(NULL);
+}
+
+// Upper bound of the bucket that holds the percentile
+static uint32_t bridge_latency_percentile(const BRIDGE_STATS_t *stats, int percent)
+{
+	uint64_t target = ((uint64_t)stats->rx_latency_count * percent + 99) / 100;
+	uint64_t count = 0;
+	for (int bucket=0;bucket<BRIDGE_LATENCY_BUCKETS;bucket++) {
+		count += stats->rx_latency_histogram[bucket];
+		if (count >= target) return 2U << bucket;
+	}
+	return stats->rx_latency_max;
+}
+
+static void bridge_stats_task(void *pvParameters)
+{
+	while(1) {
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_BRIDGE_STATS_INTERVAL * 1000));
+		BRIDGE_STATS_t stats;
+		bridge_get_stats(&stats);
+		ESP_LOGI(TAG, "rx=%"PRIu32" crc_errors=%"PRIu32" rx_drops=%"PRIu32" uplink=%"PRIu32"/%"PRIu32" batches retries=%"PRIu32" uplink_drops=%"PRIu32" tx=%"PRIu32" tx_errors=%"PRIu32" tx_drops=%"PRIu32,
+			stats.rx_packets, stats.rx_crc_errors, stats.rx_drops, stats.uplink_packets, stats.uplink_batches,
+			stats.uplink_retries, stats.uplink_drops, stats.tx_packets, stats.tx_errors, stats.tx_drops);
+#if CONFIG_BRIDGE_DUTYCYCLE
+		uint32_t remaining = dutycycle_remaining_us(airtime_config.frequency);
+		if (remaining != UINT32_MAX) {
+			ESP_LOGI(TAG, "duty cycle band=%s remaining=%"PRIu32"ms of %"PRIu32"ms deferred=%"PRIu32,
+				dutycycle_band_name(airtime_config.frequency), remaining / 1000,
+				dutycycle_budget_us(airtime_config.frequency) / 1000, stats.tx_deferred);
+		}
+#endif
+		if (stats.rx_latency_count) {
+			ESP_LOGI(TAG, "rx_latency avg=%"PRIu32"us p99<%"PRIu32"us max=%"PRIu32"us",
+				(uint32_t)(stats.rx_latency_sum / stats.rx_latency_count), bridge_latency_percentile(&stats, 99), stats.rx_latency_max);
+		}
+#if CONFIG_BRIDGE_STORE
+		ESP_LOGI(TAG, "stored=%"PRIu32" replayed=%"PRIu32" in_log=%"PRIu32, stats.stored, stats.replayed, bridge_store_count());
+#endif
+	}
+	vTaskDelete(NULL);
+}
+
+// Queue a packet to send to the radio.
+// Used by transports that receive packets in their own callbacks, such as an HTTP server.
+esp_err_t bridge_transmit(const uint8_t *data, size_t length, TickType_t wait)
+{
+	if (downlink_queue == NULL) return ESP_ERR_INVALID_STATE;
+	BRIDGE_PACKET_t item;
+	while (length > 0) {
+		// Data longer than the radio packet is split
+		item.length = length > BRIDGE_PAYLOAD_MAX ? BRIDGE_PAYLOAD_MAX : length;
+		memcpy(item.data, data, item.length);
+		item.rssi = 0;
+		item.lqi = 0;
+		item.rx_time = esp_timer_get_time();
+		item.seq = __atomic_fetch_add(&downlink_seq, 1, __ATOMIC_RELAXED);
+		TRACE_STAMP(item.seq, TRACE_TX_QUEUE);
+		if (xQueueSend(downlink_queue, &item, wait) != pdTRUE) {
+			STATS_ADD(tx_drops, 1);
+			return ESP_ERR_TIMEOUT;
+		}
+		if (radio_task_handle) xTaskNotifyGive(radio_task_handle);
+		data += item.length;
+		length -= item.length;
+	}
+	return ESP_OK;
+}
+
+// Wait for a packet received from the radio.
+// Used by transports that run their own loop, such as an MQTT client.
+esp_err_t bridge_receive(BRIDGE_PACKET_t *packet, TickType_t wait)
+{
+	if (uplink_queue == NULL) return ESP_ERR_INVALID_STATE;
+	if (xQueueReceive(uplink_queue, packet, wait) != pdTRUE) return ESP_ERR_TIMEOUT;
+	TRACE_STAMP(packet->seq, TRACE_UP_DEQUEUE);
+	STATS_ADD(uplink_packets, 1);
+	return ESP_OK;
+}
+
+// Size of the next packet from the radio after bridge_encode(), 0 when none is waiting.
+// A transport that packs several packets into one write stops before the one that does not fit.
+size_t bridge_next_length(void)
+{
+	BRIDGE_PACKET_t item;
+	if (uplink_queue == NULL) return 0;
+	if (xQueuePeek(uplink_queue, &item, 0) != pdTRUE) return 0;
+#if CONFIG_BRIDGE_ENVELOPE
+	uint8_t encoded[BRIDGE_ENCODED_MAX];
+	return bridge_encode(&item, encoded, sizeof(encoded));
+#else
+	return item.length;
+#endif
+}
+
+// Id of this gateway in the envelopes.
+uint32_t bridge_node_id(void)
+{
+	return node_id;
+}
+
+// Tells the packets of this boot from the ones replayed from an earlier boot.
+uint32_t bridge_boot_id(void)
+{
+	return boot_id;
+}
+
+// Encode a packet as the transports send it.
+// An envelope with CONFIG_BRIDGE_ENVELOPE, otherwise the data as it is.
+// Returns the number of bytes, or 0 when out is too small.
+size_t bridge_encode(const BRIDGE_PACKET_t *packet, uint8_t *out, size_t out_size)
+{
+#if CONFIG_BRIDGE_ENVELOPE
+	ENVELOPE_t envelope = {
+		.node_id = node_id,
+		.seq = packet->seq,
+		.timestamp = packet->rx_time,
+		.rssi = packet->rssi,
+		.lqi = packet->lqi,
+		.length = packet->length,
+		.payload = packet->data,
+		.boot = packet->boot,
+	};
+	return envelope_encode(&envelope, out, out_size);
+#else
+	if (out_size < packet->length) return 0;
+	memcpy(out, packet->data, packet->length);
+	return packet->length;
+#endif
+}
+
+void bridge_get_stats(BRIDGE_STATS_t *stats)
+{
+	taskENTER_CRITICAL(&stats_mux);
+	memcpy(stats, &bridge_stats, sizeof(BRIDGE_STATS_t));
+	taskEXIT_CRITICAL(&stats_mux);
+}
+
+void bridge_get_layout(BRIDGE_LAYOUT_t *layout)
+{
+	memcpy(layout, &bridge_layout, sizeof(BRIDGE_LAYOUT_t));
+}
+
+// Change the radio profile while the bridge runs, and keep it for the next boot.
+// The radio task applies it between packets.
+esp_err_t bridge_set_profile(const CC1101_PROFILE_t *profile)
+{
+	if (profile->freq >= CFREQ_LAST || profile->mode >= CSPEED_LAST || profile->paLevel >= POWER_LAST) return ESP_ERR_INVALID_ARG;
+	esp_err_t err = profile_save(profile);
+	if (err != ESP_OK) return err;
+	taskENTER_CRITICAL(&stats_mux);
+	next_profile = *profile;
+	profile_pending = true;
+	taskEXIT_CRITICAL(&stats_mux);
+	if (radio_task_handle) xTaskNotifyGive(radio_task_handle);
+	return ESP_OK;
+}
+
+// Must be called before bridge_radio_init()
+esp_err_t bridge_set_layout(const BRIDGE_LAYOUT_t *layout)
+{
+	if (radio_task_handle) return ESP_ERR_INVALID_STATE;
+	if (layout->radio_core < -1 || layout->radio_core >= portNUM_PROCESSORS) return ESP_ERR_INVALID_ARG;
+	if (layout->network_core < -1 || layout->network_core >= portNUM_PROCESSORS) return ESP_ERR_INVALID_ARG;
+	if (layout->radio_priority < 1 || layout->radio_priority >= configMAX_PRIORITIES) return ESP_ERR_INVALID_ARG;
+	if (layout->network_priority < 1 || layout->network_priority >= configMAX_PRIORITIES) return ESP_ERR_INVALID_ARG;
+	memcpy(&bridge_layout, layout, sizeof(BRIDGE_LAYOUT_t));
+	return ESP_OK;
+}
+
+static BaseType_t bridge_create_task(TaskFunction_t task, const char *name, uint32_t stack, UBaseType_t priority, int core, TaskHandle_t *handle)
+{
+	return xTaskCreatePinnedToCore(task, name, stack, NULL, priority, handle, core < 0 ? tskNO_AFFINITY : core);
+}
+
+esp_err_t bridge_start(const BRIDGE_TRANSPORT_t *transport)
+{
+	bridge_transport = transport;
+	esp_err_t ret = trace_init();
+	if (ret != ESP_OK) return ret;
+	downlink_queue = xQueueCreate(CONFIG_BRIDGE_QUEUE_DEPTH, sizeof(BRIDGE_PACKET_t));
+	if (downlink_queue == NULL) return ESP_ERR_NO_MEM;
+	if (transport->send_batch || transport->pull) {
+		uplink_queue = xQueueCreate(CONFIG_BRIDGE_QUEUE_DEPTH, sizeof(BRIDGE_PACKET_t));
+		if (uplink_queue == NULL) return ESP_ERR_NO_MEM;
+	}
+	if (transport->send_batch) {
+#if CONFIG_BRIDGE_STORE
+		esp_err_t err = bridge_store_init();
+		if (err != ESP_OK) return err;
+#endif
+		bridge_create_task(&bridge_uplink_task, "UPLINK", 1024*4, bridge_layout.network_priority, bridge_layout.network_core, NULL);
+	}
+	// Created before the downlink task, which notifies it
+	bridge_create_task(&bridge_radio_task, "RADIO", 1024*3, bridge_layout.radio_priority, bridge_layout.radio_core, &radio_task_handle);
+	if (transport->receive_batch) {
+		bridge_create_task(&bridge_downlink_task, "DOWNLINK", 1024*4, bridge_layout.network_priority, bridge_layout.network_core, NULL);
+	}
+	if (CONFIG_BRIDGE_STATS_INTERVAL > 0) {
+		bridge_create_task(&bridge_stats_task, "STATS", 1024*3, 2, bridge_layout.network_core, NULL);
+	}
+	ESP_LOGI(TAG, "radio core=%d priority=%d network core=%d priority=%d",
+		bridge_layout.radio_core, bridge_layout.radio_priority, bridge_layout.network_core, bridge_layout.network_priority);
+#if CONFIG_BRIDGE_BENCH_LOAD
+	bridge_bench_load_start(&bridge_layout);
+#endif
+	return ESP_OK;
+}
@@ -0,0 +1,114 @@
+/* Radio bridge core
+ *
+ * One radio task owns the CC1101. Packets received from the radio are
+ * passed to the transport in batches, and packets from the transport are
+ * sent to the radio. Batching, backpressure, retries and statistics are
+ * handled here, so each example only implements the transport.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _BRIDGE_H
+#define _BRIDGE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "ccpacket.h"
+#include "cc1101.h"
+#include "envelope.h"
+
+#define BRIDGE_PAYLOAD_MAX (CCPACKET_DATA_LEN)
+// Size of one packet after bridge_encode()
+#if CONFIG_BRIDGE_ENVELOPE
+#define BRIDGE_ENCODED_MAX ENVELOPE_ENCODED_MAX(BRIDGE_PAYLOAD_MAX)
+#else
+#define BRIDGE_ENCODED_MAX BRIDGE_PAYLOAD_MAX
+#endif
+
+typedef struct {
+	uint8_t length;
+	uint8_t data[BRIDGE_PAYLOAD_MAX];
+	int8_t rssi;		// dBm
+	uint8_t lqi;
+	int64_t rx_time;	// esp_timer_get_time() when received
+	uint32_t seq;		// Counted by the radio task. Restarts from 0 at boot.
+						// Packets to the radio are counted separately. Also the trace id.
+	uint32_t boot;		// bridge_boot_id() of the boot that received the packet.
+						// A packet replayed from the flash log may be from an earlier boot.
+} BRIDGE_PACKET_t;
+
+typedef struct {
+	const char *name;
+	// Deliver packets received from the radio. Return ESP_OK when all of them were delivered.
+	// NULL when the transport only sends to the radio, or takes the packets with bridge_receive().
+	esp_err_t (*send_batch)(const BRIDGE_PACKET_t *packets, int count, void *ctx);
+	// Wait for packets to send to the radio. Return the number of packets, 0 on timeout.
+	// NULL when the transport pushes packets with bridge_transmit().
+	int (*receive_batch)(BRIDGE_PACKET_t *packets, int max, TickType_t wait, void *ctx);
+	// Return true when the link is up. NULL means always up.
+	bool (*connected)(void *ctx);
+	// The transport takes the packets received from the radio with bridge_receive() in its own task.
+	// Used when the transport already has a loop of its own, such as an MQTT client.
+	bool pull;
+	void *ctx;
+} BRIDGE_TRANSPORT_t;
+
+#define BRIDGE_LATENCY_BUCKETS	20	// Bucket n counts latencies below 2^(n+1) us
+
+typedef struct {
+	uint32_t rx_packets;		// Received from the radio
+	uint32_t rx_crc_errors;
+	uint32_t rx_drops;			// Dropped because the uplink queue was full
+	uint32_t uplink_packets;	// Delivered to the transport
+	uint32_t uplink_batches;
+	uint32_t uplink_retries;
+	uint32_t uplink_drops;		// Dropped after the retries
+	uint32_t stored;			// Appended to the flash log
+	uint32_t replayed;			// Delivered from the flash log
+	uint32_t tx_packets;		// Sent to the radio
+	uint32_t tx_errors;
+	uint32_t tx_drops;			// Dropped because the downlink queue was full
+	uint32_t tx_deferred;		// Held back by the duty cycle
+	uint32_t rx_latency_count;	// From the GDO0 interrupt to the radio task
+	uint64_t rx_latency_sum;	// us
+	uint32_t rx_latency_max;	// us
+	uint32_t rx_latency_histogram[BRIDGE_LATENCY_BUCKETS];
+} BRIDGE_STATS_t;
+
+// Cores and priorities of the bridge tasks. A core of -1 means any core.
+// The radio task and the GDO0 interrupt run on radio_core.
+// The uplink and downlink tasks, which run the transport, run on network_core.
+typedef struct {
+	int radio_core;
+	UBaseType_t radio_priority;
+	int network_core;
+	UBaseType_t network_priority;
+} BRIDGE_LAYOUT_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void bridge_get_layout(BRIDGE_LAYOUT_t *layout);
+esp_err_t bridge_set_layout(const BRIDGE_LAYOUT_t *layout);
+esp_err_t bridge_radio_init(void);
+esp_err_t bridge_set_profile(const CC1101_PROFILE_t *profile);
+int bridge_rssi(uint8_t raw);
+int bridge_lqi(uint8_t raw);
+esp_err_t bridge_start(const BRIDGE_TRANSPORT_t *transport);
+esp_err_t bridge_transmit(const uint8_t *data, size_t length, TickType_t wait);
+esp_err_t bridge_receive(BRIDGE_PACKET_t *packet, TickType_t wait);
+size_t bridge_next_length(void);
+uint32_t bridge_node_id(void);
+uint32_t bridge_boot_id(void);
+size_t bridge_encode(const BRIDGE_PACKET_t *packet, uint8_t *out, size_t out_size);
+void bridge_get_stats(BRIDGE_STATS_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+/* Network load for the radio latency benchmark
+ *
+ * The LOAD task sends UDP datagrams to a host as fast as the WiFi stack accepts them.
+ * It runs on the network core at the network priority, like the transport.
+ * The latency from the GDO0 interrupt to the radio task is logged by the STATS task,
+ * so the task layouts can be compared under the same load.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+
+#include "bridge_bench.h"
+
+#if CONFIG_BRIDGE_BENCH_LOAD
+
+static const char *TAG = "LOAD";
+
+#define LOAD_DATAGRAM_SIZE	1400
+
+static void bridge_bench_load_task(void *pvParameters)
+{
+	ESP_LOGI(TAG, "Start core=%d host=%s port=%d", xPortGetCoreID(), CONFIG_BRIDGE_BENCH_LOAD_HOST, CONFIG_BRIDGE_BENCH_LOAD_PORT);
+	static uint8_t datagram[LOAD_DATAGRAM_SIZE];
+	struct addrinfo *res = NULL;
+	int sock = -1;
+	uint32_t datagrams = 0;
+	uint32_t errors = 0;
+	int64_t start = esp_timer_get_time();
+	while(1) {
+		if (sock < 0) {
+			char port[8];
+			sprintf(port, "%d", CONFIG_BRIDGE_BENCH_LOAD_PORT);
+			struct addrinfo hints = {
+				.ai_family = AF_INET,
+				.ai_socktype = SOCK_DGRAM,
+			};
+			if (getaddrinfo(CONFIG_BRIDGE_BENCH_LOAD_HOST, port, &hints, &res) != 0 || res == NULL) {
+				ESP_LOGW(TAG, "getaddrinfo fail");
+				vTaskDelay(pdMS_TO_TICKS(1000));
+				continue;
+			}
+			sock = socket(res->ai_family, res->ai_socktype, 0);
+			if (sock < 0) {
+				freeaddrinfo(res);
+				vTaskDelay(pdMS_TO_TICKS(1000));
+				continue;
+			}
+		}
+
+		if (sendto(sock, datagram, sizeof(datagram), 0, res->ai_addr, res->ai_addrlen) < 0) {
+			// Out of buffers. Let the WiFi stack catch up.
+			errors++;
+			vTaskDelay(1);
+		} else {
+			datagrams++;
+		}
+
+		int64_t elapsed = esp_timer_get_time() - start;
+		if (elapsed >= 10000000) {
+			ESP_LOGI(TAG, "%"PRIu32" kbit/s errors=%"PRIu32,
+				(uint32_t)(datagrams * (LOAD_DATAGRAM_SIZE * 8000LL) / elapsed), errors);
+			datagrams = 0;
+			errors = 0;
+			start = esp_timer_get_time();
+		}
+	}
+	vTaskDelete(NULL);
+}
+
+esp_err_t bridge_bench_load_start(const BRIDGE_LAYOUT_t *layout)
+{
+	BaseType_t core = layout->network_core < 0 ? tskNO_AFFINITY : layout->network_core;
+	if (xTaskCreatePinnedToCore(&bridge_bench_load_task, "LOAD", 1024*3, NULL, layout->network_priority, NULL, core) != pdPASS) {
+		return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+#endif // CONFIG_BRIDGE_BENCH_LOAD
@@ -0,0 +1,13 @@
+/* Network load for the radio latency benchmark
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _BRIDGE_BENCH_H
+#define _BRIDGE_BENCH_H
+
+#include "bridge.h"
+
+esp_err_t bridge_bench_load_start(const BRIDGE_LAYOUT_t *layout);
+
+#endif
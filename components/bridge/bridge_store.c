@@ -0,0 +1,274 @@
+/* Store-and-forward log on a flash partition
+ *
+ * The partition is an append-only ring of fixed size records.
+ * Record n is stored in slot (n % capacity), so writes walk through
+ * every sector in turn and the erases are spread evenly.
+ * A sector is erased just before the first record is written to it.
+ * Records still waiting in that sector are lost, which caps the retention.
+ *
+ * After a batch is replayed, the flags byte of its last record is cleared.
+ * Flash bits can be cleared without erasing, so this needs no erase.
+ * Replay is in order, so all records before it are replayed too.
+ *
+ * Each record has a version byte. Records of another version are ignored
+ * and overwritten. The records written before the version byte was added read 0 there.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "bridge_store.h"
+
+#if CONFIG_BRIDGE_STORE
+
+static const char *TAG = "STORE";
+
+#define STORE_MAGIC			0xCC11
+#define STORE_VERSION		1
+#define STORE_NOT_CONSUMED	0xFF
+#define STORE_CONSUMED		0x00
+#define STORE_SECTOR_SIZE	4096
+#define STORE_RECORD_SIZE	96
+#define STORE_RECORDS_PER_SECTOR (STORE_SECTOR_SIZE / STORE_RECORD_SIZE)
+
+typedef struct __attribute__((packed)) {
+	uint16_t magic;
+	uint8_t flags;		// Not covered by crc
+	uint8_t length;
+	uint32_t seq;
+	int64_t rx_time;
+	int8_t rssi;
+	uint8_t lqi;
+	uint8_t data[BRIDGE_PAYLOAD_MAX];
+	uint32_t packet_seq;
+	uint8_t version;
+	uint32_t boot;		// Boot that received the packet
+	uint8_t reserved[STORE_RECORD_SIZE - 31 - BRIDGE_PAYLOAD_MAX];
+	uint32_t crc;
+} STORE_RECORD_t;
+
+_Static_assert(sizeof(STORE_RECORD_t) == STORE_RECORD_SIZE, "STORE_RECORD_t size");
+
+static const esp_partition_t *partition;
+static uint32_t capacity;	// Number of slots
+static uint32_t head;		// Sequence number of the next record to write
+static uint32_t tail;		// Sequence number of the oldest record not replayed
+static STORE_RECORD_t *pending;	// Records not written to flash yet
+static int pending_count;
+
+static uint32_t record_crc(STORE_RECORD_t *record)
+{
+	uint8_t flags = record->flags;
+	record->flags = STORE_NOT_CONSUMED;
+	uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)record, offsetof(STORE_RECORD_t, crc));
+	record->flags = flags;
+	return crc;
+}
+
+static size_t slot_offset(uint32_t seq)
+{
+	uint32_t slot = seq % capacity;
+	return (slot / STORE_RECORDS_PER_SECTOR) * STORE_SECTOR_SIZE + (slot % STORE_RECORDS_PER_SECTOR) * STORE_RECORD_SIZE;
+}
+
+static bool record_valid(STORE_RECORD_t *record)
+{
+	if (record->magic != STORE_MAGIC) return false;
+	if (record->length == 0 || record->length > BRIDGE_PAYLOAD_MAX) return false;
+	if (record->crc != record_crc(record)) return false;
+	return record->version == STORE_VERSION;
+}
+
+// Drop the records that exceed the retention cap
+static void apply_retention(void)
+{
+	uint32_t limit = CONFIG_BRIDGE_STORE_RETENTION < capacity ? CONFIG_BRIDGE_STORE_RETENTION : capacity;
+	if (head - tail > limit) {
+		ESP_LOGW(TAG, "Retention exceeded. %"PRIu32" records dropped", head - tail - limit);
+		tail = head - limit;
+	}
+}
+
+esp_err_t bridge_store_init(void)
+{
+	partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CONFIG_BRIDGE_STORE_PARTITION);
+	if (partition == NULL) {
+		ESP_LOGE(TAG, "Partition [%s] not found", CONFIG_BRIDGE_STORE_PARTITION);
+		return ESP_ERR_NOT_FOUND;
+	}
+	uint32_t sectors = partition->size / STORE_SECTOR_SIZE;
+	if (sectors < 2) {
+		ESP_LOGE(TAG, "Partition [%s] is too small", CONFIG_BRIDGE_STORE_PARTITION);
+		return ESP_ERR_INVALID_SIZE;
+	}
+	capacity = sectors * STORE_RECORDS_PER_SECTOR;
+	pending = calloc(CONFIG_BRIDGE_STORE_WRITE_BATCH, sizeof(STORE_RECORD_t));
+	uint8_t *sector = malloc(STORE_SECTOR_SIZE);
+	if (pending == NULL || sector == NULL) {
+		free(sector);
+		return ESP_ERR_NO_MEM;
+	}
+
+	// Find the newest record, the oldest record and the last replayed record
+	bool found = false;
+	bool consumed = false;
+	uint32_t max_seq = 0, min_seq = 0, max_consumed = 0;
+	uint32_t old_version = 0;
+	for (uint32_t s=0;s<sectors;s++) {
+		esp_err_t err = esp_partition_read(partition, s * STORE_SECTOR_SIZE, sector, STORE_SECTOR_SIZE);
+		if (err != ESP_OK) {
+			free(sector);
+			return err;
+		}
+		for (int r=0;r<STORE_RECORDS_PER_SECTOR;r++) {
+			STORE_RECORD_t *record = (STORE_RECORD_t *)(sector + r * STORE_RECORD_SIZE);
+			if (record_valid(record) == false) {
+				if (record->magic == STORE_MAGIC && record->version != STORE_VERSION && record->flags != STORE_CONSUMED) old_version++;
+				continue;
+			}
+			if (!found || (int32_t)(record->seq - max_seq) > 0) max_seq = record->seq;
+			if (!found || (int32_t)(record->seq - min_seq) < 0) min_seq = record->seq;
+			if (record->flags == STORE_CONSUMED) {
+				if (!consumed || (int32_t)(record->seq - max_consumed) > 0) max_consumed = record->seq;
+				consumed = true;
+			}
+			found = true;
+		}
+	}
+	free(sector);
+	if (old_version) ESP_LOGW(TAG, "%"PRIu32" records of another version dropped", old_version);
+
+	if (found) {
+		head = max_seq + 1;
+		tail = min_seq;
+		if (consumed && (int32_t)(max_consumed + 1 - tail) > 0) tail = max_consumed + 1;
+		apply_retention();
+	} else {
+		head = tail = 0;
+	}
+	ESP_LOGI(TAG, "partition=%s size=%"PRIu32" capacity=%"PRIu32" records=%"PRIu32" head=%"PRIu32" tail=%"PRIu32,
+		partition->label, partition->size, capacity, head - tail, head, tail);
+	return ESP_OK;
+}
+
+bool bridge_store_pending(void)
+{
+	return (partition != NULL) && (head != tail || pending_count > 0);
+}
+
+uint32_t bridge_store_count(void)
+{
+	return head - tail + pending_count;
+}
+
+esp_err_t bridge_store_append(const BRIDGE_PACKET_t *packet)
+{
+	if (partition == NULL) return ESP_ERR_INVALID_STATE;
+	STORE_RECORD_t *record = &pending[pending_count++];
+	memset(record, 0, sizeof(STORE_RECORD_t));
+	record->magic = STORE_MAGIC;
+	record->flags = STORE_NOT_CONSUMED;
+	record->length = packet->length;
+	record->rx_time = packet->rx_time;
+	record->rssi = packet->rssi;
+	record->lqi = packet->lqi;
+	record->packet_seq = packet->seq;
+	record->version = STORE_VERSION;
+	record->boot = packet->boot;
+	memcpy(record->data, packet->data, packet->length);
+	// seq and crc are set when written
+	if (pending_count == CONFIG_BRIDGE_STORE_WRITE_BATCH) return bridge_store_flush();
+	return ESP_OK;
+}
+
+// Write the pending records. Consecutive records in the same sector are written at once.
+esp_err_t bridge_store_flush(void)
+{
+	int index = 0;
+	while (index < pending_count) {
+		uint32_t slot = head % capacity;
+		if (slot % STORE_RECORDS_PER_SECTOR == 0) {
+			// Entering a new sector. Records still in it are lost.
+			uint32_t oldest_in_sector = head - capacity;
+			if (head >= capacity && (int32_t)(tail - (oldest_in_sector + STORE_RECORDS_PER_SECTOR)) < 0) {
+				uint32_t lost = oldest_in_sector + STORE_RECORDS_PER_SECTOR - tail;
+				ESP_LOGW(TAG, "Log is full. %"PRIu32" records dropped", lost);
+				tail = oldest_in_sector + STORE_RECORDS_PER_SECTOR;
+			}
+			esp_err_t err = esp_partition_erase_range(partition, slot_offset(head), STORE_SECTOR_SIZE);
+			if (err != ESP_OK) {
+				ESP_LOGE(TAG, "esp_partition_erase_range fail %s", esp_err_to_name(err));
+				pending_count = 0;
+				return err;
+			}
+		}
+		int run = STORE_RECORDS_PER_SECTOR - (slot % STORE_RECORDS_PER_SECTOR);
+		if (run > pending_count - index) run = pending_count - index;
+		for (int i=0;i<run;i++) {
+			STORE_RECORD_t *record = &pending[index + i];
+			record->seq = head + i;
+			record->crc = record_crc(record);
+		}
+		esp_err_t err = esp_partition_write(partition, slot_offset(head), &pending[index], run * STORE_RECORD_SIZE);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "esp_partition_write fail %s", esp_err_to_name(err));
+			pending_count = 0;
+			return err;
+		}
+		head += run;
+		index += run;
+	}
+	pending_count = 0;
+	apply_retention();
+	return ESP_OK;
+}
+
+// Read the oldest records without removing them
+int bridge_store_peek(BRIDGE_PACKET_t *packets, int max)
+{
+	int count = 0;
+	STORE_RECORD_t record;
+	while (count < max && (int32_t)(head - (tail + count)) > 0) {
+		uint32_t seq = tail + count;
+		if (esp_partition_read(partition, slot_offset(seq), &record, sizeof(record)) != ESP_OK) break;
+		if (record_valid(&record) == false || record.seq != seq) {
+			// Broken record. Skip it.
+			ESP_LOGW(TAG, "Broken record seq=%"PRIu32, seq);
+			if (count == 0) {
+				tail++;
+				continue;
+			}
+			break;
+		}
+		packets[count].length = record.length;
+		memcpy(packets[count].data, record.data, record.length);
+		packets[count].rssi = record.rssi;
+		packets[count].lqi = record.lqi;
+		packets[count].rx_time = record.rx_time;
+		packets[count].seq = record.packet_seq;
+		packets[count].boot = record.boot;
+		count++;
+	}
+	return count;
+}
+
+// Mark the oldest records as replayed
+esp_err_t bridge_store_consume(int count)
+{
+	if (count <= 0) return ESP_OK;
+	uint32_t last = tail + count - 1;
+	uint8_t flags = STORE_CONSUMED;
+	esp_err_t err = esp_partition_write(partition, slot_offset(last) + offsetof(STORE_RECORD_t, flags), &flags, 1);
+	tail += count;
+	return err;
+}
+
+#endif // CONFIG_BRIDGE_STORE
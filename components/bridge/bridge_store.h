@@ -0,0 +1,19 @@
+/* Store-and-forward log on a flash partition
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _BRIDGE_STORE_H
+#define _BRIDGE_STORE_H
+
+#include "bridge.h"
+
+esp_err_t bridge_store_init(void);
+bool bridge_store_pending(void);
+uint32_t bridge_store_count(void);
+esp_err_t bridge_store_append(const BRIDGE_PACKET_t *packet);
+esp_err_t bridge_store_flush(void);
+int bridge_store_peek(BRIDGE_PACKET_t *packets, int max);
+esp_err_t bridge_store_consume(int count);
+
+#endif
@@ -0,0 +1,203 @@
+/* Packet capture
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/message_buffer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "cc1101.h"
+#include "capture.h"
+
+static const char *TAG = "CAPTURE";
+
+#define CAPTURE_SNAPLEN 256
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t network;
+} PCAP_FILE_HEADER_t;
+
+typedef struct {
+	uint32_t ts_sec;
+	uint32_t ts_usec;
+	uint32_t incl_len;
+	uint32_t orig_len;
+} PCAP_RECORD_HEADER_t;
+
+typedef struct __attribute__((packed)) {
+	PCAP_RECORD_HEADER_t pcap;
+	CAPTURE_HEADER_t header;
+	uint8_t data[CCPACKET_DATA_LEN];
+} CAPTURE_RECORD_t;
+
+static MessageBufferHandle_t capture_buffer;
+static SemaphoreHandle_t capture_mutex;
+static TaskHandle_t capture_task;
+static CAPTURE_WRITE_t capture_write;
+static void *capture_ctx;
+static bool capture_tx;
+static bool capture_header_pending;
+static CAPTURE_STATS_t capture_stats;
+
+// Get signal strength indicator in dBm.
+// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
+static int8_t rssi(uint8_t raw)
+{
+	// This rssi_offset is for 38.4kbps and 433 MHz, as in the examples.
+	int rssi_offset = 74;
+	if (raw >= 128)
+		return ((int)(raw - 256) / 2) - rssi_offset;
+	else
+		return (raw / 2) - rssi_offset;
+}
+
+// Called by the driver in the task that receives or sends.
+// The record is only copied here. Writing it may be slow.
+static void capture_tap(const CCPACKET *packet, bool tx, int64_t time)
+{
+	if (tx && !capture_tx) return;
+
+	// The time stamp of the driver is since boot. Shift it to the wall clock.
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	int64_t wall = (int64_t)now.tv_sec * 1000000 + now.tv_usec - (esp_timer_get_time() - time);
+
+	CAPTURE_RECORD_t record;
+	size_t length = sizeof(CAPTURE_HEADER_t) + packet->length;
+	record.pcap.ts_sec = wall / 1000000;
+	record.pcap.ts_usec = wall % 1000000;
+	record.pcap.incl_len = length;
+	record.pcap.orig_len = length;
+	record.header.version = CAPTURE_VERSION;
+	record.header.flags = tx ? CAPTURE_FLAG_TX | CAPTURE_FLAG_CRC_OK : (packet->crc_ok ? CAPTURE_FLAG_CRC_OK : 0);
+	record.header.band = getCarrierFreq();
+	record.header.channel = getChannel();
+	record.header.speed = getSpeed();
+	record.header.rssi = tx ? 0 : rssi(packet->rssi);
+	record.header.lqi = tx ? 0 : packet->lqi;
+	record.header.reserved = 0;
+	memcpy(record.data, packet->data, packet->length);
+
+	// A message buffer takes one writer at a time, and RX and TX may be in different tasks
+	size_t size = sizeof(PCAP_RECORD_HEADER_t) + length;
+	xSemaphoreTake(capture_mutex, portMAX_DELAY);
+	size_t sended = xMessageBufferSend(capture_buffer, &record, size, 0);
+	xSemaphoreGive(capture_mutex);
+	if (sended != size) capture_stats.dropped++;
+}
+
+static void capture_write_header(void)
+{
+	PCAP_FILE_HEADER_t header = {
+		.magic = 0xa1b2c3d4,
+		.version_major = 2,
+		.version_minor = 4,
+		.thiszone = 0,
+		.sigfigs = 0,
+		.snaplen = CAPTURE_SNAPLEN,
+		.network = CAPTURE_LINKTYPE,
+	};
+	if (capture_write(&header, sizeof(header), capture_ctx) != sizeof(header)) {
+		ESP_LOGW(TAG, "pcap file header not written");
+	}
+}
+
+static void capture_writer(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	uint8_t buf[1024];
+	uint32_t dropped = 0;
+	while(1) {
+		// Wake up now and then, so a pending file header is written without packets
+		size_t batched = xMessageBufferReceive(capture_buffer, buf, sizeof(buf), pdMS_TO_TICKS(1000));
+		if (capture_header_pending) {
+			capture_header_pending = false;
+			capture_write_header();
+		}
+		if (batched == 0) continue;
+
+		// Batch the records that are already waiting
+		int records = 1;
+		while(1) {
+			size_t next = xMessageBufferNextLengthBytes(capture_buffer);
+			if (next == 0 || batched + next > sizeof(buf)) break;
+			batched += xMessageBufferReceive(capture_buffer, &buf[batched], next, 0);
+			records++;
+		}
+		ESP_LOGD(pcTaskGetName(NULL), "%d records %d bytes", records, batched);
+		if (capture_write(buf, batched, capture_ctx) == batched) {
+			capture_stats.captured += records;
+		} else {
+			capture_stats.errors += records;
+		}
+		if (xMessageBufferIsEmpty(capture_buffer) == pdTRUE) {
+			capture_write(NULL, 0, capture_ctx);
+		}
+
+		if (capture_stats.dropped != dropped) {
+			dropped = capture_stats.dropped;
+			ESP_LOGW(pcTaskGetName(NULL), "%"PRIu32" records dropped. Increase the capture buffer size", dropped);
+		}
+	} // end while
+	vTaskDelete(NULL);
+}
+
+esp_err_t capture_start(CAPTURE_WRITE_t write, void *ctx, bool tx)
+{
+	if (capture_task == NULL) {
+		capture_buffer = xMessageBufferCreate(CONFIG_CAPTURE_BUFFER_SIZE);
+		if (capture_buffer == NULL) return ESP_ERR_NO_MEM;
+		capture_mutex = xSemaphoreCreateMutex();
+		if (capture_mutex == NULL) return ESP_ERR_NO_MEM;
+		capture_write = write;
+		capture_ctx = ctx;
+		capture_header_pending = true;
+		if (xTaskCreate(&capture_writer, "CAPTURE", 1024*3, NULL, 2, &capture_task) != pdPASS) return ESP_ERR_NO_MEM;
+	} else if (capture_write != write || capture_ctx != ctx) {
+		return ESP_ERR_INVALID_STATE;
+	}
+	capture_tx = tx;
+	setPacketTap(capture_tap);
+	ESP_LOGI(TAG, "Capture started. tx=%d", tx);
+	return ESP_OK;
+}
+
+void capture_stop(void)
+{
+	setPacketTap(NULL);
+}
+
+void capture_header(void)
+{
+	capture_header_pending = true;
+}
+
+void capture_get_stats(CAPTURE_STATS_t *stats)
+{
+	*stats = capture_stats;
+}
+
+size_t capture_file_write(const void *data, size_t length, void *ctx)
+{
+	FILE *f = ctx;
+	if (data == NULL) {
+		fflush(f);
+		return 0;
+	}
+	return fwrite(data, 1, length, f);
+}
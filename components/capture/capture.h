@@ -0,0 +1,62 @@
+/* Packet capture
+ *
+ * Records the packets of the CC1101 in pcap format.
+ * Each record starts with CAPTURE_HEADER_t, followed by the payload of the packet.
+ * cc1101.lua is the Wireshark dissector for this header.
+ *
+ * The records are buffered in RAM, and a task writes them with a function you give,
+ * for example to USB CDC or to a file.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// LINKTYPE_USER0
+#define CAPTURE_LINKTYPE 147
+#define CAPTURE_VERSION 1
+
+// Flags
+#define CAPTURE_FLAG_TX 0x01		// Sent by this node
+#define CAPTURE_FLAG_CRC_OK 0x02	// Always set for a packet sent
+
+typedef struct __attribute__((packed)) {
+	uint8_t version;	// CAPTURE_VERSION
+	uint8_t flags;
+	uint8_t band;		// CFREQ_xxx
+	uint8_t channel;
+	uint8_t speed;		// CSPEED_xxx
+	int8_t rssi;		// dBm. 0 for a packet sent.
+	uint8_t lqi;		// As read from the CC1101. Lower is better. 0 for a packet sent.
+	uint8_t reserved;
+} CAPTURE_HEADER_t;
+
+typedef struct {
+	uint32_t captured;	// Records written
+	uint32_t dropped;	// Records lost because the buffer was full
+	uint32_t errors;	// Records the write function did not take
+} CAPTURE_STATS_t;
+
+// Write length bytes and return the number of bytes written.
+// data is NULL when there is nothing more to write for now, to flush.
+typedef size_t (*CAPTURE_WRITE_t)(const void *data, size_t length, void *ctx);
+
+// Start capturing the packets received, and also the packets sent when tx is true.
+// The pcap file header is written first.
+esp_err_t capture_start(CAPTURE_WRITE_t write, void *ctx, bool tx);
+// Stop capturing. The records in the buffer are still written.
+void capture_stop(void);
+// Write the pcap file header again before the next record, for a reader that has just connected.
+void capture_header(void);
+void capture_get_stats(CAPTURE_STATS_t *stats);
+
+// Write function for a file. ctx is the FILE * opened with fopen(path, "wb").
+size_t capture_file_write(const void *data, size_t length, void *ctx);
+
+#endif
@@ -0,0 +1,85 @@
+-- Wireshark dissector for the packet capture of components/capture.
+-- Copy this file to the personal Lua plugins folder of Wireshark,
+-- shown in Help -> About Wireshark -> Folders.
+--
+-- The capture uses LINKTYPE_USER0 (147).
+-- Change wtap.USER0 below when your captures use another user link type.
+
+local cc1101 = Proto("cc1101", "CC1101 Packet Capture")
+
+local bands = { [0] = "315 MHz", [1] = "433 MHz", [2] = "868 MHz", [3] = "915 MHz" }
+local speeds = { [0] = "4800 bps", [1] = "9600 bps", [2] = "19200 bps", [3] = "38400 bps" }
+
+local f_version = ProtoField.uint8("cc1101.version", "Version", base.DEC)
+local f_flags = ProtoField.uint8("cc1101.flags", "Flags", base.HEX)
+local f_tx = ProtoField.bool("cc1101.flags.tx", "Sent", 8, { "Sent", "Received" }, 0x01)
+local f_crc_ok = ProtoField.bool("cc1101.flags.crc_ok", "CRC OK", 8, nil, 0x02)
+local f_band = ProtoField.uint8("cc1101.band", "Band", base.DEC, bands)
+local f_channel = ProtoField.uint8("cc1101.channel", "Channel", base.DEC)
+local f_speed = ProtoField.uint8("cc1101.speed", "Speed", base.DEC, speeds)
+local f_rssi = ProtoField.int8("cc1101.rssi", "RSSI (dBm)", base.DEC)
+local f_lqi = ProtoField.uint8("cc1101.lqi", "LQI", base.DEC)
+local f_length = ProtoField.uint8("cc1101.length", "Length", base.DEC)
+local f_data = ProtoField.bytes("cc1101.data", "Data")
+local f_text = ProtoField.string("cc1101.text", "Text")
+
+cc1101.fields = { f_version, f_flags, f_tx, f_crc_ok, f_band, f_channel, f_speed, f_rssi, f_lqi, f_length, f_data, f_text }
+
+local HEADER_LENGTH = 8
+
+function cc1101.dissector(buffer, pinfo, tree)
+	if buffer:len() < HEADER_LENGTH then return 0 end
+	pinfo.cols.protocol = "CC1101"
+
+	local flags = buffer(1, 1):uint()
+	local tx = bit.band(flags, 0x01) ~= 0
+	local crc_ok = bit.band(flags, 0x02) ~= 0
+	local length = buffer:len() - HEADER_LENGTH
+
+	local subtree = tree:add(cc1101, buffer(), "CC1101")
+	subtree:add(f_version, buffer(0, 1))
+	local flagtree = subtree:add(f_flags, buffer(1, 1))
+	flagtree:add(f_tx, buffer(1, 1))
+	flagtree:add(f_crc_ok, buffer(1, 1))
+	subtree:add(f_band, buffer(2, 1))
+	subtree:add(f_channel, buffer(3, 1))
+	subtree:add(f_speed, buffer(4, 1))
+	if not tx then
+		subtree:add(f_rssi, buffer(5, 1))
+		subtree:add(f_lqi, buffer(6, 1))
+	end
+	subtree:add(f_length, length):set_generated()
+
+	local info
+	if tx then
+		pinfo.cols.src = "local"
+		info = "TX"
+	else
+		pinfo.cols.dst = "local"
+		info = string.format("RX %d dBm LQI %d", buffer(5, 1):int(), buffer(6, 1):uint())
+		if not crc_ok then
+			info = info .. " [Bad CRC]"
+			subtree:add_expert_info(PI_CHECKSUM, PI_WARN, "Bad CRC")
+		end
+	end
+	info = string.format("%s ch %d len %d", info, buffer(3, 1):uint(), length)
+
+	if length > 0 then
+		local data = buffer(HEADER_LENGTH, length)
+		subtree:add(f_data, data)
+		-- Most examples send text
+		local printable = true
+		for i = 0, length - 1 do
+			local c = data(i, 1):uint()
+			if c < 0x20 or c > 0x7e then printable = false break end
+		end
+		if printable then
+			subtree:add(f_text, data)
+			info = info .. " \"" .. data:string() .. "\""
+		end
+	end
+	pinfo.cols.info = info
+	return buffer:len()
+end
+
+DissectorTable.get("wtap_encap"):add(wtap.USER0, cc1101)
@@ -23,68 +23,83 @@
  * Creation date: 03/03/2011
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
-#include <driver/spi_master.h>
-#include <driver/gpio.h>
 #include "esp_log.h"
+#include "esp_attr.h"
 
 #include "cc1101.h"
+#include "cc1101_hal.h"
 
 #define TAG "CC1101"
 
-// SPI Stuff
-#if CONFIG_SPI2_HOST
-#define HOST_ID SPI2_HOST
-#elif CONFIG_SPI3_HOST
-#define HOST_ID SPI3_HOST
-#endif
-static spi_device_handle_t _handle;
-
 /*
  * RF state
  */
-static uint8_t _rfState;
+CC1101_STATE uint8_t _rfState;
 
 /**
  * Carrier frequency
  */
-static uint8_t _carrierFreq;
+CC1101_STATE uint8_t _carrierFreq;
 
 /**
  * Working mode (speed, ...)
  */
-static uint8_t _workMode;
+CC1101_STATE uint8_t _workMode;
 
 /**
  * Frequency channel
  */
-static uint8_t _channel;
+CC1101_STATE uint8_t _channel;
 
 /**
  * Synchronization word
  */
-static uint8_t _syncWord[2];
+CC1101_STATE uint8_t _syncWord[2];
 
 /**
  * Device address
  */
-static uint8_t _devAddress;
+CC1101_STATE uint8_t _devAddress;
 
 /**
  * Packet available
  */
-static bool _packetAvailable;
+CC1101_STATE bool _packetAvailable;
+
+/**
+ * Task notified when a packet is received, and the time of the interrupt
+ */
+CC1101_STATE TaskHandle_t _packetTask;
+CC1101_STATE int64_t _packetTime;
+
+/**
+ * Called with each packet received and sent
+ */
+CC1101_STATE CC1101_TAP_t _packetTap;
 
 /**
  * Power level
  */
-static uint8_t _powerMin;
-static uint8_t _power0db;
-static uint8_t _powerMax;
+CC1101_STATE const uint8_t *_powerTable;
+CC1101_STATE uint8_t _paLevel;
+
+/**
+ * Copy of the PATABLE entries in use and of FREND0.PA_POWER
+ */
+CC1101_STATE uint8_t _patable[8];
+CC1101_STATE uint8_t _paPower;
+CC1101_STATE int8_t _txPower;
+
+/**
+ * Frequency offset written to FSCTRL0
+ */
+CC1101_STATE int8_t _freqOffset;
 
 
 /**
@@ -92,17 +107,17 @@ static uint8_t _powerMax;
  */
 // Select (SPI) CC1101
 //#define cc1101_Select() digitalWrite(SS, LOW)
-#define cc1101_Select() gpio_set_level(CONFIG_CSN_GPIO, LOW)
+#define cc1101_Select() cc1101_hal_select()
 // Deselect (SPI) CC1101
 //#define cc1101_Deselect() digitalWrite(SS, HIGH)
-#define cc1101_Deselect() gpio_set_level(CONFIG_CSN_GPIO, HIGH)
+#define cc1101_Deselect() cc1101_hal_deselect()
 // Wait until SPI MISO line goes low
 //#define wait_Miso() while(digitalRead(MISO)>0)
-#define wait_Miso() while(gpio_get_level(CONFIG_MISO_GPIO)>0)
+#define wait_Miso() while(cc1101_hal_miso()>0)
 //#define wait_Miso() (void)0
 // Get GDO0 pin state
 //#define getGDO0state() digitalRead(GDO0)
-#define getGDO0state()gpio_get_level(CONFIG_GDO0_GPIO)
+#define getGDO0state() cc1101_hal_gdo0()
 // Wait until GDO0 line goes high
 #define wait_GDO0_high() while(!getGDO0state())
 // Wait until GDO0 line goes low
@@ -115,7 +130,7 @@ static uint8_t _powerMax;
 #define bitSet(value, bit) ((value) |= (1UL << (bit)))
 #define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
 #define bitWrite(value, bit, bitvalue) ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
-#define delayMicroseconds(us) esp_rom_delay_us(us)
+#define delayMicroseconds(us) cc1101_hal_delay_us(us)
 #define LOW  0
 #define HIGH 1
 #define byte uint8_t
@@ -125,88 +140,6 @@ static uint8_t _powerMax;
  */
 //const byte paTable[8] = {0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60, 0x60};
 
-void spi_init() {
-	gpio_reset_pin(CONFIG_CSN_GPIO);
-	gpio_set_direction(CONFIG_CSN_GPIO, GPIO_MODE_OUTPUT);
-	gpio_set_level(CONFIG_CSN_GPIO, 1);
-
-	spi_bus_config_t buscfg = {
-		.sclk_io_num = CONFIG_SCK_GPIO, // set SPI CLK pin
-		.mosi_io_num = CONFIG_MOSI_GPIO, // set SPI MOSI pin
-		.miso_io_num = CONFIG_MISO_GPIO, // set SPI MISO pin
-		.quadwp_io_num = -1,
-		.quadhd_io_num = -1
-	};
-
-	esp_err_t ret;
-	ret = spi_bus_initialize( HOST_ID, &buscfg, SPI_DMA_CH_AUTO );
-	ESP_LOGI(TAG, "spi_bus_initialize=%d",ret);
-	assert(ret==ESP_OK);
-
-	spi_device_interface_config_t devcfg = {
-		.clock_speed_hz = 5000000, // SPI clock is 5 MHz!
-		.queue_size = 7,
-		.mode = 0, // SPI mode 0
-		.spics_io_num = -1, // we will use manual CS control
-		.flags = SPI_DEVICE_NO_DUMMY
-	};
-
-	ret = spi_bus_add_device( HOST_ID, &devcfg, &_handle);
-	ESP_LOGI(TAG, "spi_bus_add_device=%d",ret);
-	assert(ret==ESP_OK);
-}
-
-#if 0
-bool spi_write_byte(uint8_t* Dataout, size_t DataLength )
-{
-	spi_transaction_t SPITransaction;
-
-	if ( DataLength > 0 ) {
-		memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
-		SPITransaction.length = DataLength * 8;
-		SPITransaction.tx_buffer = Dataout;
-		SPITransaction.rx_buffer = NULL;
-		spi_device_transmit( _handle, &SPITransaction );
-	}
-
-	return true;
-}
-
-bool spi_read_byte(uint8_t* Datain, uint8_t* Dataout, size_t DataLength )
-{
-	spi_transaction_t SPITransaction;
-
-	if ( DataLength > 0 ) {
-		memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
-		SPITransaction.length = DataLength * 8;
-		SPITransaction.tx_buffer = Dataout;
-		SPITransaction.rx_buffer = Datain;
-		spi_device_transmit( _handle, &SPITransaction );
-	}
-
-	return true;
-}
-#endif
-
-uint8_t spi_transfer(uint8_t address)
-{
-	uint8_t datain[1];
-	uint8_t dataout[1];
-	dataout[0] = address;
-	//spi_write_byte(dev, dataout, 1 );
-	//spi_read_byte(datain, dataout, 1 );
-
-	spi_transaction_t SPITransaction;
-	memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
-	SPITransaction.length = 8;
-	SPITransaction.tx_buffer = dataout;
-	SPITransaction.rx_buffer = datain;
-	spi_device_transmit( _handle, &SPITransaction );
-
-	return datain[0];
-}
-
-
 /**
  * wakeUp
  * 
@@ -217,6 +150,8 @@ void wakeUp(void)
 	cc1101_Select();			// Select CC1101
 	wait_Miso();				// Wait until MISO goes low
 	cc1101_Deselect();			// Deselect CC1101
+	// SLEEP keeps only the first PATABLE entry
+	if (_paPower > 0) writeBurstReg(CC1101_PATABLE, _patable, _paPower + 1);
 }
 
 /**
@@ -231,8 +166,8 @@ void writeReg(byte regAddr, byte value)
 {
 	cc1101_Select();			// Select CC1101
 	wait_Miso();				// Wait until MISO goes low
-	spi_transfer(regAddr);		// Send register address
-	spi_transfer(value);		// Send value
+	cc1101_hal_transfer(regAddr);		// Send register address
+	cc1101_hal_transfer(value);		// Send value
 	cc1101_Deselect();			// Deselect CC1101
 }
 
@@ -252,10 +187,10 @@ void writeBurstReg(byte regAddr, byte* buffer, byte len)
 	addr = regAddr | WRITE_BURST;	// Enable burst transfer
 	cc1101_Select();				// Select CC1101
 	wait_Miso();					// Wait until MISO goes low
-	spi_transfer(addr);				// Send register address
+	cc1101_hal_transfer(addr);				// Send register address
 	
 	for(i=0 ; i<len ; i++)
-		spi_transfer(buffer[i]);	// Send value
+		cc1101_hal_transfer(buffer[i]);	// Send value
 
 	cc1101_Deselect();				// Deselect CC1101	
 }
@@ -271,7 +206,7 @@ void cmdStrobe(byte cmd)
 {
 	cc1101_Select();			// Select CC1101
 	wait_Miso();				// Wait until MISO goes low
-	spi_transfer(cmd);			// Send strobe command
+	cc1101_hal_transfer(cmd);			// Send strobe command
 	cc1101_Deselect();			// Deselect CC1101
 }
 
@@ -293,8 +228,8 @@ byte readReg(byte regAddr, byte regType)
 	addr = regAddr | regType;
 	cc1101_Select();			// Select CC1101
 	wait_Miso();				// Wait until MISO goes low
-	spi_transfer(addr);			// Send register address
-	val = spi_transfer(0x00);	// Read result
+	cc1101_hal_transfer(addr);			// Send register address
+	val = cc1101_hal_transfer(0x00);	// Read result
 	cc1101_Deselect();			// Deselect CC1101
 
 	return val;
@@ -316,12 +251,72 @@ void readBurstReg(byte * buffer, byte regAddr, byte len)
 	addr = regAddr | READ_BURST;
 	cc1101_Select();				// Select CC1101
 	wait_Miso();					// Wait until MISO goes low
-	spi_transfer(addr);				// Send register address
+	cc1101_hal_transfer(addr);				// Send register address
 	for(i=0 ; i<len ; i++)
-		buffer[i] = spi_transfer(0x00);		// Read result byte by byte
+		buffer[i] = cc1101_hal_transfer(0x00);		// Read result byte by byte
 	cc1101_Deselect();				// Deselect CC1101
 }
 
+// Output power of the PATABLE values in powerTables
+static const int8_t powerDbm[CC1101_POWER_STEPS] = {-30, -20, -15, -10, 0, 5, 7, 10};
+
+// PATABLE values of each carrier frequency, from the datasheet (Table 39)
+static const uint8_t powerTables[CFREQ_LAST][CC1101_POWER_STEPS] = {
+	[CFREQ_315] = {PA_MinPower_315, 0x0D, 0x1C, 0x34, PA_0dbPower_315, 0x85, 0xCB, PA_MaxPower_315},
+	[CFREQ_433] = {PA_MinPower_433, 0x0E, 0x1D, 0x34, PA_0dbPower_433, 0x84, 0xC8, PA_MaxPower_433},
+	[CFREQ_868] = {PA_MinPower_868, 0x0F, 0x1E, 0x27, PA_0dbPower_868, 0x81, 0xCB, PA_MaxPower_868},
+	[CFREQ_915] = {PA_MinPower_915, 0x0E, 0x1E, 0x27, PA_0dbPower_915, 0xCD, 0xC7, PA_MaxPower_915},
+};
+
+// Step of each power level
+static const uint8_t powerSteps[POWER_LAST] = {
+	[POWER_MIN] = 0,
+	[POWER_0db] = 4,
+	[POWER_MAX] = CC1101_POWER_STEPS - 1,
+};
+
+// PATABLE values of the power levels for a carrier frequency
+static esp_err_t setPowerTable(uint8_t freq)
+{
+	if (freq >= CFREQ_LAST) return ESP_ERR_INVALID_ARG;
+	_powerTable = powerTables[freq];
+	return ESP_OK;
+}
+
+// PATABLE value of a power level
+static uint8_t powerValue(uint8_t paLevel)
+{
+	return _powerTable[powerSteps[paLevel]];
+}
+
+// The PATABLE and FREND0 right after a reset
+static void resetPowerTable(void)
+{
+	_patable[0] = CC1101_DEFVAL_PATABLE;
+	_paPower = CC1101_DEFVAL_FREND0 & 0x07;
+	_txPower = CC1101_POWER_UNKNOWN;
+}
+
+// Write the first count entries of the PATABLE, and set PA_POWER to the last of them.
+// Nothing is written when the CC1101 already holds them.
+static void writePowerTable(const uint8_t *patable, uint8_t count)
+{
+	uint8_t paPower = count - 1;
+	if (paPower == _paPower && memcmp(patable, _patable, count) == 0) return;
+	memcpy(_patable, patable, count);
+	if (count == 1) {
+		writeReg(CC1101_PATABLE, _patable[0]);
+	} else {
+		writeBurstReg(CC1101_PATABLE, _patable, count);
+	}
+	if (paPower != _paPower) {
+		writeReg(CC1101_FREND0, (CC1101_DEFVAL_FREND0 & 0xF8) | paPower);
+		_paPower = paPower;
+	}
+	// Reading back costs SPI transfers. Only when the debug log is compiled in.
+	if (LOG_LOCAL_LEVEL >= ESP_LOG_DEBUG) checkTxPower();
+}
+
 /**
  * reset
  * 
@@ -338,12 +333,87 @@ void reset(void)
 	cc1101_Select();				// Select CC1101
 
 	wait_Miso();					// Wait until MISO goes low
-	spi_transfer(CC1101_SRES);			// Send reset command strobe
+	cc1101_hal_transfer(CC1101_SRES);			// Send reset command strobe
 	wait_Miso();					// Wait until MISO goes low
 
 	cc1101_Deselect();				// Deselect CC1101
 
 	setCCregs();					// Reconfigure CC1101
+	resetPowerTable();
+}
+
+// MDMCFG4 of each working mode: data rate and channel bandwidth
+static const uint8_t speedRegs[CSPEED_LAST] = {
+	[CSPEED_4800] = CC1101_DEFVAL_MDMCFG4_4800,
+	[CSPEED_9600] = CC1101_DEFVAL_MDMCFG4_9600,
+	[CSPEED_19200] = CC1101_DEFVAL_MDMCFG4_19200,
+	[CSPEED_38400] = CC1101_DEFVAL_MDMCFG4_38400,
+};
+
+// FREQ2, FREQ1 and FREQ0 of each carrier frequency
+static const uint8_t freqRegs[CFREQ_LAST][3] = {
+	[CFREQ_315] = {CC1101_DEFVAL_FREQ2_315, CC1101_DEFVAL_FREQ1_315, CC1101_DEFVAL_FREQ0_315},
+	[CFREQ_433] = {CC1101_DEFVAL_FREQ2_433, CC1101_DEFVAL_FREQ1_433, CC1101_DEFVAL_FREQ0_433},
+	[CFREQ_868] = {CC1101_DEFVAL_FREQ2_868, CC1101_DEFVAL_FREQ1_868, CC1101_DEFVAL_FREQ0_868},
+	[CFREQ_915] = {CC1101_DEFVAL_FREQ2_915, CC1101_DEFVAL_FREQ1_915, CC1101_DEFVAL_FREQ0_915},
+};
+
+// Data rate and channel bandwidth of a working mode
+static void writeSpeedReg(uint8_t mode)
+{
+	if (mode < CSPEED_LAST)
+		writeReg(CC1101_MDMCFG4, speedRegs[mode]);
+}
+
+// Configuration registers for the current frequency, speed, channel, sync word and address,
+// in the order of the addresses
+static void buildCCregs(uint8_t *regs)
+{
+	regs[CC1101_IOCFG2] = CC1101_DEFVAL_IOCFG2;
+	regs[CC1101_IOCFG1] = CC1101_DEFVAL_IOCFG1;
+	regs[CC1101_IOCFG0] = CC1101_DEFVAL_IOCFG0;
+	regs[CC1101_FIFOTHR] = CC1101_DEFVAL_FIFOTHR;
+	regs[CC1101_SYNC1] = _syncWord[0];
+	regs[CC1101_SYNC0] = _syncWord[1];
+	regs[CC1101_PKTLEN] = CC1101_DEFVAL_PKTLEN;
+	regs[CC1101_PKTCTRL1] = CC1101_DEFVAL_PKTCTRL1;
+	regs[CC1101_PKTCTRL0] = CC1101_DEFVAL_PKTCTRL0;
+	regs[CC1101_ADDR] = _devAddress;
+	regs[CC1101_CHANNR] = _channel;
+	regs[CC1101_FSCTRL1] = CC1101_DEFVAL_FSCTRL1;
+	regs[CC1101_FSCTRL0] = CC1101_DEFVAL_FSCTRL0;
+	memcpy(&regs[CC1101_FREQ2], freqRegs[_carrierFreq < CFREQ_LAST ? _carrierFreq : CFREQ_868], 3);
+	regs[CC1101_MDMCFG4] = speedRegs[_workMode < CSPEED_LAST ? _workMode : CSPEED_38400];
+	regs[CC1101_MDMCFG3] = CC1101_DEFVAL_MDMCFG3;
+	regs[CC1101_MDMCFG2] = CC1101_DEFVAL_MDMCFG2;
+	regs[CC1101_MDMCFG1] = CC1101_DEFVAL_MDMCFG1;
+	regs[CC1101_MDMCFG0] = CC1101_DEFVAL_MDMCFG0;
+	regs[CC1101_DEVIATN] = CC1101_DEFVAL_DEVIATN;
+	regs[CC1101_MCSM2] = CC1101_DEFVAL_MCSM2;
+	regs[CC1101_MCSM1] = CC1101_DEFVAL_MCSM1;
+	regs[CC1101_MCSM0] = CC1101_DEFVAL_MCSM0;
+	regs[CC1101_FOCCFG] = CC1101_DEFVAL_FOCCFG;
+	regs[CC1101_BSCFG] = CC1101_DEFVAL_BSCFG;
+	regs[CC1101_AGCCTRL2] = CC1101_DEFVAL_AGCCTRL2;
+	regs[CC1101_AGCCTRL1] = CC1101_DEFVAL_AGCCTRL1;
+	regs[CC1101_AGCCTRL0] = CC1101_DEFVAL_AGCCTRL0;
+	regs[CC1101_WOREVT1] = CC1101_DEFVAL_WOREVT1;
+	regs[CC1101_WOREVT0] = CC1101_DEFVAL_WOREVT0;
+	regs[CC1101_WORCTRL] = CC1101_DEFVAL_WORCTRL;
+	regs[CC1101_FREND1] = CC1101_DEFVAL_FREND1;
+	regs[CC1101_FREND0] = CC1101_DEFVAL_FREND0;
+	regs[CC1101_FSCAL3] = CC1101_DEFVAL_FSCAL3;
+	regs[CC1101_FSCAL2] = CC1101_DEFVAL_FSCAL2;
+	regs[CC1101_FSCAL1] = CC1101_DEFVAL_FSCAL1;
+	regs[CC1101_FSCAL0] = CC1101_DEFVAL_FSCAL0;
+	regs[CC1101_RCCTRL1] = CC1101_DEFVAL_RCCTRL1;
+	regs[CC1101_RCCTRL0] = CC1101_DEFVAL_RCCTRL0;
+	regs[CC1101_FSTEST] = CC1101_DEFVAL_FSTEST;
+	regs[CC1101_PTEST] = CC1101_DEFVAL_PTEST;
+	regs[CC1101_AGCTEST] = CC1101_DEFVAL_AGCTEST;
+	regs[CC1101_TEST2] = CC1101_DEFVAL_TEST2;
+	regs[CC1101_TEST1] = CC1101_DEFVAL_TEST1;
+	regs[CC1101_TEST0] = CC1101_DEFVAL_TEST0;
 }
 
 /**
@@ -353,77 +423,10 @@ void reset(void)
  */
 void setCCregs(void) 
 {
-	writeReg(CC1101_IOCFG2, CC1101_DEFVAL_IOCFG2);
-	writeReg(CC1101_IOCFG1, CC1101_DEFVAL_IOCFG1);
-	writeReg(CC1101_IOCFG0, CC1101_DEFVAL_IOCFG0);
-	writeReg(CC1101_FIFOTHR, CC1101_DEFVAL_FIFOTHR);
-	writeReg(CC1101_PKTLEN, CC1101_DEFVAL_PKTLEN);
-	writeReg(CC1101_PKTCTRL1, CC1101_DEFVAL_PKTCTRL1);
-	writeReg(CC1101_PKTCTRL0, CC1101_DEFVAL_PKTCTRL0);
-
-	// Set default synchronization word
-	setSyncWordArray(_syncWord);
-
-	// Set default device address
-	setDevAddress(_devAddress);
-
-	// Set default frequency channel
-	setChannel(_channel);
-	
-	writeReg(CC1101_FSCTRL1, CC1101_DEFVAL_FSCTRL1);
-	writeReg(CC1101_FSCTRL0, CC1101_DEFVAL_FSCTRL0);
-
-	// Set default carrier frequency = 868 MHz
-	setCarrierFreq(_carrierFreq);
-
-	// RF speed
-	switch(_workMode)
-	{
-		case CSPEED_4800:
-			writeReg(CC1101_MDMCFG4, CC1101_DEFVAL_MDMCFG4_4800);
-			break;
-		case CSPEED_9600:
-			writeReg(CC1101_MDMCFG4, CC1101_DEFVAL_MDMCFG4_9600);
-			break;
-		case CSPEED_19200:
-			writeReg(CC1101_MDMCFG4, CC1101_DEFVAL_MDMCFG4_19200);
-			break;
-		case CSPEED_38400:
-			writeReg(CC1101_MDMCFG4, CC1101_DEFVAL_MDMCFG4_38400);
-			break;
-	}
-
-		
-	writeReg(CC1101_MDMCFG3, CC1101_DEFVAL_MDMCFG3);
-	writeReg(CC1101_MDMCFG2, CC1101_DEFVAL_MDMCFG2);
-	writeReg(CC1101_MDMCFG1, CC1101_DEFVAL_MDMCFG1);
-	writeReg(CC1101_MDMCFG0, CC1101_DEFVAL_MDMCFG0);
-	writeReg(CC1101_DEVIATN, CC1101_DEFVAL_DEVIATN);
-	writeReg(CC1101_MCSM2, CC1101_DEFVAL_MCSM2);
-	writeReg(CC1101_MCSM1, CC1101_DEFVAL_MCSM1);
-	writeReg(CC1101_MCSM0, CC1101_DEFVAL_MCSM0);
-	writeReg(CC1101_FOCCFG, CC1101_DEFVAL_FOCCFG);
-	writeReg(CC1101_BSCFG, CC1101_DEFVAL_BSCFG);
-	writeReg(CC1101_AGCCTRL2, CC1101_DEFVAL_AGCCTRL2);
-	writeReg(CC1101_AGCCTRL1, CC1101_DEFVAL_AGCCTRL1);
-	writeReg(CC1101_AGCCTRL0, CC1101_DEFVAL_AGCCTRL0);
-	writeReg(CC1101_WOREVT1, CC1101_DEFVAL_WOREVT1);
-	writeReg(CC1101_WOREVT0, CC1101_DEFVAL_WOREVT0);
-	writeReg(CC1101_WORCTRL, CC1101_DEFVAL_WORCTRL);
-	writeReg(CC1101_FREND1, CC1101_DEFVAL_FREND1);
-	writeReg(CC1101_FREND0, CC1101_DEFVAL_FREND0);
-	writeReg(CC1101_FSCAL3, CC1101_DEFVAL_FSCAL3);
-	writeReg(CC1101_FSCAL2, CC1101_DEFVAL_FSCAL2);
-	writeReg(CC1101_FSCAL1, CC1101_DEFVAL_FSCAL1);
-	writeReg(CC1101_FSCAL0, CC1101_DEFVAL_FSCAL0);
-	writeReg(CC1101_RCCTRL1, CC1101_DEFVAL_RCCTRL1);
-	writeReg(CC1101_RCCTRL0, CC1101_DEFVAL_RCCTRL0);
-	writeReg(CC1101_FSTEST, CC1101_DEFVAL_FSTEST);
-	writeReg(CC1101_PTEST, CC1101_DEFVAL_PTEST);
-	writeReg(CC1101_AGCTEST, CC1101_DEFVAL_AGCTEST);
-	writeReg(CC1101_TEST2, CC1101_DEFVAL_TEST2);
-	writeReg(CC1101_TEST1, CC1101_DEFVAL_TEST1);
-	writeReg(CC1101_TEST0, CC1101_DEFVAL_TEST0);
+	// All the configuration registers in one burst
+	uint8_t regs[CC1101_CONFIG_REGS];
+	buildCCregs(regs);
+	writeBurstReg(CC1101_IOCFG2, regs, CC1101_CONFIG_REGS);
 	
 	// Send empty packet
 	CCPACKET packet;
@@ -434,6 +437,25 @@ void setCCregs(void)
 static void IRAM_ATTR gpio_isr_handler(void *arg)
 {
 	_packetAvailable = true;
+	_packetTime = cc1101_hal_time_us();
+	if (_packetTask) {
+		BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+		vTaskNotifyGiveFromISR(_packetTask, &xHigherPriorityTaskWoken);
+		if (xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
+	}
+}
+
+static esp_err_t checkChipId(void)
+{
+	uint8_t CHIP_PARTNUM = readReg(CC1101_PARTNUM, CC1101_STATUS_REGISTER);
+	uint8_t CHIP_VERSION = readReg(CC1101_VERSION, CC1101_STATUS_REGISTER);
+	ESP_LOGI(TAG, "CC1101_PARTNUM %d", CHIP_PARTNUM);
+	ESP_LOGI(TAG, "CC1101_VERSION %d", CHIP_VERSION);
+	if (CHIP_PARTNUM != 0 || CHIP_VERSION != 20) {
+		ESP_LOGE(TAG, "CC1101 not installed");
+		return ESP_FAIL;
+	}
+	return ESP_OK;
 }
 
 /**
@@ -453,48 +475,17 @@ esp_err_t init(uint8_t freq, uint8_t mode)
 	_syncWord[0] = CC1101_DEFVAL_SYNC1; // 0xB5
 	_syncWord[1] = CC1101_DEFVAL_SYNC0; // 0x47
 	_devAddress = CC1101_DEFVAL_ADDR; // 0xFF
+	_freqOffset = CC1101_DEFVAL_FSCTRL0; // 0x00
 	_packetAvailable = false;
 
-	if (freq == CFREQ_315) {
-		_powerMin = PA_MinPower_315;
-		_power0db = PA_0dbPower_315;
-		_powerMax = PA_MaxPower_315;
-	} else if (freq == CFREQ_433) {
-		_powerMin = PA_MinPower_433;
-		_power0db = PA_0dbPower_433;
-		_powerMax = PA_MaxPower_433;
-	} else if (freq == CFREQ_868) {
-		_powerMin = PA_MinPower_868;
-		_power0db = PA_0dbPower_868;
-		_powerMax = PA_MaxPower_868;
-	} else if (freq == CFREQ_915) {
-		_powerMin = PA_MinPower_915;
-		_power0db = PA_0dbPower_915;
-		_powerMax = PA_MaxPower_915;
-	} else {
+	_paLevel = POWER_LAST; // PATABLE is not set
+	if (setPowerTable(freq) != ESP_OK) {
 		ESP_LOGE(TAG, "Illegal Freqiency");
 		vTaskDelete(NULL);
 	}
 
-	// Initialize SPI
-	spi_init();
-
-	//interrupt setting
-	gpio_config_t io_conf;
-	//interrupt of falling edge
-	io_conf.intr_type = GPIO_INTR_NEGEDGE; // GPIO interrupt type : falling edge
-	//bit mask of the pins
-	io_conf.pin_bit_mask = 1ULL<<CONFIG_GDO0_GPIO;
-	//set as input mode
-	io_conf.mode = GPIO_MODE_INPUT;
-	//enable pull-up mode
-	io_conf.pull_up_en = 1;
-	io_conf.pull_down_en = 0;
-	gpio_config(&io_conf);
-	//install gpio isr service
-	gpio_install_isr_service(0);
-	//hook isr handler for specific gpio pin
-	gpio_isr_handler_add(CONFIG_GDO0_GPIO, gpio_isr_handler, (void*) CONFIG_GDO0_GPIO);
+	// Initialize SPI and the GDO0 interrupt
+	cc1101_hal_init(gpio_isr_handler);
 
 	// Reset CC1101
 	reset();
@@ -508,17 +499,152 @@ esp_err_t init(uint8_t freq, uint8_t mode)
 #endif
 
 	// Check Chip ID
-	uint8_t CHIP_PARTNUM = readReg(CC1101_PARTNUM, CC1101_STATUS_REGISTER);
-	uint8_t CHIP_VERSION = readReg(CC1101_VERSION, CC1101_STATUS_REGISTER);
-	ESP_LOGI(TAG, "CC1101_PARTNUM %d", CHIP_PARTNUM);
-	ESP_LOGI(TAG, "CC1101_VERSION %d", CHIP_VERSION);
-	if (CHIP_PARTNUM != 0 || CHIP_VERSION != 20) {
-		ESP_LOGE(TAG, "CC1101 not installed");
-		return ESP_FAIL;
+	return checkChipId();
+}
+
+// Registers the calibration writes. They differ from the values written.
+static bool calibrationReg(uint8_t addr)
+{
+	return addr == CC1101_FSCAL3 || addr == CC1101_FSCAL2 || addr == CC1101_FSCAL1;
+}
+
+/**
+ * initProfile
+ * 
+ * Initialize CC1101 radio with a complete profile.
+ * The CC1101 keeps its registers over a reset of the ESP32.
+ * When one burst read shows that it already holds the profile, the reset and
+ * the register writes are skipped, and the radio only goes back to RX state.
+ *
+ * @param profile Radio profile
+ * @param warm Set to true when the registers were kept. May be NULL.
+ */
+esp_err_t initProfile(const CC1101_PROFILE_t *profile, bool *warm)
+{
+	if (warm) *warm = false;
+	if (profile->freq >= CFREQ_LAST || profile->mode >= CSPEED_LAST || profile->paLevel >= POWER_LAST) {
+		ESP_LOGE(TAG, "Illegal profile");
+		return ESP_ERR_INVALID_ARG;
+	}
+	_carrierFreq = profile->freq;
+	_workMode = profile->mode;
+	_channel = profile->channel;
+	_syncWord[0] = profile->syncWord[0];
+	_syncWord[1] = profile->syncWord[1];
+	_devAddress = profile->devAddress;
+	_freqOffset = CC1101_DEFVAL_FSCTRL0;
+	_packetAvailable = false;
+	setPowerTable(profile->freq);
+
+	// Initialize SPI and the GDO0 interrupt
+	cc1101_hal_init(gpio_isr_handler);
+
+	// The chip ID is readable without a reset
+	esp_err_t ret = checkChipId();
+	if (ret != ESP_OK) return ret;
+
+	uint8_t expected[CC1101_CONFIG_REGS];
+	buildCCregs(expected);
+	expected[CC1101_PKTCTRL1] = profile->addressCheck ? 0x06 : 0x04;
+	uint8_t current[CC1101_CONFIG_REGS];
+	readBurstReg(current, CC1101_IOCFG2, CC1101_CONFIG_REGS);
+	uint8_t patable;
+	readBurstReg(&patable, CC1101_PATABLE, 1);
+
+	bool same = (patable == powerValue(profile->paLevel));
+	for (int addr=0;addr<CC1101_CONFIG_REGS && same;addr++) {
+		if (calibrationReg(addr)) continue;
+		if (current[addr] != expected[addr]) {
+			ESP_LOGD(TAG, "Register 0x%02x is 0x%02x, not 0x%02x", addr, current[addr], expected[addr]);
+			same = false;
+		}
+	}
+
+	if (same) {
+		ESP_LOGI(TAG, "Warm start. The CC1101 already holds the profile");
+		// Still listening with an empty RX FIFO. Even the calibration is not needed.
+		uint8_t marcState = readStatusReg(CC1101_MARCSTATE) & 0x1F;
+		uint8_t rxBytes = readStatusReg(CC1101_RXBYTES);
+		if (marcState == 0x0D && rxBytes == 0) {
+			_rfState = RFSTATE_RX;
+		} else {
+			setIdleState();
+			flushRxFifo();
+			flushTxFifo();
+			setRxState();
+		}
+		_paLevel = profile->paLevel;
+		_patable[0] = patable;
+		_paPower = 0;
+		_txPower = powerDbm[powerSteps[profile->paLevel]];
+	} else {
+		reset();
+		writeReg(CC1101_PKTCTRL1, expected[CC1101_PKTCTRL1]);
+		setTxPowerAmp(profile->paLevel);
 	}
+	if (warm) *warm = same;
 	return ESP_OK;
 }
 
+/**
+ * setProfile
+ * 
+ * Change the whole profile without init().
+ * The radio goes through IDLE and is back in RX state on return.
+ *
+ * @param profile Radio profile
+ */
+esp_err_t setProfile(const CC1101_PROFILE_t *profile)
+{
+	if (profile->freq >= CFREQ_LAST || profile->mode >= CSPEED_LAST || profile->paLevel >= POWER_LAST) {
+		return ESP_ERR_INVALID_ARG;
+	}
+	setIdleState();
+	setPowerTable(profile->freq);
+	setCarrierFreq(profile->freq);
+	writeSpeedReg(profile->mode);
+	_workMode = profile->mode;
+	setChannel(profile->channel);
+	setSyncWord(profile->syncWord[0], profile->syncWord[1]);
+	setDevAddress(profile->devAddress);
+	if (profile->addressCheck) {
+		enableAddressCheck();
+	} else {
+		disableAddressCheck();
+	}
+	setTxPowerAmp(profile->paLevel);
+	flushRxFifo();
+	setRxState();
+	return ESP_OK;
+}
+
+/**
+ * getProfile
+ * 
+ * Current profile
+ *
+ * @param profile Radio profile
+ */
+void getProfile(CC1101_PROFILE_t *profile)
+{
+	profile->freq = _carrierFreq;
+	profile->mode = _workMode;
+	profile->channel = _channel;
+	profile->syncWord[0] = _syncWord[0];
+	profile->syncWord[1] = _syncWord[1];
+	profile->devAddress = _devAddress;
+	profile->addressCheck = (readConfigReg(CC1101_PKTCTRL1) & 0x03) != 0;
+	profile->paLevel = _paLevel;
+	if (_paLevel == POWER_LAST && _txPower != CC1101_POWER_UNKNOWN) {
+		// The profile only carries a power level. Report the nearest one.
+		int best = 0;
+		for (int level=0;level<POWER_LAST;level++) {
+			if (abs(powerDbm[powerSteps[level]] - _txPower) < abs(powerDbm[powerSteps[best]] - _txPower)) best = level;
+		}
+		profile->paLevel = best;
+	}
+}
+
 /**
  * setSyncWord
  * 
@@ -582,40 +708,28 @@ void setChannel(byte chnl)
  */
 void setCarrierFreq(byte freq)
 {
-	switch(freq)
-	{
-		case CFREQ_315:
-			writeReg(CC1101_FREQ2, CC1101_DEFVAL_FREQ2_315);
-			writeReg(CC1101_FREQ1, CC1101_DEFVAL_FREQ1_315);
-			writeReg(CC1101_FREQ0, CC1101_DEFVAL_FREQ0_315);
-			break;
-		case CFREQ_433:
-			writeReg(CC1101_FREQ2, CC1101_DEFVAL_FREQ2_433);
-			writeReg(CC1101_FREQ1, CC1101_DEFVAL_FREQ1_433);
-			writeReg(CC1101_FREQ0, CC1101_DEFVAL_FREQ0_433);
-			break;
-		case CFREQ_868:
-			writeReg(CC1101_FREQ2, CC1101_DEFVAL_FREQ2_868);
-			writeReg(CC1101_FREQ1, CC1101_DEFVAL_FREQ1_868);
-			writeReg(CC1101_FREQ0, CC1101_DEFVAL_FREQ0_868);
-			break;
-		case CFREQ_915:
-			writeReg(CC1101_FREQ2, CC1101_DEFVAL_FREQ2_915);
-			writeReg(CC1101_FREQ1, CC1101_DEFVAL_FREQ1_915);
-			writeReg(CC1101_FREQ0, CC1101_DEFVAL_FREQ0_915);
-			break;
-#if 0
-		case CFREQ_918:
-			writeReg(CC1101_FREQ2, CC1101_DEFVAL_FREQ2_918);
-			writeReg(CC1101_FREQ1, CC1101_DEFVAL_FREQ1_918);
-			writeReg(CC1101_FREQ0, CC1101_DEFVAL_FREQ0_918);
-			break;
-#endif
-	}
-	 
+	if (freq >= CFREQ_LAST) return;
+	writeBurstReg(CC1101_FREQ2, (byte *)freqRegs[freq], 3);
 	_carrierFreq = freq;
 }
 
+/**
+ * setSpeed
+ * 
+ * Change the working mode (speed) without init().
+ * The radio goes through IDLE and is back in RX state on return.
+ * 
+ * @param mode New working mode
+ */
+void setSpeed(uint8_t mode)
+{
+	if (mode >= CSPEED_LAST) return;
+	setIdleState();
+	writeSpeedReg(mode);
+	_workMode = mode;
+	setRxState();
+}
+
 /**
  * setPowerDownState
  * 
@@ -712,6 +826,10 @@ bool sendData(CCPACKET packet)
 	// Declare to be in Rx state
 	_rfState = RFSTATE_RX;
 
+	// GDO0 went low at the end of the packet, so _packetTime is the end of the transmission
+	if (res && _packetTap)
+		_packetTap(&packet, true, _packetTime);
+
 	return res;
 }
 
@@ -748,6 +866,11 @@ byte receiveData(CCPACKET * packet)
 			val = readConfigReg(CC1101_RXFIFO);
 			packet->lqi = val & 0x7F;
 			packet->crc_ok = bitRead(val, 7);
+			// Still holds the estimate of this packet until RX starts again
+			packet->freqest = (signed char)readStatusReg(CC1101_FREQEST);
+			// Packets with a bad CRC are passed too
+			if (_packetTap && packet->length > 0)
+				_packetTap(packet, false, _packetTime);
 		}
 	}
 	else
@@ -794,23 +917,85 @@ void setTxState(void)
  */
 void setTxPowerAmp(uint8_t paLevel)
 {
-#if 0
-	writeReg(CC1101_PATABLE, paLevel);
-#endif
-	ESP_LOGI(TAG, "setTxPowerAmp paLevel=%d", paLevel);
-	if (paLevel == POWER_MIN) {
-		ESP_LOGI(TAG, "setTxPowerAmp _powerMin=0x%x", _powerMin);
-		writeReg(CC1101_PATABLE, _powerMin);
-	} else if (paLevel == POWER_0db) {
-		ESP_LOGI(TAG, "setTxPowerAmp _power0db=0x%x", _power0db);
-		writeReg(CC1101_PATABLE, _power0db);
-	} else if (paLevel == POWER_MAX) {
-		ESP_LOGI(TAG, "setTxPowerAmp _powerMax=0x%x", _powerMax);
-		writeReg(CC1101_PATABLE, _powerMax);
+	ESP_LOGD(TAG, "setTxPowerAmp paLevel=%d", paLevel);
+	if (paLevel >= POWER_LAST) return;
+	uint8_t value = powerValue(paLevel);
+	ESP_LOGD(TAG, "setTxPowerAmp PATABLE=0x%x", value);
+	writePowerTable(&value, 1);
+	_paLevel = paLevel;
+	_txPower = powerDbm[powerSteps[paLevel]];
+}
+
+/**
+ * setTxPower
+ *
+ * Set the output power in dBm
+ *
+ * @param dbm Output power
+ * @param ramp Shape the ramp through the lower steps
+ */
+int8_t setTxPower(int8_t dbm, bool ramp)
+{
+	uint8_t step = 0;
+	for (int i=1;i<CC1101_POWER_STEPS;i++) {
+		if (powerDbm[i] <= dbm) step = i;
 	}
-	uint8_t ptable[8];
-	readBurstReg(ptable, CC1101_PATABLE, 8);
-	ESP_LOG_BUFFER_HEXDUMP(TAG, ptable, 8, ESP_LOG_INFO);
+	if (ramp) {
+		// The PA steps through PATABLE[0] to PATABLE[PA_POWER]
+		writePowerTable(_powerTable, step + 1);
+	} else {
+		writePowerTable(&_powerTable[step], 1);
+	}
+	_paLevel = POWER_LAST;
+	if (!ramp) {
+		for (int level=0;level<POWER_LAST;level++) {
+			if (powerSteps[level] == step) _paLevel = level;
+		}
+	}
+	_txPower = powerDbm[step];
+	ESP_LOGD(TAG, "setTxPower %ddBm ramp=%d", _txPower, ramp);
+	return _txPower;
+}
+
+/**
+ * getTxPower
+ *
+ * Output power in dBm
+ */
+int8_t getTxPower(void)
+{
+	return _txPower;
+}
+
+/**
+ * getTxPowerStep
+ *
+ * Output power of a step in dBm
+ *
+ * @param step 0 to CC1101_POWER_STEPS - 1
+ */
+int8_t getTxPowerStep(uint8_t step)
+{
+	if (step >= CC1101_POWER_STEPS) step = CC1101_POWER_STEPS - 1;
+	return powerDbm[step];
+}
+
+/**
+ * checkTxPower
+ *
+ * Compare FREND0 and the PATABLE entries in use with the copy
+ */
+esp_err_t checkTxPower(void)
+{
+	uint8_t patable[8];
+	uint8_t paPower = readConfigReg(CC1101_FREND0) & 0x07;
+	readBurstReg(patable, CC1101_PATABLE, _paPower + 1);
+	ESP_LOG_BUFFER_HEXDUMP(TAG, patable, _paPower + 1, ESP_LOG_DEBUG);
+	if (paPower != _paPower || memcmp(patable, _patable, _paPower + 1) != 0) {
+		ESP_LOGW(TAG, "PA_POWER or PATABLE differs from the copy");
+		return ESP_ERR_INVALID_STATE;
+	}
+	return ESP_OK;
 }
 
 /**
@@ -828,3 +1013,146 @@ uint8_t packet_available()
 	return 0;
 }
 
+/**
+ * setPacketNotify
+ *
+ * Notify a task from the GDO0 interrupt, so the task does not have to poll packet_available()
+ *
+ * @param task Task to notify. NULL stops the notification.
+ */
+void setPacketNotify(TaskHandle_t task)
+{
+	_packetTask = task;
+}
+
+/**
+ * getPacketTime
+ *
+ * Time of the last GDO0 interrupt in microseconds since boot
+ */
+int64_t getPacketTime(void)
+{
+	return _packetTime;
+}
+
+/**
+ * setPacketTap
+ *
+ * Call a function with each packet received and each packet sent, for example to capture them.
+ * The function is called in the task that calls receiveData() or sendData().
+ *
+ * @param tap Function to call. NULL stops the calls.
+ */
+void setPacketTap(CC1101_TAP_t tap)
+{
+	_packetTap = tap;
+}
+
+/**
+ * getCarrierFreq
+ *
+ * Current carrier frequency (CFREQ_xxx)
+ */
+uint8_t getCarrierFreq(void)
+{
+	return _carrierFreq;
+}
+
+/**
+ * getChannel
+ *
+ * Current frequency channel
+ */
+uint8_t getChannel(void)
+{
+	return _channel;
+}
+
+/**
+ * setFreqOffset
+ *
+ * Move the carrier by offset * 26MHz/2^14 (about 1.6kHz), for TX and RX.
+ * Compensates the error of the crystal of this node, or of the node at the other end.
+ *
+ * @param offset Frequency offset in the unit of FREQEST
+ */
+void setFreqOffset(int8_t offset)
+{
+	writeReg(CC1101_FSCTRL0, (uint8_t)offset);
+	_freqOffset = offset;
+}
+
+/**
+ * getFreqOffset
+ *
+ * Current frequency offset
+ */
+int8_t getFreqOffset(void)
+{
+	return _freqOffset;
+}
+
+// Channel filter bandwidth of CHANBW_E and CHANBW_M
+static uint32_t bandwidthHz(uint8_t chanbw)
+{
+	uint8_t exponent = chanbw >> 2;
+	uint8_t mantissa = chanbw & 0x03;
+	return CC1101_XOSC_HZ / ((8 * (4 + mantissa)) << exponent);
+}
+
+/**
+ * setRxBandwidth
+ *
+ * Set the narrowest channel filter that is at least hz wide.
+ * setSpeed() sets the bandwidth of the working mode again.
+ *
+ * @param hz Bandwidth in Hz. 58kHz to 812kHz.
+ *
+ * Return:
+ *	Bandwidth set in Hz
+ */
+static uint8_t chanbwFor(uint32_t hz)
+{
+	// From the narrowest one
+	uint8_t chanbw = 0x0F;
+	while (chanbw > 0 && bandwidthHz(chanbw) < hz) chanbw--;
+	return chanbw;
+}
+
+uint32_t setRxBandwidth(uint32_t hz)
+{
+	uint8_t chanbw = chanbwFor(hz);
+	uint8_t mdmcfg4 = readConfigReg(CC1101_MDMCFG4);
+	writeReg(CC1101_MDMCFG4, (chanbw << 4) | (mdmcfg4 & 0x0F));
+	return bandwidthHz(chanbw);
+}
+
+/**
+ * getRxBandwidth
+ *
+ * Current channel filter bandwidth in Hz
+ */
+uint32_t getRxBandwidth(void)
+{
+	return bandwidthHz(readConfigReg(CC1101_MDMCFG4) >> 4);
+}
+
+/**
+ * fitRxBandwidth
+ *
+ * Bandwidth that setRxBandwidth(hz) would set, without setting it
+ */
+uint32_t fitRxBandwidth(uint32_t hz)
+{
+	return bandwidthHz(chanbwFor(hz));
+}
+
+/**
+ * getSpeed
+ *
+ * Current working mode (CSPEED_xxx)
+ */
+uint8_t getSpeed(void)
+{
+	return _workMode;
+}
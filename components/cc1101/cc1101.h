@@ -28,7 +28,9 @@
 
 //#include <Arduino.h>
 //#include <SPI.h>
-#include <driver/spi_master.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "ccpacket.h"
 
 /**
@@ -77,6 +79,9 @@ enum TXPOWER
 	POWER_LAST
 };
 
+#define CC1101_POWER_STEPS			8		// Output powers of setTxPower(), one PATABLE entry each
+#define CC1101_POWER_UNKNOWN		INT8_MIN	// getTxPower() before the power is set
+
 /**
  * Frequency channels
  */
@@ -123,6 +128,11 @@ enum TXPOWER
 #define CC1101_SWORRST				0x3C	// Reset real time clock to Event1 value
 #define CC1101_SNOP					0x3D	// No operation. May be used to get access to the chip status byte
 
+/**
+ * Crystal frequency
+ */
+#define CC1101_XOSC_HZ				26000000
+
 /**
  * CC1101 configuration registers
  */
@@ -173,6 +183,7 @@ enum TXPOWER
 #define CC1101_TEST2				0x2C	// Various Test Settings
 #define CC1101_TEST1				0x2D	// Various Test Settings
 #define CC1101_TEST0				0x2E	// Various Test Settings
+#define CC1101_CONFIG_REGS			0x2F	// Number of configuration registers, IOCFG2 to TEST0
 
 /**
  * Status registers
@@ -303,6 +314,7 @@ enum TXPOWER
 #define CC1101_DEFVAL_TEST2			0x81	// Various Test Settings
 #define CC1101_DEFVAL_TEST1			0x35	// Various Test Settings
 #define CC1101_DEFVAL_TEST0			0x09	// Various Test Settings
+#define CC1101_DEFVAL_PATABLE		0xC6	// PATABLE entry 0
 
 /**
  * Alias for some default values
@@ -494,6 +506,15 @@ void setCarrierFreq(uint8_t freq);
  */
 void setChannel(uint8_t chnl);
 
+/**
+ * setSpeed
+ * 
+ * Change the working mode (speed) without init()
+ * 
+ * @param mode New working mode
+ */
+void setSpeed(uint8_t mode);
+
 /**
  * setPowerDownState
  * 
@@ -547,12 +568,149 @@ void setTxState(void);
  */
 void setTxPowerAmp(uint8_t paLevel);
 
+/**
+ * setTxPower
+ *
+ * Set the output power in dBm, from the PATABLE values of the carrier frequency.
+ * The steps are -30, -20, -15, -10, 0, 5, 7 and 10dBm. The highest step that
+ * does not exceed dbm is set, or -30dBm below it.
+ * With ramp, the PA goes up through the lower steps at the start of a packet
+ * and down at the end, which keeps the spectrum of the edges narrow.
+ * Nothing is written when the CC1101 already holds the values.
+ *
+ * @param dbm Output power
+ * @param ramp Shape the ramp through the lower steps
+ * Return: the output power set
+ */
+int8_t setTxPower(int8_t dbm, bool ramp);
+
+/**
+ * getTxPower, getTxPowerStep
+ *
+ * Output power in dBm from the copy of the PATABLE, without a SPI transfer.
+ * CC1101_POWER_UNKNOWN until setTxPower() or setTxPowerAmp() is called.
+ * getTxPowerStep() is the output power of a step, 0 to CC1101_POWER_STEPS - 1.
+ */
+int8_t getTxPower(void);
+int8_t getTxPowerStep(uint8_t step);
+
+/**
+ * checkTxPower
+ *
+ * Read back FREND0 and the PATABLE entries in use, and compare them with the copy.
+ * A reset or the SLEEP state loses them. wakeUp() writes them again.
+ * Return: ESP_ERR_INVALID_STATE when they differ
+ */
+esp_err_t checkTxPower(void);
+
 /**
  * packet_available
  *
  * Check if Packet is received
  */
 uint8_t packet_available();
+
+/**
+ * setPacketNotify
+ *
+ * Notify a task from the GDO0 interrupt, so the task does not have to poll packet_available()
+ *
+ * @param task Task to notify. NULL stops the notification.
+ */
+void setPacketNotify(TaskHandle_t task);
+
+/**
+ * getPacketTime
+ *
+ * Time of the last GDO0 interrupt in microseconds since boot
+ */
+int64_t getPacketTime(void);
+
+/**
+ * setPacketTap
+ *
+ * Call a function with each packet received and each packet sent, for example to capture them.
+ * The function is called in the task that calls receiveData() or sendData().
+ * Received packets with a bad CRC are passed too.
+ *
+ * @param tap Function to call. NULL stops the calls.
+ *	tx is true for a packet sent.
+ *	time is the GDO0 interrupt at the end of the packet, in microseconds since boot.
+ */
+typedef void (*CC1101_TAP_t)(const CCPACKET *packet, bool tx, int64_t time);
+void setPacketTap(CC1101_TAP_t tap);
+
+/**
+ * getCarrierFreq, getChannel, getSpeed
+ *
+ * Current carrier frequency (CFREQ_xxx), channel and working mode (CSPEED_xxx)
+ */
+uint8_t getCarrierFreq(void);
+uint8_t getChannel(void);
+uint8_t getSpeed(void);
+
+/**
+ * setFreqOffset, getFreqOffset
+ *
+ * Frequency offset in FSCTRL0, in the unit of CCPACKET.freqest.
+ * It moves the carrier for TX and RX.
+ */
+void setFreqOffset(int8_t offset);
+int8_t getFreqOffset(void);
+
+/**
+ * setRxBandwidth, getRxBandwidth, fitRxBandwidth
+ *
+ * Channel filter bandwidth in Hz. setRxBandwidth() sets the narrowest one
+ * that is at least the given width, and returns it.
+ * fitRxBandwidth() returns the same width without setting it.
+ */
+uint32_t setRxBandwidth(uint32_t hz);
+uint32_t getRxBandwidth(void);
+uint32_t fitRxBandwidth(uint32_t hz);
+
+/**
+ * Radio profile
+ *
+ * Everything an application sets after init().
+ */
+typedef struct {
+	uint8_t freq;			// CFREQ_xxx
+	uint8_t mode;			// CSPEED_xxx
+	uint8_t channel;
+	uint8_t syncWord[2];
+	uint8_t devAddress;
+	bool addressCheck;
+	uint8_t paLevel;		// POWER_xxx
+} CC1101_PROFILE_t;
+
+/**
+ * initProfile
+ *
+ * Initialize CC1101 radio with a complete profile, in place of init() and the settings after it.
+ * When the CC1101 already holds the profile, the reset and the register writes are skipped.
+ *
+ * @param profile Radio profile
+ * @param warm Set to true when the registers were kept. May be NULL.
+ */
+esp_err_t initProfile(const CC1101_PROFILE_t *profile, bool *warm);
+
+/**
+ * setProfile
+ *
+ * Change the whole profile without init().
+ * The radio goes through IDLE and is back in RX state on return.
+ */
+esp_err_t setProfile(const CC1101_PROFILE_t *profile);
+
+/**
+ * getProfile
+ *
+ * Current profile. paLevel is POWER_LAST until setTxPowerAmp() or setTxPower() is called.
+ * The profile only carries a power level: after setTxPower() sets a power
+ * that is not one, or a ramp, paLevel is the power level nearest in dBm.
+ */
+void getProfile(CC1101_PROFILE_t *profile);
 #endif
 
 
@@ -0,0 +1,38 @@
+/* Hardware access of the CC1101 driver
+ *
+ * cc1101_hal_esp.c implements it with the ESP-IDF SPI and GPIO drivers.
+ * host/cc1101_hal_sim.c implements it with a software model of the CC1101,
+ * so the driver also runs on Linux.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _CC1101_HAL_H
+#define _CC1101_HAL_H
+
+#include <stdint.h>
+
+// Storage class of the driver state.
+// The host simulation of many nodes defines it as "static __thread", one driver for each thread.
+#ifndef CC1101_STATE
+#define CC1101_STATE static
+#endif
+
+typedef void (*cc1101_hal_isr_t)(void *arg);
+
+// Initialize the SPI bus and CSN, and call isr on the falling edge of GDO0
+void cc1101_hal_init(cc1101_hal_isr_t isr);
+// Drive CSN low / high
+void cc1101_hal_select(void);
+void cc1101_hal_deselect(void);
+// Level of the MISO line. The CC1101 pulls it low when it is ready.
+int cc1101_hal_miso(void);
+// Send one byte and return the byte received at the same time
+uint8_t cc1101_hal_transfer(uint8_t data);
+// Level of the GDO0 line
+int cc1101_hal_gdo0(void);
+void cc1101_hal_delay_us(uint32_t us);
+// Microseconds since boot. Called from the interrupt.
+int64_t cc1101_hal_time_us(void);
+
+#endif
@@ -0,0 +1,126 @@
+/* Hardware access of the CC1101 driver with the ESP-IDF drivers
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <string.h>
+
+#include <driver/spi_master.h>
+#include <driver/gpio.h>
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+
+#include "cc1101_hal.h"
+
+#define TAG "CC1101"
+
+// SPI Stuff
+#if CONFIG_SPI2_HOST
+#define HOST_ID SPI2_HOST
+#elif CONFIG_SPI3_HOST
+#define HOST_ID SPI3_HOST
+#endif
+static spi_device_handle_t _handle;
+
+static void spi_init(void)
+{
+	gpio_reset_pin(CONFIG_CSN_GPIO);
+	gpio_set_direction(CONFIG_CSN_GPIO, GPIO_MODE_OUTPUT);
+	gpio_set_level(CONFIG_CSN_GPIO, 1);
+
+	spi_bus_config_t buscfg = {
+		.sclk_io_num = CONFIG_SCK_GPIO, // set SPI CLK pin
+		.mosi_io_num = CONFIG_MOSI_GPIO, // set SPI MOSI pin
+		.miso_io_num = CONFIG_MISO_GPIO, // set SPI MISO pin
+		.quadwp_io_num = -1,
+		.quadhd_io_num = -1
+	};
+
+	esp_err_t ret;
+	ret = spi_bus_initialize( HOST_ID, &buscfg, SPI_DMA_CH_AUTO );
+	ESP_LOGI(TAG, "spi_bus_initialize=%d",ret);
+	assert(ret==ESP_OK);
+
+	spi_device_interface_config_t devcfg = {
+		.clock_speed_hz = 5000000, // SPI clock is 5 MHz!
+		.queue_size = 7,
+		.mode = 0, // SPI mode 0
+		.spics_io_num = -1, // we will use manual CS control
+		.flags = SPI_DEVICE_NO_DUMMY
+	};
+
+	ret = spi_bus_add_device( HOST_ID, &devcfg, &_handle);
+	ESP_LOGI(TAG, "spi_bus_add_device=%d",ret);
+	assert(ret==ESP_OK);
+}
+
+void cc1101_hal_init(cc1101_hal_isr_t isr)
+{
+	// Initialize SPI
+	spi_init();
+
+	//interrupt setting
+	gpio_config_t io_conf;
+	//interrupt of falling edge
+	io_conf.intr_type = GPIO_INTR_NEGEDGE; // GPIO interrupt type : falling edge
+	//bit mask of the pins
+	io_conf.pin_bit_mask = 1ULL<<CONFIG_GDO0_GPIO;
+	//set as input mode
+	io_conf.mode = GPIO_MODE_INPUT;
+	//enable pull-up mode
+	io_conf.pull_up_en = 1;
+	io_conf.pull_down_en = 0;
+	gpio_config(&io_conf);
+	//install gpio isr service
+	gpio_install_isr_service(0);
+	//hook isr handler for specific gpio pin
+	gpio_isr_handler_add(CONFIG_GDO0_GPIO, isr, (void*) CONFIG_GDO0_GPIO);
+}
+
+void cc1101_hal_select(void)
+{
+	gpio_set_level(CONFIG_CSN_GPIO, 0);
+}
+
+void cc1101_hal_deselect(void)
+{
+	gpio_set_level(CONFIG_CSN_GPIO, 1);
+}
+
+int cc1101_hal_miso(void)
+{
+	return gpio_get_level(CONFIG_MISO_GPIO);
+}
+
+uint8_t cc1101_hal_transfer(uint8_t data)
+{
+	uint8_t datain[1];
+	uint8_t dataout[1];
+	dataout[0] = data;
+
+	spi_transaction_t SPITransaction;
+	memset( &SPITransaction, 0, sizeof( spi_transaction_t ) );
+	SPITransaction.length = 8;
+	SPITransaction.tx_buffer = dataout;
+	SPITransaction.rx_buffer = datain;
+	spi_device_transmit( _handle, &SPITransaction );
+
+	return datain[0];
+}
+
+int cc1101_hal_gdo0(void)
+{
+	return gpio_get_level(CONFIG_GDO0_GPIO);
+}
+
+void cc1101_hal_delay_us(uint32_t us)
+{
+	esp_rom_delay_us(us);
+}
+
+int64_t IRAM_ATTR cc1101_hal_time_us(void)
+{
+	return esp_timer_get_time();
+}
@@ -64,6 +64,11 @@ typedef struct {
 	 */
 	unsigned char lqi;
 
+	/**
+	 * Frequency offset of the carrier (FREQEST), in units of 26MHz/2^14
+	 */
+	signed char freqest;
+
 } CCPACKET;
 
 #endif
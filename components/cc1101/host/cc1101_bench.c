@@ -0,0 +1,349 @@
+/* The cc1101 driver on a simulated CC1101
+ *
+ * Runs the driver against the software model and measures, in virtual time:
+ * - sendData(): packets per second and SPI bytes per packet.
+ * - receiveData(): the time from the end of the packet on air to the packet in the buffer,
+ *   and the packets lost while the radio was not in RX.
+ * - init() and initProfile(): the time to RX state, on a new CC1101 and on one that kept its registers.
+ * The data, RSSI, LQI, CRC_OK and FREQEST read by the driver are checked against the model.
+ * The exit status is 1 when a check fails or a limit given with -t or -r is not met.
+ *
+ * Build and run on Linux:
+ * gcc -O2 -Iinclude -I.. -o cc1101_bench cc1101_bench.c cc1101_model.c cc1101_hal_sim.c ../cc1101.c
+ * ./cc1101_bench
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cc1101.h"
+#include "cc1101_sim.h"
+
+static int errors;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			errors++; \
+		} \
+	} while(0)
+
+static MODEL_FRAME_t sent;
+
+static void on_transmit(CC1101_MODEL_t *model, const MODEL_FRAME_t *frame, void *ctx)
+{
+	sent = *frame;
+}
+
+static void fill_packet(CCPACKET *packet, int length, int seq)
+{
+	packet->length = length;
+	for (int i=0;i<length;i++) packet->data[i] = (uint8_t)(seq + i);
+}
+
+// Send count packets back to back. Returns packets per second.
+static double bench_tx(int length, int count)
+{
+	CC1101_MODEL_t *model = cc1101_sim_model();
+	uint32_t spi_bytes = model->spi_bytes;
+	uint32_t frames = model->frames_sent;
+	int64_t start = cc1101_sim_now_ns();
+	for (int i=0;i<count;i++) {
+		CCPACKET packet;
+		fill_packet(&packet, length, i);
+		CHECK(sendData(packet), "sendData failed length=%d", length);
+		CHECK(sent.length == length + 1 && sent.data[0] == length && memcmp(&sent.data[1], packet.data, length) == 0,
+			"Packet on air does not match length=%d", length);
+	}
+	int64_t elapsed = cc1101_sim_now_ns() - start;
+	CHECK(model->frames_sent - frames == count, "%d packets sent, %d expected", (int)(model->frames_sent - frames), count);
+
+	double rate = count * 1e9 / elapsed;
+	double airtime = cc1101_model_airtime_ns(model, length) / 1000.0;
+	printf("TX length=%2d %7.1f packets/s %7.0fus/packet airtime %6.0fus (%4.1f%%) %4.1f SPI bytes/packet\n",
+		length, rate, elapsed / 1000.0 / count, airtime, airtime * 100000.0 * count / elapsed,
+		(double)(model->spi_bytes - spi_bytes) / count);
+	return rate;
+}
+
+// Packets arrive every interval_us. The task is woken by the GDO0 interrupt and calls receiveData().
+// Returns the average time from the end of the packet to receiveData() returning.
+static double bench_rx(int length, int count, int interval_us)
+{
+	CC1101_MODEL_t *model = cc1101_sim_model();
+	struct tskTaskControlBlock task = {0};
+	setPacketNotify(&task);
+	uint32_t lost = model->frames_lost;
+	int received = 0;
+	int64_t latency_sum = 0;
+	int64_t latency_max = 0;
+	int64_t next = cc1101_sim_now_ns() + 1000000;
+
+	for (int i=0;i<count;i++) {
+		// Wait for the next packet
+		if (cc1101_sim_now_ns() < next) cc1101_sim_advance(next - cc1101_sim_now_ns());
+		MODEL_FRAME_t frame = {0};
+		frame.data[0] = length;
+		for (int j=0;j<length;j++) frame.data[j+1] = (uint8_t)(i * 7 + j);
+		frame.data[1] = 0x00;	// Broadcast address
+		frame.length = length + 1;
+		frame.sync[0] = model->regs[CC1101_SYNC1];
+		frame.sync[1] = model->regs[CC1101_SYNC0];
+		frame.frequency = cc1101_model_frequency(model);
+		frame.rate = cc1101_model_data_rate(model);
+		// -20 to +20 steps of FREQEST
+		int8_t freqest = i % 41 - 20;
+		frame.offset = freqest * 26000000.0 / 16384;
+		frame.start_ns = cc1101_sim_now_ns();
+		frame.end_ns = frame.start_ns + cc1101_model_airtime_ns(model, length);
+		int8_t rssi = -40 - (i % 50);
+		uint8_t lqi = i % 128;
+		bool crc_ok = (i % 10) != 9;
+		bool heard = cc1101_model_receive(model, &frame, rssi, lqi, crc_ok);
+		next = frame.end_ns + interval_us * 1000LL;
+
+		// Sleep until the interrupt. The task wakes up at the end of the packet.
+		task.notify = 0;
+		if (heard) cc1101_sim_advance(frame.end_ns - cc1101_sim_now_ns());
+		if (task.notify == 0) {
+			CHECK(heard == false, "No interrupt for packet %d", i);
+			continue;
+		}
+		// getPacketTime() is in microseconds
+		int64_t isr_ns = getPacketTime() * 1000;
+		CHECK(isr_ns > frame.end_ns - 1000 && isr_ns <= frame.end_ns, "Interrupt at %lldns, packet ended at %lldns",
+			(long long)isr_ns, (long long)frame.end_ns);
+		CHECK(packet_available(), "packet_available() is not set for packet %d", i);
+
+		CCPACKET packet;
+		uint8_t len = receiveData(&packet);
+		int64_t latency = cc1101_sim_now_ns() - frame.end_ns;
+		CHECK(len == length, "receiveData returned %d, %d expected", len, length);
+		if (len != length) continue;
+		CHECK(memcmp(packet.data, &frame.data[1], length) == 0, "Data of packet %d does not match", i);
+		CHECK(packet.rssi == (uint8_t)((rssi + 74) * 2), "RSSI 0x%02x for %ddBm", packet.rssi, rssi);
+		CHECK(packet.lqi == lqi && packet.crc_ok == crc_ok, "LQI %d CRC %d, %d %d expected",
+			packet.lqi, packet.crc_ok, lqi, crc_ok);
+		CHECK(packet.freqest == freqest, "FREQEST %d, %d expected", packet.freqest, freqest);
+		received++;
+		latency_sum += latency;
+		if (latency > latency_max) latency_max = latency;
+	}
+	setPacketNotify(NULL);
+	CHECK(received == count, "%d of %d packets received", received, count);
+
+	double average = received ? latency_sum / 1000.0 / received : 0;
+	printf("RX length=%2d interval=%4dus received %d/%d lost %d latency avg %.0fus max %.0fus\n",
+		length, interval_us, received, count, (int)(model->frames_lost - lost), average, latency_max / 1000.0);
+	return average;
+}
+
+// A packet for another address is dropped by the radio
+static void check_filter(void)
+{
+	CC1101_MODEL_t *model = cc1101_sim_model();
+	setDevAddress(0x10);
+	cc1101_sim_advance(2000000);
+	MODEL_FRAME_t frame = {0};
+	uint8_t data[] = {3, 0x20, 'A', 'B'};
+	memcpy(frame.data, data, sizeof(data));
+	frame.length = sizeof(data);
+	frame.sync[0] = model->regs[CC1101_SYNC1];
+	frame.sync[1] = model->regs[CC1101_SYNC0];
+	frame.frequency = cc1101_model_frequency(model);
+	frame.rate = cc1101_model_data_rate(model);
+	frame.start_ns = cc1101_sim_now_ns();
+	frame.end_ns = frame.start_ns + cc1101_model_airtime_ns(model, 3);
+	cc1101_model_receive(model, &frame, -50, 10, true);
+	cc1101_sim_advance(frame.end_ns - frame.start_ns);
+	CCPACKET packet;
+	if (packet_available()) {
+		CHECK(receiveData(&packet) == 0, "Packet for address 0x20 was received by 0x10");
+	}
+	CHECK((model->marcstate & 0x1F) != 0x11, "RX FIFO overflow");
+	setDevAddress(CC1101_DEFVAL_ADDR);
+}
+
+// setTxPower() with and without the ramp, and the PATABLE over SLEEP
+static void check_power(void)
+{
+	static const uint8_t ramp[CC1101_POWER_STEPS] = {0x03, 0x0F, 0x1E, 0x27, 0x50, 0x81, 0xCB, 0xC2};
+	CC1101_MODEL_t *model = cc1101_sim_model();
+	CHECK(setTxPower(3, false) == 0, "setTxPower(3) is not 0dBm");
+	CHECK(model->patable[0] == 0x50 && (model->regs[CC1101_FREND0] & 0x07) == 0,
+		"PATABLE 0x%02x PA_POWER %d at 0dBm", model->patable[0], model->regs[CC1101_FREND0] & 0x07);
+	uint32_t spi_bytes = model->spi_bytes;
+	setTxPower(0, false);
+	CHECK(model->spi_bytes == spi_bytes, "setTxPower() wrote the same value again");
+
+	CHECK(setTxPower(20, true) == 10, "setTxPower(20) is not 10dBm");
+	CHECK(memcmp(model->patable, ramp, sizeof(ramp)) == 0 && (model->regs[CC1101_FREND0] & 0x07) == 7,
+		"Ramp not written");
+	CHECK(cc1101_model_tx_power(model) == 10, "Output power %ddBm", cc1101_model_tx_power(model));
+	CHECK(getTxPower() == 10 && checkTxPower() == ESP_OK, "PATABLE differs from the copy");
+	CC1101_PROFILE_t profile;
+	getProfile(&profile);
+	CHECK(profile.paLevel == POWER_MAX, "getProfile() paLevel %d with a ramp", profile.paLevel);
+
+	// SLEEP keeps only the first entry. wakeUp() writes the ramp again.
+	setPowerDownState();
+	cc1101_sim_advance(1000000);
+	CHECK(model->patable[7] == 0, "PATABLE kept over SLEEP");
+	wakeUp();
+	CHECK(checkTxPower() == ESP_OK, "PATABLE not restored after SLEEP");
+	model->patable[7] = 0;
+	CHECK(checkTxPower() == ESP_ERR_INVALID_STATE, "checkTxPower() missed a lost entry");
+	model->patable[7] = ramp[7];
+
+	setTxPowerAmp(POWER_MAX);
+	CHECK(model->patable[0] == 0xC2 && (model->regs[CC1101_FREND0] & 0x07) == 0, "setTxPowerAmp() kept the ramp");
+	CHECK(getTxPower() == 10, "getTxPower() %d at POWER_MAX", getTxPower());
+	setIdleState();
+	setRxState();
+	cc1101_sim_advance(1000000);
+}
+
+// Time from the start of the initialization to RX state, in us
+static double time_to_rx(int64_t start)
+{
+	CC1101_MODEL_t *model = cc1101_sim_model();
+	while (model->marcstate != 0x0D && cc1101_sim_now_ns() - start < 100000000) cc1101_sim_advance(1000);
+	return (cc1101_sim_now_ns() - start) / 1000.0;
+}
+
+// Boot of an example: init() and the settings after it, then initProfile() on a new
+// CC1101 and on a CC1101 that kept its registers over a reset of the ESP32.
+static void bench_init(void)
+{
+	static CC1101_MODEL_t legacy, profiled;
+	CC1101_PROFILE_t profile = {
+		.freq = CFREQ_868,
+		.mode = CSPEED_38400,
+		.channel = 1,
+		.syncWord = {199, 10},
+		.devAddress = CC1101_DEFVAL_ADDR,
+		.addressCheck = false,
+		.paLevel = POWER_MAX,
+	};
+
+	cc1101_model_init(&legacy);
+	cc1101_sim_attach(&legacy);
+	int64_t start = cc1101_sim_now_ns();
+	uint32_t spi_bytes = legacy.spi_bytes;
+	CHECK(init(profile.freq, profile.mode) == ESP_OK, "init failed");
+	setSyncWordArray(profile.syncWord);
+	setChannel(profile.channel);
+	disableAddressCheck();
+	setTxPowerAmp(profile.paLevel);
+	double us = time_to_rx(start);
+	printf("INIT init() and settings   %6.0fus to RX %4u SPI bytes\n", us, legacy.spi_bytes - spi_bytes);
+
+	cc1101_model_init(&profiled);
+	cc1101_sim_attach(&profiled);
+	bool warm = true;
+	start = cc1101_sim_now_ns();
+	spi_bytes = profiled.spi_bytes;
+	CHECK(initProfile(&profile, &warm) == ESP_OK, "initProfile failed");
+	us = time_to_rx(start);
+	printf("INIT initProfile() cold    %6.0fus to RX %4u SPI bytes\n", us, profiled.spi_bytes - spi_bytes);
+	CHECK(warm == false, "Warm start on a new CC1101");
+	for (int addr=0;addr<CC1101_CONFIG_REGS;addr++) {
+		if (addr == CC1101_FSCAL3 || addr == CC1101_FSCAL2 || addr == CC1101_FSCAL1) continue;
+		CHECK(profiled.regs[addr] == legacy.regs[addr], "Register 0x%02x is 0x%02x, init() wrote 0x%02x",
+			addr, profiled.regs[addr], legacy.regs[addr]);
+	}
+	CHECK(profiled.patable[0] == legacy.patable[0], "PATABLE 0x%02x, init() wrote 0x%02x", profiled.patable[0], legacy.patable[0]);
+
+	// Reset of the ESP32. The CC1101 keeps its registers.
+	start = cc1101_sim_now_ns();
+	spi_bytes = profiled.spi_bytes;
+	CHECK(initProfile(&profile, &warm) == ESP_OK, "initProfile failed");
+	us = time_to_rx(start);
+	printf("INIT initProfile() warm    %6.0fus to RX %4u SPI bytes\n", us, profiled.spi_bytes - spi_bytes);
+	CHECK(warm == true, "No warm start with the same profile");
+
+	profile.channel = 2;
+	CHECK(initProfile(&profile, &warm) == ESP_OK, "initProfile failed");
+	CHECK(warm == false, "Warm start with another channel");
+	CHECK(profiled.regs[CC1101_CHANNR] == 2, "CHANNR %d", profiled.regs[CC1101_CHANNR]);
+
+	CC1101_PROFILE_t current;
+	profile.mode = CSPEED_4800;
+	profile.paLevel = POWER_MIN;
+	CHECK(setProfile(&profile) == ESP_OK, "setProfile failed");
+	getProfile(&current);
+	CHECK(memcmp(&current, &profile, sizeof(profile)) == 0, "getProfile() differs from setProfile()");
+	CHECK(time_to_rx(cc1101_sim_now_ns()) < 1000, "Not in RX after setProfile()");
+}
+
+int main(int argc, char **argv)
+{
+	int count = 100;
+	int interval_us = 2000;
+	double min_tx_rate = 0;
+	double max_rx_latency = 0;
+	CC1101_SIM_TIMING_t timing = {
+		.spi_byte_ns = 1600,
+		.spi_call_ns = 0,
+		.gpio_ns = 100,
+	};
+
+	int opt;
+	while ((opt = getopt(argc, argv, "n:i:o:t:r:")) != -1) {
+		switch(opt) {
+			case 'n': count = atoi(optarg); break;
+			case 'i': interval_us = atoi(optarg); break;
+			case 'o': timing.spi_call_ns = atof(optarg) * 1000; break;
+			case 't': min_tx_rate = atof(optarg); break;
+			case 'r': max_rx_latency = atof(optarg); break;
+			default:
+				printf("usage: %s [-n packets] [-i RX interval us] [-o SPI overhead us] [-t min TX packets/s] [-r max RX latency us]\n", argv[0]);
+				return 2;
+		}
+	}
+	cc1101_sim_set_timing(&timing);
+	cc1101_sim_model()->on_transmit = on_transmit;
+
+	CHECK(init(CFREQ_868, CSPEED_38400) == ESP_OK, "init failed");
+	CC1101_MODEL_t *model = cc1101_sim_model();
+	// init() ends with SRX and the calibration
+	cc1101_sim_advance(1000000);
+	printf("frequency %uHz MARCSTATE 0x%02x\n", cc1101_model_frequency(model), model->marcstate);
+	CHECK(model->regs[CC1101_IOCFG0] == 0x06, "IOCFG0 0x%02x", model->regs[CC1101_IOCFG0]);
+	CHECK(model->marcstate == 0x0D, "Not in RX after init");
+
+	double tx_rate = 0;
+	static const int lengths[] = {1, 16, 32, 61};
+	for (int i=0;i<sizeof(lengths)/sizeof(lengths[0]);i++) {
+		double rate = bench_tx(lengths[i], count);
+		if (lengths[i] == 32) tx_rate = rate;
+	}
+
+	double rx_latency = 0;
+	for (int i=0;i<sizeof(lengths)/sizeof(lengths[0]);i++) {
+		double latency = bench_rx(lengths[i], count, interval_us);
+		if (lengths[i] == 32) rx_latency = latency;
+	}
+	// Back to back packets. The recalibration after receiveData() ends within the preamble.
+	bench_rx(32, count, 100);
+	check_filter();
+	check_power();
+	bench_init();
+
+	if (min_tx_rate && tx_rate < min_tx_rate) {
+		printf("FAIL TX %.1f packets/s is below %.1f\n", tx_rate, min_tx_rate);
+		errors++;
+	}
+	if (max_rx_latency && rx_latency > max_rx_latency) {
+		printf("FAIL RX latency %.0fus is above %.0fus\n", rx_latency, max_rx_latency);
+		errors++;
+	}
+	printf("%s: %d errors\n", errors ? "FAIL" : "PASS", errors);
+	return errors ? 1 : 0;
+}
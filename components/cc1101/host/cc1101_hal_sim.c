@@ -0,0 +1,135 @@
+/* Hardware access of the CC1101 driver with the software model
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "cc1101_hal.h"
+#include "cc1101_sim.h"
+
+static CC1101_MODEL_t default_model;
+static cc1101_hal_isr_t gdo0_isr;
+static cc1101_sim_wait_t sim_wait;
+// Each thread drives its own model
+static __thread CC1101_MODEL_t *model;
+static __thread uint32_t spi_calls;
+static CC1101_SIM_TIMING_t timing = {
+	.spi_byte_ns = 1600,
+	.spi_call_ns = 0,
+	.gpio_ns = 100,
+};
+
+CC1101_MODEL_t *cc1101_sim_model(void)
+{
+	if (model == NULL) {
+		cc1101_model_init(&default_model);
+		model = &default_model;
+	}
+	return model;
+}
+
+void cc1101_sim_attach(CC1101_MODEL_t *_model)
+{
+	model = _model;
+}
+
+void cc1101_sim_set_wait(cc1101_sim_wait_t wait)
+{
+	sim_wait = wait;
+}
+
+void cc1101_sim_set_timing(const CC1101_SIM_TIMING_t *_timing)
+{
+	timing = *_timing;
+}
+
+int64_t cc1101_sim_now_ns(void)
+{
+	return cc1101_sim_model()->now_ns;
+}
+
+void cc1101_sim_advance(int64_t ns)
+{
+	CC1101_MODEL_t *m = cc1101_sim_model();
+	if (sim_wait) {
+		sim_wait(m->now_ns + ns);
+	} else {
+		cc1101_model_advance(m, m->now_ns + ns);
+	}
+}
+
+uint32_t cc1101_sim_spi_calls(void)
+{
+	return spi_calls;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+	return cc1101_sim_now_ns() / 1000000;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *pxHigherPriorityTaskWoken)
+{
+	task->notify++;
+	if (pxHigherPriorityTaskWoken) *pxHigherPriorityTaskWoken = pdTRUE;
+}
+
+// The GPIO interrupt is set for the falling edge
+static void on_gdo0(CC1101_MODEL_t *m, int level, void *ctx)
+{
+	if (level == 0 && gdo0_isr) gdo0_isr(NULL);
+}
+
+void cc1101_hal_init(cc1101_hal_isr_t isr)
+{
+	CC1101_MODEL_t *m = cc1101_sim_model();
+	m->on_gdo0 = on_gdo0;
+	// The same handler for all the threads
+	gdo0_isr = isr;
+}
+
+void cc1101_hal_select(void)
+{
+	cc1101_model_select(cc1101_sim_model(), true);
+}
+
+void cc1101_hal_deselect(void)
+{
+	cc1101_model_select(cc1101_sim_model(), false);
+}
+
+int cc1101_hal_miso(void)
+{
+	cc1101_sim_advance(timing.gpio_ns);
+	return cc1101_model_miso(cc1101_sim_model());
+}
+
+uint8_t cc1101_hal_transfer(uint8_t data)
+{
+	spi_calls++;
+	cc1101_sim_advance(timing.spi_call_ns);
+	uint8_t miso = cc1101_model_transfer(cc1101_sim_model(), data);
+	cc1101_sim_advance(timing.spi_byte_ns);
+	return miso;
+}
+
+int cc1101_hal_gdo0(void)
+{
+	cc1101_sim_advance(timing.gpio_ns);
+	return cc1101_model_gdo0(cc1101_sim_model());
+}
+
+void cc1101_hal_delay_us(uint32_t us)
+{
+	cc1101_sim_advance(us * 1000LL);
+}
+
+int64_t cc1101_hal_time_us(void)
+{
+	return cc1101_sim_now_ns() / 1000;
+}
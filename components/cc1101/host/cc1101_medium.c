@@ -0,0 +1,474 @@
+/* Many simulated CC1101 on one radio channel
+ *
+ * The scheduler resumes the node with the earliest virtual time.
+ * Nodes only affect each other with the packets they put on air, and a packet starts
+ * at least MODEL_RXTX_SWITCH_NS after the strobe. So a node runs ahead of the others
+ * by that much without a thread switch, which keeps the SPI level simulation fast.
+ * The start of its own packet waits until all the other nodes have caught up.
+ *
+ * A packet put on air by one node is given to the model of every other node:
+ * - The model checks the frequency, sync word, length and address, and whether it is in RX.
+ * - A packet that overlaps another one at a receiver is corrupted (CRC_OK=0),
+ *   unless it is capture_db stronger than the other one.
+ * - MEDIUM_CONFIG_t.loss drops packets at random.
+ * - With MEDIUM_CONFIG_t.noise_figure, a link budget: the noise of the channel filter,
+ *   and the part of the signal the filter cuts off when the carriers of the sender and
+ *   the receiver differ. The crystal of each node is off by up to MEDIUM_CONFIG_t.ppm.
+ * - A node sees the carrier for CCA while a packet of another node is on air.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "cc1101_sim.h"
+#include "cc1101_medium.h"
+
+#define TICK_NS	(1000000000LL / configTICK_RATE_HZ)
+#define SNR_DB	10		// Needed by 2-FSK for a PER of 50%
+
+typedef struct {
+	int id;
+	char name[16];
+	medium_task_t task;
+	void *arg;
+	pthread_t thread;
+	pthread_cond_t cond;
+	CC1101_MODEL_t model;
+	struct tskTaskControlBlock tcb;
+	int64_t wake_ns;		// Time the task waits for
+	bool notify_wait;		// Also wakes up on a notification
+	bool exited;
+	int rx_rssi;			// RSSI of the packet being received
+	MEDIUM_STATS_t stats;	// Receiver counts
+} NODE_t;
+
+typedef struct {
+	int from;
+	int power;				// dBm
+	int64_t start_ns;
+	int64_t end_ns;
+} ONAIR_t;
+
+static MEDIUM_CONFIG_t config;
+static MEDIUM_STATS_t stats;
+static NODE_t *nodes[MEDIUM_NODE_MAX];
+static int node_count;
+static ONAIR_t *onair;
+static int onair_count;
+static int onair_size;
+static int64_t busy_until;
+static uint32_t random_state;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scheduler_cond = PTHREAD_COND_INITIALIZER;
+static NODE_t *running;			// NULL while the scheduler runs
+static int64_t scheduled_ns;	// Time the running node was resumed for
+static bool stopping;
+static int64_t horizon;			// Earliest time of the other nodes
+static int64_t tx_horizon;		// Earliest time another node can put a packet on air
+static bool horizon_valid;
+static __thread NODE_t *self;
+
+uint32_t medium_random(void)
+{
+	// xorshift32
+	uint32_t x = random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	random_state = x;
+	return x;
+}
+
+// RSSI of a packet sent at the reset PATABLE.
+// The same in both directions, fixed for the run.
+static int link_rssi(int a, int b)
+{
+	uint32_t h = config.seed * 2654435761u;
+	h ^= (a < b ? a : b) * 40503u + (a < b ? b : a) * 65599u;
+	h ^= h >> 15;
+	h *= 2246822519u;
+	h ^= h >> 13;
+	return config.rssi_min + h % (config.rssi_max - config.rssi_min + 1);
+}
+
+// Fixed for the run, between -ppm and +ppm
+int32_t medium_node_ppb(int id)
+{
+	if (config.ppm == 0) return 0;
+	uint32_t h = (config.seed + 1) * 2654435761u ^ (id + 1) * 2246822519u;
+	h ^= h >> 13;
+	h *= 3266489917u;
+	h ^= h >> 16;
+	return (int32_t)(h % (2000u * config.ppm + 1)) - 1000 * config.ppm;
+}
+
+// Probability that a packet is received with bit errors.
+// -1 when the receiver does not find the sync word at all.
+static double link_error(const CC1101_MODEL_t *receiver, const MODEL_FRAME_t *frame, int rssi)
+{
+	double offset = fabs((double)frame->offset - cc1101_model_offset(receiver));
+	double bandwidth = cc1101_model_bandwidth(receiver);
+	double deviation = cc1101_model_deviation(receiver);
+	// The demodulator follows the offset up to FOC_LIMIT, and a quarter of the deviation beyond it
+	if (offset > cc1101_model_foc_limit(receiver) + deviation / 4) return -1;
+	// Carson bandwidth of the signal, and the part of it outside the filter
+	double rate = cc1101_model_data_rate(receiver);
+	double signal = 2 * deviation + rate;
+	double outside = (offset + signal / 2 - bandwidth / 2) / signal;
+	if (outside >= 1) return -1;
+	double penalty = outside > 0 ? -20 * log10(1 - outside) : 0;
+	// Noise in the geometric mean of the filter and the data rate. Within 3dB of the
+	// sensitivity in the datasheet from 1.2 to 250 kBaud with a noise figure of 10dB.
+	double noise = -174 + 5 * log10(bandwidth * rate) + config.noise_figure;
+	double margin = rssi - penalty - noise - SNR_DB;
+	return 1 / (1 + pow(10, margin / 1.5));
+}
+
+// Strongest packet of another node on air at the receiver. Returns -999 if none.
+static int interference(int receiver, int except, int64_t now_ns)
+{
+	int strongest = -999;
+	for (int i=0;i<onair_count;i++) {
+		ONAIR_t *p = &onair[i];
+		if (p->from == receiver || p->from == except) continue;
+		if (p->start_ns > now_ns || p->end_ns <= now_ns) continue;
+		int rssi = link_rssi(p->from, receiver) + p->power - MEDIUM_RESET_POWER;
+		if (rssi > strongest) strongest = rssi;
+	}
+	return strongest;
+}
+
+static void add_onair(int from, int power, int64_t start_ns, int64_t end_ns)
+{
+	// Forget the packets that ended before this one
+	int n = 0;
+	for (int i=0;i<onair_count;i++) {
+		if (onair[i].end_ns > start_ns) onair[n++] = onair[i];
+	}
+	onair_count = n;
+	if (onair_count == onair_size) {
+		onair_size = onair_size ? onair_size * 2 : 16;
+		onair = realloc(onair, onair_size * sizeof(ONAIR_t));
+	}
+	onair[onair_count++] = (ONAIR_t){from, power, start_ns, end_ns};
+}
+
+static void on_transmit(CC1101_MODEL_t *model, const MODEL_FRAME_t *frame, void *ctx)
+{
+	NODE_t *sender = ctx;
+	int64_t start = frame->start_ns;
+	stats.packets++;
+	stats.airtime_ns += frame->end_ns - start;
+	if (frame->end_ns > busy_until) {
+		stats.busy_ns += frame->end_ns - (start > busy_until ? start : busy_until);
+		busy_until = frame->end_ns;
+	}
+
+	for (int i=0;i<node_count;i++) {
+		NODE_t *node = nodes[i];
+		if (node == sender || node->exited) continue;
+		int rssi = link_rssi(sender->id, node->id) + frame->power - MEDIUM_RESET_POWER;
+		if (rssi < -128) rssi = -128;
+		CC1101_MODEL_t *receiver = &node->model;
+		if (receiver->rx_active) {
+			// Already receiving a packet
+			if (node->rx_rssi - rssi < config.capture_db) cc1101_model_corrupt(receiver);
+			node->stats.collisions++;
+			continue;
+		}
+		if (config.loss > 0 && medium_random() < config.loss * 4294967296.0) {
+			node->stats.losses++;
+			continue;
+		}
+		bool crc_ok = true;
+		if (config.noise_figure > 0 && frame->frequency == cc1101_model_frequency(receiver)) {
+			double error = link_error(receiver, frame, rssi);
+			if (error < 0) {
+				node->stats.faded++;
+				continue;
+			}
+			if (medium_random() < error * 4294967295.0) {
+				crc_ok = false;
+				node->stats.faded++;
+			}
+		}
+		int other = interference(node->id, sender->id, start);
+		if (crc_ok && other != -999 && rssi - other < config.capture_db) {
+			crc_ok = false;
+			node->stats.collisions++;
+		}
+		// Lower LQI is better
+		int lqi = -40 - rssi;
+		if (lqi < 0) lqi = 0;
+		if (lqi > 127) lqi = 127;
+		uint32_t missed = receiver->frames_lost;
+		if (cc1101_model_receive(receiver, frame, rssi, lqi, crc_ok)) node->rx_rssi = rssi;
+		node->stats.missed += receiver->frames_lost - missed;
+	}
+	add_onair(sender->id, frame->power, start, frame->end_ns);
+	horizon_valid = false;
+}
+
+static bool carrier(NODE_t *node, int64_t now_ns)
+{
+	return interference(node->id, -1, now_ns) != -999;
+}
+
+static int64_t next_time(NODE_t *node)
+{
+	if (node->exited) return INT64_MAX;
+	if (node->notify_wait && node->tcb.notify) return node->model.now_ns;
+	int64_t next = node->wake_ns;
+	int64_t event = cc1101_model_next_event(&node->model);
+	if (event < next) next = event;
+	if (next < node->model.now_ns) next = node->model.now_ns;
+	return next;
+}
+
+static bool tx_pending(const CC1101_MODEL_t *model)
+{
+	return model->state_end_ns && model->next_state == MODEL_TX;
+}
+
+static void update_horizon(NODE_t *node)
+{
+	if (horizon_valid) return;
+	horizon = INT64_MAX;
+	tx_horizon = INT64_MAX;
+	for (int i=0;i<node_count;i++) {
+		if (nodes[i] == node || nodes[i]->exited) continue;
+		int64_t next = next_time(nodes[i]);
+		if (next < horizon) horizon = next;
+		int64_t tx = next + MODEL_RXTX_SWITCH_NS;
+		if (tx_pending(&nodes[i]->model) && nodes[i]->model.state_end_ns < tx) tx = nodes[i]->model.state_end_ns;
+		if (tx < tx_horizon) tx_horizon = tx;
+	}
+	horizon_valid = true;
+}
+
+static void advance(NODE_t *node, int64_t now_ns)
+{
+	cc1101_model_advance(&node->model, now_ns);
+	node->model.carrier = carrier(node, node->model.now_ns);
+}
+
+// Give the turn back to the scheduler and wait for the next one
+static void yield(NODE_t *node)
+{
+	pthread_mutex_lock(&lock);
+	running = NULL;
+	pthread_cond_signal(&scheduler_cond);
+	while (running != node) pthread_cond_wait(&node->cond, &lock);
+	pthread_mutex_unlock(&lock);
+	if (stopping) pthread_exit(NULL);
+}
+
+// Wait until until_ns, or a notification when notify is set
+static void medium_wait(int64_t until_ns, bool notify)
+{
+	NODE_t *node = self;
+	CC1101_MODEL_t *model = &node->model;
+	while(1) {
+		if (notify && node->tcb.notify) return;
+		if (model->now_ns >= until_ns) return;
+		int64_t next = cc1101_model_next_event(model);
+		bool tx_start = tx_pending(model) && model->state_end_ns == next;
+		if (next > until_ns) {
+			next = until_ns;
+			tx_start = false;
+		}
+		update_horizon(node);
+		if (next < (tx_start ? horizon : tx_horizon)) {
+			// No packet of another node starts before next
+			advance(node, next);
+			continue;
+		}
+		node->wake_ns = until_ns;
+		node->notify_wait = notify;
+		yield(node);
+		node->wake_ns = INT64_MAX;
+		node->notify_wait = false;
+		advance(node, scheduled_ns);
+	}
+}
+
+// For the HAL: SPI transfers, GPIO reads and delays
+static void hal_wait(int64_t until_ns)
+{
+	medium_wait(until_ns, false);
+}
+
+static void node_exit(void *arg)
+{
+	NODE_t *node = arg;
+	pthread_mutex_lock(&lock);
+	node->exited = true;
+	running = NULL;
+	pthread_cond_signal(&scheduler_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+static void *node_thread(void *arg)
+{
+	NODE_t *node = arg;
+	self = node;
+	cc1101_sim_attach(&node->model);
+	pthread_cleanup_push(node_exit, node);
+	pthread_mutex_lock(&lock);
+	while (running != node) pthread_cond_wait(&node->cond, &lock);
+	pthread_mutex_unlock(&lock);
+	if (stopping == false) {
+		node->wake_ns = INT64_MAX;
+		node->task(node->arg);
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+void medium_init(const MEDIUM_CONFIG_t *_config)
+{
+	for (int i=0;i<node_count;i++) {
+		pthread_cond_destroy(&nodes[i]->cond);
+		free(nodes[i]);
+	}
+	node_count = 0;
+	config = *_config;
+	memset(&stats, 0, sizeof(stats));
+	onair_count = 0;
+	busy_until = 0;
+	random_state = config.seed ? config.seed : 1;
+	stopping = false;
+	running = NULL;
+	cc1101_sim_set_wait(hal_wait);
+}
+
+int medium_add_node(const char *name, medium_task_t task, void *arg)
+{
+	if (node_count >= MEDIUM_NODE_MAX) return -1;
+	NODE_t *node = calloc(1, sizeof(NODE_t));
+	node->id = node_count;
+	snprintf(node->name, sizeof(node->name), "%s", name);
+	node->task = task;
+	node->arg = arg;
+	pthread_cond_init(&node->cond, NULL);
+	cc1101_model_init(&node->model);
+	node->model.xtal_ppb = medium_node_ppb(node->id);
+	node->model.on_transmit = on_transmit;
+	node->model.ctx = node;
+	nodes[node_count++] = node;
+	return node->id;
+}
+
+// Resume one node and wait until it yields or exits
+static void resume(NODE_t *node)
+{
+	pthread_mutex_lock(&lock);
+	horizon_valid = false;
+	running = node;
+	pthread_cond_signal(&node->cond);
+	while (running != NULL) pthread_cond_wait(&scheduler_cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+void medium_run(int64_t duration_ns)
+{
+	for (int i=0;i<node_count;i++) {
+		nodes[i]->wake_ns = 0;
+		pthread_create(&nodes[i]->thread, NULL, node_thread, nodes[i]);
+	}
+
+	while(1) {
+		NODE_t *node = NULL;
+		int64_t next = INT64_MAX;
+		for (int i=0;i<node_count;i++) {
+			int64_t t = next_time(nodes[i]);
+			if (t < next) {
+				next = t;
+				node = nodes[i];
+			}
+		}
+		if (node == NULL || next > duration_ns) break;
+		scheduled_ns = next;
+		resume(node);
+	}
+
+	stopping = true;
+	for (int i=0;i<node_count;i++) {
+		if (nodes[i]->exited == false) resume(nodes[i]);
+		pthread_join(nodes[i]->thread, NULL);
+	}
+}
+
+void medium_get_stats(int id, MEDIUM_STATS_t *_stats)
+{
+	*_stats = stats;
+	for (int i=0;i<node_count;i++) {
+		if (id != -1 && id != i) continue;
+		_stats->collisions += nodes[i]->stats.collisions;
+		_stats->losses += nodes[i]->stats.losses;
+		_stats->missed += nodes[i]->stats.missed;
+		_stats->faded += nodes[i]->stats.faded;
+	}
+}
+
+int medium_node_id(void)
+{
+	return self ? self->id : -1;
+}
+
+int64_t medium_now_ns(void)
+{
+	return self ? self->model.now_ns : 0;
+}
+
+// FreeRTOS task functions for the node threads
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+	task->notify++;
+	horizon_valid = false;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait)
+{
+	NODE_t *node = self;
+	if (node->tcb.notify == 0 && xTicksToWait) {
+		int64_t until = INT64_MAX;
+		if (xTicksToWait != portMAX_DELAY) until = (node->model.now_ns / TICK_NS + xTicksToWait) * TICK_NS;
+		medium_wait(until, true);
+	}
+	uint32_t value = node->tcb.notify;
+	if (value) node->tcb.notify = xClearCountOnExit ? 0 : value - 1;
+	return value;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+	return &self->tcb;
+}
+
+// Wakes up on a tick, as FreeRTOS does
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+	NODE_t *node = self;
+	medium_wait((node->model.now_ns / TICK_NS + xTicksToDelay) * TICK_NS, false);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return self->model.now_ns / TICK_NS;
+}
+
+const char *pcTaskGetName(TaskHandle_t task)
+{
+	return self->name;
+}
@@ -0,0 +1,60 @@
+/* Many simulated CC1101 on one radio channel
+ *
+ * Each node is a thread with its own model and its own copy of the driver state.
+ * Only one thread runs at a time, the one with the earliest virtual time,
+ * so a run is repeatable for the same seed.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _CC1101_MEDIUM_H
+#define _CC1101_MEDIUM_H
+
+#include <stdint.h>
+
+#include "cc1101_model.h"
+
+#define MEDIUM_NODE_MAX	128
+#define MEDIUM_RESET_POWER	8		// dBm of the reset PATABLE 0xC6
+
+typedef struct {
+	uint32_t seed;
+	double loss;			// Probability that a receiver misses a packet
+	int capture_db;			// A packet this much stronger than the others survives a collision
+	int rssi_min;			// The RSSI between two nodes is between rssi_min and rssi_max dBm at the reset PATABLE.
+							// A lower PATABLE lowers it by the difference of the output power.
+	int rssi_max;
+	int ppm;				// The crystal of each node is off by up to this much
+	int noise_figure;		// dB. 0 turns off the link budget, and the packets are received at any RSSI and offset.
+} MEDIUM_CONFIG_t;
+
+typedef struct {
+	// The channel
+	uint32_t packets;		// Packets put on air
+	int64_t airtime_ns;		// Sum of the time on air
+	int64_t busy_ns;		// Time with at least one packet on air
+	// The receiver
+	uint32_t collisions;	// Packets corrupted or missed because of another packet
+	uint32_t losses;		// Packets dropped by MEDIUM_CONFIG_t.loss
+	uint32_t missed;		// Packets that arrived while the radio was not in RX
+	uint32_t faded;			// Packets lost or corrupted by noise, or by a frequency offset
+} MEDIUM_STATS_t;
+
+typedef void (*medium_task_t)(void *arg);
+
+void medium_init(const MEDIUM_CONFIG_t *config);
+// Returns the node id
+int medium_add_node(const char *name, medium_task_t task, void *arg);
+// Run the nodes until the virtual time reaches duration_ns, then stop them
+void medium_run(int64_t duration_ns);
+// The channel, and the receiver counts of one node, or of all the nodes when id is -1
+void medium_get_stats(int id, MEDIUM_STATS_t *stats);
+// Node of the calling thread
+int medium_node_id(void);
+int64_t medium_now_ns(void);
+// Crystal error of a node in parts per billion
+int32_t medium_node_ppb(int id);
+// Repeatable random numbers
+uint32_t medium_random(void);
+
+#endif
@@ -0,0 +1,579 @@
+/* Software model of the CC1101 for Linux
+ *
+ * The model follows the datasheet closely enough for the driver in cc1101.c:
+ * - Configuration registers with the reset values, PATABLE and the status registers.
+ * - SPI header byte, single and burst access, and the chip status byte.
+ * - SRES, SRX, STX, SIDLE, SFRX, SFTX and SPWD, with the calibration and RX/TX switch times.
+ * - 64 byte FIFOs, RX FIFO overflow and TX FIFO underflow.
+ * - Packet handling with PKTCTRL0/1: variable length, PKTLEN, address check and APPEND_STATUS.
+ * - GDO0 for IOCFG0=0x06 and 0x46. Other GDO0 settings read as low.
+ * - CCA for MCSM1.CCA_MODE, and RXOFF_MODE/TXOFF_MODE for IDLE and RX.
+ * - FSCTRL0 and the crystal error move the carrier. FREQEST is the offset of the
+ *   received packet from the carrier of the receiver.
+ * - The output power of PATABLE[0].
+ *
+ * The TX FIFO is drained when the packet ends, not byte by byte.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cc1101_model.h"
+
+// Register addresses and strobes from the datasheet
+#define REG_IOCFG0		0x02
+#define REG_SYNC1		0x04
+#define REG_SYNC0		0x05
+#define REG_PKTLEN		0x06
+#define REG_PKTCTRL1	0x07
+#define REG_PKTCTRL0	0x08
+#define REG_ADDR		0x09
+#define REG_CHANNR		0x0A
+#define REG_FSCTRL0		0x0C
+#define REG_FREQ2		0x0D
+#define REG_MDMCFG4		0x10
+#define REG_MDMCFG3		0x11
+#define REG_MDMCFG2		0x12
+#define REG_MDMCFG1		0x13
+#define REG_MDMCFG0		0x14
+#define REG_DEVIATN		0x15
+#define REG_MCSM1		0x17
+#define REG_MCSM0		0x18
+#define REG_FOCCFG		0x19
+#define REG_FREND0		0x22
+
+#define STROBE_SRES		0x30
+#define STROBE_SRX		0x34
+#define STROBE_STX		0x35
+#define STROBE_SIDLE	0x36
+#define STROBE_SPWD		0x39
+#define STROBE_SFRX		0x3A
+#define STROBE_SFTX		0x3B
+
+#define STATUS_PARTNUM		0x30
+#define STATUS_VERSION		0x31
+#define STATUS_FREQEST		0x32
+#define STATUS_LQI			0x33
+#define STATUS_RSSI			0x34
+#define STATUS_MARCSTATE	0x35
+#define STATUS_PKTSTATUS	0x38
+#define STATUS_TXBYTES		0x3A
+#define STATUS_RXBYTES		0x3B
+
+#define ADDR_PATABLE	0x3E
+#define ADDR_FIFO		0x3F
+
+// Times from the datasheet, Table 34
+#define CALIBRATE_NS	799000	// IDLE to RX or TX with FS_AUTOCAL=1
+#define SETTLE_NS		75100	// IDLE to RX or TX without calibration
+#define WAKEUP_NS		150000	// Crystal start after SPWD
+#define RSSI_OFFSET		74
+#define XOSC_HZ			26000000.0
+#define FREQOFF_HZ		(XOSC_HZ / 16384)	// Step of FSCTRL0 and FREQEST
+
+static const uint8_t reset_values[0x2F] = {
+	0x29, 0x2E, 0x3F, 0x07, 0xD3, 0x91, 0xFF, 0x04,	// 0x00
+	0x45, 0x00, 0x00, 0x0F, 0x00, 0x1E, 0xC4, 0xEC,	// 0x08
+	0x8C, 0x22, 0x02, 0x22, 0xF8, 0x47, 0x07, 0x30,	// 0x10
+	0x04, 0x36, 0x6C, 0x03, 0x40, 0x91, 0x87, 0x6B,	// 0x18
+	0xF8, 0x56, 0x10, 0xA9, 0x0A, 0x20, 0x0D, 0x41,	// 0x20
+	0x00, 0x59, 0x7F, 0x3F, 0x88, 0x31, 0x0B,		// 0x28
+};
+
+static void reset_registers(CC1101_MODEL_t *model)
+{
+	memcpy(model->regs, reset_values, sizeof(model->regs));
+	memset(model->patable, 0, sizeof(model->patable));
+	model->patable[0] = 0xC6;
+}
+
+void cc1101_model_init(CC1101_MODEL_t *model)
+{
+	memset(model, 0, sizeof(CC1101_MODEL_t));
+	reset_registers(model);
+	model->marcstate = MODEL_IDLE;
+	model->last_rssi = (uint8_t)((-100 + RSSI_OFFSET) * 2);
+}
+
+// Carrier frequency in Hz from FREQ2-0, CHANNR and the channel spacing
+uint32_t cc1101_model_frequency(const CC1101_MODEL_t *model)
+{
+	uint32_t freq = (model->regs[REG_FREQ2] << 16) | (model->regs[REG_FREQ2 + 1] << 8) | model->regs[REG_FREQ2 + 2];
+	double spacing = (256.0 + model->regs[REG_MDMCFG0]) * (1 << (model->regs[REG_MDMCFG1] & 0x03)) / 4.0;
+	return (freq + model->regs[REG_CHANNR] * spacing) * 26000000.0 / 65536.0;
+}
+
+// Offset of the carrier in Hz from the crystal error and FSCTRL0
+int32_t cc1101_model_offset(const CC1101_MODEL_t *model)
+{
+	double freq = cc1101_model_frequency(model);
+	return freq * model->xtal_ppb / 1e9 + (int8_t)model->regs[REG_FSCTRL0] * FREQOFF_HZ;
+}
+
+double cc1101_model_data_rate(const CC1101_MODEL_t *model)
+{
+	int exponent = model->regs[REG_MDMCFG4] & 0x0F;
+	int mantissa = model->regs[REG_MDMCFG3];
+	return (256.0 + mantissa) * (1 << exponent) * 26000000.0 / (1 << 28);
+}
+
+// Channel filter bandwidth of MDMCFG4
+uint32_t cc1101_model_bandwidth(const CC1101_MODEL_t *model)
+{
+	int exponent = model->regs[REG_MDMCFG4] >> 6;
+	int mantissa = (model->regs[REG_MDMCFG4] >> 4) & 0x03;
+	return XOSC_HZ / (8 * (4 + mantissa) << exponent);
+}
+
+// FSK deviation of DEVIATN
+uint32_t cc1101_model_deviation(const CC1101_MODEL_t *model)
+{
+	int exponent = (model->regs[REG_DEVIATN] >> 4) & 0x07;
+	int mantissa = model->regs[REG_DEVIATN] & 0x07;
+	return XOSC_HZ / 131072 * (8 + mantissa) * (1 << exponent);
+}
+
+// The largest offset the demodulator follows with FOCCFG.FOC_LIMIT
+uint32_t cc1101_model_foc_limit(const CC1101_MODEL_t *model)
+{
+	static const int divider[4] = {0, 8, 4, 2};
+	int limit = model->regs[REG_FOCCFG] & 0x03;
+	return limit ? cc1101_model_bandwidth(model) / divider[limit] : 0;
+}
+
+// Output power in dBm, from the 868MHz table of the datasheet.
+// The PA ends its ramp at the PATABLE entry of FREND0.PA_POWER.
+// 0x00, an entry lost in SLEEP, is about off.
+// Other values count as the reset value 0xC6, which is 8.5dBm.
+int cc1101_model_tx_power(const CC1101_MODEL_t *model)
+{
+	static const struct {
+		uint8_t value;
+		int8_t dbm;
+	} table[] = {
+		{0x03, -30}, {0x0F, -20}, {0x1E, -15}, {0x27, -10}, {0x50, 0},
+		{0x81, 5}, {0xCB, 7}, {0xC2, 10}, {0xC0, 12}, {0x00, -60},
+	};
+	uint8_t value = model->patable[model->regs[REG_FREND0] & 0x07];
+	for (int i=0;i<sizeof(table)/sizeof(table[0]);i++) {
+		if (table[i].value == value) return table[i].dbm;
+	}
+	return 8;
+}
+
+static int64_t bytes_ns(const CC1101_MODEL_t *model, int bytes)
+{
+	return bytes * 8 * 1000000000.0 / cc1101_model_data_rate(model);
+}
+
+// Preamble and sync word in bytes
+static int header_bytes(const CC1101_MODEL_t *model)
+{
+	static const int preamble[8] = {2, 3, 4, 6, 8, 12, 16, 24};
+	static const int sync[8] = {0, 2, 2, 4, 0, 2, 2, 4};
+	return preamble[(model->regs[REG_MDMCFG1] >> 4) & 0x07] + sync[model->regs[REG_MDMCFG2] & 0x07];
+}
+
+// Time on air of a packet with the given number of data bytes
+int64_t cc1101_model_airtime_ns(const CC1101_MODEL_t *model, int bytes)
+{
+	int total = header_bytes(model) + bytes;
+	if ((model->regs[REG_PKTCTRL0] & 0x03) == 0x01) total++;	// Length byte
+	if (model->regs[REG_PKTCTRL0] & 0x04) total += 2;			// CRC
+	return bytes_ns(model, total);
+}
+
+static void set_gdo0(CC1101_MODEL_t *model, bool level)
+{
+	if (model->gdo0 == level) return;
+	model->gdo0 = level;
+	if (model->on_gdo0) model->on_gdo0(model, cc1101_model_gdo0(model), model->ctx);
+}
+
+int cc1101_model_gdo0(CC1101_MODEL_t *model)
+{
+	uint8_t iocfg0 = model->regs[REG_IOCFG0];
+	if ((iocfg0 & 0x3F) != 0x06) return 0;
+	return model->gdo0 ^ ((iocfg0 >> 6) & 0x01);
+}
+
+// Stop the packet being sent or received
+static void abort_packet(CC1101_MODEL_t *model)
+{
+	model->tx_active = false;
+	model->rx_active = false;
+	model->sync_ns = 0;
+	model->end_ns = 0;
+	set_gdo0(model, false);
+}
+
+static void enter_state(CC1101_MODEL_t *model, uint8_t state, int64_t delay_ns, uint8_t next_state)
+{
+	model->marcstate = state;
+	model->next_state = next_state;
+	model->state_end_ns = delay_ns ? model->now_ns + delay_ns : 0;
+}
+
+// The FIFO status bits of the chip status byte
+static uint8_t status_byte(CC1101_MODEL_t *model, bool read)
+{
+	uint8_t state;
+	switch(model->marcstate) {
+		case MODEL_IDLE: state = 0; break;
+		case MODEL_RX: state = 1; break;
+		case MODEL_TX: state = 2; break;
+		case MODEL_STARTCAL: state = 4; break;
+		case MODEL_RXTX_SWITCH: state = 5; break;
+		case MODEL_RXFIFO_OVERFLOW: state = 6; break;
+		case MODEL_TXFIFO_UNDERFLOW: state = 7; break;
+		default: state = 0; break;
+	}
+	int fifo = read ? model->rxlen : MODEL_FIFO_SIZE - 1 - model->txlen;
+	if (fifo > 15) fifo = 15;
+	if (fifo < 0) fifo = 0;
+	uint8_t chip_rdyn = (model->marcstate == MODEL_SLEEP) ? 0x80 : 0x00;
+	return chip_rdyn | (state << 4) | fifo;
+}
+
+static void start_tx(CC1101_MODEL_t *model)
+{
+	// The packet must be complete in the TX FIFO
+	int length = model->txlen ? model->txfifo[0] + 1 : 0;
+	if (length == 0 || length > model->txlen) {
+		enter_state(model, MODEL_TXFIFO_UNDERFLOW, 0, 0);
+		return;
+	}
+	enter_state(model, MODEL_TX, 0, 0);
+	MODEL_FRAME_t *frame = &model->frame;
+	memcpy(frame->data, model->txfifo, length);
+	frame->length = length;
+	frame->sync[0] = model->regs[REG_SYNC1];
+	frame->sync[1] = model->regs[REG_SYNC0];
+	frame->frequency = cc1101_model_frequency(model);
+	frame->offset = cc1101_model_offset(model);
+	frame->power = cc1101_model_tx_power(model);
+	frame->rate = cc1101_model_data_rate(model);
+	frame->start_ns = model->now_ns;
+	frame->end_ns = model->now_ns + cc1101_model_airtime_ns(model, length - 1);
+	model->tx_active = true;
+	model->sync_ns = model->now_ns + bytes_ns(model, header_bytes(model));
+	model->end_ns = frame->end_ns;
+	model->frames_sent++;
+	if (model->on_transmit) model->on_transmit(model, frame, model->ctx);
+}
+
+static void end_tx(CC1101_MODEL_t *model)
+{
+	// Remove the packet from the TX FIFO
+	int length = model->frame.length;
+	memmove(model->txfifo, model->txfifo + length, model->txlen - length);
+	model->txlen -= length;
+	abort_packet(model);
+	// MCSM1.TXOFF_MODE
+	if ((model->regs[REG_MCSM1] & 0x03) == 0x03) {
+		enter_state(model, MODEL_RXTX_SWITCH, MODEL_RXTX_SWITCH_NS, MODEL_RX);
+	} else {
+		enter_state(model, MODEL_IDLE, 0, 0);
+	}
+}
+
+// The address check of PKTCTRL1.ADR_CHK
+static bool address_ok(CC1101_MODEL_t *model, uint8_t address)
+{
+	uint8_t own = model->regs[REG_ADDR];
+	switch(model->regs[REG_PKTCTRL1] & 0x03) {
+		case 0: return true;
+		case 1: return address == own;
+		case 2: return address == own || address == 0x00;
+		default: return address == own || address == 0x00 || address == 0xFF;
+	}
+}
+
+static void push_rx(CC1101_MODEL_t *model, uint8_t value)
+{
+	if (model->rxlen >= MODEL_FIFO_SIZE) {
+		model->rxoverflow = true;
+		return;
+	}
+	model->rxfifo[model->rxlen++] = value;
+}
+
+static void end_rx(CC1101_MODEL_t *model)
+{
+	bool filtered = model->rx_filtered;
+	const MODEL_FRAME_t *frame = &model->frame;
+	if (filtered == false) {
+		for (int i=0;i<frame->length;i++) push_rx(model, frame->data[i]);
+		if (model->regs[REG_PKTCTRL1] & 0x04) {
+			push_rx(model, model->last_rssi);
+			push_rx(model, model->last_lqi);
+		}
+		model->frames_received++;
+	}
+	abort_packet(model);
+	if (model->rxoverflow) {
+		enter_state(model, MODEL_RXFIFO_OVERFLOW, 0, 0);
+		return;
+	}
+	// A filtered packet does not end RX
+	if (filtered) return;
+	// MCSM1.RXOFF_MODE
+	if (((model->regs[REG_MCSM1] >> 2) & 0x03) != 0x03) enter_state(model, MODEL_IDLE, 0, 0);
+}
+
+// Time of the next event, or INT64_MAX when nothing is pending
+int64_t cc1101_model_next_event(const CC1101_MODEL_t *model)
+{
+	int64_t next = INT64_MAX;
+	if (model->state_end_ns && model->state_end_ns < next) next = model->state_end_ns;
+	if (model->sync_ns && model->sync_ns < next) next = model->sync_ns;
+	if (model->end_ns && model->end_ns < next) next = model->end_ns;
+	return next;
+}
+
+// Process the events up to now_ns. Callbacks are called at the time of the event.
+void cc1101_model_advance(CC1101_MODEL_t *model, int64_t now_ns)
+{
+	while(1) {
+		int64_t next = cc1101_model_next_event(model);
+		if (next > now_ns) break;
+		if (next > model->now_ns) model->now_ns = next;
+
+		if (next == model->state_end_ns) {
+			model->state_end_ns = 0;
+			if (model->marcstate == MODEL_SLEEP) {
+				enter_state(model, MODEL_IDLE, 0, 0);
+			} else if (model->next_state == MODEL_TX) {
+				start_tx(model);
+			} else {
+				enter_state(model, model->next_state, 0, 0);
+			}
+		} else if (next == model->sync_ns) {
+			model->sync_ns = 0;
+			set_gdo0(model, true);
+		} else {
+			model->end_ns = 0;
+			if (model->tx_active) {
+				end_tx(model);
+			} else {
+				end_rx(model);
+			}
+		}
+	}
+	if (now_ns > model->now_ns) model->now_ns = now_ns;
+}
+
+// A packet starts on air at frame->start_ns. Advance the model to that time first.
+// Returns false when the radio does not hear it.
+bool cc1101_model_receive(CC1101_MODEL_t *model, const MODEL_FRAME_t *frame, int8_t rssi, uint8_t lqi, bool crc_ok)
+{
+	if (frame->frequency != cc1101_model_frequency(model)) return false;
+	// The demodulator does not find the sync word at another data rate
+	double rate = cc1101_model_data_rate(model);
+	if (frame->rate > rate * 1.1 || frame->rate < rate * 0.9) return false;
+	if (frame->sync[0] != model->regs[REG_SYNC1] || frame->sync[1] != model->regs[REG_SYNC0]) return false;
+
+	// The radio must be in RX when the sync word arrives
+	int64_t sync_ns = frame->start_ns + bytes_ns(model, header_bytes(model));
+	bool listening = (model->marcstate == MODEL_RX)
+		|| (model->state_end_ns && model->next_state == MODEL_RX && model->state_end_ns <= sync_ns);
+	if (listening == false || model->tx_active || model->rx_active) {
+		model->frames_lost++;
+		return false;
+	}
+
+	model->frame = *frame;
+	model->rx_active = true;
+	model->sync_ns = sync_ns;
+	model->end_ns = frame->end_ns;
+	model->rx_filtered = false;
+	model->last_rssi = (uint8_t)((rssi + RSSI_OFFSET) * 2);
+	model->last_lqi = (crc_ok ? 0x80 : 0x00) | (lqi & 0x7F);
+	double freqest = (frame->offset - cc1101_model_offset(model)) / FREQOFF_HZ;
+	if (freqest > 127) freqest = 127;
+	if (freqest < -128) freqest = -128;
+	model->last_freqest = (int8_t)(freqest < 0 ? freqest - 0.5 : freqest + 0.5);
+
+	// Length and address are checked after the first two bytes
+	uint8_t length = frame->data[0];
+	bool filtered = false;
+	if ((model->regs[REG_PKTCTRL0] & 0x03) == 0x01 && length > model->regs[REG_PKTLEN]) filtered = true;
+	if ((model->regs[REG_PKTCTRL1] & 0x03) && (length == 0 || address_ok(model, frame->data[1]) == false)) filtered = true;
+	if (filtered) {
+		model->rx_filtered = true;
+		model->end_ns = sync_ns + bytes_ns(model, 2);
+		model->frames_filtered++;
+	}
+	return true;
+}
+
+// The packet being received collided with another one. It is kept with CRC_OK=0.
+void cc1101_model_corrupt(CC1101_MODEL_t *model)
+{
+	if (model->rx_active) model->last_lqi &= 0x7F;
+}
+
+// Clear channel assessment for MCSM1.CCA_MODE
+static bool channel_clear(CC1101_MODEL_t *model)
+{
+	bool carrier = model->carrier || model->rx_active;
+	switch((model->regs[REG_MCSM1] >> 4) & 0x03) {
+		case 0: return true;
+		case 1: return !carrier;
+		case 2: return !model->rx_active;
+		default: return !carrier && !model->rx_active;
+	}
+}
+
+static void strobe(CC1101_MODEL_t *model, uint8_t command)
+{
+	bool autocal = ((model->regs[REG_MCSM0] >> 4) & 0x03) == 0x01;
+	int64_t settle = autocal ? CALIBRATE_NS : SETTLE_NS;
+	switch(command) {
+		case STROBE_SRES:
+			abort_packet(model);
+			reset_registers(model);
+			model->txlen = model->rxlen = 0;
+			model->rxoverflow = false;
+			enter_state(model, MODEL_IDLE, 0, 0);
+			break;
+		case STROBE_SRX:
+			if (model->marcstate == MODEL_IDLE) {
+				enter_state(model, MODEL_STARTCAL, settle, MODEL_RX);
+			} else if (model->marcstate == MODEL_TX) {
+				abort_packet(model);
+				enter_state(model, MODEL_RXTX_SWITCH, MODEL_RXTX_SWITCH_NS, MODEL_RX);
+			}
+			break;
+		case STROBE_STX:
+			if (model->marcstate == MODEL_IDLE) {
+				enter_state(model, MODEL_STARTCAL, settle, MODEL_TX);
+			} else if (model->marcstate == MODEL_RX && channel_clear(model)) {
+				abort_packet(model);
+				enter_state(model, MODEL_RXTX_SWITCH, MODEL_RXTX_SWITCH_NS, MODEL_TX);
+			}
+			break;
+		case STROBE_SIDLE:
+			abort_packet(model);
+			enter_state(model, MODEL_IDLE, 0, 0);
+			break;
+		case STROBE_SPWD:
+			// Takes effect when CSn goes high
+			if (model->marcstate == MODEL_IDLE) model->power_down = true;
+			break;
+		case STROBE_SFRX:
+			if (model->marcstate == MODEL_IDLE || model->marcstate == MODEL_RXFIFO_OVERFLOW) {
+				model->rxlen = 0;
+				model->rxoverflow = false;
+				enter_state(model, MODEL_IDLE, 0, 0);
+			}
+			break;
+		case STROBE_SFTX:
+			if (model->marcstate == MODEL_IDLE || model->marcstate == MODEL_TXFIFO_UNDERFLOW) {
+				model->txlen = 0;
+				enter_state(model, MODEL_IDLE, 0, 0);
+			}
+			break;
+	}
+}
+
+static uint8_t read_status(CC1101_MODEL_t *model, uint8_t addr)
+{
+	switch(addr) {
+		case STATUS_PARTNUM: return 0x00;
+		case STATUS_VERSION: return 0x14;
+		case STATUS_FREQEST: return model->last_freqest;
+		case STATUS_LQI: return model->last_lqi;
+		case STATUS_RSSI: return model->last_rssi;
+		case STATUS_MARCSTATE: return model->marcstate;
+		case STATUS_PKTSTATUS:
+			return (model->last_lqi & 0x80) | (model->carrier ? 0x40 : 0) | (channel_clear(model) ? 0x10 : 0)
+				| (model->rx_active && model->gdo0 ? 0x08 : 0) | (cc1101_model_gdo0(model) ? 0x01 : 0);
+		case STATUS_TXBYTES: return (model->marcstate == MODEL_TXFIFO_UNDERFLOW ? 0x80 : 0) | model->txlen;
+		case STATUS_RXBYTES: return (model->rxoverflow ? 0x80 : 0) | model->rxlen;
+		default: return 0x00;
+	}
+}
+
+void cc1101_model_select(CC1101_MODEL_t *model, bool selected)
+{
+	if (selected && !model->selected) {
+		// CSn low wakes the chip up
+		if (model->marcstate == MODEL_SLEEP && model->state_end_ns == 0) {
+			model->state_end_ns = model->now_ns + WAKEUP_NS;
+		}
+	} else if (!selected && model->selected) {
+		if (model->power_down) {
+			model->power_down = false;
+			enter_state(model, MODEL_SLEEP, 0, 0);
+			// Only the first PATABLE entry is kept
+			memset(&model->patable[1], 0, sizeof(model->patable) - 1);
+		}
+	}
+	model->selected = selected;
+	model->spi_count = 0;
+	model->pa_index = 0;
+}
+
+// MISO goes low when the crystal is running
+int cc1101_model_miso(CC1101_MODEL_t *model)
+{
+	if (model->selected == false) return 1;
+	return model->marcstate == MODEL_SLEEP ? 1 : 0;
+}
+
+uint8_t cc1101_model_transfer(CC1101_MODEL_t *model, uint8_t mosi)
+{
+	model->spi_bytes++;
+	if (model->selected == false || model->marcstate == MODEL_SLEEP) return 0xFF;
+
+	if (model->spi_count++ == 0) {
+		// Header byte: R/W, burst and address
+		model->header = mosi;
+		model->addr = mosi & 0x3F;
+		bool read = mosi & 0x80;
+		bool burst = mosi & 0x40;
+		uint8_t status = status_byte(model, read);
+		if (model->addr >= 0x30 && model->addr <= 0x3D && burst == false) {
+			strobe(model, model->addr);
+		}
+		return status;
+	}
+
+	bool read = model->header & 0x80;
+	bool burst = model->header & 0x40;
+	uint8_t addr = model->addr;
+	uint8_t miso = status_byte(model, read);
+	if (addr == ADDR_FIFO) {
+		if (read) {
+			if (model->rxlen) {
+				miso = model->rxfifo[0];
+				memmove(model->rxfifo, model->rxfifo + 1, --model->rxlen);
+			} else {
+				miso = 0;
+			}
+		} else if (model->txlen < MODEL_FIFO_SIZE) {
+			model->txfifo[model->txlen++] = mosi;
+		}
+	} else if (addr == ADDR_PATABLE) {
+		if (read) {
+			miso = model->patable[model->pa_index];
+		} else {
+			model->patable[model->pa_index] = mosi;
+		}
+		model->pa_index = (model->pa_index + 1) & 0x07;
+	} else if (addr >= 0x30) {
+		// Status registers are read with the burst bit set
+		if (read && burst) miso = read_status(model, addr);
+	} else if (addr <= 0x2E) {
+		if (read) {
+			miso = model->regs[addr];
+		} else {
+			model->regs[addr] = mosi;
+		}
+		if (burst && model->addr < 0x2E) model->addr++;
+	}
+	return miso;
+}
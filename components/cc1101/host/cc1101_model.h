@@ -0,0 +1,110 @@
+/* Software model of the CC1101 for Linux
+ *
+ * Covers the registers, command strobes, FIFOs, MARCSTATE and
+ * GDO0 with IOCFG0=0x06 (asserts on sync word, de-asserts at the end of the packet).
+ * The carrier is off by the crystal error and FSCTRL0, and FREQEST reports
+ * the offset of the received packet. The output power follows PATABLE[0].
+ * The time is given by the caller in nanoseconds.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _CC1101_MODEL_H
+#define _CC1101_MODEL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MODEL_FIFO_SIZE		64
+#define MODEL_RXTX_SWITCH_NS	31000	// The shortest time from a strobe to a packet on air
+#define MODEL_FRAME_MAX		256
+
+// MARCSTATE
+#define MODEL_SLEEP				0x00
+#define MODEL_IDLE				0x01
+#define MODEL_STARTCAL			0x08
+#define MODEL_RX				0x0D
+#define MODEL_RXFIFO_OVERFLOW	0x11
+#define MODEL_TX				0x13
+#define MODEL_RXTX_SWITCH		0x15
+#define MODEL_TXFIFO_UNDERFLOW	0x16
+
+typedef struct CC1101_MODEL CC1101_MODEL_t;
+
+typedef struct {
+	uint8_t data[MODEL_FRAME_MAX];	// Length byte and data as written to the TX FIFO
+	int length;
+	uint8_t sync[2];
+	uint32_t frequency;		// FREQ and CHANNR registers
+	int32_t offset;			// Hz. The carrier is off frequency by this much.
+	int power;				// dBm, from PATABLE[0]
+	double rate;			// Data rate in bps
+	int64_t start_ns;		// Start of the preamble
+	int64_t end_ns;			// End of the packet
+} MODEL_FRAME_t;
+
+struct CC1101_MODEL {
+	uint8_t regs[0x2F];
+	uint8_t patable[8];
+	uint8_t marcstate;
+	uint8_t next_state;			// State after calibration or RX/TX switch
+	int64_t now_ns;
+	int64_t state_end_ns;		// End of calibration, RX/TX switch or wake up. 0 if none.
+	uint8_t txfifo[MODEL_FIFO_SIZE];
+	int txlen;
+	bool txunderflow;
+	uint8_t rxfifo[MODEL_FIFO_SIZE];
+	int rxlen;
+	bool rxoverflow;
+	bool gdo0;					// Level before IOCFG0.GDO0_INV
+	bool carrier;				// Set by the caller when another radio is on air
+	// Packet being sent or received
+	bool tx_active;
+	bool rx_active;
+	bool rx_filtered;			// Dropped by the length or address check
+	MODEL_FRAME_t frame;
+	int64_t sync_ns;			// GDO0 asserts. 0 if none.
+	int64_t end_ns;				// GDO0 de-asserts. 0 if none.
+	uint8_t last_rssi;			// RSSI status register
+	uint8_t last_lqi;			// LQI status register with CRC_OK
+	uint8_t last_freqest;		// FREQEST status register
+	int32_t xtal_ppb;			// Set by the caller. Error of the crystal in parts per billion.
+	// SPI
+	bool selected;
+	int spi_count;
+	uint8_t header;
+	uint8_t addr;
+	int pa_index;
+	bool power_down;
+	// Statistics
+	uint32_t spi_bytes;
+	uint32_t frames_sent;
+	uint32_t frames_received;
+	uint32_t frames_lost;		// Arrived while not in RX
+	uint32_t frames_filtered;	// Dropped by the length or address check
+	// Called when a frame starts on air
+	void (*on_transmit)(CC1101_MODEL_t *model, const MODEL_FRAME_t *frame, void *ctx);
+	// Called when GDO0 changes
+	void (*on_gdo0)(CC1101_MODEL_t *model, int level, void *ctx);
+	void *ctx;
+};
+
+void cc1101_model_init(CC1101_MODEL_t *model);
+void cc1101_model_advance(CC1101_MODEL_t *model, int64_t now_ns);
+int64_t cc1101_model_next_event(const CC1101_MODEL_t *model);
+void cc1101_model_select(CC1101_MODEL_t *model, bool selected);
+uint8_t cc1101_model_transfer(CC1101_MODEL_t *model, uint8_t mosi);
+int cc1101_model_miso(CC1101_MODEL_t *model);
+int cc1101_model_gdo0(CC1101_MODEL_t *model);
+uint32_t cc1101_model_frequency(const CC1101_MODEL_t *model);
+int64_t cc1101_model_airtime_ns(const CC1101_MODEL_t *model, int bytes);
+int32_t cc1101_model_offset(const CC1101_MODEL_t *model);
+double cc1101_model_data_rate(const CC1101_MODEL_t *model);
+uint32_t cc1101_model_bandwidth(const CC1101_MODEL_t *model);
+uint32_t cc1101_model_deviation(const CC1101_MODEL_t *model);
+uint32_t cc1101_model_foc_limit(const CC1101_MODEL_t *model);
+int cc1101_model_tx_power(const CC1101_MODEL_t *model);
+bool cc1101_model_receive(CC1101_MODEL_t *model, const MODEL_FRAME_t *frame, int8_t rssi, uint8_t lqi, bool crc_ok);
+void cc1101_model_corrupt(CC1101_MODEL_t *model);
+
+#endif
@@ -0,0 +1,662 @@
+/* Many nodes with the cc1101 driver on one simulated channel
+ *
+ * Each node runs the driver and the task of an example on its own simulated CC1101:
+ * - basic:    The sensors run tx_task of basic. The gateway runs rx_task of basic,
+ *             which polls packet_available() every tick.
+ * - bridge:   The sensors run tx_task of basic. The gateway runs the radio task of the bridge,
+ *             woken by the GDO0 interrupt, and sends a downlink packet every -D ms.
+ * - pingpong: The nodes run primary_task of PingPong. One node runs secondary_task.
+ * - afc:      The sensors send a packet to the gateway and wait for its reply, as the primary of PingPong.
+ *             With -a, the gateway tracks the frequency offset of each sensor with components/afc.
+ *             Use it with -x and -f, so that the offsets and the channel filter matter.
+ * - adapt:    Links of a primary and a secondary. The primary sends a packet and waits for the reply,
+ *             which carries the RSSI and the LQI of the packet. With -a, the primary picks the speed
+ *             and the output power with components/linkadapt. Use it with -f, so that the RSSI matters.
+ *             With -P, linkadapt uses only the power levels of setTxPowerAmp().
+ * The run is repeated for each node count given with -n, and reports:
+ * - The packet delivery ratio. For pingpong, the ratio of pings answered.
+ * - The latency from sendData() to receiveData() on the gateway. For pingpong, the round trip time.
+ * - The channel utilization (sum of the airtime, and the time with a packet on air).
+ * - sendData() failures, and the packets the gateway lost to collisions, to -l and while not in RX.
+ *
+ * Build and run on Linux:
+ * gcc -O2 -pthread -Iinclude -I.. -I../../afc -I../../linkadapt -D'CC1101_STATE=static __thread' -DLOG_LOCAL_LEVEL=ESP_LOG_WARN \
+ *   -o cc1101_netsim cc1101_netsim.c cc1101_medium.c cc1101_model.c cc1101_hal_sim.c ../cc1101.c \
+ *   ../../afc/afc.c ../../linkadapt/linkadapt.c -lm
+ * ./cc1101_netsim -s basic -n 1,2,5,10,20,50
+ * ./cc1101_netsim -s afc -n 10 -x 20 -f 10 -a
+ * ./cc1101_netsim -s adapt -n 5 -b 4800 -f 10 -a
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "cc1101.h"
+#include "cc1101_medium.h"
+#include "afc.h"
+#include "linkadapt.h"
+
+typedef enum {
+	SCENARIO_BASIC,
+	SCENARIO_BRIDGE,
+	SCENARIO_PINGPONG,
+	SCENARIO_AFC,
+	SCENARIO_ADAPT,
+} SCENARIO_t;
+
+static SCENARIO_t scenario = SCENARIO_BASIC;
+static int period_ms = 1000;
+static int jitter_ms = 0;
+static int downlink_ms = 5000;
+static int seconds = 60;
+static uint8_t speed = CSPEED_38400;
+static bool enabled = false;	// -a: components/afc for afc, components/linkadapt for adapt
+static uint32_t bandwidth = 0;	// afc: Channel filter of the sensors in Hz. 0 keeps the one of the working mode.
+
+// Results of one run
+static int seq_max;
+static int64_t *sent_ns;		// [node][seq] Time of sendData(), 0 if not sent
+static bool *delivered;			// [node][seq]
+static int64_t *latencies;
+static int latency_count;
+static uint32_t sent;
+static uint32_t send_failures;	// sendData() returned false, as when CCA finds the channel busy
+static uint32_t crc_errors;
+static uint32_t wrong_replies;	// pingpong: a reply to another node
+static bool *uplinked;			// afc: [node][seq] Received by the gateway
+static uint32_t replies;		// afc: Replies sent by the gateway
+static AFC_STATUS_t afc_status;	// afc: Of the gateway at the end of the run
+static uint32_t tx_modes[CSPEED_LAST];	// adapt: Packets of the primaries at each speed
+static uint32_t tx_powers[CC1101_POWER_STEPS];	// adapt: and at each step of setTxPower()
+static bool power_levels = false;	// -P: linkadapt uses only the power levels
+
+static void add_latency(int64_t ns)
+{
+	if (latency_count < seq_max * MEDIUM_NODE_MAX) latencies[latency_count++] = ns;
+}
+
+// The radio setup of app_main of basic and PingPong
+static void radio_init(void)
+{
+	if (init(CFREQ_868, speed) != ESP_OK) {
+		ESP_LOGE(pcTaskGetName(NULL), "CC1101 not installed");
+		vTaskDelete(NULL);
+	}
+	uint8_t syncWord[2] = {199, 10};
+	setSyncWordArray(syncWord);
+	setChannel(0);
+	disableAddressCheck();
+}
+
+// Nodes do not boot at the same time
+static void boot_delay(void)
+{
+	vTaskDelay(pdMS_TO_TICKS(medium_random() % (period_ms + 1)));
+}
+
+static void send_delay(void)
+{
+	int ms = period_ms;
+	if (jitter_ms) ms += medium_random() % (jitter_ms + 1);
+	vTaskDelay(ms/portTICK_PERIOD_MS);
+}
+
+// tx_task of basic. The packet carries the node and the sequence number.
+static void sensor_task(void *arg)
+{
+	radio_init();
+	boot_delay();
+	int id = medium_node_id();
+	CCPACKET packet;
+	for (int seq=0;seq<seq_max;seq++) {
+		packet.length = sprintf((char *)packet.data, "%03d %06d Hello World %u", id, seq, (unsigned)xTaskGetTickCount());
+		sent_ns[id * seq_max + seq] = medium_now_ns();
+		sent++;
+		if (sendData(packet) == false) send_failures++;
+		send_delay();
+	}
+	vTaskDelete(NULL);
+}
+
+static void gateway_packet(const CCPACKET *packet)
+{
+	if (!packet->crc_ok) {
+		crc_errors++;
+		return;
+	}
+	int id, seq;
+	if (sscanf((const char *)packet->data, "%d %d", &id, &seq) != 2) return;
+	if (id < 0 || id >= MEDIUM_NODE_MAX || seq < 0 || seq >= seq_max) return;
+	int index = id * seq_max + seq;
+	if (sent_ns[index] == 0 || delivered[index]) return;
+	delivered[index] = true;
+	add_latency(medium_now_ns() - sent_ns[index]);
+}
+
+// rx_task of basic
+static void basic_gateway_task(void *arg)
+{
+	radio_init();
+	CCPACKET packet;
+	while(1) {
+		if(packet_available()) {
+			if (receiveData(&packet) > 0) gateway_packet(&packet);
+		}
+		vTaskDelay(1);
+	}
+}
+
+// The radio task of the bridge, with a downlink packet every downlink_ms
+static void bridge_gateway_task(void *arg)
+{
+	radio_init();
+	CCPACKET packet;
+	TickType_t next_downlink = pdMS_TO_TICKS(downlink_ms);
+	setPacketNotify(xTaskGetCurrentTaskHandle());
+	while(1) {
+		TickType_t now = xTaskGetTickCount();
+		TickType_t wait = pdMS_TO_TICKS(100);
+		if (next_downlink - now < wait) wait = next_downlink - now;
+		ulTaskNotifyTake(pdTRUE, wait);
+		if (packet_available()) {
+			if (receiveData(&packet) > 0) gateway_packet(&packet);
+		}
+		if ((int32_t)(xTaskGetTickCount() - next_downlink) >= 0) {
+			packet.length = sprintf((char *)packet.data, "downlink %u", (unsigned)xTaskGetTickCount());
+			if (sendData(packet) == false) send_failures++;
+			next_downlink += pdMS_TO_TICKS(downlink_ms);
+		}
+	}
+}
+
+// primary_task of PingPong, with the response time in microseconds
+static void primary_task(void *arg)
+{
+	radio_init();
+	boot_delay();
+	int id = medium_node_id();
+	CCPACKET packet_sent;
+	CCPACKET packet_recv;
+	for (int seq=0;seq<seq_max;seq++) {
+		packet_sent.length = sprintf((char *)packet_sent.data, "%03d %06d Hello World", id, seq);
+		int64_t start = medium_now_ns();
+		sent_ns[id * seq_max + seq] = start;
+		sent++;
+		if (sendData(packet_sent) == false) send_failures++;
+
+		// Wait for a response from the other party
+		bool waiting = true;
+		TickType_t startTick = xTaskGetTickCount();
+		while(waiting) {
+			if(packet_available()) {
+				if (receiveData(&packet_recv) > 0) {
+					if (!packet_recv.crc_ok) {
+						crc_errors++;
+					} else if (packet_recv.length == packet_sent.length
+						&& strncasecmp((char *)packet_recv.data, (char *)packet_sent.data, packet_sent.length) == 0) {
+						delivered[id * seq_max + seq] = true;
+						add_latency(medium_now_ns() - start);
+						waiting = false;
+					} else {
+						// The ping or the reply of another node
+						wrong_replies++;
+					}
+				}
+			}
+			TickType_t diffTick = xTaskGetTickCount() - startTick;
+			if (diffTick > 100) waiting = false;
+			if (waiting) vTaskDelay(1);
+		}
+		send_delay();
+	}
+	vTaskDelete(NULL);
+}
+
+// afc: The first two bytes are the destination and the source. The gateway is node 0.
+static void afc_sensor_task(void *arg)
+{
+	radio_init();
+	if (bandwidth) setRxBandwidth(bandwidth);
+	boot_delay();
+	int id = medium_node_id();
+	CCPACKET packet;
+	for (int seq=0;seq<seq_max;seq++) {
+		packet.data[0] = 0;
+		packet.data[1] = id;
+		packet.length = 2 + sprintf((char *)&packet.data[2], "%06d Hello World", seq);
+		int64_t start = medium_now_ns();
+		sent_ns[id * seq_max + seq] = start;
+		sent++;
+		if (sendData(packet) == false) send_failures++;
+
+		TickType_t startTick = xTaskGetTickCount();
+		while(xTaskGetTickCount() - startTick <= 100) {
+			if (packet_available() && receiveData(&packet) > 0) {
+				if (!packet.crc_ok) {
+					crc_errors++;
+				} else if (packet.data[0] == id && atoi((char *)&packet.data[2]) == seq) {
+					delivered[id * seq_max + seq] = true;
+					add_latency(medium_now_ns() - start);
+					break;
+				}
+			}
+			vTaskDelay(1);
+		}
+		send_delay();
+	}
+	vTaskDelete(NULL);
+}
+
+static void afc_gateway_task(void *arg)
+{
+	radio_init();
+	afc_init();
+	CCPACKET packet;
+	uint32_t updates = 0;
+	setPacketNotify(xTaskGetCurrentTaskHandle());
+	while(1) {
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+		afc_get_status(&afc_status);
+		if (packet_available() == false || receiveData(&packet) == 0) continue;
+		if (!packet.crc_ok) {
+			crc_errors++;
+			continue;
+		}
+		int node = packet.data[1];
+		int seq = atoi((char *)&packet.data[2]);
+		if (packet.data[0] != 0 || node < 1 || node >= MEDIUM_NODE_MAX || seq < 0 || seq >= seq_max) continue;
+		uplinked[node * seq_max + seq] = true;
+		if (enabled) {
+			afc_update(node, &packet);
+			if (++updates % 8 == 0) afc_adjust_rx();
+		}
+		// The reply
+		packet.data[0] = node;
+		packet.data[1] = 0;
+		if (enabled) afc_tx_begin(node);
+		if (sendData(packet) == false) send_failures++;
+		if (enabled) afc_tx_end();
+		replies++;
+	}
+}
+
+// Get signal strength indicator in dBm.
+static int rssi_dbm(uint8_t raw)
+{
+	int rssi_offset = 74;
+	if (raw >= 128) return ((int)(raw - 256) / 2) - rssi_offset;
+	return (raw / 2) - rssi_offset;
+}
+
+// Step of setTxPower() of an output power
+static int power_step(int8_t dbm)
+{
+	int step = 0;
+	for (int i=1;i<CC1101_POWER_STEPS;i++) {
+		if (getTxPowerStep(i) <= dbm) step = i;
+	}
+	return step;
+}
+
+// adapt: data[0] and data[1] are the destination and the source. The secondary of the link is id - 1.
+// The primary tells the speed to switch to after the reply, and the output power of the reply.
+// The secondary sends back the RSSI and the LQI of the packet.
+#define ADAPT_MODE		2
+#define ADAPT_POWER		3
+#define ADAPT_RSSI		4
+#define ADAPT_LQI		5
+#define ADAPT_HEADER	6
+
+static void adapt_primary_task(void *arg)
+{
+	radio_init();
+	int8_t power = setTxPower(INT8_MAX, false);
+	boot_delay();
+	int id = medium_node_id();
+	int peer = id - 1;
+	uint8_t mode = speed;
+	CCPACKET packet;
+	for (int seq=0;seq<seq_max;seq++) {
+		uint8_t next_mode = speed;
+		int8_t next_power = power;
+		if (enabled) linkadapt_get(peer, &next_mode, &next_power);
+		// Nothing is written when the power is the same
+		power = setTxPower(next_power, false);
+		packet.data[0] = peer;
+		packet.data[1] = id;
+		packet.data[ADAPT_MODE] = next_mode;
+		packet.data[ADAPT_POWER] = power;
+		packet.data[ADAPT_RSSI] = 0;
+		packet.data[ADAPT_LQI] = 0;
+		packet.length = ADAPT_HEADER + sprintf((char *)&packet.data[ADAPT_HEADER], "%06d Hello World", seq);
+		int64_t start = medium_now_ns();
+		sent_ns[id * seq_max + seq] = start;
+		sent++;
+		tx_modes[mode]++;
+		tx_powers[power_step(power)]++;
+		if (sendData(packet) == false) send_failures++;
+
+		bool replied = false;
+		TickType_t startTick = xTaskGetTickCount();
+		while(xTaskGetTickCount() - startTick <= 100) {
+			if (packet_available() && receiveData(&packet) > 0) {
+				if (!packet.crc_ok) {
+					crc_errors++;
+				} else if (packet.data[0] == id && atoi((char *)&packet.data[ADAPT_HEADER]) == seq) {
+					delivered[id * seq_max + seq] = true;
+					add_latency(medium_now_ns() - start);
+					replied = true;
+					break;
+				}
+			}
+			vTaskDelay(1);
+		}
+		if (replied) {
+			if (enabled) linkadapt_report(peer, packet.data[ADAPT_RSSI], packet.data[ADAPT_LQI]);
+			// The secondary switched after the reply
+			if (next_mode != mode) {
+				mode = next_mode;
+				setSpeed(mode);
+			}
+		} else if (enabled && linkadapt_lost(peer)) {
+			// The secondary falls back by itself
+			if (mode != speed) {
+				mode = speed;
+				setSpeed(mode);
+			}
+		}
+		send_delay();
+	}
+	vTaskDelete(NULL);
+}
+
+// Goes back to the base speed when no packet arrives for 2.5 periods,
+// so that two lost packets of the primary bring both sides back together.
+static void adapt_secondary_task(void *arg)
+{
+	radio_init();
+	int8_t maxPower = setTxPower(INT8_MAX, false);
+	int id = medium_node_id();
+	CCPACKET packet;
+	TickType_t lastTick = xTaskGetTickCount();
+	TickType_t timeout = pdMS_TO_TICKS(period_ms * 5 / 2 + jitter_ms);
+	while(1) {
+		if (packet_available() && receiveData(&packet) > 0 && packet.crc_ok
+			&& packet.data[0] == id && packet.data[1] == id + 1 && packet.length > ADAPT_HEADER) {
+			lastTick = xTaskGetTickCount();
+			uint8_t mode = packet.data[ADAPT_MODE];
+			setTxPower((int8_t)packet.data[ADAPT_POWER], false);
+			packet.data[0] = id + 1;
+			packet.data[1] = id;
+			packet.data[ADAPT_RSSI] = rssi_dbm(packet.rssi);
+			packet.data[ADAPT_LQI] = packet.lqi;
+			sendData(packet);
+			if (mode < CSPEED_LAST && mode != getSpeed()) setSpeed(mode);
+		}
+		if (xTaskGetTickCount() - lastTick > timeout) {
+			lastTick = xTaskGetTickCount();
+			if (getSpeed() != speed) setSpeed(speed);
+			setTxPower(maxPower, false);
+		}
+		vTaskDelay(1);
+	}
+}
+
+// secondary_task of PingPong
+static void secondary_task(void *arg)
+{
+	radio_init();
+	CCPACKET packet;
+	while(1) {
+		if(packet_available()) {
+			if (receiveData(&packet) > 0 && packet.crc_ok && packet.length > 0) {
+				for (int i=0;i<packet.length;i++) {
+					if (islower(packet.data[i])) {
+						packet.data[i] = toupper(packet.data[i]);
+					} else {
+						packet.data[i] = tolower(packet.data[i]);
+					}
+				}
+				sendData(packet);
+			}
+		}
+		vTaskDelay(1);
+	}
+}
+
+static int compare(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static double percentile(double p)
+{
+	if (latency_count == 0) return 0;
+	int index = p * (latency_count - 1) + 0.5;
+	return latencies[index] / 1000.0;
+}
+
+static void run(int count, const MEDIUM_CONFIG_t *config)
+{
+	seq_max = seconds * 1000 / period_ms + 1;
+	sent_ns = calloc(MEDIUM_NODE_MAX * seq_max, sizeof(int64_t));
+	delivered = calloc(MEDIUM_NODE_MAX * seq_max, sizeof(bool));
+	latencies = calloc(MEDIUM_NODE_MAX * seq_max, sizeof(int64_t));
+	uplinked = calloc(MEDIUM_NODE_MAX * seq_max, sizeof(bool));
+	latency_count = 0;
+	sent = send_failures = crc_errors = wrong_replies = replies = 0;
+	memset(&afc_status, 0, sizeof(afc_status));
+	memset(tx_modes, 0, sizeof(tx_modes));
+	memset(tx_powers, 0, sizeof(tx_powers));
+	// One state for all the primaries. Each link has its own peer.
+	LINKADAPT_CONFIG_t adapt_config;
+	linkadapt_default_config(&adapt_config);
+	adapt_config.base_mode = speed;
+	adapt_config.power_levels = power_levels;
+	linkadapt_init(&adapt_config);
+
+	medium_init(config);
+	switch(scenario) {
+		case SCENARIO_BASIC:
+			medium_add_node("GATEWAY", basic_gateway_task, NULL);
+			break;
+		case SCENARIO_BRIDGE:
+			medium_add_node("GATEWAY", bridge_gateway_task, NULL);
+			break;
+		case SCENARIO_PINGPONG:
+			medium_add_node("SECONDARY", secondary_task, NULL);
+			break;
+		case SCENARIO_AFC:
+			medium_add_node("GATEWAY", afc_gateway_task, NULL);
+			break;
+		case SCENARIO_ADAPT:
+			break;
+	}
+	for (int i=0;i<count;i++) {
+		if (scenario == SCENARIO_ADAPT) {
+			medium_add_node("SECONDARY", adapt_secondary_task, NULL);
+			medium_add_node("PRIMARY", adapt_primary_task, NULL);
+		} else if (scenario == SCENARIO_AFC) {
+			medium_add_node("SENSOR", afc_sensor_task, NULL);
+		} else {
+			medium_add_node(scenario == SCENARIO_PINGPONG ? "PRIMARY" : "SENSOR",
+				scenario == SCENARIO_PINGPONG ? primary_task : sensor_task, NULL);
+		}
+	}
+	int64_t duration = seconds * 1000000000LL;
+	medium_run(duration);
+
+	// The receiver counts of the gateway or the secondary
+	MEDIUM_STATS_t stats;
+	medium_get_stats(0, &stats);
+	qsort(latencies, latency_count, sizeof(int64_t), compare);
+	if (scenario == SCENARIO_ADAPT) {
+		medium_get_stats(-1, &stats);
+		uint32_t changes = 0;
+		uint32_t fallbacks = 0;
+		for (int i=0;i<count;i++) {
+			LINKADAPT_STATUS_t status;
+			linkadapt_get_status(i * 2, &status);
+			changes += status.changes;
+			fallbacks += status.fallbacks;
+		}
+		uint32_t total = sent ? sent : 1;
+		// Mean output power of the packets
+		double dbm = 0;
+		for (int i=0;i<CC1101_POWER_STEPS;i++) dbm += (double)tx_powers[i] * getTxPowerStep(i) / total;
+		printf("%5d %6u %6d %6.1f%% %6u %6u %6u %5.1f%% %5.1f%% %5.1f%% %5.1f%% %5.1f%% %5.1f%% %5.1f %7u %6u %7.0f\n",
+			count, sent, latency_count, sent ? 100.0 - latency_count * 100.0 / sent : 0,
+			send_failures, stats.collisions, stats.faded, stats.airtime_ns * 100.0 / duration,
+			tx_modes[CSPEED_4800] * 100.0 / total, tx_modes[CSPEED_9600] * 100.0 / total,
+			tx_modes[CSPEED_19200] * 100.0 / total, tx_modes[CSPEED_38400] * 100.0 / total,
+			tx_powers[CC1101_POWER_STEPS - 1] * 100.0 / total, dbm, changes, fallbacks, percentile(0.5));
+		fflush(stdout);
+		free(sent_ns);
+		free(delivered);
+		free(uplinked);
+		free(latencies);
+		return;
+	}
+	if (scenario == SCENARIO_AFC) {
+		// Uplink: sensor to gateway. Downlink: the replies to the packets the gateway received.
+		uint32_t uplinks = 0;
+		for (int i=0;i<MEDIUM_NODE_MAX*seq_max;i++) if (uplinked[i]) uplinks++;
+		printf("%5d %6u %6u %6.1f%% %6u %6u %6.1f%% %6u %6u %6u %6d %6d %4d %4d %7.1f %7.0f\n",
+			count, sent, uplinks, sent ? 100.0 - uplinks * 100.0 / sent : 0,
+			replies, latency_count, replies ? 100.0 - latency_count * 100.0 / replies : 0,
+			send_failures, stats.collisions, stats.faded, afc_status.nodes, afc_status.rx_offset,
+			afc_status.min_offset, afc_status.max_offset,
+			afc_status.bandwidth / 1000.0, percentile(0.5));
+		fflush(stdout);
+		free(sent_ns);
+		free(delivered);
+		free(uplinked);
+		free(latencies);
+		return;
+	}
+	printf("%5d %6u %6d %6.1f%% %6u %6u %6u %6u %6u %5.1f%% %5.1f%% %7.0f %7.0f %7.0f %7.0f",
+		count, sent, latency_count, sent ? latency_count * 100.0 / sent : 0,
+		send_failures, crc_errors, stats.collisions, stats.missed, stats.losses,
+		stats.airtime_ns * 100.0 / duration, stats.busy_ns * 100.0 / duration,
+		percentile(0.5), percentile(0.9), percentile(0.99), percentile(1.0));
+	if (scenario == SCENARIO_PINGPONG) printf(" %6u", wrong_replies);
+	printf("\n");
+	fflush(stdout);
+
+	free(sent_ns);
+	free(delivered);
+	free(uplinked);
+	free(latencies);
+}
+
+int main(int argc, char **argv)
+{
+	MEDIUM_CONFIG_t config = {
+		.seed = 1,
+		.loss = 0,
+		.capture_db = 6,
+		.rssi_min = -95,
+		.rssi_max = -50,
+	};
+	char *counts = "1,2,5,10,20,50";
+
+	int opt;
+	while ((opt = getopt(argc, argv, "s:n:d:p:j:D:l:c:r:b:B:x:f:w:W:aP")) != -1) {
+		switch(opt) {
+			case 's':
+				if (strcmp(optarg, "basic") == 0) {
+					scenario = SCENARIO_BASIC;
+				} else if (strcmp(optarg, "bridge") == 0) {
+					scenario = SCENARIO_BRIDGE;
+				} else if (strcmp(optarg, "pingpong") == 0) {
+					scenario = SCENARIO_PINGPONG;
+				} else if (strcmp(optarg, "afc") == 0) {
+					scenario = SCENARIO_AFC;
+				} else if (strcmp(optarg, "adapt") == 0) {
+					scenario = SCENARIO_ADAPT;
+				} else {
+					printf("Unknown scenario %s\n", optarg);
+					return 2;
+				}
+				break;
+			case 'n': counts = optarg; break;
+			case 'd': seconds = atoi(optarg); break;
+			case 'p': period_ms = atoi(optarg); break;
+			case 'j': jitter_ms = atoi(optarg); break;
+			case 'D': downlink_ms = atoi(optarg); break;
+			case 'l': config.loss = atof(optarg); break;
+			case 'c': config.capture_db = atoi(optarg); break;
+			case 'r': config.seed = atoi(optarg); break;
+			case 'b':
+				switch(atoi(optarg)) {
+					case 4800: speed = CSPEED_4800; break;
+					case 9600: speed = CSPEED_9600; break;
+					case 19200: speed = CSPEED_19200; break;
+					case 38400: speed = CSPEED_38400; break;
+					default:
+						printf("The speed must be 4800, 9600, 19200 or 38400\n");
+						return 2;
+				}
+				break;
+			case 'B': bandwidth = atoi(optarg) * 1000; break;
+			case 'x': config.ppm = atoi(optarg); break;
+			case 'f': config.noise_figure = atoi(optarg); break;
+			case 'w': config.rssi_min = atoi(optarg); break;
+			case 'W': config.rssi_max = atoi(optarg); break;
+			case 'a': enabled = true; break;
+			case 'P': power_levels = true; break;
+			default:
+				printf("usage: %s [-s basic|bridge|pingpong|afc|adapt] [-n node counts] [-d seconds] [-p period ms] [-j jitter ms]\n"
+					"       [-D downlink ms] [-l loss 0-1] [-c capture dB] [-r seed] [-b speed] [-B sensor bandwidth kHz]\n"
+					"       [-x crystal ppm] [-f noise figure dB] [-w weakest RSSI dBm] [-W strongest RSSI dBm] [-a] [-P]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (period_ms <= 0 || seconds <= 0 || downlink_ms <= 0) {
+		printf("-d, -p and -D must be positive\n");
+		return 2;
+	}
+
+	printf("%d seconds, a packet every %dms", seconds, period_ms);
+	if (jitter_ms) printf(" + 0-%dms", jitter_ms);
+	printf(", loss %.1f%%, capture %ddB", config.loss * 100, config.capture_db);
+	if (config.ppm) printf(", crystals +-%dppm", config.ppm);
+	if (config.noise_figure) printf(", noise figure %ddB, RSSI %d to %ddBm", config.noise_figure, config.rssi_min, config.rssi_max);
+	if (scenario == SCENARIO_AFC) printf(", AFC %s", enabled ? "on" : "off");
+	if (scenario == SCENARIO_ADAPT) printf(", link adaptation %s%s", enabled ? "on" : "off", enabled && power_levels ? " with the power levels" : "");
+	printf("\n");
+	if (scenario == SCENARIO_ADAPT) {
+		printf("links   sent  deliv     PER  fails collis  faded   util   4800   9600  19200  38400    max   dBm changes fallbk  p50 us\n");
+	} else if (scenario == SCENARIO_AFC) {
+		printf("nodes   sent uplink  upPER  reply  downl downPER  fails collis  faded  known rxoff  min  max  bw kHz  p50 us\n");
+	} else {
+		printf("nodes   sent  deliv    PDR  fails crcerr collis missed   loss  util  busy  p50 us  p90 us  p99 us  max us%s\n",
+			scenario == SCENARIO_PINGPONG ? "  wrong" : "");
+	}
+	char *list = strdup(counts);
+	for (char *p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+		int count = atoi(p);
+		if (count < 1 || count >= MEDIUM_NODE_MAX) {
+			printf("The node count must be 1-%d\n", MEDIUM_NODE_MAX - 1);
+			return 2;
+		}
+		if (scenario == SCENARIO_ADAPT && count * 2 > MEDIUM_NODE_MAX) {
+			printf("The link count must be 1-%d\n", MEDIUM_NODE_MAX / 2);
+			return 2;
+		}
+		run(count, &config);
+	}
+	free(list);
+	return 0;
+}
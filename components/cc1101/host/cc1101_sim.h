@@ -0,0 +1,38 @@
+/* Simulated hardware for the cc1101 driver on Linux
+ *
+ * cc1101_hal_sim.c connects the driver to a CC1101_MODEL_t.
+ * Time is virtual. SPI transfers, GPIO reads and delays move the clock forward,
+ * so the timing of the driver can be measured without the hardware.
+ * Each thread drives its own model. cc1101_medium.c runs many of them on one channel.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _CC1101_SIM_H
+#define _CC1101_SIM_H
+
+#include <stdint.h>
+
+#include "cc1101_model.h"
+
+typedef struct {
+	int64_t spi_byte_ns;	// One byte on the SPI bus. 1600ns at 5MHz.
+	int64_t spi_call_ns;	// Overhead of spi_device_transmit() for each byte
+	int64_t gpio_ns;		// One gpio_get_level()
+} CC1101_SIM_TIMING_t;
+
+// Moves the clock of the calling thread to until_ns, in place of advancing the model directly
+typedef void (*cc1101_sim_wait_t)(int64_t until_ns);
+
+// The model of the calling thread. A model is created for the first thread that asks.
+CC1101_MODEL_t *cc1101_sim_model(void);
+// Drive another model from the calling thread
+void cc1101_sim_attach(CC1101_MODEL_t *model);
+void cc1101_sim_set_wait(cc1101_sim_wait_t wait);
+void cc1101_sim_set_timing(const CC1101_SIM_TIMING_t *timing);
+int64_t cc1101_sim_now_ns(void);
+// Let time pass, as vTaskDelay() does. The GDO0 interrupt is called on the way.
+void cc1101_sim_advance(int64_t ns);
+uint32_t cc1101_sim_spi_calls(void);
+
+#endif
@@ -0,0 +1,8 @@
+/* esp_attr.h for the host build */
+
+#ifndef _HOST_ESP_ATTR_H
+#define _HOST_ESP_ATTR_H
+
+#define IRAM_ATTR
+
+#endif
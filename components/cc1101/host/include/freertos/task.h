@@ -0,0 +1,28 @@
+/* task.h for the host build
+ *
+ * A task is a counter of notifications. The driver only gives notifications.
+ * The other functions are implemented by cc1101_medium.c, with one task for each node.
+ */
+
+#ifndef _HOST_TASK_H
+#define _HOST_TASK_H
+
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct tskTaskControlBlock {
+	uint32_t notify;
+} *TaskHandle_t;
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *pxHigherPriorityTaskWoken);
+void xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t xClearCountOnExit, TickType_t xTicksToWait);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+void vTaskDelay(TickType_t xTicksToDelay);
+TickType_t xTaskGetTickCount(void);
+const char *pcTaskGetName(TaskHandle_t task);
+
+#define vTaskDelete(task) pthread_exit(NULL)
+
+#endif
@@ -0,0 +1,214 @@
+/* Deferred log
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+
+#include "dlog.h"
+
+#if CONFIG_DLOG
+
+static const char *TAG = "DLOG";
+
+// A power of 2, so the index wraps with a mask
+#define DLOG_SIZE ( \
+	CONFIG_DLOG_ENTRIES >= 4096 ? 4096 : CONFIG_DLOG_ENTRIES >= 2048 ? 2048 : \
+	CONFIG_DLOG_ENTRIES >= 1024 ? 1024 : CONFIG_DLOG_ENTRIES >= 512 ? 512 : \
+	CONFIG_DLOG_ENTRIES >= 256 ? 256 : CONFIG_DLOG_ENTRIES >= 128 ? 128 : \
+	CONFIG_DLOG_ENTRIES >= 64 ? 64 : 32)
+
+#define DLOG_POLL_MS 10
+
+typedef enum {
+	DLOG_TYPE_ARGS = 0,
+	DLOG_TYPE_TEXT,
+	DLOG_TYPE_HEX,
+} DLOG_TYPE_t;
+
+typedef struct {
+	uint32_t seq;		// Index + 1 when the entry is complete, 0 while it is written
+	uint32_t time;		// esp_log_timestamp()
+	const char *tag;
+	const char *format;
+	uint8_t level;
+	uint8_t type;
+	uint8_t count;		// Arguments, or bytes of data
+	uint8_t truncated;	// The data was longer than DLOG_MAX_BYTES
+	union {
+		uint32_t args[DLOG_MAX_ARGS];
+		uint8_t data[DLOG_MAX_BYTES];
+	};
+} DLOG_ENTRY_t;
+
+static DLOG_ENTRY_t dlog_ring[DLOG_SIZE];
+static uint32_t dlog_head;		// Index of the next entry
+static uint32_t dlog_tail;		// Index of the first entry not printed yet
+static uint32_t dlog_lost_entries;
+static SemaphoreHandle_t dlog_mutex;
+
+// Claim a slot with one atomic add, like components/trace.
+// Safe from any task and any core.
+static DLOG_ENTRY_t *dlog_claim(uint32_t *index)
+{
+	*index = __atomic_fetch_add(&dlog_head, 1, __ATOMIC_RELAXED);
+	DLOG_ENTRY_t *entry = &dlog_ring[*index & (DLOG_SIZE - 1)];
+	__atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	return entry;
+}
+
+static void dlog_commit(DLOG_ENTRY_t *entry, uint32_t index)
+{
+	__atomic_store_n(&entry->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *format, int count, ...)
+{
+	uint32_t index;
+	DLOG_ENTRY_t *entry = dlog_claim(&index);
+	entry->time = esp_log_timestamp();
+	entry->tag = tag;
+	entry->format = format;
+	entry->level = level;
+	entry->type = DLOG_TYPE_ARGS;
+	entry->count = count;
+	entry->truncated = 0;
+	va_list ap;
+	va_start(ap, count);
+	for (int i=0;i<count;i++) entry->args[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+	dlog_commit(entry, index);
+}
+
+void dlog_write_data(esp_log_level_t level, const char *tag, const char *format, const void *data, size_t length)
+{
+	uint32_t index;
+	DLOG_ENTRY_t *entry = dlog_claim(&index);
+	entry->time = esp_log_timestamp();
+	entry->tag = tag;
+	entry->format = format;
+	entry->level = level;
+	entry->type = format ? DLOG_TYPE_TEXT : DLOG_TYPE_HEX;
+	entry->truncated = length > DLOG_MAX_BYTES;
+	entry->count = entry->truncated ? DLOG_MAX_BYTES : length;
+	memcpy(entry->data, data, entry->count);
+	dlog_commit(entry, index);
+}
+
+static void dlog_print(const DLOG_ENTRY_t *entry)
+{
+	static const char letters[] = "NEWIDV";
+	printf("%c (%"PRIu32") %s: ", letters[entry->level < 6 ? entry->level : 5], entry->time, entry->tag);
+	const uint32_t *a = entry->args;
+	switch (entry->type) {
+	case DLOG_TYPE_ARGS:
+		// Unused arguments are ignored by printf
+		printf(entry->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+		break;
+	case DLOG_TYPE_TEXT:
+		printf(entry->format, (int)entry->count, (const char *)entry->data);
+		break;
+	case DLOG_TYPE_HEX:
+		for (int i=0;i<entry->count;i++) printf("%s%02x", i ? " " : "", entry->data[i]);
+		break;
+	}
+	if (entry->truncated) printf(" ...");
+	printf("\n");
+}
+
+// Print the entries up to the head.
+// Stop at an entry that is still being written, and print it next time.
+static void dlog_drain(void)
+{
+	xSemaphoreTake(dlog_mutex, portMAX_DELAY);
+	uint32_t head = __atomic_load_n(&dlog_head, __ATOMIC_ACQUIRE);
+	uint32_t lost = 0;
+	if (head - dlog_tail > DLOG_SIZE) {
+		lost = head - DLOG_SIZE - dlog_tail;
+		dlog_tail = head - DLOG_SIZE;
+	}
+	while (dlog_tail != head) {
+		const DLOG_ENTRY_t *slot = &dlog_ring[dlog_tail & (DLOG_SIZE - 1)];
+		uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		// Still being written. seq is 0, or from the previous round just after the slot was claimed.
+		if (seq == 0 || (int32_t)(seq - (dlog_tail + 1)) < 0) break;
+		if (seq != dlog_tail + 1) {
+			// Overwritten by a writer that went round the ring
+			lost++;
+			dlog_tail++;
+			continue;
+		}
+		DLOG_ENTRY_t entry = *slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+			lost++;
+		} else {
+			dlog_print(&entry);
+		}
+		dlog_tail++;
+	}
+	if (lost) {
+		dlog_lost_entries += lost;
+		ESP_LOGW(TAG, "%"PRIu32" entries lost. Increase the number of entries", lost);
+	}
+	xSemaphoreGive(dlog_mutex);
+}
+
+static void dlog_task(void *pvParameters)
+{
+	while(1) {
+		dlog_drain();
+		vTaskDelay(pdMS_TO_TICKS(DLOG_POLL_MS));
+	}
+	vTaskDelete(NULL);
+}
+
+esp_err_t dlog_init(void)
+{
+	static TaskHandle_t task;
+	if (task) return ESP_OK;
+	dlog_mutex = xSemaphoreCreateMutex();
+	if (dlog_mutex == NULL) return ESP_ERR_NO_MEM;
+	ESP_LOGI(TAG, "%d entries", DLOG_SIZE);
+	if (xTaskCreate(&dlog_task, "DLOG", 1024*3, NULL, 1, &task) != pdPASS) return ESP_ERR_NO_MEM;
+	return ESP_OK;
+}
+
+void dlog_flush(void)
+{
+	if (dlog_mutex) dlog_drain();
+	fflush(stdout);
+}
+
+uint32_t dlog_lost(void)
+{
+	return dlog_lost_entries;
+}
+
+#else
+
+esp_err_t dlog_init(void)
+{
+	return ESP_OK;
+}
+
+void dlog_flush(void)
+{
+}
+
+uint32_t dlog_lost(void)
+{
+	return 0;
+}
+
+#endif // CONFIG_DLOG
@@ -0,0 +1,79 @@
+/* Deferred log
+ *
+ * DLOGx() records the address of the format string and the raw arguments
+ * in a ring buffer in RAM, which takes well under a microsecond.
+ * A low priority task formats and prints them later, so the UART does not
+ * slow down the task that logs.
+ *
+ * The arguments must be 32 bit or smaller: int, char, pointers.
+ * %s must point to a string that still exists when it is printed, like a string literal.
+ * Use DLOG_TEXT() and DLOG_HEX() for the data of a packet. They copy up to DLOG_MAX_BYTES bytes.
+ * 64 bit integers and floating point are not supported.
+ *
+ * DLOGx() above CONFIG_DLOG_LEVEL compile to nothing.
+ * A file may define DLOG_LOCAL_LEVEL before including this header, like LOG_LOCAL_LEVEL.
+ * When CONFIG_DLOG is disabled, DLOGx() is ESP_LOGx().
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _DLOG_H
+#define _DLOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+#ifndef DLOG_LOCAL_LEVEL
+#define DLOG_LOCAL_LEVEL CONFIG_DLOG_LEVEL
+#endif
+
+#define DLOG_MAX_ARGS 6
+// Enough for the data of a CCPACKET (CCPACKET_DATA_LEN)
+#define DLOG_MAX_BYTES 64
+
+// Number of arguments, 0 to 8
+#define DLOG_NARGS(...) DLOG_NARGS_(0, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, N, ...) N
+
+#if CONFIG_DLOG
+#define DLOG_LEVEL(level, tag, format, ...) do { \
+	_Static_assert(DLOG_NARGS(__VA_ARGS__) <= DLOG_MAX_ARGS, "DLOG takes up to 6 arguments"); \
+	if ((level) <= DLOG_LOCAL_LEVEL) dlog_write((level), (tag), (format), DLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__); \
+} while (0)
+// format has one %.*s for the data
+#define DLOG_TEXT(tag, format, data, length, level) do { \
+	if ((level) <= DLOG_LOCAL_LEVEL) dlog_write_data((level), (tag), (format), (data), (length)); \
+} while (0)
+#define DLOG_HEX(tag, data, length, level) do { \
+	if ((level) <= DLOG_LOCAL_LEVEL) dlog_write_data((level), (tag), NULL, (data), (length)); \
+} while (0)
+#else
+#define DLOG_LEVEL(level, tag, format, ...) do { \
+	if ((level) <= DLOG_LOCAL_LEVEL) ESP_LOG_LEVEL_LOCAL((level), (tag), format, ##__VA_ARGS__); \
+} while (0)
+#define DLOG_TEXT(tag, format, data, length, level) do { \
+	if ((level) <= DLOG_LOCAL_LEVEL) ESP_LOG_LEVEL_LOCAL((level), (tag), format, (int)(length), (const char *)(data)); \
+} while (0)
+#define DLOG_HEX(tag, data, length, level) do { \
+	if ((level) <= DLOG_LOCAL_LEVEL) ESP_LOG_BUFFER_HEX_LEVEL((tag), (data), (length), (level)); \
+} while (0)
+#endif
+
+#define DLOGE(tag, format, ...) DLOG_LEVEL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG_LEVEL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG_LEVEL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG_LEVEL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+
+// Start the task that prints. Entries recorded before wait in the buffer.
+esp_err_t dlog_init(void);
+// Print the waiting entries now, for example before esp_restart()
+void dlog_flush(void);
+// Number of entries overwritten before they were printed
+uint32_t dlog_lost(void);
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *format, int count, ...);
+void dlog_write_data(esp_log_level_t level, const char *tag, const char *format, const void *data, size_t length);
+
+#endif
@@ -0,0 +1,69 @@
+/* Airtime of a CC1101 packet
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+#include "cc1101.h"
+#include "dutycycle.h"
+
+static const char *TAG = "AIRTIME";
+
+#define AIRTIME_XOSC_HZ	26000000ULL
+
+// Read the radio settings from the registers.
+// Must be called from the task that accesses the radio.
+esp_err_t airtime_read_config(AIRTIME_CONFIG_t *config)
+{
+	uint8_t mdmcfg4 = readConfigReg(CC1101_MDMCFG4);
+	uint8_t mdmcfg3 = readConfigReg(CC1101_MDMCFG3);
+	uint8_t mdmcfg2 = readConfigReg(CC1101_MDMCFG2);
+	uint8_t mdmcfg1 = readConfigReg(CC1101_MDMCFG1);
+	uint8_t mdmcfg0 = readConfigReg(CC1101_MDMCFG0);
+	uint8_t pktctrl0 = readConfigReg(CC1101_PKTCTRL0);
+	uint8_t pktlen = readConfigReg(CC1101_PKTLEN);
+	uint8_t channr = readConfigReg(CC1101_CHANNR);
+	uint32_t freq = (readConfigReg(CC1101_FREQ2) << 16) | (readConfigReg(CC1101_FREQ1) << 8) | readConfigReg(CC1101_FREQ0);
+
+	// Data rate = (256 + DRATE_M) * 2^DRATE_E * fXOSC / 2^28
+	config->baud = ((256 + mdmcfg3) << (mdmcfg4 & 0x0F)) * AIRTIME_XOSC_HZ >> 28;
+	if (config->baud == 0) return ESP_ERR_INVALID_STATE;
+	config->bits_per_symbol = ((mdmcfg2 >> 4) & 0x07) == 4 ? 2 : 1;
+	config->manchester = (mdmcfg2 >> 3) & 0x01;
+	static const uint8_t sync_bytes[8] = {0, 2, 2, 4, 0, 2, 2, 4};
+	config->sync_bytes = sync_bytes[mdmcfg2 & 0x07];
+	config->fec = (mdmcfg1 >> 7) & 0x01;
+	static const uint8_t preamble_bytes[8] = {2, 3, 4, 6, 8, 12, 16, 24};
+	config->preamble_bytes = preamble_bytes[(mdmcfg1 >> 4) & 0x07];
+	config->crc = (pktctrl0 >> 2) & 0x01;
+	config->fixed_length = (pktctrl0 & 0x03) == 0 ? pktlen : 0;
+
+	// f = fXOSC / 2^16 * (FREQ + CHAN * (256 + CHANSPC_M) * 2^(CHANSPC_E - 2))
+	uint64_t spacing = (uint64_t)(256 + mdmcfg0) << (mdmcfg1 & 0x03);
+	config->frequency = ((uint64_t)freq * 4 + channr * spacing) * AIRTIME_XOSC_HZ >> 18;
+
+	ESP_LOGI(TAG, "frequency=%"PRIu32"Hz baud=%"PRIu32" preamble=%d sync=%d crc=%d fec=%d manchester=%d",
+		config->frequency, config->baud, config->preamble_bytes, config->sync_bytes,
+		config->crc, config->fec, config->manchester);
+	return ESP_OK;
+}
+
+// Time on air of a packet with length bytes of data, in microseconds.
+uint32_t airtime_us(const AIRTIME_CONFIG_t *config, uint8_t length)
+{
+	uint32_t bytes = config->fixed_length ? config->fixed_length : length + 1;	// Length byte
+	if (config->crc) bytes += 2;
+	if (config->fec) {
+		// Rate 1/2 convolutional code with a trellis termination byte,
+		// interleaved in blocks of 4 bytes
+		bytes = ((bytes + 1) * 2 + 3) / 4 * 4;
+	}
+	uint32_t bits = (config->preamble_bytes + config->sync_bytes + bytes) * 8;
+	if (config->manchester) bits *= 2;
+	uint64_t rate = (uint64_t)config->baud * config->bits_per_symbol;
+	return (bits * 1000000ULL + rate - 1) / rate;
+}
@@ -0,0 +1,177 @@
+/* Duty cycle scheduler
+ *
+ * The window is split into DUTYCYCLE_SLOTS slots. A window that starts in the
+ * middle of a slot covers DUTYCYCLE_SLOTS + 1 slots, so the airtime of a slot is
+ * released only when the whole slot has left the window. The duty cycle over
+ * any window never exceeds the limit.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "dutycycle.h"
+
+static const char *TAG = "DUTYCYCLE";
+
+#define DUTYCYCLE_SLOTS		60
+#define DUTYCYCLE_WINDOW_US	(CONFIG_DUTYCYCLE_WINDOW * 1000000LL)
+#define DUTYCYCLE_SLOT_US	(DUTYCYCLE_WINDOW_US / DUTYCYCLE_SLOTS)
+
+typedef struct {
+	const char *name;
+	uint32_t low;		// Hz
+	uint32_t high;		// Hz
+	uint16_t limit;		// 0.1%
+} DUTYCYCLE_BAND_t;
+
+// ERC Recommendation 70-03 Annex 1, non-specific short range devices
+static const DUTYCYCLE_BAND_t bands[] = {
+	{ "h1.3", 863000000, 865000000, 1 },
+	{ "h1.4", 865000000, 868000000, 10 },
+	{ "h1.5", 868000000, 868600000, 10 },
+	{ "h1.6", 868700000, 869200000, 1 },
+	{ "h1.7", 869400000, 869650000, 100 },
+	{ "h1.8", 869700000, 870000000, 10 },
+	// Gaps between the sub-bands use the lowest limit
+	{ "863-870", 863000000, 870000000, 1 },
+	{ "other", 0, UINT32_MAX, CONFIG_DUTYCYCLE_OTHER_LIMIT },
+};
+
+#define DUTYCYCLE_BANDS	(sizeof(bands) / sizeof(bands[0]))
+
+#define DUTYCYCLE_RING		(DUTYCYCLE_SLOTS + 1)
+
+typedef struct {
+	uint32_t slot[DUTYCYCLE_RING];	// Slot number
+	uint32_t used[DUTYCYCLE_RING];	// Airtime in the slot (us)
+} DUTYCYCLE_USAGE_t;
+
+static DUTYCYCLE_USAGE_t usage[DUTYCYCLE_BANDS];
+static portMUX_TYPE dutycycle_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static int find_band(uint32_t frequency)
+{
+	for (int i=0;i<DUTYCYCLE_BANDS;i++) {
+		if (frequency >= bands[i].low && frequency < bands[i].high) return i;
+	}
+	return DUTYCYCLE_BANDS - 1;
+}
+
+static uint32_t band_budget(int band)
+{
+	return DUTYCYCLE_WINDOW_US * bands[band].limit / 1000;
+}
+
+static bool unlimited(int band)
+{
+	return bands[band].limit >= 1000;
+}
+
+// Must be called with dutycycle_mux taken
+static uint32_t band_used(int band, uint32_t now_slot)
+{
+	uint32_t used = 0;
+	for (int i=0;i<DUTYCYCLE_RING;i++) {
+		if (now_slot - usage[band].slot[i] < DUTYCYCLE_RING) used += usage[band].used[i];
+	}
+	return used;
+}
+
+const char *dutycycle_band_name(uint32_t frequency)
+{
+	return bands[find_band(frequency)].name;
+}
+
+// Airtime allowed in one window
+uint32_t dutycycle_budget_us(uint32_t frequency)
+{
+	int band = find_band(frequency);
+	if (unlimited(band)) return UINT32_MAX;
+	return band_budget(band);
+}
+
+// Airtime that can be used now
+uint32_t dutycycle_remaining_us(uint32_t frequency)
+{
+	int band = find_band(frequency);
+	if (unlimited(band)) return UINT32_MAX;
+	uint32_t now_slot = esp_timer_get_time() / DUTYCYCLE_SLOT_US;
+	taskENTER_CRITICAL(&dutycycle_mux);
+	uint32_t used = band_used(band, now_slot);
+	taskEXIT_CRITICAL(&dutycycle_mux);
+	uint32_t budget = band_budget(band);
+	return used < budget ? budget - used : 0;
+}
+
+// Time until a packet of the airtime can be sent. 0 when it can be sent now.
+// -1 when it never fits in the budget.
+int64_t dutycycle_delay_us(uint32_t frequency, uint32_t airtime)
+{
+	int band = find_band(frequency);
+	if (unlimited(band)) return 0;
+	uint32_t budget = band_budget(band);
+	if (airtime > budget) return -1;
+
+	int64_t now = esp_timer_get_time();
+	uint32_t now_slot = now / DUTYCYCLE_SLOT_US;
+	int64_t delay = 0;
+	taskENTER_CRITICAL(&dutycycle_mux);
+	uint32_t used = band_used(band, now_slot);
+	// Release the oldest slots until the packet fits
+	for (uint32_t age=DUTYCYCLE_RING-1;used + airtime > budget;age--) {
+		uint32_t slot = now_slot - age;
+		int i = slot % DUTYCYCLE_RING;
+		if (usage[band].slot[i] == slot) used -= usage[band].used[i];
+		delay = (int64_t)(uint32_t)(slot + DUTYCYCLE_RING) * DUTYCYCLE_SLOT_US - now;
+	}
+	taskEXIT_CRITICAL(&dutycycle_mux);
+	return delay;
+}
+
+// Account a transmission
+void dutycycle_charge(uint32_t frequency, uint32_t airtime)
+{
+	int band = find_band(frequency);
+	if (unlimited(band)) return;
+	uint32_t now_slot = esp_timer_get_time() / DUTYCYCLE_SLOT_US;
+	int i = now_slot % DUTYCYCLE_RING;
+	taskENTER_CRITICAL(&dutycycle_mux);
+	if (usage[band].slot[i] != now_slot) {
+		usage[band].slot[i] = now_slot;
+		usage[band].used[i] = 0;
+	}
+	usage[band].used[i] += airtime;
+	taskEXIT_CRITICAL(&dutycycle_mux);
+}
+
+// Wait until the packet fits in the budget, and account it.
+esp_err_t dutycycle_wait(uint32_t frequency, uint32_t airtime, TickType_t wait)
+{
+	TickType_t start = xTaskGetTickCount();
+	while (1) {
+		int64_t delay = dutycycle_delay_us(frequency, airtime);
+		if (delay < 0) {
+			ESP_LOGE(TAG, "airtime %"PRIu32"us is larger than the budget of %s", airtime, dutycycle_band_name(frequency));
+			return ESP_ERR_INVALID_SIZE;
+		}
+		if (delay == 0) break;
+		TickType_t ticks = pdMS_TO_TICKS((delay + 999) / 1000) + 1;
+		TickType_t elapsed = xTaskGetTickCount() - start;
+		if (wait != portMAX_DELAY) {
+			if (elapsed >= wait) return ESP_ERR_TIMEOUT;
+			if (ticks > wait - elapsed) ticks = wait - elapsed;
+		}
+		ESP_LOGD(TAG, "%s deferred %"PRId64"ms", dutycycle_band_name(frequency), delay / 1000);
+		vTaskDelay(ticks);
+	}
+	dutycycle_charge(frequency, airtime);
+	return ESP_OK;
+}
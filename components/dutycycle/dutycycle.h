@@ -0,0 +1,40 @@
+/* Airtime and duty cycle scheduler
+ *
+ * airtime_us() calculates the time on air of a packet from the radio settings.
+ * The scheduler keeps the airtime of each 868 MHz sub-band within its duty cycle
+ * over a sliding window. A packet that does not fit is deferred, not dropped.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _DUTYCYCLE_H
+#define _DUTYCYCLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+typedef struct {
+	uint32_t baud;			// Symbols per second
+	uint8_t bits_per_symbol;	// 2 for 4-FSK
+	uint8_t preamble_bytes;
+	uint8_t sync_bytes;
+	uint8_t fixed_length;	// 0 for variable packet length
+	bool crc;
+	bool fec;
+	bool manchester;
+	uint32_t frequency;		// Carrier frequency in Hz
+} AIRTIME_CONFIG_t;
+
+esp_err_t airtime_read_config(AIRTIME_CONFIG_t *config);
+uint32_t airtime_us(const AIRTIME_CONFIG_t *config, uint8_t length);
+
+const char *dutycycle_band_name(uint32_t frequency);
+uint32_t dutycycle_budget_us(uint32_t frequency);
+uint32_t dutycycle_remaining_us(uint32_t frequency);
+int64_t dutycycle_delay_us(uint32_t frequency, uint32_t airtime);
+void dutycycle_charge(uint32_t frequency, uint32_t airtime);
+esp_err_t dutycycle_wait(uint32_t frequency, uint32_t airtime, TickType_t wait);
+
+#endif
@@ -0,0 +1,161 @@
+/* The duty cycle scheduler on a virtual clock
+ *
+ * A sender transmits as fast as dutycycle_wait() allows, for 3 hours by default.
+ * For each sub-band it checks the airtime of every one hour window against the limit,
+ * and prints the highest window and the average duty cycle of the whole run.
+ * It also checks the unlimited bands, a packet that never fits and the timeout of dutycycle_wait().
+ * The exit status is 1 when a check fails.
+ *
+ * Build and run on Linux:
+ * gcc -O2 -Iinclude -I.. -DCONFIG_DUTYCYCLE_WINDOW=3600 -DCONFIG_DUTYCYCLE_OTHER_LIMIT=1000 -o dutycycle_test dutycycle_test.c ../dutycycle.c
+ * ./dutycycle_test
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "dutycycle.h"
+
+static int errors;
+
+#define CHECK(cond, ...) do { \
+		if (!(cond)) { \
+			printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+			printf(__VA_ARGS__); \
+			printf("\n"); \
+			errors++; \
+		} \
+	} while(0)
+
+#define TICK_US		(portTICK_PERIOD_MS * 1000LL)
+#define WINDOW_US	(CONFIG_DUTYCYCLE_WINDOW * 1000000LL)
+
+// Airtime of a 61 byte packet at 38400 bps, as measured by cc1101_bench
+#define PACKET_US	15006
+
+// Virtual clock. It starts at a time that is not on a slot boundary.
+static int64_t now_us = 1234567;
+
+int64_t esp_timer_get_time(void)
+{
+	return now_us;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+	return now_us / TICK_US;
+}
+
+// Wake up on the tick, as FreeRTOS does
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+	now_us = ((int64_t)xTaskGetTickCount() + xTicksToDelay) * TICK_US;
+}
+
+// Airtime in [from, from + WINDOW_US) of the packets sent at start[]
+static int64_t window_airtime(const int64_t *start, int count, int first, int64_t from)
+{
+	int64_t to = from + WINDOW_US;
+	int64_t airtime = 0;
+	for (int i=first;i<count && start[i] < to;i++) {
+		int64_t begin = start[i] < from ? from : start[i];
+		int64_t end = start[i] + PACKET_US > to ? to : start[i] + PACKET_US;
+		if (end > begin) airtime += end - begin;
+	}
+	return airtime;
+}
+
+// Send as fast as allowed for duration_us.
+// Returns the average duty cycle in percent, and the highest window in *highest.
+static double run_band(uint32_t frequency, int64_t duration_us, double *highest, int *packets)
+{
+	uint32_t budget = dutycycle_budget_us(frequency);
+	int max = duration_us / PACKET_US + 1;
+	int64_t *start = malloc(max * sizeof(int64_t));
+	int count = 0;
+	int64_t begin = now_us;
+	while (now_us - begin < duration_us && count < max) {
+		esp_err_t err = dutycycle_wait(frequency, PACKET_US, portMAX_DELAY);
+		CHECK(err == ESP_OK, "dutycycle_wait failed err=0x%x", err);
+		if (err != ESP_OK) break;
+		start[count++] = now_us;
+		now_us += PACKET_US;
+	}
+	int64_t end = now_us;
+
+	// The busiest window starts at the start of a packet, or ends at the end of one
+	int64_t most = 0;
+	int first = 0;
+	for (int i=0;i<count;i++) {
+		int64_t airtime = window_airtime(start, count, i, start[i]);
+		if (airtime > most) most = airtime;
+		int64_t from = start[i] + PACKET_US - WINDOW_US;
+		while (first < i && start[first] + PACKET_US <= from) first++;
+		airtime = window_airtime(start, count, first, from);
+		if (airtime > most) most = airtime;
+	}
+	CHECK(most <= budget, "%s window airtime %"PRId64"us over the budget of %"PRIu32"us",
+		dutycycle_band_name(frequency), most, budget);
+
+	free(start);
+	*highest = most * 100.0 / WINDOW_US;
+	*packets = count;
+	return (double)count * PACKET_US * 100.0 / (end - begin);
+}
+
+int main(int argc, char **argv)
+{
+	int hours = 3;
+	int opt;
+	while ((opt = getopt(argc, argv, "h:")) != -1) {
+		switch (opt) {
+			case 'h':
+				hours = atoi(optarg);
+				break;
+			default:
+				printf("usage: %s [-h hours]\n", argv[0]);
+				return 2;
+		}
+	}
+	int64_t duration_us = hours * 3600000000LL;
+
+	// Sub-bands of 1%, 0.1% and 10%
+	static const uint32_t frequencies[] = { 868300000, 864000000, 869525000 };
+	for (int i=0;i<sizeof(frequencies)/sizeof(frequencies[0]);i++) {
+		uint32_t frequency = frequencies[i];
+		double highest;
+		int packets;
+		double average = run_band(frequency, duration_us, &highest, &packets);
+		double limit = dutycycle_budget_us(frequency) * 100.0 / WINDOW_US;
+		printf("%-5s limit %5.2f%%  highest window %7.4f%%  average %7.4f%%  %6d packets in %d hours\n",
+			dutycycle_band_name(frequency), limit, highest, average, packets, hours);
+	}
+
+	// Not limited outside the 863-870 MHz band
+	CHECK(dutycycle_budget_us(433920000) == UINT32_MAX, "433 MHz is limited");
+	CHECK(dutycycle_delay_us(433920000, 1000000) == 0, "433 MHz is deferred");
+
+	// A packet longer than the budget of a window never fits
+	uint32_t budget = dutycycle_budget_us(868900000);
+	CHECK(dutycycle_delay_us(868900000, budget + 1) == -1, "a packet over the budget fits");
+	CHECK(dutycycle_wait(868900000, budget + 1, 0) == ESP_ERR_INVALID_SIZE, "a packet over the budget was accepted");
+
+	// Use up the budget. The wait times out, and the budget is back after the window and one slot.
+	dutycycle_charge(868900000, budget);
+	CHECK(dutycycle_remaining_us(868900000) == 0, "budget left after it was used up");
+	int64_t before = now_us;
+	CHECK(dutycycle_wait(868900000, PACKET_US, pdMS_TO_TICKS(1000)) == ESP_ERR_TIMEOUT, "no timeout");
+	CHECK(now_us - before > 1000000 - TICK_US && now_us - before <= 1000000, "timeout after %"PRId64"us", now_us - before);
+	now_us += WINDOW_US + WINDOW_US / 60;
+	CHECK(dutycycle_remaining_us(868900000) == budget, "budget not released after the window");
+
+	printf("%s: %d errors\n", errors ? "FAIL" : "PASS", errors);
+	return errors ? 1 : 0;
+}
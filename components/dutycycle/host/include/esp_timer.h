@@ -0,0 +1,13 @@
+/* esp_timer.h for the host build
+ *
+ * Implemented by dutycycle_test.c on the virtual clock.
+ */
+
+#ifndef _HOST_ESP_TIMER_H
+#define _HOST_ESP_TIMER_H
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif
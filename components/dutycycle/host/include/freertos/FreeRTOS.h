@@ -0,0 +1,28 @@
+/* FreeRTOS.h for the host build
+ *
+ * Only what the duty cycle scheduler uses. There is one task, so the critical sections do nothing.
+ */
+
+#ifndef _HOST_FREERTOS_H
+#define _HOST_FREERTOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef int BaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE		0
+#define pdTRUE		1
+
+#define configTICK_RATE_HZ	100
+#define portTICK_PERIOD_MS	(1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY		(TickType_t)0xffffffffUL
+#define pdMS_TO_TICKS(ms)	((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	0
+#define taskENTER_CRITICAL(mux)	(void)(mux)
+#define taskEXIT_CRITICAL(mux)	(void)(mux)
+
+#endif
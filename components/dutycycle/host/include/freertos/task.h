@@ -0,0 +1,14 @@
+/* task.h for the host build
+ *
+ * Implemented by dutycycle_test.c on the virtual clock.
+ */
+
+#ifndef _HOST_TASK_H
+#define _HOST_TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+void vTaskDelay(TickType_t xTicksToDelay);
+TickType_t xTaskGetTickCount(void);
+
+#endif
@@ -0,0 +1,179 @@
+/* Binary envelope for bridged packets
+ *
+ * Only the part of CBOR used by the envelope is implemented.
+ * No heap is used.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <string.h>
+
+#include "envelope.h"
+
+#define CBOR_UNSIGNED	0
+#define CBOR_NEGATIVE	1
+#define CBOR_BYTES		2
+#define CBOR_TEXT		3
+#define CBOR_ARRAY		4
+#define CBOR_MAP		5
+#define CBOR_TAG		6
+
+static size_t cbor_head_size(uint64_t value)
+{
+	if (value < 24) return 1;
+	if (value <= 0xFF) return 2;
+	if (value <= 0xFFFF) return 3;
+	if (value <= 0xFFFFFFFF) return 5;
+	return 9;
+}
+
+// Write the head of a data item with the shortest form of the argument.
+static uint8_t *cbor_put_head(uint8_t *p, uint8_t major, uint64_t value)
+{
+	major <<= 5;
+	if (value < 24) {
+		*p++ = major | value;
+	} else if (value <= 0xFF) {
+		*p++ = major | 24;
+		*p++ = value;
+	} else if (value <= 0xFFFF) {
+		*p++ = major | 25;
+		*p++ = value >> 8;
+		*p++ = value;
+	} else if (value <= 0xFFFFFFFF) {
+		*p++ = major | 26;
+		for (int shift=24;shift>=0;shift-=8) *p++ = value >> shift;
+	} else {
+		*p++ = major | 27;
+		for (int shift=56;shift>=0;shift-=8) *p++ = value >> shift;
+	}
+	return p;
+}
+
+static uint8_t *cbor_put_int(uint8_t *p, int64_t value)
+{
+	if (value >= 0) return cbor_put_head(p, CBOR_UNSIGNED, value);
+	return cbor_put_head(p, CBOR_NEGATIVE, -1 - value);
+}
+
+// Returns the number of bytes written, or 0 when out is too small.
+size_t envelope_encode(const ENVELOPE_t *envelope, uint8_t *out, size_t out_size)
+{
+	size_t size = cbor_head_size(ENVELOPE_ITEMS) + cbor_head_size(ENVELOPE_VERSION)
+		+ cbor_head_size(envelope->node_id) + cbor_head_size(envelope->seq)
+		+ cbor_head_size(envelope->timestamp)
+		+ cbor_head_size(envelope->rssi >= 0 ? envelope->rssi : -1 - envelope->rssi)
+		+ cbor_head_size(envelope->lqi) + cbor_head_size(envelope->length) + envelope->length
+		+ cbor_head_size(envelope->boot);
+	if (out_size < size) return 0;
+	uint8_t *p = out;
+	p = cbor_put_head(p, CBOR_ARRAY, ENVELOPE_ITEMS);
+	p = cbor_put_head(p, CBOR_UNSIGNED, ENVELOPE_VERSION);
+	p = cbor_put_head(p, CBOR_UNSIGNED, envelope->node_id);
+	p = cbor_put_head(p, CBOR_UNSIGNED, envelope->seq);
+	p = cbor_put_head(p, CBOR_UNSIGNED, envelope->timestamp);
+	p = cbor_put_int(p, envelope->rssi);
+	p = cbor_put_head(p, CBOR_UNSIGNED, envelope->lqi);
+	p = cbor_put_head(p, CBOR_BYTES, envelope->length);
+	memcpy(p, envelope->payload, envelope->length);
+	p += envelope->length;
+	p = cbor_put_head(p, CBOR_UNSIGNED, envelope->boot);
+	return p - out;
+}
+
+// Read the head of a data item. Returns the number of bytes read, or 0 on error.
+static size_t cbor_get_head(const uint8_t *in, size_t len, uint8_t *major, uint64_t *value)
+{
+	if (len < 1) return 0;
+	*major = in[0] >> 5;
+	uint8_t info = in[0] & 0x1F;
+	if (info < 24) {
+		*value = info;
+		return 1;
+	}
+	if (info > 27) return 0;	// Indefinite length is not used
+	size_t size = 1 << (info - 24);
+	if (len < 1 + size) return 0;
+	*value = 0;
+	for (size_t i=0;i<size;i++) *value = (*value << 8) | in[1 + i];
+	return 1 + size;
+}
+
+static size_t cbor_get_uint(const uint8_t *in, size_t len, uint64_t max, uint64_t *value)
+{
+	uint8_t major;
+	size_t n = cbor_get_head(in, len, &major, value);
+	if (n == 0 || major != CBOR_UNSIGNED || *value > max) return 0;
+	return n;
+}
+
+// Decode one envelope from a CBOR sequence.
+// Returns the number of bytes consumed, or 0 when the data is not a valid envelope.
+size_t envelope_decode(const uint8_t *in, size_t len, ENVELOPE_t *envelope)
+{
+	const uint8_t *p = in;
+	const uint8_t *end = in + len;
+	uint8_t major;
+	uint64_t value;
+	size_t n;
+
+	n = cbor_get_head(p, end - p, &major, &value);
+	if (n == 0 || major != CBOR_ARRAY || value < ENVELOPE_ITEMS_V1) return 0;
+	uint64_t items = value;
+	p += n;
+
+	if ((n = cbor_get_uint(p, end - p, 0xFF, &value)) == 0) return 0;
+	envelope->version = value;
+	p += n;
+	if ((n = cbor_get_uint(p, end - p, 0xFFFFFFFF, &value)) == 0) return 0;
+	envelope->node_id = value;
+	p += n;
+	if ((n = cbor_get_uint(p, end - p, 0xFFFFFFFF, &value)) == 0) return 0;
+	envelope->seq = value;
+	p += n;
+	if ((n = cbor_get_uint(p, end - p, UINT64_MAX, &value)) == 0) return 0;
+	envelope->timestamp = value;
+	p += n;
+
+	n = cbor_get_head(p, end - p, &major, &value);
+	if (n == 0) return 0;
+	if (major == CBOR_UNSIGNED && value <= 127) {
+		envelope->rssi = value;
+	} else if (major == CBOR_NEGATIVE && value <= 127) {
+		envelope->rssi = -1 - (int)value;
+	} else {
+		return 0;
+	}
+	p += n;
+
+	if ((n = cbor_get_uint(p, end - p, 0xFF, &value)) == 0) return 0;
+	envelope->lqi = value;
+	p += n;
+
+	n = cbor_get_head(p, end - p, &major, &value);
+	if (n == 0 || major != CBOR_BYTES || value > ENVELOPE_PAYLOAD_MAX) return 0;
+	p += n;
+	if ((size_t)(end - p) < value) return 0;
+	envelope->length = value;
+	envelope->payload = p;
+	p += value;
+
+	envelope->boot = 0;
+	if (items >= ENVELOPE_ITEMS) {
+		if ((n = cbor_get_uint(p, end - p, 0xFFFFFFFF, &value)) == 0) return 0;
+		envelope->boot = value;
+		p += n;
+	}
+
+	// Skip the items added by later versions. Nested items are not expected.
+	for (uint64_t i=ENVELOPE_ITEMS;i<items;i++) {
+		n = cbor_get_head(p, end - p, &major, &value);
+		if (n == 0 || major == CBOR_ARRAY || major == CBOR_MAP || major == CBOR_TAG) return 0;
+		p += n;
+		if (major == CBOR_BYTES || major == CBOR_TEXT) {
+			if ((uint64_t)(end - p) < value) return 0;
+			p += value;
+		}
+	}
+	return p - in;
+}
@@ -0,0 +1,62 @@
+/* Binary envelope for bridged packets
+ *
+ * Each packet is encoded as a CBOR (RFC8949) array.
+ * [ version, node_id, seq, timestamp, rssi, lqi, payload, boot ]
+ *
+ * version   unsigned  ENVELOPE_VERSION
+ * node_id   unsigned  Id of the gateway that received the packet, the lower 4 bytes of its MAC address.
+ *                     Not the radio node that sent the packet. Its address, if any, is the first byte of the payload.
+ * seq       unsigned  Packet number counted by the gateway. Restarts from 0 when the gateway restarts.
+ * timestamp unsigned  Microseconds since the gateway started when the packet was received
+ * rssi      integer   dBm
+ * lqi       unsigned  Link quality indicator
+ * payload   bytes     Radio packet data
+ * boot      unsigned  Random id of the gateway boot that received the packet. seq and timestamp count from this boot.
+ *                     A packet stored in flash and sent after a restart has the id of the earlier boot.
+ *                     Added in version 2. 0 when decoded from version 1.
+ *
+ * Several envelopes are concatenated as a CBOR sequence (RFC8742).
+ * Later versions only append items to the array, and a decoder ignores the items it does not know.
+ * The integers always use the shortest form, so an envelope is at most 32 bytes plus the payload.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _ENVELOPE_H
+#define _ENVELOPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ENVELOPE_VERSION		2
+#define ENVELOPE_ITEMS			8
+#define ENVELOPE_ITEMS_V1		7	// The decoder accepts version 1
+#define ENVELOPE_PAYLOAD_MAX	255
+// array(1) version(1) node_id(5) seq(5) timestamp(9) rssi(2) lqi(2) payload header(2) boot(5)
+#define ENVELOPE_HEADER_MAX		32
+#define ENVELOPE_ENCODED_MAX(length) (ENVELOPE_HEADER_MAX + (length))
+
+typedef struct {
+	uint8_t version;
+	uint32_t node_id;
+	uint32_t seq;
+	uint64_t timestamp;
+	int8_t rssi;
+	uint8_t lqi;
+	uint8_t length;
+	const uint8_t *payload;	// Not copied. Points into the decoded buffer after envelope_decode().
+	uint32_t boot;
+} ENVELOPE_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t envelope_encode(const ENVELOPE_t *envelope, uint8_t *out, size_t out_size);
+size_t envelope_decode(const uint8_t *in, size_t len, ENVELOPE_t *envelope);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
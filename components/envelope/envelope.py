@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+#
+# Decoder of the binary envelope. See envelope.h for the format.
+# Only the standard library is used.
+#
+# import envelope
+# for e in envelope.decode_seq(body):
+#     print(e['node_id'], e['seq'], e['rssi'], e['payload'])
+#
+# python3 ./envelope.py decode --file body.cbor
+# stty -F /dev/ttyACM0 raw; python3 ./envelope.py decode --stream --file /dev/ttyACM0
+
+import argparse
+import struct
+import sys
+import time
+
+ENVELOPE_VERSION = 2
+ENVELOPE_ITEMS = 8
+ENVELOPE_ITEMS_V1 = 7
+FIELDS = ('version', 'node_id', 'seq', 'timestamp', 'rssi', 'lqi', 'payload', 'boot')
+
+class Truncated(ValueError):
+	"""The data ends in the middle of an envelope."""
+
+def _head(data, index):
+	if index >= len(data):
+		raise Truncated("truncated")
+	major = data[index] >> 5
+	info = data[index] & 0x1F
+	index += 1
+	if info < 24:
+		return major, info, index
+	if info > 27:
+		raise ValueError("unsupported additional information {}".format(info))
+	size = 1 << (info - 24)
+	if index + size > len(data):
+		raise Truncated("truncated")
+	return major, int.from_bytes(data[index:index+size], 'big'), index + size
+
+def _item(data, index):
+	major, value, index = _head(data, index)
+	if major == 0:
+		return value, index
+	if major == 1:
+		return -1 - value, index
+	if major == 2 or major == 3:
+		if index + value > len(data):
+			raise Truncated("truncated")
+		item = data[index:index+value]
+		return (bytes(item) if major == 2 else item.decode('utf-8')), index + value
+	if major == 7:
+		return {20: False, 21: True, 22: None}.get(value, value), index
+	raise ValueError("unsupported major type {}".format(major))
+
+def decode(data, index=0):
+	"""Decode one envelope. Returns the envelope as a dict and the index of the next envelope."""
+	major, items, index = _head(data, index)
+	if major != 4 or items < ENVELOPE_ITEMS_V1:
+		raise ValueError("not an envelope")
+	values = []
+	for i in range(items):
+		value, index = _item(data, index)
+		values.append(value)
+	envelope = dict(zip(FIELDS, values))
+	envelope.setdefault('boot', 0)
+	if not isinstance(envelope['payload'], bytes):
+		raise ValueError("payload is not bytes")
+	return envelope, index
+
+def decode_seq(data):
+	"""Decode a CBOR sequence of envelopes."""
+	envelopes = []
+	index = 0
+	while index < len(data):
+		envelope, index = decode(data, index)
+		envelopes.append(envelope)
+	return envelopes
+
+def _put_head(major, value):
+	major <<= 5
+	if value < 24:
+		return bytes([major | value])
+	if value <= 0xFF:
+		return bytes([major | 24, value])
+	if value <= 0xFFFF:
+		return bytes([major | 25]) + struct.pack('>H', value)
+	if value <= 0xFFFFFFFF:
+		return bytes([major | 26]) + struct.pack('>I', value)
+	return bytes([major | 27]) + struct.pack('>Q', value)
+
+def encode(node_id, seq, timestamp, rssi, lqi, payload, boot=0):
+	"""Encode one envelope. Same output as envelope_encode()."""
+	rssi_head = _put_head(0, rssi) if rssi >= 0 else _put_head(1, -1 - rssi)
+	return (_put_head(4, ENVELOPE_ITEMS) + _put_head(0, ENVELOPE_VERSION) + _put_head(0, node_id)
+		+ _put_head(0, seq) + _put_head(0, timestamp) + rssi_head + _put_head(0, lqi)
+		+ _put_head(2, len(payload)) + bytes(payload) + _put_head(0, boot))
+
+def decode_stream(f):
+	"""Decode the envelopes from a stream, such as a serial port, as they arrive."""
+	data = b''
+	while True:
+		chunk = f.read1(4096) if hasattr(f, 'read1') else f.read(4096)
+		if not chunk:
+			break
+		data += chunk
+		index = 0
+		while index < len(data):
+			try:
+				envelope, index = decode(data, index)
+			except Truncated:
+				break
+			yield envelope
+		data = data[index:]
+
+def print_envelope(envelope):
+	print("node_id=0x{:08x} boot=0x{:08x} seq={} timestamp={} rssi={}dBm lqi={} payload={}".format(
+		envelope['node_id'], envelope['boot'], envelope['seq'], envelope['timestamp'], envelope['rssi'],
+		envelope['lqi'], envelope['payload'].decode('utf-8', 'replace')))
+
+if __name__=='__main__':
+	parser = argparse.ArgumentParser()
+	parser.add_argument('command', choices=['decode', 'bench'])
+	parser.add_argument('--file', help='file to decode. stdin when omitted')
+	parser.add_argument('--stream', action='store_true', help='print the envelopes as they arrive')
+	parser.add_argument('--count', type=int, help='number of envelopes for bench', default=100000)
+	args = parser.parse_args()
+
+	if args.command == 'decode':
+		f = open(args.file, 'rb') if args.file else sys.stdin.buffer
+		if args.stream:
+			for envelope in decode_stream(f):
+				print_envelope(envelope)
+		else:
+			for envelope in decode_seq(f.read()):
+				print_envelope(envelope)
+	else:
+		body = encode(0x12345678, 1000, 123456789, -60, 20, b'Hello World 1000', 0x9abcdef0)
+		start = time.time()
+		for i in range(args.count):
+			decode(body)
+		elapsed = time.time() - start
+		print("decode {} bytes: {:.0f} envelopes/s".format(len(body), args.count / elapsed))
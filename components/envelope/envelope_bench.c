@@ -0,0 +1,71 @@
+/* Throughput benchmark of the envelope encoder
+ *
+ * Build and run on Linux:
+ * gcc -O2 -o envelope_bench envelope_bench.c envelope.c
+ * ./envelope_bench
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "envelope.h"
+
+#define COUNT 10000000
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(uint8_t length)
+{
+	uint8_t payload[ENVELOPE_PAYLOAD_MAX];
+	memset(payload, 'A', sizeof(payload));
+	uint8_t out[ENVELOPE_ENCODED_MAX(ENVELOPE_PAYLOAD_MAX)];
+	ENVELOPE_t envelope = {
+		.node_id = 0x12345678,
+		.timestamp = 123456789,
+		.rssi = -60,
+		.lqi = 20,
+		.length = length,
+		.payload = payload,
+		.boot = 0x9abcdef0,
+	};
+
+	size_t total = 0;
+	double start = now();
+	for (uint32_t i=0;i<COUNT;i++) {
+		envelope.seq = i;
+		envelope.timestamp += 1000;
+		total += envelope_encode(&envelope, out, sizeof(out));
+		// Keep the compiler from removing the loop
+		__asm__ volatile("" : : "r"(out) : "memory");
+	}
+	double encode_time = now() - start;
+
+	ENVELOPE_t decoded;
+	size_t len = envelope_encode(&envelope, out, sizeof(out));
+	start = now();
+	for (uint32_t i=0;i<COUNT;i++) {
+		envelope_decode(out, len, &decoded);
+		__asm__ volatile("" : : "r"(&decoded) : "memory");
+	}
+	double decode_time = now() - start;
+
+	printf("payload=%3d envelope=%3zu bytes  encode %6.1f M envelopes/s %7.1f MB/s  decode %6.1f M envelopes/s\n",
+		length, len, COUNT / encode_time / 1e6, total / encode_time / 1e6, COUNT / decode_time / 1e6);
+}
+
+int main(void)
+{
+	bench(8);
+	bench(16);
+	bench(61);
+	return 0;
+}
@@ -0,0 +1,141 @@
+/* Binary framing for serial bridges
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <string.h>
+
+#include "frame.h"
+
+// CRC-16/CCITT-FALSE. Polynomial 0x1021, initial value 0xFFFF.
+uint16_t frame_crc16(const uint8_t *data, size_t len)
+{
+	uint16_t crc = 0xFFFF;
+	for (size_t i=0;i<len;i++) {
+		crc ^= (uint16_t)data[i] << 8;
+		for (int bit=0;bit<8;bit++) {
+			if (crc & 0x8000) {
+				crc = (crc << 1) ^ 0x1021;
+			} else {
+				crc = crc << 1;
+			}
+		}
+	}
+	return crc;
+}
+
+// COBS encode. The output is terminated with 0x00.
+// Returns the number of bytes written, or 0 when out is too small.
+static size_t cobs_encode(const uint8_t *in, size_t len, uint8_t *out, size_t out_size)
+{
+	if (out_size < len + (len / 254) + 2) return 0;
+	size_t code_index = 0;
+	size_t index = 1;
+	uint8_t code = 1;
+	for (size_t i=0;i<len;i++) {
+		if (in[i] == 0) {
+			out[code_index] = code;
+			code_index = index++;
+			code = 1;
+		} else {
+			out[index++] = in[i];
+			code++;
+			if (code == 0xFF) {
+				out[code_index] = code;
+				code_index = index++;
+				code = 1;
+			}
+		}
+	}
+	out[code_index] = code;
+	out[index++] = 0x00;
+	return index;
+}
+
+// COBS decode without the delimiter. Decoding can be done in place.
+// Returns the number of bytes written, or 0 when the input is malformed.
+static size_t cobs_decode(const uint8_t *in, size_t len, uint8_t *out)
+{
+	size_t index = 0;
+	size_t i = 0;
+	while (i < len) {
+		uint8_t code = in[i++];
+		if (code == 0 || i + code - 1 > len) return 0;
+		for (int j=1;j<code;j++) {
+			out[index++] = in[i++];
+		}
+		if (code != 0xFF && i < len) out[index++] = 0x00;
+	}
+	return index;
+}
+
+size_t frame_encode(const FRAME_t *frame, uint8_t *out, size_t out_size)
+{
+	if (frame->length > FRAME_DATA_MAX) return 0;
+	uint8_t raw[FRAME_RAW_MAX];
+	raw[0] = frame->type;
+	raw[1] = frame->length;
+	raw[2] = (uint8_t)frame->rssi;
+	raw[3] = frame->lqi;
+	memcpy(&raw[FRAME_HEADER_LEN], frame->data, frame->length);
+	size_t len = FRAME_HEADER_LEN + frame->length;
+	uint16_t crc = frame_crc16(raw, len);
+	raw[len++] = crc & 0xFF;
+	raw[len++] = crc >> 8;
+	return cobs_encode(raw, len, out, out_size);
+}
+
+void frame_decoder_init(FRAME_DECODER_t *decoder)
+{
+	memset(decoder, 0, sizeof(FRAME_DECODER_t));
+}
+
+// Feed one byte from the serial line.
+// Returns true when a valid frame has been stored in frame.
+bool frame_decoder_put(FRAME_DECODER_t *decoder, uint8_t ch, FRAME_t *frame)
+{
+	if (ch != 0x00) {
+		if (decoder->index < sizeof(decoder->buf)) {
+			decoder->buf[decoder->index++] = ch;
+		} else {
+			decoder->overflow = true;
+		}
+		return false;
+	}
+
+	// End of frame
+	size_t encoded = decoder->index;
+	bool overflow = decoder->overflow;
+	decoder->index = 0;
+	decoder->overflow = false;
+	if (encoded == 0) return false; // Empty frame is used for resynchronization
+	if (overflow) {
+		decoder->errors++;
+		return false;
+	}
+
+	size_t len = cobs_decode(decoder->buf, encoded, decoder->buf);
+	if (len < FRAME_HEADER_LEN + FRAME_CRC_LEN) {
+		decoder->errors++;
+		return false;
+	}
+	uint8_t *raw = decoder->buf;
+	size_t length = raw[1];
+	if (length > FRAME_DATA_MAX || len != FRAME_HEADER_LEN + length + FRAME_CRC_LEN) {
+		decoder->errors++;
+		return false;
+	}
+	uint16_t crc = raw[len-2] | (raw[len-1] << 8);
+	if (crc != frame_crc16(raw, len - FRAME_CRC_LEN)) {
+		decoder->errors++;
+		return false;
+	}
+
+	frame->type = raw[0];
+	frame->length = length;
+	frame->rssi = (int8_t)raw[2];
+	frame->lqi = raw[3];
+	memcpy(frame->data, &raw[FRAME_HEADER_LEN], length);
+	decoder->frames++;
+	return true;
+}
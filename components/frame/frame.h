@@ -0,0 +1,65 @@
+/* Binary framing for serial bridges
+ *
+ * A frame carries one radio packet and its metadata.
+ *
+ * Before encoding:
+ * +------+--------+------+-----+----------------+--------+
+ * | type | length | rssi | lqi | data[length]   | crc16  |
+ * +------+--------+------+-----+----------------+--------+
+ *   1      1        1      1     0-61             2 (little endian)
+ *
+ * The whole block is COBS encoded and terminated with 0x00.
+ * So the data can contain any byte including CR and LF.
+ * The crc16 is CRC-16/CCITT-FALSE over type to the end of data.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _FRAME_H
+#define _FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "ccpacket.h"
+
+#define FRAME_TYPE_RX			0x01 // Received from radio. Device to host.
+#define FRAME_TYPE_TX			0x02 // Send to radio. Host to device.
+
+#define FRAME_DATA_MAX			(CCPACKET_DATA_LEN)	// A longer frame could not be sent by the radio
+#define FRAME_HEADER_LEN		4
+#define FRAME_CRC_LEN			2
+#define FRAME_RAW_MAX			(FRAME_HEADER_LEN + FRAME_DATA_MAX + FRAME_CRC_LEN)
+// COBS adds one byte every 254 bytes plus the delimiter
+#define FRAME_ENCODED_MAX		(FRAME_RAW_MAX + (FRAME_RAW_MAX / 254) + 2)
+
+typedef struct {
+	uint8_t type;
+	uint8_t length;
+	int8_t rssi;	// dBm
+	uint8_t lqi;
+	uint8_t data[FRAME_DATA_MAX];
+} FRAME_t;
+
+typedef struct {
+	uint8_t buf[FRAME_ENCODED_MAX];
+	size_t index;
+	bool overflow;
+	uint32_t frames;
+	uint32_t errors;
+} FRAME_DECODER_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+uint16_t frame_crc16(const uint8_t *data, size_t len);
+size_t frame_encode(const FRAME_t *frame, uint8_t *out, size_t out_size);
+void frame_decoder_init(FRAME_DECODER_t *decoder);
+bool frame_decoder_put(FRAME_DECODER_t *decoder, uint8_t ch, FRAME_t *frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
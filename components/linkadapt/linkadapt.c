@@ -0,0 +1,229 @@
+/* Link adaptation
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "linkadapt.h"
+
+static const char *TAG = "LINKADAPT";
+
+#define LINKADAPT_PENALTY_MAX	30
+#define LINKADAPT_WINDOW		32		// The PER counts are halved at this many packets
+
+// Sensitivity at 1% PER with the channel filter of setSpeed(), about the datasheet at 868MHz.
+// The penalties make up for the difference on a real link.
+static const int8_t linkadapt_sensitivity[CSPEED_LAST] = {
+	[CSPEED_4800] = -108,
+	[CSPEED_9600] = -107,
+	[CSPEED_19200] = -105,
+	[CSPEED_38400] = -104,
+};
+
+// Output power of the power levels, for power_levels
+static const int8_t linkadapt_level_dbm[POWER_LAST] = {
+	[POWER_MIN] = -30,
+	[POWER_0db] = 0,
+	[POWER_MAX] = 10,
+};
+
+static const int speed_bps[CSPEED_LAST] = {4800, 9600, 19200, 38400};
+
+typedef struct {
+	uint8_t mode;
+	int8_t power;			// dBm
+	bool known;
+	int16_t rssi;			// At the peer as if sent at 0dBm, in 1/16 dB
+	uint8_t lqi;			// Of the last reply
+	uint8_t packets;		// At the current setting
+	uint8_t lost;
+	uint8_t losses;			// In a row
+	uint8_t hold;			// Replies before a higher speed
+	uint16_t good;			// Replies since the penalties last wore off
+	int8_t penalty[CSPEED_LAST];
+	uint32_t changes;
+	uint32_t fallbacks;
+} LINKADAPT_NODE_t;
+
+static LINKADAPT_CONFIG_t linkadapt_config;
+static LINKADAPT_NODE_t linkadapt_nodes[LINKADAPT_NODES];
+
+void linkadapt_default_config(LINKADAPT_CONFIG_t *config)
+{
+	config->base_mode = CSPEED_4800;
+	config->max_mode = CSPEED_38400;
+	config->target_per = 5;
+	config->margin_db = 6;
+	config->lqi_max = 80;
+	config->power_levels = false;
+}
+
+// The highest output power
+static int8_t linkadapt_max_power(void)
+{
+	return getTxPowerStep(CC1101_POWER_STEPS - 1);
+}
+
+// Every peer starts at the base speed and the maximum power
+void linkadapt_init(const LINKADAPT_CONFIG_t *config)
+{
+	linkadapt_config = *config;
+	if (linkadapt_config.base_mode >= CSPEED_LAST) linkadapt_config.base_mode = CSPEED_4800;
+	if (linkadapt_config.max_mode >= CSPEED_LAST) linkadapt_config.max_mode = CSPEED_LAST - 1;
+	if (linkadapt_config.max_mode < linkadapt_config.base_mode) linkadapt_config.max_mode = linkadapt_config.base_mode;
+	memset(linkadapt_nodes, 0, sizeof(linkadapt_nodes));
+	for (int i=0;i<LINKADAPT_NODES;i++) {
+		linkadapt_nodes[i].mode = linkadapt_config.base_mode;
+		linkadapt_nodes[i].power = linkadapt_max_power();
+	}
+}
+
+static int linkadapt_rssi(const LINKADAPT_NODE_t *entry)
+{
+	return entry->rssi >= 0 ? (entry->rssi + 8) / 16 : (entry->rssi - 8) / 16;
+}
+
+// RSSI the peer needs at a speed
+static int linkadapt_required(const LINKADAPT_NODE_t *entry, uint8_t mode)
+{
+	return linkadapt_sensitivity[mode] + linkadapt_config.margin_db + entry->penalty[mode];
+}
+
+static bool linkadapt_over_target(const LINKADAPT_NODE_t *entry)
+{
+	return entry->packets >= LINKADAPT_MIN_PACKETS && entry->lost * 100 > linkadapt_config.target_per * entry->packets;
+}
+
+// Pick the speed and the output power from the RSSI and the penalties.
+// A higher speed waits for some replies at the current setting. A lower speed does not.
+static void linkadapt_decide(LINKADAPT_NODE_t *entry, uint8_t node)
+{
+	int rssi = linkadapt_rssi(entry);
+	uint8_t mode = CSPEED_4800;
+	for (int m=linkadapt_config.max_mode;m>CSPEED_4800;m--) {
+		int required = linkadapt_required(entry, m);
+		if (m > entry->mode) required += LINKADAPT_HYSTERESIS_DB;
+		if (rssi + linkadapt_max_power() >= required) {
+			mode = m;
+			break;
+		}
+	}
+	// Not held back by the PER of the current speed. Collisions raise it too,
+	// and a higher speed has fewer of them.
+	if (mode > entry->mode && (entry->hold || entry->lqi > linkadapt_config.lqi_max)) mode = entry->mode;
+
+	int8_t power = linkadapt_max_power();
+	int steps = linkadapt_config.power_levels ? POWER_LAST : CC1101_POWER_STEPS;
+	for (int s=0;s<steps-1;s++) {
+		int8_t dbm = linkadapt_config.power_levels ? linkadapt_level_dbm[s] : getTxPowerStep(s);
+		int required = linkadapt_required(entry, mode);
+		if (dbm < entry->power) required += LINKADAPT_HYSTERESIS_DB;
+		if (rssi + dbm >= required) {
+			power = dbm;
+			break;
+		}
+	}
+
+	if (mode == entry->mode && power == entry->power) return;
+	ESP_LOGI(TAG, "node=%d rssi=%ddBm@0dBm %dbps %ddBm --> %dbps %ddBm", node, rssi,
+		speed_bps[entry->mode], entry->power, speed_bps[mode], power);
+	entry->mode = mode;
+	entry->power = power;
+	entry->packets = entry->lost = 0;
+	entry->hold = LINKADAPT_MIN_PACKETS;
+	entry->changes++;
+}
+
+// Count a packet at the current setting. A setting that misses the target PER
+// makes its speed need a few dB more.
+static void linkadapt_count(LINKADAPT_NODE_t *entry, uint8_t node, bool lost)
+{
+	entry->packets++;
+	if (lost) entry->lost++;
+	if (linkadapt_over_target(entry)) {
+		ESP_LOGI(TAG, "node=%d %dbps lost %d of %d", node, speed_bps[entry->mode], entry->lost, entry->packets);
+		if (entry->penalty[entry->mode] < LINKADAPT_PENALTY_MAX) entry->penalty[entry->mode] += LINKADAPT_PENALTY_DB;
+		entry->packets = entry->lost = 0;
+	}
+	if (entry->packets >= LINKADAPT_WINDOW) {
+		entry->packets /= 2;
+		entry->lost /= 2;
+	}
+}
+
+// Call for each reply of the peer, with the RSSI in dBm and the LQI
+// that the peer measured on the packet it replies to.
+void linkadapt_report(uint8_t node, int8_t rssi, uint8_t lqi)
+{
+	LINKADAPT_NODE_t *entry = &linkadapt_nodes[node];
+	int16_t value = (rssi - entry->power) * 16;
+	if (entry->known) {
+		// Average over the last replies. The RSSI of one packet is noisy.
+		entry->rssi += (value - entry->rssi) / 4;
+	} else {
+		entry->rssi = value;
+		entry->known = true;
+	}
+	entry->lqi = lqi;
+	entry->losses = 0;
+	if (entry->hold) entry->hold--;
+	linkadapt_count(entry, node, false);
+	if (++entry->good >= LINKADAPT_DECAY_PACKETS) {
+		entry->good = 0;
+		for (int m=0;m<CSPEED_LAST;m++) {
+			if (entry->penalty[m] > 0) entry->penalty[m]--;
+		}
+	}
+	linkadapt_decide(entry, node);
+}
+
+// Call when the reply of the peer does not arrive.
+// Returns true on a fallback to the base speed at the maximum power.
+// The peer may be on another speed by now, so it must fall back too
+// when it hears nothing for a while. The RSSI is kept, so the link
+// goes back up after LINKADAPT_MIN_PACKETS replies.
+bool linkadapt_lost(uint8_t node)
+{
+	LINKADAPT_NODE_t *entry = &linkadapt_nodes[node];
+	entry->losses++;
+	linkadapt_count(entry, node, true);
+	if (entry->losses >= LINKADAPT_FALLBACK_LOSSES) {
+		ESP_LOGW(TAG, "node=%d %d replies lost at %dbps. Back to %dbps", node, entry->losses,
+			speed_bps[entry->mode], speed_bps[linkadapt_config.base_mode]);
+		if (entry->mode != linkadapt_config.base_mode && entry->penalty[entry->mode] < LINKADAPT_PENALTY_MAX) {
+			entry->penalty[entry->mode] += LINKADAPT_PENALTY_DB;
+		}
+		entry->mode = linkadapt_config.base_mode;
+		entry->power = linkadapt_max_power();
+		entry->packets = entry->lost = entry->losses = 0;
+		entry->hold = LINKADAPT_MIN_PACKETS;
+		entry->fallbacks++;
+		return true;
+	}
+	if (entry->known) linkadapt_decide(entry, node);
+	return false;
+}
+
+// The speed and the output power for the next packet to the peer
+void linkadapt_get(uint8_t node, uint8_t *mode, int8_t *power)
+{
+	*mode = linkadapt_nodes[node].mode;
+	*power = linkadapt_nodes[node].power;
+}
+
+void linkadapt_get_status(uint8_t node, LINKADAPT_STATUS_t *status)
+{
+	const LINKADAPT_NODE_t *entry = &linkadapt_nodes[node];
+	status->mode = entry->mode;
+	status->power = entry->power;
+	status->known = entry->known;
+	status->rssi = linkadapt_rssi(entry);
+	status->per = entry->packets ? entry->lost * 100 / entry->packets : 0;
+	memcpy(status->penalty, entry->penalty, sizeof(status->penalty));
+	status->changes = entry->changes;
+	status->fallbacks = entry->fallbacks;
+}
@@ -0,0 +1,58 @@
+/* Link adaptation
+ *
+ * Picks the speed (CSPEED_xxx) and the output power in dBm for each peer
+ * from the RSSI and LQI that the peer measured on our packets, and from the replies we lost.
+ * - The highest speed whose sensitivity plus a margin the link reaches at the maximum power.
+ * - The lowest step of setTxPower() that still reaches it at that speed.
+ * A speed that misses the target PER anyway gets a penalty in dB, which wears off
+ * slowly, so the speed is tried again later. Lost replies in a row fall back
+ * to the base speed at the maximum power.
+ * Both sides must use the same speed, so the caller tells the peer the next speed
+ * before switching. The power needs no agreement.
+ * All the functions must be called from the task that accesses the radio.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _LINKADAPT_H
+#define _LINKADAPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cc1101.h"
+
+#define LINKADAPT_NODES				256		// One for each address
+#define LINKADAPT_FALLBACK_LOSSES	3		// Lost replies in a row before the fallback
+#define LINKADAPT_MIN_PACKETS		8		// Packets at a setting before its PER counts, and before a higher speed
+#define LINKADAPT_HYSTERESIS_DB		3		// Extra margin to go to a higher speed or a lower power
+#define LINKADAPT_PENALTY_DB		3		// Added to a speed each time it misses the target PER
+#define LINKADAPT_DECAY_PACKETS		64		// Replies for each dB the penalties wear off
+
+typedef struct {
+	uint8_t base_mode;		// CSPEED_xxx of a new peer and after a fallback
+	uint8_t max_mode;		// The highest speed to use
+	uint8_t target_per;		// Percent of the replies lost
+	int8_t margin_db;		// Over the sensitivity, for fading
+	uint8_t lqi_max;		// A reply with a higher LQI does not allow a higher speed. Lower is better.
+	bool power_levels;		// Only the power levels of setTxPowerAmp(), -30, 0 and 10dBm
+} LINKADAPT_CONFIG_t;
+
+typedef struct {
+	uint8_t mode;			// CSPEED_xxx
+	int8_t power;			// dBm for setTxPower()
+	bool known;				// A reply arrived
+	int8_t rssi;			// RSSI at the peer, as if sent at 0dBm
+	uint8_t per;			// Percent of the replies lost at the current setting
+	int8_t penalty[CSPEED_LAST];	// dB added to the sensitivity of each speed
+	uint32_t changes;		// Of the speed or the power
+	uint32_t fallbacks;
+} LINKADAPT_STATUS_t;
+
+void linkadapt_default_config(LINKADAPT_CONFIG_t *config);
+void linkadapt_init(const LINKADAPT_CONFIG_t *config);
+void linkadapt_report(uint8_t node, int8_t rssi, uint8_t lqi);
+bool linkadapt_lost(uint8_t node);
+void linkadapt_get(uint8_t node, uint8_t *mode, int8_t *power);
+void linkadapt_get_status(uint8_t node, LINKADAPT_STATUS_t *status);
+
+#endif
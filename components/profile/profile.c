@@ -0,0 +1,130 @@
+/* Radio profile in NVS
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+
+#include "profile.h"
+
+static const char *TAG = "PROFILE";
+
+#define PROFILE_NAMESPACE	"cc1101"
+#define PROFILE_KEY			"profile"
+#define PROFILE_VERSION		1
+
+typedef struct {
+	uint16_t version;
+	uint16_t length;	// sizeof(CC1101_PROFILE_t)
+	CC1101_PROFILE_t profile;
+	uint32_t crc;
+} PROFILE_BLOB_t;
+
+static uint32_t blob_crc(const PROFILE_BLOB_t *blob)
+{
+	return esp_rom_crc32_le(0, (const uint8_t *)blob, offsetof(PROFILE_BLOB_t, crc));
+}
+
+void profile_default(CC1101_PROFILE_t *profile)
+{
+	memset(profile, 0, sizeof(CC1101_PROFILE_t));
+#if CONFIG_CC1101_FREQ_315
+	profile->freq = CFREQ_315;
+#elif CONFIG_CC1101_FREQ_433
+	profile->freq = CFREQ_433;
+#elif CONFIG_CC1101_FREQ_868
+	profile->freq = CFREQ_868;
+#elif CONFIG_CC1101_FREQ_915
+	profile->freq = CFREQ_915;
+#endif
+
+#if CONFIG_CC1101_SPEED_4800
+	profile->mode = CSPEED_4800;
+#elif CONFIG_CC1101_SPEED_9600
+	profile->mode = CSPEED_9600;
+#elif CONFIG_CC1101_SPEED_19200
+	profile->mode = CSPEED_19200;
+#elif CONFIG_CC1101_SPEED_38400
+	profile->mode = CSPEED_38400;
+#endif
+
+	profile->channel = CONFIG_CC1101_CHANNEL;
+	profile->syncWord[0] = 199;
+	profile->syncWord[1] = 10;
+	profile->devAddress = 0;
+	profile->addressCheck = false;
+
+#if CONFIG_CC1101_POWER_MIN
+	profile->paLevel = POWER_MIN;
+#elif CONFIG_CC1101_POWER_0db
+	profile->paLevel = POWER_0db;
+#elif CONFIG_CC1101_POWER_MAX
+	profile->paLevel = POWER_MAX;
+#endif
+}
+
+// Always fills the profile. Returns ESP_ERR_NOT_FOUND when the defaults are used.
+esp_err_t profile_load(CC1101_PROFILE_t *profile)
+{
+	profile_default(profile);
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(PROFILE_NAMESPACE, NVS_READONLY, &handle);
+	if (err != ESP_OK) return ESP_ERR_NOT_FOUND;
+	PROFILE_BLOB_t blob;
+	size_t size = sizeof(blob);
+	err = nvs_get_blob(handle, PROFILE_KEY, &blob, &size);
+	nvs_close(handle);
+	if (err != ESP_OK) return ESP_ERR_NOT_FOUND;
+
+	if (size != sizeof(blob) || blob.version != PROFILE_VERSION || blob.length != sizeof(CC1101_PROFILE_t)) {
+		ESP_LOGW(TAG, "Stored profile has another version. Use the defaults");
+		return ESP_ERR_NOT_FOUND;
+	}
+	if (blob.crc != blob_crc(&blob)) {
+		ESP_LOGW(TAG, "Stored profile is broken. Use the defaults");
+		return ESP_ERR_NOT_FOUND;
+	}
+	memcpy(profile, &blob.profile, sizeof(CC1101_PROFILE_t));
+	ESP_LOGI(TAG, "freq=%d mode=%d channel=%d paLevel=%d", profile->freq, profile->mode, profile->channel, profile->paLevel);
+	return ESP_OK;
+}
+
+esp_err_t profile_save(const CC1101_PROFILE_t *profile)
+{
+	PROFILE_BLOB_t blob;
+	memset(&blob, 0, sizeof(blob));
+	blob.version = PROFILE_VERSION;
+	blob.length = sizeof(CC1101_PROFILE_t);
+	memcpy(&blob.profile, profile, sizeof(CC1101_PROFILE_t));
+	blob.crc = blob_crc(&blob);
+
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(PROFILE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_open fail %s", esp_err_to_name(err));
+		return err;
+	}
+	err = nvs_set_blob(handle, PROFILE_KEY, &blob, sizeof(blob));
+	if (err == ESP_OK) err = nvs_commit(handle);
+	if (err != ESP_OK) ESP_LOGE(TAG, "nvs_set_blob fail %s", esp_err_to_name(err));
+	nvs_close(handle);
+	return err;
+}
+
+esp_err_t profile_erase(void)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open(PROFILE_NAMESPACE, NVS_READWRITE, &handle);
+	if (err != ESP_OK) return err;
+	err = nvs_erase_key(handle, PROFILE_KEY);
+	if (err == ESP_OK) err = nvs_commit(handle);
+	nvs_close(handle);
+	return err;
+}
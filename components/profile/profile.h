@@ -0,0 +1,22 @@
+/* Radio profile in NVS
+ *
+ * The profile is kept as one blob with a version and a crc.
+ * When it is missing or does not match, the defaults of CC1101 Configuration are used.
+ * Pass the profile to initProfile(), which skips the reset when the CC1101
+ * still holds it from before the restart of the ESP32.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include "esp_err.h"
+#include "cc1101.h"
+
+void profile_default(CC1101_PROFILE_t *profile);
+esp_err_t profile_load(CC1101_PROFILE_t *profile);
+esp_err_t profile_save(const CC1101_PROFILE_t *profile);
+esp_err_t profile_erase(void);
+
+#endif
@@ -0,0 +1,289 @@
+/* mDNS host name resolver with a cache
+ *
+ * A cached address is returned without waiting for the network.
+ * When it has expired, or the caller reports a connection failure with
+ * resolver_invalidate(), it is refreshed by the RESOLVER task in the background.
+ * The last good address is kept in NVS, so the first connection after
+ * a restart does not wait for an mDNS query.
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "nvs.h"
+#include "mdns.h"
+
+#include "resolver.h"
+
+static const char *TAG = "RESOLVER";
+
+#define RESOLVER_CACHE_SIZE	4
+#define RESOLVER_HOST_MAX	64
+#define RESOLVER_IP_MAX		16
+
+typedef struct {
+	char host[RESOLVER_HOST_MAX];
+	char ip[RESOLVER_IP_MAX];
+	int64_t expire;		// esp_timer_get_time()
+	bool valid;
+	bool refresh;		// Refresh in the background
+} RESOLVER_ENTRY_t;
+
+static RESOLVER_ENTRY_t entries[RESOLVER_CACHE_SIZE];
+static SemaphoreHandle_t resolver_mutex;
+static TaskHandle_t resolver_task_handle;
+
+static bool is_mdns_host(const char *host)
+{
+	size_t len = strlen(host);
+	return len > 6 && strcmp(host + len - 6, ".local") == 0;
+}
+
+static void copy_string(char *to, const char *from, size_t size)
+{
+	if (size == 0) return;
+	strncpy(to, from, size - 1);
+	to[size - 1] = 0;
+}
+
+static esp_err_t query_mdns(const char *host, char *ip)
+{
+	// mdns_query_a() takes the host name without ".local"
+	char name[RESOLVER_HOST_MAX];
+	size_t len = strlen(host) - 6;
+	if (len >= sizeof(name)) return ESP_ERR_INVALID_SIZE;
+	memcpy(name, host, len);
+	name[len] = 0;
+
+	int64_t start = esp_timer_get_time();
+	esp_ip4_addr_t addr;
+	addr.addr = 0;
+	esp_err_t err = mdns_query_a(name, CONFIG_RESOLVER_QUERY_TIMEOUT, &addr);
+	int elapsed = (esp_timer_get_time() - start) / 1000;
+	if (err != ESP_OK) {
+		if (err == ESP_ERR_NOT_FOUND) {
+			ESP_LOGW(TAG, "%s: Host was not found! %dms", host, elapsed);
+		} else {
+			ESP_LOGE(TAG, "%s: Query Failed: %s", host, esp_err_to_name(err));
+		}
+		return err;
+	}
+	sprintf(ip, IPSTR, IP2STR(&addr));
+	ESP_LOGI(TAG, "%s resolved to %s in %dms", host, ip, elapsed);
+	return ESP_OK;
+}
+
+#if CONFIG_RESOLVER_CACHE
+#if CONFIG_RESOLVER_NVS
+// NVS keys are limited to 15 characters, so the key is a hash of the host name
+static void nvs_key(const char *host, char *key)
+{
+	uint32_t hash = 5381;
+	for (const char *p=host;*p;p++) hash = hash * 33 + (uint8_t)*p;
+	sprintf(key, "h%08"PRIx32, hash);
+}
+
+static esp_err_t load_address(const char *host, char *ip)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open("resolver", NVS_READONLY, &handle);
+	if (err != ESP_OK) return err;
+	char key[16];
+	nvs_key(host, key);
+	size_t size = RESOLVER_IP_MAX;
+	err = nvs_get_str(handle, key, ip, &size);
+	nvs_close(handle);
+	return err;
+}
+
+static void save_address(const char *host, const char *ip)
+{
+	nvs_handle_t handle;
+	esp_err_t err = nvs_open("resolver", NVS_READWRITE, &handle);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "nvs_open fail %s", esp_err_to_name(err));
+		return;
+	}
+	char key[16];
+	nvs_key(host, key);
+	err = nvs_set_str(handle, key, ip);
+	if (err == ESP_OK) err = nvs_commit(handle);
+	if (err != ESP_OK) ESP_LOGE(TAG, "nvs_set_str fail %s", esp_err_to_name(err));
+	nvs_close(handle);
+}
+#endif
+
+// Must be called with resolver_mutex taken
+static RESOLVER_ENTRY_t *find_entry(const char *host, bool create)
+{
+	RESOLVER_ENTRY_t *oldest = &entries[0];
+	for (int i=0;i<RESOLVER_CACHE_SIZE;i++) {
+		if (strcmp(entries[i].host, host) == 0) return &entries[i];
+		if (entries[i].host[0] == 0) {
+			oldest = &entries[i];
+		} else if (oldest->host[0] != 0 && entries[i].expire < oldest->expire) {
+			oldest = &entries[i];
+		}
+	}
+	if (create == false) return NULL;
+	memset(oldest, 0, sizeof(RESOLVER_ENTRY_t));
+	copy_string(oldest->host, host, sizeof(oldest->host));
+	return oldest;
+}
+
+// Store a new address. Returns true when the address changed.
+static bool update_entry(const char *host, const char *ip)
+{
+	bool changed = false;
+	xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+	RESOLVER_ENTRY_t *entry = find_entry(host, true);
+	if (entry->valid == false || strcmp(entry->ip, ip) != 0) {
+		if (entry->valid) ESP_LOGW(TAG, "%s moved from %s to %s", host, entry->ip, ip);
+		changed = true;
+	}
+	strcpy(entry->ip, ip);
+	entry->valid = true;
+	entry->refresh = false;
+	entry->expire = esp_timer_get_time() + CONFIG_RESOLVER_TTL * 1000000LL;
+	xSemaphoreGive(resolver_mutex);
+#if CONFIG_RESOLVER_NVS
+	if (changed) save_address(host, ip);
+#endif
+	return changed;
+}
+
+static void resolver_task(void *pvParameters)
+{
+	TickType_t wait = portMAX_DELAY;
+	while(1) {
+		ulTaskNotifyTake(pdTRUE, wait);
+		wait = portMAX_DELAY;
+		for (int i=0;i<RESOLVER_CACHE_SIZE;i++) {
+			char host[RESOLVER_HOST_MAX];
+			xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+			bool refresh = entries[i].refresh;
+			strcpy(host, entries[i].host);
+			xSemaphoreGive(resolver_mutex);
+			if (refresh == false) continue;
+
+			char ip[RESOLVER_IP_MAX];
+			if (query_mdns(host, ip) == ESP_OK) {
+				update_entry(host, ip);
+			} else {
+				// Keep the old address and try again later
+				wait = pdMS_TO_TICKS(CONFIG_RESOLVER_RETRY_INTERVAL * 1000);
+			}
+		}
+	}
+	vTaskDelete(NULL);
+}
+#endif // CONFIG_RESOLVER_CACHE
+
+esp_err_t resolver_init(void)
+{
+#if CONFIG_RESOLVER_CACHE
+	if (resolver_mutex) return ESP_OK;
+	resolver_mutex = xSemaphoreCreateMutex();
+	if (resolver_mutex == NULL) return ESP_ERR_NO_MEM;
+	if (xTaskCreate(&resolver_task, "RESOLVER", 1024*3, NULL, 2, &resolver_task_handle) != pdPASS) {
+		return ESP_ERR_NO_MEM;
+	}
+#endif
+	return ESP_OK;
+}
+
+// Resolve the host name. Waits for an mDNS query only when no address is known.
+// On failure, the host name is copied to ip.
+esp_err_t resolver_resolve(const char *host, char *ip, size_t size)
+{
+	if (is_mdns_host(host) == false) {
+		copy_string(ip, host, size);
+		return ESP_OK;
+	}
+
+#if CONFIG_RESOLVER_CACHE
+	if (resolver_get(host, ip, size) == ESP_OK) return ESP_OK;
+#endif
+
+	char _ip[RESOLVER_IP_MAX];
+	esp_err_t err = query_mdns(host, _ip);
+	if (err != ESP_OK) {
+		copy_string(ip, host, size);
+		return err;
+	}
+#if CONFIG_RESOLVER_CACHE
+	update_entry(host, _ip);
+#endif
+	copy_string(ip, _ip, size);
+	return ESP_OK;
+}
+
+// Return the cached address without waiting for the network.
+// An expired address is returned and refreshed in the background.
+esp_err_t resolver_get(const char *host, char *ip, size_t size)
+{
+	if (is_mdns_host(host) == false) {
+		copy_string(ip, host, size);
+		return ESP_OK;
+	}
+#if CONFIG_RESOLVER_CACHE
+	if (resolver_mutex == NULL) return ESP_ERR_INVALID_STATE;
+	esp_err_t err = ESP_ERR_NOT_FOUND;
+	bool notify = false;
+	xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+	RESOLVER_ENTRY_t *entry = find_entry(host, false);
+#if CONFIG_RESOLVER_NVS
+	if (entry == NULL) {
+		char _ip[RESOLVER_IP_MAX];
+		if (load_address(host, _ip) == ESP_OK) {
+			// Use the last good address now, and check it in the background
+			ESP_LOGI(TAG, "%s is %s in NVS", host, _ip);
+			entry = find_entry(host, true);
+			strcpy(entry->ip, _ip);
+			entry->valid = true;
+			entry->expire = 0;
+		}
+	}
+#endif
+	if (entry && entry->valid) {
+		copy_string(ip, entry->ip, size);
+		if (entry->expire <= esp_timer_get_time() && entry->refresh == false) {
+			entry->refresh = true;
+			notify = true;
+		}
+		err = ESP_OK;
+	}
+	xSemaphoreGive(resolver_mutex);
+	if (notify) xTaskNotifyGive(resolver_task_handle);
+	return err;
+#else
+	return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// Report a connection failure. The address is refreshed in the background.
+void resolver_invalidate(const char *host)
+{
+#if CONFIG_RESOLVER_CACHE
+	if (is_mdns_host(host) == false || resolver_mutex == NULL) return;
+	bool notify = false;
+	xSemaphoreTake(resolver_mutex, portMAX_DELAY);
+	RESOLVER_ENTRY_t *entry = find_entry(host, false);
+	if (entry && entry->refresh == false) {
+		entry->expire = 0;
+		entry->refresh = true;
+		notify = true;
+	}
+	xSemaphoreGive(resolver_mutex);
+	if (notify) xTaskNotifyGive(resolver_task_handle);
+#endif
+}
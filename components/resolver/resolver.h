@@ -0,0 +1,20 @@
+/* mDNS host name resolver with a cache
+ *
+ * Host names ending with ".local" are resolved with mDNS.
+ * Other host names are returned as they are.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _RESOLVER_H
+#define _RESOLVER_H
+
+#include <stddef.h>
+#include "esp_err.h"
+
+esp_err_t resolver_init(void);
+esp_err_t resolver_resolve(const char *host, char *ip, size_t size);
+esp_err_t resolver_get(const char *host, char *ip, size_t size);
+void resolver_invalidate(const char *host);
+
+#endif
@@ -0,0 +1,176 @@
+/* Packet trace
+ *
+ * This sample code is in the public domain.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "trace.h"
+
+static const char *stage_names[TRACE_STAGE_LAST] = {
+	[TRACE_RX_ISR] = "isr",
+	[TRACE_RX_WAKEUP] = "wakeup",
+	[TRACE_RX_READ] = "receiveData",
+	[TRACE_RX_QUEUE] = "enqueue",
+	[TRACE_UP_DEQUEUE] = "uplink_queue",
+	[TRACE_UP_SEND] = "batch",
+	[TRACE_UP_DONE] = "transport",
+	[TRACE_TX_QUEUE] = "downlink",
+	[TRACE_TX_START] = "radio_queue",
+	[TRACE_TX_DONE] = "sendData",
+};
+
+const char *trace_stage_name(TRACE_STAGE_t stage)
+{
+	if (stage >= TRACE_STAGE_LAST) return "unknown";
+	return stage_names[stage];
+}
+
+#if CONFIG_TRACE
+
+static const char *TAG = "TRACE";
+
+// A power of 2, so the index wraps with a mask
+#define TRACE_SIZE ( \
+	CONFIG_TRACE_EVENTS >= 16384 ? 16384 : CONFIG_TRACE_EVENTS >= 8192 ? 8192 : \
+	CONFIG_TRACE_EVENTS >= 4096 ? 4096 : CONFIG_TRACE_EVENTS >= 2048 ? 2048 : \
+	CONFIG_TRACE_EVENTS >= 1024 ? 1024 : CONFIG_TRACE_EVENTS >= 512 ? 512 : \
+	CONFIG_TRACE_EVENTS >= 256 ? 256 : CONFIG_TRACE_EVENTS >= 128 ? 128 : 64)
+
+typedef struct {
+	int64_t time;		// esp_timer_get_time()
+	uint32_t id;
+	uint16_t stage;
+	uint16_t reserved;
+	uint32_t seq;		// Index + 1 when the event is complete, 0 while it is written
+} TRACE_EVENT_t;
+
+static TRACE_EVENT_t trace_ring[TRACE_SIZE];
+static uint32_t trace_head;		// Index of the next event
+static uint32_t trace_dumped;	// Index of the first event not dumped yet
+
+// Each writer claims a slot with one atomic add.
+// The reader checks seq before and after copying, like a seqlock,
+// and skips an event that was being written or overwritten.
+void trace_stamp(uint32_t id, TRACE_STAGE_t stage, int64_t time)
+{
+	uint32_t index = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+	TRACE_EVENT_t *event = &trace_ring[index & (TRACE_SIZE - 1)];
+	__atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	event->time = time;
+	event->id = id;
+	event->stage = stage;
+	__atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+static bool trace_read(uint32_t index, TRACE_EVENT_t *copy)
+{
+	TRACE_EVENT_t *event = &trace_ring[index & (TRACE_SIZE - 1)];
+	uint32_t seq = __atomic_load_n(&event->seq, __ATOMIC_ACQUIRE);
+	if (seq != index + 1) return false;
+	copy->time = event->time;
+	copy->id = event->id;
+	copy->stage = event->stage;
+	copy->seq = seq;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&event->seq, __ATOMIC_RELAXED) == seq;
+}
+
+static int trace_pid(uint16_t stage)
+{
+	return stage >= TRACE_TX_QUEUE ? 2 : 1;
+}
+
+// Print the events recorded since the last dump.
+// Each stage is a span from the previous stage of the same packet.
+// The previous stage may be in an earlier dump, as long as it is still in the ring.
+void trace_dump(void)
+{
+	TRACE_EVENT_t *events = malloc(TRACE_SIZE * sizeof(TRACE_EVENT_t));
+	if (events == NULL) {
+		ESP_LOGE(TAG, "Not enough memory to dump");
+		return;
+	}
+	uint32_t head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+	uint32_t first = head > TRACE_SIZE ? head - TRACE_SIZE : 0;
+	uint32_t dumped = trace_dumped;
+	if ((int32_t)(dumped - first) < 0) {
+		ESP_LOGW(TAG, "%"PRIu32" events were overwritten before the dump", first - dumped);
+		dumped = first;
+	}
+	int count = 0;
+	for (uint32_t index=first;index!=head;index++) {
+		if (trace_read(index, &events[count])) count++;
+	}
+	trace_dumped = head;
+
+	printf("{\"traceEvents\":[\n");
+	for (int i=0;i<count;i++) {
+		const TRACE_EVENT_t *event = &events[i];
+		if ((int32_t)(event->seq - 1 - dumped) < 0) continue;
+		int pid = trace_pid(event->stage);
+		const TRACE_EVENT_t *previous = NULL;
+		for (int j=i-1;j>=0;j--) {
+			if (events[j].id == event->id && trace_pid(events[j].stage) == pid && events[j].stage < event->stage) {
+				previous = &events[j];
+				break;
+			}
+		}
+		if (previous) {
+			printf("{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%"PRId64",\"dur\":%"PRId64",\"pid\":%d,\"tid\":%"PRIu32",\"args\":{\"id\":%"PRIu32"}},\n",
+				stage_names[event->stage], previous->time, event->time - previous->time, pid, event->id, event->id);
+		} else {
+			printf("{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%"PRId64",\"pid\":%d,\"tid\":%"PRIu32",\"args\":{\"id\":%"PRIu32"}},\n",
+				stage_names[event->stage], event->time, pid, event->id, event->id);
+		}
+	}
+	printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"uplink\"}},\n");
+	printf("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"downlink\"}}\n");
+	printf("]}\n");
+	fflush(stdout);
+	free(events);
+}
+
+static void trace_dump_task(void *pvParameters)
+{
+	while(1) {
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_TRACE_DUMP_INTERVAL * 1000));
+		trace_dump();
+	}
+	vTaskDelete(NULL);
+}
+
+esp_err_t trace_init(void)
+{
+	static TaskHandle_t dump_task;
+	ESP_LOGI(TAG, "%d events", TRACE_SIZE);
+	if (CONFIG_TRACE_DUMP_INTERVAL > 0 && dump_task == NULL) {
+		if (xTaskCreate(&trace_dump_task, "TRACE", 1024*3, NULL, 1, &dump_task) != pdPASS) return ESP_ERR_NO_MEM;
+	}
+	return ESP_OK;
+}
+
+#else
+
+void trace_stamp(uint32_t id, TRACE_STAGE_t stage, int64_t time)
+{
+}
+
+void trace_dump(void)
+{
+}
+
+esp_err_t trace_init(void)
+{
+	return ESP_OK;
+}
+
+#endif // CONFIG_TRACE
@@ -0,0 +1,50 @@
+/* Packet trace
+ *
+ * Each packet gets a trace id, and each stage it passes records a time stamp
+ * in a ring buffer. Any task and any core can record without a lock.
+ * trace_dump() prints the new events as Chrome trace JSON, which
+ * chrome://tracing and https://ui.perfetto.dev open directly.
+ * trace.py turns the dumps into latency percentiles of each stage.
+ *
+ * This sample code is in the public domain.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+
+// In the order a packet passes them.
+// The dump names the span that ends at each stage.
+typedef enum {
+	// Radio to network. The id is BRIDGE_PACKET_t.seq.
+	TRACE_RX_ISR = 0,	// "isr"          GDO0 interrupt at the end of the packet
+	TRACE_RX_WAKEUP,	// "wakeup"       The radio task woke up
+	TRACE_RX_READ,		// "receiveData"  receiveData() returned
+	TRACE_RX_QUEUE,		// "enqueue"      Queued to the uplink task
+	TRACE_UP_DEQUEUE,	// "uplink_queue" Taken from the queue by the uplink task
+	TRACE_UP_SEND,		// "batch"        Passed to the transport with its batch
+	TRACE_UP_DONE,		// "transport"    The transport delivered the batch
+	// Network to radio. Counted separately.
+	TRACE_TX_QUEUE,		// "downlink"     Queued to the radio task
+	TRACE_TX_START,		// "radio_queue"  Taken from the queue by the radio task
+	TRACE_TX_DONE,		// "sendData"     sendData() returned
+	TRACE_STAGE_LAST
+} TRACE_STAGE_t;
+
+#if CONFIG_TRACE
+#define TRACE_STAMP(id, stage) trace_stamp((id), (stage), esp_timer_get_time())
+#define TRACE_STAMP_AT(id, stage, time) trace_stamp((id), (stage), (time))
+#else
+#define TRACE_STAMP(id, stage) do { } while (0)
+#define TRACE_STAMP_AT(id, stage, time) do { (void)(time); } while (0)
+#endif
+
+esp_err_t trace_init(void);
+void trace_stamp(uint32_t id, TRACE_STAGE_t stage, int64_t time);
+void trace_dump(void);
+const char *trace_stage_name(TRACE_STAGE_t stage);
+
+#endif
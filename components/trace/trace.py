@@ -0,0 +1,94 @@
+#!/usr/bin/python3
+#-*- encoding: utf-8 -*-
+#
+# Latency of each stage from the dumps of the packet trace.
+# Only the standard library is used.
+#
+# The input is the console output with one or more dumps, mixed with log lines,
+# or a Chrome trace JSON file.
+#
+# python3 ./trace.py console.txt
+# python3 ./trace.py console.txt --output trace.json   # Open it in https://ui.perfetto.dev
+
+import argparse
+import json
+import sys
+
+# Stages in the order a packet passes them. See trace.h.
+UPLINK = ('wakeup', 'receiveData', 'enqueue', 'uplink_queue', 'batch', 'transport')
+DOWNLINK = ('radio_queue', 'sendData')
+
+def load(paths):
+	events = []
+	for path in paths:
+		with open(path, errors='replace') as f:
+			text = f.read()
+		try:
+			# A Chrome trace file
+			events.extend(json.loads(text)['traceEvents'])
+			continue
+		except (ValueError, KeyError, TypeError):
+			pass
+		# Console output. Each event is on its own line.
+		for line in text.splitlines():
+			line = line.strip()
+			if not line.startswith('{"name":'): continue
+			try:
+				events.append(json.loads(line.rstrip(',')))
+			except ValueError:
+				pass
+	return events
+
+def percentile(values, p):
+	index = int(p * (len(values) - 1) / 100 + 0.5)
+	return values[index]
+
+def print_table(title, rows):
+	print(title)
+	print('{:<16} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9}'.format('stage', 'count', 'p50 us', 'p90 us', 'p99 us', 'max us', 'avg us'))
+	for name, values in rows:
+		if not values: continue
+		values = sorted(values)
+		print('{:<16} {:>7} {:>9} {:>9} {:>9} {:>9} {:>9.1f}'.format(name, len(values),
+			percentile(values, 50), percentile(values, 90), percentile(values, 99), values[-1], sum(values) / len(values)))
+
+def main():
+	parser = argparse.ArgumentParser()
+	parser.add_argument('input', nargs='+', help='Console output or Chrome trace JSON')
+	parser.add_argument('--output', help='Write all the events to one Chrome trace JSON file')
+	args = parser.parse_args()
+
+	events = load(args.input)
+	spans = [e for e in events if e.get('ph') == 'X']
+	if not spans:
+		print('No trace events found')
+		sys.exit(1)
+
+	stages = {}
+	packets = {}	# (pid, id) --> [first ts, last ts, stages]
+	for e in spans:
+		stages.setdefault((e['pid'], e['name']), []).append(e['dur'])
+		key = (e['pid'], e['tid'])
+		packet = packets.setdefault(key, [e['ts'], e['ts'] + e['dur'], set()])
+		packet[0] = min(packet[0], e['ts'])
+		packet[1] = max(packet[1], e['ts'] + e['dur'])
+		packet[2].add(e['name'])
+
+	# End to end only for packets with every stage
+	uplink = [p[1] - p[0] for k, p in packets.items() if k[0] == 1 and p[2].issuperset(UPLINK)]
+	downlink = [p[1] - p[0] for k, p in packets.items() if k[0] == 2 and p[2].issuperset(DOWNLINK)]
+
+	rows = [(name, stages.get((1, name), [])) for name in UPLINK]
+	rows.append(('total', uplink))
+	print_table('uplink: GDO0 interrupt to the transport', rows)
+	print()
+	rows = [(name, stages.get((2, name), [])) for name in DOWNLINK]
+	rows.append(('total', downlink))
+	print_table('downlink: transport to sendData()', rows)
+
+	if args.output:
+		with open(args.output, 'w') as f:
+			json.dump({'traceEvents': events}, f)
+
+if __name__ == '__main__':
+	main()
@@ -4,11 +4,17 @@
 # https://qiita.com/tkj/items/210a66213667bc038110
 
 import argparse
+import os
+import sys
 from http.server import HTTPServer
 from http.server import BaseHTTPRequestHandler
 from urllib.parse import urlparse
 from urllib.parse import parse_qs
 
+# Decoder of the binary envelope
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '../components/envelope'))
+import envelope
+
 class class1(BaseHTTPRequestHandler):
 	def do_POST(self):
 		#parsed = urlparse(self.path)
@@ -17,9 +23,13 @@ class class1(BaseHTTPRequestHandler):
 		#print("params={}".format(params))
 		content_len  = int(self.headers.get("content-length"))
 		#print("content_len={}".format(content_len))
-		req_body = self.rfile.read(content_len).decode("utf-8")
-		#print("req_body={}".format(req_body))
-		print("{}".format(req_body))
+		req_body = self.rfile.read(content_len)
+		if self.headers.get("content-type") == "application/cbor-seq":
+			for item in envelope.decode_seq(req_body):
+				envelope.print_envelope(item)
+		else:
+			#print("req_body={}".format(req_body))
+			print("{}".format(req_body.decode("utf-8")))
 
 		body = "OK"
 		self.send_response(200)
@@ -12,16 +12,16 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_wifi.h"
 #include "esp_tls.h"
 #include "esp_http_client.h"
 
-static const char *TAG = "CLIENT";
+#include "bridge.h"
+#include "resolver.h"
 
-extern MessageBufferHandle_t xMessageBufferTrans;
-extern size_t xItemSize;
+static const char *TAG = "CLIENT";
 
 esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
@@ -109,7 +109,7 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 
 #define MAX_HTTP_OUTPUT_BUFFER 128
 
-esp_err_t http_post_with_url(char *url, char * post_data, size_t post_len)
+esp_err_t http_post_with_url(char *url, char * post_data, size_t post_len, const char *content_type)
 {
 	ESP_LOGI(TAG, "http_post_with_url url=[%s]", url);
 	char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER] = {0};
@@ -146,15 +146,18 @@ esp_err_t http_post_with_url(char *url, char * post_data, size_t post_len)
 
 	// POST
 	esp_http_client_set_method(client, HTTP_METHOD_POST);
-	esp_http_client_set_header(client, "Content-Type", "application/json");
+	esp_http_client_set_header(client, "Content-Type", content_type);
 	//esp_http_client_set_post_field(client, post_data, strlen(post_data));
 	esp_http_client_set_post_field(client, post_data, post_len);
 	esp_err_t err = esp_http_client_perform(client);
 	if (err == ESP_OK) {
+		int status = esp_http_client_get_status_code(client);
 		ESP_LOGI(TAG, "HTTP POST Status = %d, content_length = %d",
-			esp_http_client_get_status_code(client),
+			status,
 			(int)esp_http_client_get_content_length(client));
 		ESP_LOGI(TAG, "local_response_buffer=[%s]", local_response_buffer);
+		// Server errors are retried
+		if (status >= 500) err = ESP_FAIL;
 	} else {
 		ESP_LOGE(TAG, "HTTP POST request failed: %s", esp_err_to_name(err));
 	}
@@ -163,38 +166,51 @@ esp_err_t http_post_with_url(char *url, char * post_data, size_t post_len)
 	return err;
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip);
-void convert_mdns_host(char * from, char * to);
-
-void http_client(void *pvParameters)
+// Send the packets in one POST request.
+// Text packets are separated by newline. Envelopes are a CBOR sequence.
+static esp_err_t http_send_batch(const BRIDGE_PACKET_t *packets, int count, void *ctx)
 {
-	ESP_LOGI(TAG, "Start WEB_SERVER_HOST:%s WEB_SERVER_PORT:%d", CONFIG_WEB_SERVER_HOST, CONFIG_WEB_SERVER_PORT);
-
 	// Resolve mDNS host name
+	// The cached address is used, so this does not wait for the network
 	char ip[128];
-	ESP_LOGI(TAG, "CONFIG_WEB_SERVER_HOST=[%s]", CONFIG_WEB_SERVER_HOST);
-	convert_mdns_host(CONFIG_WEB_SERVER_HOST, ip);
-	ESP_LOGI(TAG, "ip=[%s]", ip);
 	char url[142];
+	resolver_resolve(CONFIG_WEB_SERVER_HOST, ip, sizeof(ip));
 	sprintf(url, "http://%s:%d", ip, CONFIG_WEB_SERVER_PORT);
-	ESP_LOGI(TAG, "url=[%s]", url);
-
-	char buffer[xItemSize];
-	while (1) {
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buffer, sizeof(buffer), portMAX_DELAY);
-		ESP_LOGI(TAG, "xMessageBufferReceive received=%d", received);
-		if (received > 0) {
-			ESP_LOGI(TAG, "xMessageBufferReceive buffer=[%.*s]",received, buffer);
-			//http_post_with_url("http://192.168.10.46:8000", buffer, received);
-			if (http_post_with_url(url, buffer, received) != ESP_OK) {
-				ESP_LOGE(TAG, "http_post_with_url fail");
-			}
-		} else {
-			ESP_LOGE(TAG, "xMessageBufferReceive fail");
-			break;
-		}
-	} // end while
+	ESP_LOGD(TAG, "url=[%s]", url);
+
+	esp_err_t err;
+#if !CONFIG_BRIDGE_ENVELOPE
+	char body[CONFIG_BRIDGE_BATCH_MAX * (BRIDGE_PAYLOAD_MAX + 1)];
+	size_t body_len = 0;
+	for (int i=0;i<count;i++) {
+		if (i) body[body_len++] = '\n';
+		memcpy(&body[body_len], packets[i].data, packets[i].length);
+		body_len += packets[i].length;
+	}
+	ESP_LOGI(TAG, "count=%d body=[%.*s]", count, body_len, body);
+	err = http_post_with_url(url, body, body_len, "text/plain");
+#else
+	char body[CONFIG_BRIDGE_BATCH_MAX * BRIDGE_ENCODED_MAX];
+	size_t body_len = 0;
+	for (int i=0;i<count;i++) {
+		body_len += bridge_encode(&packets[i], (uint8_t *)&body[body_len], sizeof(body) - body_len);
+	}
+	ESP_LOGI(TAG, "count=%d body_len=%d", count, body_len);
+	err = http_post_with_url(url, body, body_len, "application/cbor-seq");
+#endif
+	// The server may have moved to another address
+	if (err != ESP_OK) resolver_invalidate(CONFIG_WEB_SERVER_HOST);
+	return err;
+}
 
-	// Stop connection
-	vTaskDelete(NULL);
+static bool http_connected(void *ctx)
+{
+	wifi_ap_record_t ap_info;
+	return esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK;
 }
+
+const BRIDGE_TRANSPORT_t http_client_transport = {
+	.name = "http_client",
+	.send_batch = http_send_batch,
+	.connected = http_connected,
+};
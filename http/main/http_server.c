@@ -12,14 +12,12 @@
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
 
-static const char *TAG = "SERVER";
+#include "bridge.h"
 
-extern MessageBufferHandle_t xMessageBufferRecv;
-extern size_t xItemSize;
+static const char *TAG = "SERVER";
 
 /* root post handler */
 static esp_err_t root_post_handler(httpd_req_t *req)
@@ -44,13 +42,10 @@ static esp_err_t root_post_handler(httpd_req_t *req)
 	/* Log data received */
 	ESP_LOGI(TAG, "%.*s", req->content_len, buf);
 
-	// Queries a message buffer to see how much free space it contains
-	size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferRecv );
-	ESP_LOGI(TAG, "spacesAvailable=%d", spacesAvailable);
-	if (req->content_len > xItemSize) req->content_len = xItemSize;
-	size_t sended = xMessageBufferSend(xMessageBufferRecv, buf, req->content_len, 100);
-	if (sended != req->content_len) {
-		ESP_LOGE(TAG, "xMessageBufferSend fail. sended=%d req->content_len=%d", sended, req->content_len);
+	// Send to radio. Long data is split into several packets.
+	esp_err_t err = bridge_transmit((uint8_t *)buf, req->content_len, pdMS_TO_TICKS(100));
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "bridge_transmit fail. req->content_len=%d", req->content_len);
 	}
 	free(buf);
 
@@ -79,6 +74,10 @@ esp_err_t start_server(int port)
 	config.lru_purge_enable = true;
 	// TCP Port number for receiving and transmitting HTTP traffic
 	config.server_port = port;
+	// Keep the server on the network core, away from the radio
+	BRIDGE_LAYOUT_t layout;
+	bridge_get_layout(&layout);
+	config.core_id = layout.network_core < 0 ? tskNO_AFFINITY : layout.network_core;
 
 	// Start the httpd server
 	if (httpd_start(&server, &config) != ESP_OK) {
@@ -1,17 +1,30 @@
 # https://qiita.com/masakielastic/items/05cd6a36bb6fb10fccf6
 import argparse
+import os
+import sys
 from http.server import HTTPServer
 from http.server import BaseHTTPRequestHandler
 import ssl
 
+# Decoder of the binary envelope
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '../components/envelope'))
+import envelope
+
 class my_handler(BaseHTTPRequestHandler):
+	# Keep the connection open for the following requests
+	protocol_version = "HTTP/1.1"
+
 	def do_POST(self):
 		if (args.print): print(self.headers)
 		content_len  = int(self.headers.get("content-length"))
 		#print("content_len={}".format(content_len))
-		req_body = self.rfile.read(content_len).decode("utf-8")
-		#print("req_body={}".format(req_body))
-		print("{}".format(req_body))
+		req_body = self.rfile.read(content_len)
+		if self.headers.get("content-type") == "application/cbor-seq":
+			for item in envelope.decode_seq(req_body):
+				envelope.print_envelope(item)
+		else:
+			#print("req_body={}".format(req_body))
+			print("{}".format(req_body.decode("utf-8")))
 
 		body = "OK"
 		self.send_response(200)
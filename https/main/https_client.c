@@ -12,32 +12,85 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include <string.h>
+#include <strings.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "esp_tls.h"
 
-static const char *TAG = "HTTPS_CLIENT";
+#include "bridge.h"
+#include "resolver.h"
 
-extern MessageBufferHandle_t xMessageBufferTrans;
-extern size_t xItemSize;
+static const char *TAG = "HTTPS_CLIENT";
 
 extern const uint8_t server_crt_start[] asm("_binary_server_crt_start");
 extern const uint8_t server_crt_end[]	asm("_binary_server_crt_end");
 
-static esp_err_t https_request(esp_tls_cfg_t cfg, char *url, char *request)
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+static esp_tls_client_session_t *tls_client_session = NULL;
+#endif
+
+#define PIPELINE_DEPTH		CONFIG_HTTPS_PIPELINE_DEPTH
+#define COALESCE_MAX		CONFIG_HTTPS_COALESCE_MAX
+#define PAYLOAD_MAX			BRIDGE_PAYLOAD_MAX
+#if CONFIG_BRIDGE_ENVELOPE
+#define BODY_MAX			(COALESCE_MAX * BRIDGE_ENCODED_MAX)
+#define CONTENT_TYPE		"application/cbor-seq"
+#else
+#define BODY_MAX			(COALESCE_MAX * (PAYLOAD_MAX + 1))
+#define CONTENT_TYPE		"application/json"
+#endif
+#define HEADER_MAX			256
+#define TIMEOUT_MS			5000
+#define RETRY_MAX			3
+#define LATENCY_SAMPLES		256
+#define STATS_INTERVAL_MS	10000
+
+// One POST request. Several packets are coalesced into a body separated by newline,
+// or into a CBOR sequence of envelopes with CONFIG_BRIDGE_ENVELOPE.
+typedef struct {
+	char request[HEADER_MAX + BODY_MAX];
+	size_t length;
+	int packets;
+	int retry;
+	int64_t rx_time[COALESCE_MAX];
+} REQUEST_t;
+
+// Bytes read from the server. Pipelined responses can arrive in one read.
+typedef struct {
+	char buf[1024];
+	size_t len;
+	bool close;
+} RESPONSE_t;
+
+typedef struct {
+	uint32_t latency[LATENCY_SAMPLES];
+	int samples;
+	uint32_t requests;
+	uint32_t packets;
+	uint32_t connects;
+	uint32_t errors;
+	uint32_t dropped;
+} STATS_t;
+
+static esp_tls_t *https_connect(esp_tls_cfg_t *cfg, char *url)
 {
 	esp_tls_t *tls = esp_tls_init();
 	if (!tls) {
 		ESP_LOGE(TAG, "Failed to allocate esp_tls handle!");
-		return ESP_FAIL;
+		return NULL;
 	}
 
-	if (esp_tls_conn_http_new_sync(url, &cfg, tls) == 1) {
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+	/* Resume the previous session to skip the full handshake */
+	cfg->client_session = tls_client_session;
+#endif
+	if (esp_tls_conn_http_new_sync(url, cfg, tls) == 1) {
 		ESP_LOGI(TAG, "Connection established...");
 	} else {
 		ESP_LOGE(TAG, "Connection failed...");
@@ -50,80 +103,197 @@ static esp_err_t https_request(esp_tls_cfg_t cfg, char *url, char *request)
 			ESP_LOGE(TAG, "TLS error = -0x%x, TLS flags = -0x%x", esp_tls_code, esp_tls_flags);
 		}
 		esp_tls_conn_destroy(tls);
-		return ESP_FAIL;
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+		/* The session may have been rejected. Start over with a full handshake */
+		esp_tls_free_client_session(tls_client_session);
+		tls_client_session = NULL;
+#endif
+		return NULL;
 	}
 
-#ifdef CONFIG_EXAMPLE_CLIENT_SESSION_TICKETS
+#ifdef CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
 	/* The TLS session is successfully established, now saving the session ctx for reuse */
-	if (save_client_session) {
-		esp_tls_free_client_session(tls_client_session);
-		tls_client_session = esp_tls_get_client_session(tls);
-	}
+	esp_tls_free_client_session(tls_client_session);
+	tls_client_session = esp_tls_get_client_session(tls);
 #endif
+	return tls;
+}
 
-	ESP_LOGI(TAG, "Writing HTTP request...");
+static void https_close(esp_tls_t **tls)
+{
+	if (*tls == NULL) return;
+	esp_tls_conn_destroy(*tls);
+	*tls = NULL;
+}
+
+static esp_err_t https_write(esp_tls_t *tls, char *request, size_t length)
+{
 	size_t written_bytes = 0;
-	ssize_t ssize;
+	int64_t deadline = esp_timer_get_time() + TIMEOUT_MS * 1000LL;
 	do {
-		ssize = esp_tls_conn_write(tls, request + written_bytes, strlen(request) - written_bytes);
+		ssize_t ssize = esp_tls_conn_write(tls, request + written_bytes, length - written_bytes);
 		if (ssize >= 0) {
-			ESP_LOGI(TAG, "%d bytes written", ssize);
+			ESP_LOGD(TAG, "%d bytes written", ssize);
 			written_bytes += ssize;
 		} else if (ssize != ESP_TLS_ERR_SSL_WANT_READ  && ssize != ESP_TLS_ERR_SSL_WANT_WRITE) {
 			ESP_LOGE(TAG, "esp_tls_conn_write  returned: [0x%02X](%s)", ssize, esp_err_to_name(ssize));
-			esp_tls_conn_destroy(tls);
 			return ESP_FAIL;
+		} else if (esp_timer_get_time() > deadline) {
+			ESP_LOGE(TAG, "esp_tls_conn_write timed out");
+			return ESP_FAIL;
+		} else {
+			vTaskDelay(1);
 		}
-	} while (written_bytes < strlen(request));
+	} while (written_bytes < length);
+	return ESP_OK;
+}
 
-	ESP_LOGI(TAG, "Reading HTTP response...");
-	char buf[512];
-	do {
-		int len = sizeof(buf) - 1;
-		memset(buf, 0x00, sizeof(buf));
-		ssize = esp_tls_conn_read(tls, (char *)buf, len);
+// Find the value of the header in the response header.
+static char *header_value(char *header, size_t header_len, const char *name)
+{
+	size_t name_len = strlen(name);
+	char *line = header;
+	while (line < header + header_len) {
+		char *eol = strstr(line, "\r\n");
+		if (eol == NULL || eol == line) break;
+		if (strncasecmp(line, name, name_len) == 0 && line[name_len] == ':') {
+			char *value = line + name_len + 1;
+			while (*value == ' ') value++;
+			return value;
+		}
+		line = eol + 2;
+	}
+	return NULL;
+}
+
+// Read one response.
+// Returns the HTTP status code, or -1 when the connection is lost
+// or the response does not arrive within TIMEOUT_MS.
+static int https_read_response(esp_tls_t *tls, RESPONSE_t *res)
+{
+	int64_t deadline = esp_timer_get_time() + TIMEOUT_MS * 1000LL;
+	while (1) {
+		res->buf[res->len] = 0;
+		char *end = strstr(res->buf, "\r\n\r\n");
+		if (end) {
+			size_t header_len = end - res->buf + 4;
+			int status = -1;
+			sscanf(res->buf, "HTTP/%*d.%*d %d", &status);
+			size_t content_length = 0;
+			char *value = header_value(res->buf, header_len, "Content-Length");
+			if (value) content_length = atoi(value);
+			value = header_value(res->buf, header_len, "Connection");
+			if (value && strncasecmp(value, "close", 5) == 0) res->close = true;
+			if (strncmp(res->buf, "HTTP/1.0", 8) == 0) res->close = true;
+
+			size_t total = header_len + content_length;
+			if (total >= sizeof(res->buf)) {
+				ESP_LOGE(TAG, "Response too large %d", total);
+				return -1;
+			}
+			if (res->len >= total) {
+				ESP_LOGD(TAG, "status=%d body=[%.*s]", status, content_length, res->buf + header_len);
+				memmove(res->buf, res->buf + total, res->len - total);
+				res->len -= total;
+				return status;
+			}
+		}
 
+		if (res->len >= sizeof(res->buf) - 1) {
+			ESP_LOGE(TAG, "Response header too large");
+			return -1;
+		}
+		ssize_t ssize = esp_tls_conn_read(tls, res->buf + res->len, sizeof(res->buf) - 1 - res->len);
 		if (ssize == ESP_TLS_ERR_SSL_WANT_WRITE  || ssize == ESP_TLS_ERR_SSL_WANT_READ) {
+			if (esp_timer_get_time() > deadline) {
+				ESP_LOGE(TAG, "No response in %dms", TIMEOUT_MS);
+				return -1;
+			}
+			vTaskDelay(1);
 			continue;
 		} else if (ssize < 0) {
 			ESP_LOGE(TAG, "esp_tls_conn_read  returned [-0x%02X](%s)", -ssize, esp_err_to_name(ssize));
-			break;
+			return -1;
 		} else if (ssize == 0) {
 			ESP_LOGI(TAG, "connection closed");
-			break;
+			return -1;
 		}
-
 		ESP_LOGD(TAG, "%d bytes read", ssize);
-		/* Print response directly to stdout as it is read */
-		for (int i = 0; i < ssize; i++) {
-			putchar(buf[i]);
-		}
-		putchar('\n'); // JSON output doesn't have a newline at end
-	} while (1);
-
-	esp_tls_conn_destroy(tls);
-	return ESP_OK;
+		res->len += ssize;
+	}
 }
 
-static void makePostRequest(char * request, char * host, int port, char * payload, int length)
+static size_t makePostRequest(char * request, char * host, int port, char * payload, int length)
 {
 	char wk[64];
-	strcpy(request, "POST / HTTP/1.1\n");
-	//strcat(request, "User-Agent: ESP32 HTTPS Client/1.0\n");
-	sprintf(wk, "User-Agent: ESP-IDF/%d.%d\n", ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR);
+	strcpy(request, "POST / HTTP/1.1\r\n");
+	//strcat(request, "User-Agent: ESP32 HTTPS Client/1.0\r\n");
+	sprintf(wk, "User-Agent: ESP-IDF/%d.%d\r\n", ESP_IDF_VERSION_MAJOR, ESP_IDF_VERSION_MINOR);
 	strcat(request, wk);
-	//strcat(request, "Host: 192.168.0.40:8080\n");
-	sprintf(wk, "Host: %s:%d\n", host, port);
+	//strcat(request, "Host: 192.168.0.40:8080\r\n");
+	sprintf(wk, "Host: %s:%d\r\n", host, port);
 	strcat(request, wk);
-	strcat(request, "Content-Type: application/json\n");
-	//strcat(request, "Content-Length: 18\n\n");
-	sprintf(wk, "Content-Length: %d\n\n", length);
+	strcat(request, "Connection: keep-alive\r\n");
+	strcat(request, "Content-Type: " CONTENT_TYPE "\r\n");
+	//strcat(request, "Content-Length: 18\r\n\r\n");
+	sprintf(wk, "Content-Length: %d\r\n\r\n", length);
 	strcat(request, wk);
-	strcat(request, payload);
+	size_t header_len = strlen(request);
+	memcpy(request + header_len, payload, length);
+	return header_len + length;
+}
+
+// Build a request from the packets received from the radio.
+// Returns the number of coalesced packets.
+static int collect(REQUEST_t *req, char *host, TickType_t wait)
+{
+	BRIDGE_PACKET_t packet;
+	char body[BODY_MAX];
+	size_t body_len = 0;
+	req->packets = 0;
+	while (req->packets < COALESCE_MAX) {
+		if (bridge_receive(&packet, req->packets == 0 ? wait : 0) != ESP_OK) break;
+		ESP_LOGD(TAG, "packet=[%.*s] rssi=%d lqi=%d", packet.length, packet.data, packet.rssi, packet.lqi);
+		req->rx_time[req->packets] = packet.rx_time;
+#if CONFIG_BRIDGE_ENVELOPE
+		body_len += bridge_encode(&packet, (uint8_t *)&body[body_len], sizeof(body) - body_len);
+#else
+		if (body_len) body[body_len++] = '\n';
+		memcpy(&body[body_len], packet.data, packet.length);
+		body_len += packet.length;
+#endif
+		req->packets++;
+	}
+	if (req->packets == 0) return 0;
+	req->length = makePostRequest(req->request, host, CONFIG_HTTPS_SERVER_PORT, body, body_len);
+	req->retry = 0;
+	return req->packets;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint32_t _a = *(const uint32_t *)a;
+	uint32_t _b = *(const uint32_t *)b;
+	return (_a > _b) - (_a < _b);
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip);
-void convert_mdns_host(char * from, char * to);
+static void print_stats(STATS_t *stats)
+{
+	if (stats->requests) {
+		uint32_t median = 0, p99 = 0;
+		int samples = stats->samples < LATENCY_SAMPLES ? stats->samples : LATENCY_SAMPLES;
+		if (samples) {
+			uint32_t sorted[LATENCY_SAMPLES];
+			memcpy(sorted, stats->latency, samples * sizeof(uint32_t));
+			qsort(sorted, samples, sizeof(uint32_t), compare_latency);
+			median = sorted[samples / 2];
+			p99 = sorted[(samples * 99) / 100 < samples ? (samples * 99) / 100 : samples - 1];
+		}
+		ESP_LOGI(TAG, "requests=%"PRIu32" packets=%"PRIu32" latency median=%"PRIu32"ms p99=%"PRIu32"ms connects=%"PRIu32" errors=%"PRIu32" dropped=%"PRIu32,
+			stats->requests, stats->packets, median / 1000, p99 / 1000, stats->connects, stats->errors, stats->dropped);
+	}
+	memset(stats, 0, sizeof(STATS_t));
+}
 
 void https_client(void *pvParameters)
 {
@@ -132,34 +302,112 @@ void https_client(void *pvParameters)
 	// Resolve mDNS host name
 	char ip[128];
 	ESP_LOGI(TAG, "CONFIG_HTTPS_SERVER_HOST=[%s]", CONFIG_HTTPS_SERVER_HOST);
-	convert_mdns_host(CONFIG_HTTPS_SERVER_HOST, ip);
+	resolver_resolve(CONFIG_HTTPS_SERVER_HOST, ip, sizeof(ip));
 	ESP_LOGI(TAG, "ip=[%s]", ip);
 	char url[142];
-	sprintf(url, "https://%s:%d", ip, CONFIG_HTTPS_SERVER_PORT);
-	ESP_LOGI(TAG, "url=[%s]", url);
 
-	char buffer[xItemSize];
+	ESP_LOGI(TAG, "https_request using server.crt");
+	esp_tls_cfg_t cfg = {
+		.cacert_buf = (const unsigned char *) server_crt_start,
+		.cacert_bytes = server_crt_end - server_crt_start,
+		.timeout_ms = TIMEOUT_MS,
+	};
+
+	REQUEST_t *pipeline = calloc(PIPELINE_DEPTH, sizeof(REQUEST_t));
+	RESPONSE_t *response = calloc(1, sizeof(RESPONSE_t));
+	STATS_t *stats = calloc(1, sizeof(STATS_t));
+	if (pipeline == NULL || response == NULL || stats == NULL) {
+		ESP_LOGE(TAG, "calloc fail");
+		vTaskDelete(NULL);
+	}
+	int head = 0;
+	int inflight = 0;
+	esp_tls_t *tls = NULL;
+	int64_t stats_start = esp_timer_get_time();
+	bool stats_delivered = false;
+
 	while (1) {
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buffer, sizeof(buffer), portMAX_DELAY);
-		ESP_LOGI(TAG, "xMessageBufferReceive received=%d", received);
-		if (received > 0) {
-			ESP_LOGI(TAG, "xMessageBufferReceive buffer=[%.*s]",received, buffer);
-
-			ESP_LOGI(TAG, "https_request using server.crt");
-			esp_tls_cfg_t cfg = {
-				.cacert_buf = (const unsigned char *) server_crt_start,
-				.cacert_bytes = server_crt_end - server_crt_start,
-			};
-
-			char request[512];
-			makePostRequest(request, ip, CONFIG_HTTPS_SERVER_PORT, buffer, received);
-	
-			//https_request(cfg, "https://192.168.0.40:8000", request);
-			https_request(cfg, url, request);
+		// Send requests without waiting for the responses
+		TickType_t wait = (inflight == 0) ? pdMS_TO_TICKS(STATS_INTERVAL_MS) : 0;
+		while (inflight < PIPELINE_DEPTH) {
+			REQUEST_t *req = &pipeline[(head + inflight) % PIPELINE_DEPTH];
+			if (collect(req, ip, wait) == 0) break;
+			wait = 0;
+			inflight++;
+			if (tls == NULL) continue; // Sent after connecting
+			if (https_write(tls, req->request, req->length) != ESP_OK) {
+				stats->errors++;
+				https_close(&tls);
+			}
+		}
 
-		} else {
-			ESP_LOGE(TAG, "xMessageBufferReceive fail");
-			break;
+		if (inflight > 0 && tls == NULL) {
+			// Connect only when there is something to send, and send the pending requests again
+			if (pipeline[head].retry++ >= RETRY_MAX) {
+				ESP_LOGW(TAG, "Give up request. %d packets dropped", pipeline[head].packets);
+				stats->dropped += pipeline[head].packets;
+				head = (head + 1) % PIPELINE_DEPTH;
+				inflight--;
+				continue;
+			}
+			// The address is checked again on every connection
+			resolver_resolve(CONFIG_HTTPS_SERVER_HOST, ip, sizeof(ip));
+			sprintf(url, "https://%s:%d", ip, CONFIG_HTTPS_SERVER_PORT);
+			ESP_LOGI(TAG, "url=[%s]", url);
+			tls = https_connect(&cfg, url);
+			if (tls == NULL) {
+				// The server may have moved to another address
+				resolver_invalidate(CONFIG_HTTPS_SERVER_HOST);
+				vTaskDelay(pdMS_TO_TICKS(1000));
+				continue;
+			}
+			stats->connects++;
+			response->len = 0;
+			response->close = false;
+			for (int i=0;i<inflight;i++) {
+				REQUEST_t *req = &pipeline[(head + i) % PIPELINE_DEPTH];
+				if (https_write(tls, req->request, req->length) != ESP_OK) {
+					stats->errors++;
+					https_close(&tls);
+					break;
+				}
+			}
+			if (tls == NULL) continue;
+		}
+
+		if (inflight > 0) {
+			// Responses are returned in the order of the requests
+			int status = https_read_response(tls, response);
+			if (status < 0) {
+				// Keep the requests in the pipeline and send them again on a new connection
+				stats->errors++;
+				https_close(&tls);
+				continue;
+			}
+			if (status != 200) ESP_LOGW(TAG, "HTTP status %d", status);
+			REQUEST_t *req = &pipeline[head];
+			int64_t now = esp_timer_get_time();
+			if (stats_delivered == false) {
+				ESP_LOGI(TAG, "First packet delivered %"PRId64"ms after boot", now / 1000);
+				stats_delivered = true;
+			}
+			for (int i=0;i<req->packets;i++) {
+				stats->latency[stats->samples % LATENCY_SAMPLES] = now - req->rx_time[i];
+				stats->samples++;
+			}
+			stats->requests++;
+			stats->packets += req->packets;
+			head = (head + 1) % PIPELINE_DEPTH;
+			inflight--;
+			if (response->close) {
+				ESP_LOGI(TAG, "Server closed the connection");
+				https_close(&tls);
+			}
+		}
+
+		if (esp_timer_get_time() - stats_start >= STATS_INTERVAL_MS * 1000LL) {
+			print_stats(stats);
+			stats_start = esp_timer_get_time();
 		}
 	} // end while
 
@@ -10,7 +10,6 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
@@ -18,7 +17,8 @@
 #include "nvs_flash.h"
 #include "mdns.h"
 
-#include <cc1101.h>
+#include "bridge.h"
+#include "resolver.h"
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
@@ -32,14 +32,6 @@ static const char *TAG = "MAIN";
 
 static int s_retry_num = 0;
 
-MessageBufferHandle_t xMessageBufferTrans;
-MessageBufferHandle_t xMessageBufferRecv;
-
-// The total number of bytes (not single messages) the message buffer will be able to hold at any one time.
-size_t xBufferSizeBytes = 1024;
-// The size, in bytes, required to hold each item in the message,
-size_t xItemSize = 64; // Maximum Payload size of CC1101 is 64
-
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
 	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
@@ -133,103 +125,6 @@ esp_err_t wifi_init_sta(void)
 	return ret_value;
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip)
-{
-	ESP_LOGD(__FUNCTION__, "Query A: %s", host_name);
-
-	struct esp_ip4_addr addr;
-	addr.addr = 0;
-
-	esp_err_t err = mdns_query_a(host_name, 10000,	&addr);
-	if(err){
-		if(err == ESP_ERR_NOT_FOUND){
-			ESP_LOGW(__FUNCTION__, "%s: Host was not found!", host_name);
-		} else {
-			ESP_LOGE(__FUNCTION__, "Query Failed: %s", esp_err_to_name(err));
-		}
-		return ESP_FAIL;
-	}
-
-	ESP_LOGD(__FUNCTION__, "Query A: %s.local resolved to: " IPSTR, host_name, IP2STR(&addr));
-	sprintf(ip, IPSTR, IP2STR(&addr));
-	return ESP_OK;
-}
-
-void convert_mdns_host(char * from, char * to)
-{
-	ESP_LOGI(__FUNCTION__, "from=[%s]",from);
-	strcpy(to, from);
-	char *sp;
-	sp = strstr(from, ".local");
-	if (sp == NULL) return;
-
-	int _len = sp - from;
-	ESP_LOGD(__FUNCTION__, "_len=%d", _len);
-	char _from[128];
-	strcpy(_from, from);
-	_from[_len] = 0;
-	ESP_LOGI(__FUNCTION__, "_from=[%s]", _from);
-
-	char _ip[128];
-	esp_err_t ret = query_mdns_host(_from, _ip);
-	ESP_LOGI(__FUNCTION__, "query_mdns_host=%d _ip=[%s]", ret, _ip);
-	if (ret != ESP_OK) return;
-
-	strcpy(to, _ip);
-	ESP_LOGI(__FUNCTION__, "to=[%s]", to);
-}
-
-// Get signal strength indicator in dBm.
-// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
-int rssi(char raw) {
-	uint8_t rssi_dec;
-	// TODO: This rssi_offset is dependent on baud and MHz; this is for 38.4kbps and 433 MHz.
-	uint8_t rssi_offset = 74;
-	rssi_dec = (uint8_t) raw;
-	if (rssi_dec >= 128)
-		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
-	else
-		return (rssi_dec / 2) - rssi_offset;
-}
-
-// Get link quality indicator.
-int lqi(char raw) {
-	return 0x3F - raw;
-}
-
-void rx_task(void *pvParameter)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	while(1) {
-		if(packet_available()) {
-			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
-				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
-					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *) packet.data);
-						size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferTrans );
-						ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-						size_t sended = xMessageBufferSend(xMessageBufferTrans, packet.data, packet.length, 100);
-						if (sended != packet.length) {
-							ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail packet.length=%d sended=%d", packet.length, sended);
-							break;
-						}
-					}
-				}
-			} // end receiveData
-		} // end packet_available
-		vTaskDelay(1); // Avoid Watchdog asserts
-	} // end while
-
-	vTaskDelete( NULL );
-}
-
 void https_client(void *pvParameters);
 
 void app_main()
@@ -245,68 +140,21 @@ void app_main()
 	// Initialize WiFi
 	ESP_ERROR_CHECK(wifi_init_sta());
 
-	// Create MessageBuffer
-	xMessageBufferTrans = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferTrans );
-	xMessageBufferRecv = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferRecv );
-
 	// Initialize mDNS
 	ESP_ERROR_CHECK( mdns_init() );
+	ESP_ERROR_CHECK(resolver_init());
 
-	uint8_t freq;
-#if CONFIG_CC1101_FREQ_315
-	freq = CFREQ_315;
-	ESP_LOGW(TAG, "Set frequency to 315MHz");
-#elif CONFIG_CC1101_FREQ_433
-	freq = CFREQ_433;
-	ESP_LOGW(TAG, "Set frequency to 433MHz");
-#elif CONFIG_CC1101_FREQ_868
-	freq = CFREQ_868;
-	ESP_LOGW(TAG, "Set frequency to 868MHz");
-#elif CONFIG_CC1101_FREQ_915
-	freq = CFREQ_915;
-	ESP_LOGW(TAG, "Set frequency to 915MHz");
-#endif
-
-	uint8_t mode;
-#if CONFIG_CC1101_SPEED_4800
-	mode = CSPEED_4800;
-	ESP_LOGW(TAG, "Set speed to 4800bps");
-#elif CONFIG_CC1101_SPEED_9600
-	mode = CSPEED_9600;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_19200
-	mode = CSPEED_19200;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_38400
-	mode = CSPEED_38400;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#endif
-
-	//init(CFREQ_433, 0);
-	ret = init(freq, mode);
+	// Initialize CC1101
+	ret = bridge_radio_init();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "CC1101 not installed");
 		while(1) { vTaskDelay(1); }
 	}
 
-	uint8_t syncWord[2] = {199, 10};
-	setSyncWordArray(syncWord);
-	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
-	setChannel(CONFIG_CC1101_CHANNEL);
-	disableAddressCheck();
-#if CONFIG_CC1101_POWER_MIN
-	ESP_LOGW(TAG, "Set Minimum power level");
-	setTxPowerAmp(POWER_MIN);
-#elif CONFIG_CC1101_POWER_0db
-	ESP_LOGW(TAG, "Set 0 dBm power level");
-	setTxPowerAmp(POWER_0db);
-#elif CONFIG_CC1101_POWER_MAX
-	ESP_LOGW(TAG, "Set Maximum power level");
-	setTxPowerAmp(POWER_MAX);
-#endif
-
-	xTaskCreate(&rx_task, "RX", 1024*3, NULL, 5, NULL);
-	xTaskCreate(&https_client, "HTTP_CLIENT", 1024*4, NULL, 5, NULL);
+	// The HTTPS client takes packets with bridge_receive()
+	static const BRIDGE_TRANSPORT_t https_client_transport = {
+		.name = "https_client",
+		.pull = true,
+	};
+	ESP_ERROR_CHECK(bridge_start(&https_client_transport));
+	xTaskCreate(&https_client, "HTTP_CLIENT", 1024*6, NULL, 5, NULL);
 }
@@ -10,15 +10,17 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
+#include "freertos/queue.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "mdns.h"
 
-#include <cc1101.h>
+#include "bridge.h"
+#include "resolver.h"
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
@@ -32,14 +34,6 @@ static const char *TAG = "MAIN";
 
 static int s_retry_num = 0;
 
-MessageBufferHandle_t xMessageBufferTrans;
-MessageBufferHandle_t xMessageBufferRecv;
-
-// The total number of bytes (not single messages) the message buffer will be able to hold at any one time.
-size_t xBufferSizeBytes = 1024;
-// The size, in bytes, required to hold each item in the message,
-size_t xItemSize = 64; // Maximum Payload size of CC1101 is 64
-
 static void event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
 	if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
@@ -133,119 +127,39 @@ esp_err_t wifi_init_sta(void)
 	return ret_value;
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip)
-{
-	ESP_LOGD(__FUNCTION__, "Query A: %s", host_name);
-
-	struct esp_ip4_addr addr;
-	addr.addr = 0;
-
-	esp_err_t err = mdns_query_a(host_name, 10000,	&addr);
-	if(err){
-		if(err == ESP_ERR_NOT_FOUND){
-			ESP_LOGW(__FUNCTION__, "%s: Host was not found!", host_name);
-		} else {
-			ESP_LOGE(__FUNCTION__, "Query Failed: %s", esp_err_to_name(err));
-		}
-		return ESP_FAIL;
-	}
-
-	ESP_LOGD(__FUNCTION__, "Query A: %s.local resolved to: " IPSTR, host_name, IP2STR(&addr));
-	sprintf(ip, IPSTR, IP2STR(&addr));
-	return ESP_OK;
-}
-
-void convert_mdns_host(char * from, char * to)
-{
-	ESP_LOGI(__FUNCTION__, "from=[%s]",from);
-	strcpy(to, from);
-	char *sp;
-	sp = strstr(from, ".local");
-	if (sp == NULL) return;
-
-	int _len = sp - from;
-	ESP_LOGD(__FUNCTION__, "_len=%d", _len);
-	char _from[128];
-	strcpy(_from, from);
-	_from[_len] = 0;
-	ESP_LOGI(__FUNCTION__, "_from=[%s]", _from);
-
-	char _ip[128];
-	esp_err_t ret = query_mdns_host(_from, _ip);
-	ESP_LOGI(__FUNCTION__, "query_mdns_host=%d _ip=[%s]", ret, _ip);
-	if (ret != ESP_OK) return;
-
-	strcpy(to, _ip);
-	ESP_LOGI(__FUNCTION__, "to=[%s]", to);
-}
-
-#if CONFIG_SENDER
-void tx_task(void *pvParameter)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	while(1) {
-		packet.length = xMessageBufferReceive(xMessageBufferRecv, packet.data, sizeof(packet.data), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "packet.length=%d", packet.length);
-		sendData(packet);
-	} // end while
-
-	// never reach here
-	vTaskDelete( NULL );
-}
-#endif // CONFIG_SENDER
-
-#if CONFIG_RECEIVER
-// Get signal strength indicator in dBm.
-// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
-int rssi(char raw) {
-	uint8_t rssi_dec;
-	// TODO: This rssi_offset is dependent on baud and MHz; this is for 38.4kbps and 433 MHz.
-	uint8_t rssi_offset = 74;
-	rssi_dec = (uint8_t) raw;
-	if (rssi_dec >= 128)
-		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
-	else
-		return (rssi_dec / 2) - rssi_offset;
-}
+#if CONFIG_MQTT_PUB_BENCHMARK
+// Packets of the benchmark. Read by mqtt_pub instead of the radio.
+QueueHandle_t xQueueBench;
 
-// Get link quality indicator.
-int lqi(char raw) {
-	return 0x3F - raw;
-}
-
-void rx_task(void *pvParameter)
+void bench_task(void *pvParameter)
 {
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
+	ESP_LOGI(pcTaskGetName(NULL), "Start rate=%d addresses=%d", CONFIG_MQTT_PUB_BENCHMARK_RATE, CONFIG_MQTT_PUB_BENCHMARK_ADDRESSES);
+	BRIDGE_PACKET_t packet = {0};
+	packet.boot = bridge_boot_id();
+	uint32_t sequence = 0;
+	TickType_t started = xTaskGetTickCount();
 	while(1) {
-		if(packet_available()) {
-			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
-				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
-					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *) packet.data);
-						size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferTrans );
-						ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-						size_t sended = xMessageBufferSend(xMessageBufferTrans, packet.data, packet.length, 100);
-						if (sended != packet.length) {
-							ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail packet.length=%d sended=%d", packet.length, sended);
-							break;
-						}
-					}
-				}
-			} // end receiveData
-		} // end packet_available
-		vTaskDelay(1);
+		// Same layout as a radio packet: address byte followed by text
+		packet.data[0] = (sequence % CONFIG_MQTT_PUB_BENCHMARK_ADDRESSES) + 1;
+		packet.length = 1 + snprintf((char *)&packet.data[1], sizeof(packet.data)-1, "seq=%"PRIu32" tick=%"PRIu32, sequence, xTaskGetTickCount());
+		packet.seq = sequence;
+		packet.rx_time = esp_timer_get_time();
+		if (xQueueSend(xQueueBench, &packet, 0) != pdTRUE) {
+			ESP_LOGW(pcTaskGetName(NULL), "xQueueSend fail sequence=%"PRIu32, sequence);
+		}
+		sequence++;
+		// Pace to the configured rate
+		TickType_t next = started + (uint64_t)sequence * configTICK_RATE_HZ / CONFIG_MQTT_PUB_BENCHMARK_RATE;
+		TickType_t now = xTaskGetTickCount();
+		if ((int32_t)(next - now) > 0) {
+			vTaskDelay(next - now);
+		} else if ((sequence % 16) == 0) {
+			vTaskDelay(1); // Avoid Watchdog asserts
+		}
 	} // end while
 	vTaskDelete( NULL );
 }
-#endif // CONFIG_RECEIVER
+#endif // CONFIG_MQTT_PUB_BENCHMARK
 
 void mqtt_sub(void *pvParameters);
 void mqtt_pub(void *pvParameters);
@@ -263,75 +177,38 @@ void app_main()
 	// Initialize WiFi
 	ESP_ERROR_CHECK(wifi_init_sta());
 
-	// Create MessageBuffer
-	xMessageBufferTrans = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferTrans );
-	xMessageBufferRecv = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferRecv );
-
 	// Initialize mDNS
 	ESP_ERROR_CHECK( mdns_init() );
+	ESP_ERROR_CHECK(resolver_init());
 
-	uint8_t freq;
-#if CONFIG_CC1101_FREQ_315
-	freq = CFREQ_315;
-	ESP_LOGW(TAG, "Set frequency to 315MHz");
-#elif CONFIG_CC1101_FREQ_433
-	freq = CFREQ_433;
-	ESP_LOGW(TAG, "Set frequency to 433MHz");
-#elif CONFIG_CC1101_FREQ_868
-	freq = CFREQ_868;
-	ESP_LOGW(TAG, "Set frequency to 868MHz");
-#elif CONFIG_CC1101_FREQ_915
-	freq = CFREQ_915;
-	ESP_LOGW(TAG, "Set frequency to 915MHz");
-#endif
-
-	uint8_t mode;
-#if CONFIG_CC1101_SPEED_4800
-	mode = CSPEED_4800;
-	ESP_LOGW(TAG, "Set speed to 4800bps");
-#elif CONFIG_CC1101_SPEED_9600
-	mode = CSPEED_9600;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_19200
-	mode = CSPEED_19200;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_38400
-	mode = CSPEED_38400;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#endif
-
-	//init(CFREQ_433, 0);
-	ret = init(freq, mode);
+	// Initialize CC1101
+	ret = bridge_radio_init();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "CC1101 not installed");
 		while(1) { vTaskDelay(1); }
 	}
 
-	uint8_t syncWord[2] = {199, 10};
-	setSyncWordArray(syncWord);
-	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
-	setChannel(CONFIG_CC1101_CHANNEL);
-	disableAddressCheck();
-#if CONFIG_CC1101_POWER_MIN
-	ESP_LOGW(TAG, "Set Minimum power level");
-	setTxPowerAmp(POWER_MIN);
-#elif CONFIG_CC1101_POWER_0db
-	ESP_LOGW(TAG, "Set 0 dBm power level");
-	setTxPowerAmp(POWER_0db);
-#elif CONFIG_CC1101_POWER_MAX
-	ESP_LOGW(TAG, "Set Maximum power level");
-	setTxPowerAmp(POWER_MAX);
-#endif
-
 #if CONFIG_SENDER
-	xTaskCreate(&tx_task, "TX", 1024*3, NULL, 5, NULL);
+	// The MQTT subscriber pushes packets with bridge_transmit()
+	static const BRIDGE_TRANSPORT_t mqtt_sub_transport = {
+		.name = "mqtt_sub",
+	};
+	ESP_ERROR_CHECK(bridge_start(&mqtt_sub_transport));
 	xTaskCreate(&mqtt_sub, "SUB", 1024*4, NULL, 5, NULL);
 #endif
 #if CONFIG_RECEIVER
-	xTaskCreate(&rx_task, "RX", 1024*3, NULL, 5, NULL);
+#if CONFIG_MQTT_PUB_BENCHMARK
+	// The radio is not used
+	xQueueBench = xQueueCreate(32, sizeof(BRIDGE_PACKET_t));
+	configASSERT( xQueueBench );
+	xTaskCreate(&bench_task, "BENCH", 1024*3, NULL, 5, NULL);
+#else
+	// The MQTT publisher takes packets with bridge_receive()
+	static const BRIDGE_TRANSPORT_t mqtt_pub_transport = {
+		.name = "mqtt_pub",
+		.pull = true,
+	};
+	ESP_ERROR_CHECK(bridge_start(&mqtt_pub_transport));
+#endif
 	xTaskCreate(&mqtt_pub, "PUB", 1024*4, NULL, 5, NULL);
 #endif
 }
-
@@ -13,12 +13,17 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "esp_event.h"
 #include "esp_mac.h" // esp_base_mac_addr_get
+#include "esp_timer.h"
 #include "mqtt_client.h"
 
+#include "bridge.h"
+#include "resolver.h"
+
 static const char *TAG = "PUB";
 
 extern const uint8_t root_cert_pem_start[] asm("_binary_root_cert_pem_start");
@@ -27,8 +32,79 @@ extern const uint8_t root_cert_pem_end[] asm("_binary_root_cert_pem_end");
 EventGroupHandle_t mqtt_status_event_group;
 #define MQTT_CONNECTED_BIT BIT2
 
-extern MessageBufferHandle_t xMessageBufferTrans;
-extern size_t xItemSize;
+#if CONFIG_MQTT_PUB_BENCHMARK
+extern QueueHandle_t xQueueBench;
+#endif
+
+// Bound the number of QoS1 messages waiting for PUBACK
+static SemaphoreHandle_t xOutboxSemaphore;
+
+// Topic aliases were sent on this connection and the broker has not acknowledged any message yet
+static volatile bool alias_unconfirmed = false;
+// The broker closed the connection before it acknowledged a message with a topic alias
+static volatile bool alias_disabled = false;
+
+/*
+ * Publish state of each sender.
+ * Readings are collected in batch[] while the packet rate is above the threshold.
+ * Text readings are separated by a newline. Envelopes are a CBOR sequence and need no separator.
+ */
+#if CONFIG_BRIDGE_ENVELOPE
+#define SEPARATOR_SIZE 0
+#else
+#define SEPARATOR_SIZE 1
+#endif
+
+#if CONFIG_MQTT_PUB_TOPIC_PER_ADDRESS
+#define MAX_SENDERS 16
+#else
+#define MAX_SENDERS 1
+#endif
+
+#if CONFIG_MQTT_PROTOCOL_V_5
+#define TOPIC_ALIAS_MAX CONFIG_MQTT_PUB_TOPIC_ALIAS_MAX
+#else
+#define TOPIC_ALIAS_MAX 0
+#endif
+
+typedef struct {
+	bool used;
+	uint8_t address;	// First byte of the packet
+	char topic[96];
+	uint16_t alias;				// MQTT v5 topic alias, 0 if not used
+	int readings;
+	int length;
+	TickType_t started;
+	TickType_t last_used;
+	char batch[CONFIG_MQTT_PUB_BATCH_BYTES];
+} SENDER_t;
+
+static SENDER_t senders[MAX_SENDERS];
+
+static struct {
+	uint32_t packets;
+	uint32_t publishes;
+	uint32_t readings;
+	uint32_t bytes;
+	uint32_t dropped;
+	uint32_t inflight_waits;
+} stats;
+
+// Address of the broker used by the client
+static char broker_ip[128];
+
+static void make_uri(const char *ip, char *uri)
+{
+#if CONFIG_MQTT_TRANSPORT_OVER_TCP
+	sprintf(uri, "mqtt://%.60s:%d", ip, CONFIG_MQTT_PORT_TCP);
+#elif CONFIG_MQTT_TRANSPORT_OVER_SSL
+	sprintf(uri, "mqtts://%.60s:%d", ip, CONFIG_MQTT_PORT_SSL);
+#elif CONFIG_MQTT_TRANSPORT_OVER_WS
+	sprintf(uri, "ws://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WS);
+#elif CONFIG_MQTT_TRANSPORT_OVER_WSS
+	sprintf(uri, "wss://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WSS);
+#endif
+}
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -36,11 +112,28 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 	switch (event->event_id) {
 		case MQTT_EVENT_CONNECTED:
 			ESP_LOGI(TAG, "MQTT_EVENT_CONNECTED");
+			alias_unconfirmed = false;
 			xEventGroupSetBits(mqtt_status_event_group, MQTT_CONNECTED_BIT);
 			break;
 		case MQTT_EVENT_DISCONNECTED:
 			ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
 			xEventGroupClearBits(mqtt_status_event_group, MQTT_CONNECTED_BIT);
+			if (alias_unconfirmed && alias_disabled == false) {
+				// A broker closes the connection on an alias it does not accept
+				ESP_LOGW(TAG, "Closed before any message with a topic alias was acknowledged. Topic aliases disabled");
+				alias_disabled = true;
+			}
+			// The broker may have moved to another address.
+			// The address is refreshed in the background and used on a later reconnect.
+			resolver_invalidate(CONFIG_MQTT_BROKER);
+			char ip[128];
+			if (resolver_get(CONFIG_MQTT_BROKER, ip, sizeof(ip)) == ESP_OK && strcmp(ip, broker_ip) != 0) {
+				char uri[138];
+				make_uri(ip, uri);
+				ESP_LOGI(TAG, "Broker moved. uri=[%s]", uri);
+				esp_mqtt_client_set_uri(event->client, uri);
+				strcpy(broker_ip, ip);
+			}
 			break;
 		case MQTT_EVENT_SUBSCRIBED:
 			ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -49,7 +142,19 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 			ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
 			break;
 		case MQTT_EVENT_PUBLISHED:
-			ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+			ESP_LOGD(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+			alias_unconfirmed = false;
+			static bool delivered = false;
+			if (delivered == false) {
+				ESP_LOGI(TAG, "First packet delivered %"PRId64"ms after boot", esp_timer_get_time() / 1000);
+				delivered = true;
+			}
+			xSemaphoreGive(xOutboxSemaphore);
+			break;
+		case MQTT_EVENT_DELETED:
+			// Message expired in the outbox without PUBACK
+			ESP_LOGW(TAG, "MQTT_EVENT_DELETED, msg_id=%d", event->msg_id);
+			xSemaphoreGive(xOutboxSemaphore);
 			break;
 		case MQTT_EVENT_DATA:
 			ESP_LOGI(TAG, "MQTT_EVENT_DATA");
@@ -64,8 +169,137 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 	return;
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip);
-void convert_mdns_host(char * from, char * to);
+/*
+ * Publish one message with QoS1.
+ * Waits while CONFIG_MQTT_PUB_OUTBOX_LIMIT messages are in flight.
+ */
+static int publish(esp_mqtt_client_handle_t mqtt_client, SENDER_t *sender, const char *data, int len, int readings)
+{
+	EventBits_t EventBits = xEventGroupGetBits(mqtt_status_event_group);
+	if ((EventBits & MQTT_CONNECTED_BIT) == 0) {
+		ESP_LOGW(TAG, "Disconnect to MQTT Broker. Skip to send");
+		stats.dropped += readings;
+		return -1;
+	}
+
+	if (xSemaphoreTake(xOutboxSemaphore, 0) != pdTRUE) {
+		stats.inflight_waits++;
+		while (xSemaphoreTake(xOutboxSemaphore, pdMS_TO_TICKS(100)) != pdTRUE) {
+			EventBits = xEventGroupGetBits(mqtt_status_event_group);
+			if ((EventBits & MQTT_CONNECTED_BIT) == 0) {
+				ESP_LOGW(TAG, "Disconnect to MQTT Broker. Skip to send");
+				stats.dropped += readings;
+				return -1;
+			}
+		}
+	}
+
+#if CONFIG_MQTT_PROTOCOL_V_5
+	// The topic name is always sent with the alias.
+	// A QoS1 message may be sent again from the outbox after a reconnect, when the broker no longer knows the alias.
+	esp_mqtt5_publish_property_config_t publish_property = {0};
+	if (sender->alias && alias_disabled == false) {
+		publish_property.topic_alias = sender->alias;
+		alias_unconfirmed = true;
+	}
+	esp_mqtt5_client_set_publish_property(mqtt_client, &publish_property);
+#endif
+
+	int msg_id = esp_mqtt_client_publish(mqtt_client, sender->topic, data, len, 1, 0);
+	if (msg_id < 0) {
+		ESP_LOGE(TAG, "esp_mqtt_client_publish fail topic=[%s]", sender->topic);
+		xSemaphoreGive(xOutboxSemaphore);
+		stats.dropped += readings;
+		return msg_id;
+	}
+	ESP_LOGD(TAG, "sent publish successful, topic=[%s] msg_id=%d readings=%d", sender->topic, msg_id, readings);
+	stats.publishes++;
+	stats.readings += readings;
+	stats.bytes += len;
+	return msg_id;
+}
+
+static void flush_sender(esp_mqtt_client_handle_t mqtt_client, SENDER_t *sender)
+{
+	if (sender->readings == 0) return;
+	publish(mqtt_client, sender, sender->batch, sender->length, sender->readings);
+	sender->readings = 0;
+	sender->length = 0;
+}
+
+/*
+ * Publish the batches older than max_age.
+ */
+static void flush_expired(esp_mqtt_client_handle_t mqtt_client, TickType_t now, TickType_t max_age)
+{
+	for (int i=0;i<MAX_SENDERS;i++) {
+		if (senders[i].readings && now - senders[i].started >= max_age) flush_sender(mqtt_client, &senders[i]);
+	}
+}
+
+/*
+ * Ticks until the oldest batch must be published.
+ */
+static TickType_t next_flush(TickType_t now)
+{
+	TickType_t timeout = pdMS_TO_TICKS(1000);
+	for (int i=0;i<MAX_SENDERS;i++) {
+		if (senders[i].readings == 0) continue;
+		TickType_t age = now - senders[i].started;
+		TickType_t remain = age >= pdMS_TO_TICKS(CONFIG_MQTT_PUB_BATCH_TIMEOUT) ? 0 : pdMS_TO_TICKS(CONFIG_MQTT_PUB_BATCH_TIMEOUT) - age;
+		if (remain < timeout) timeout = remain;
+	}
+	return timeout;
+}
+
+/*
+ * Find the publish state of a sender.
+ * The sender is told by the first byte of the packet, which is the address byte when address check is used.
+ * When the table is full, the least recently used sender is flushed and reused.
+ */
+static SENDER_t *get_sender(esp_mqtt_client_handle_t mqtt_client, uint8_t address, TickType_t now)
+{
+#if CONFIG_MQTT_PUB_TOPIC_PER_ADDRESS
+	int lru = 0;
+	for (int i=0;i<MAX_SENDERS;i++) {
+		if (senders[i].used && senders[i].address == address) {
+			senders[i].last_used = now;
+			return &senders[i];
+		}
+		if (senders[i].used == false) {
+			lru = i;
+			break;
+		}
+		if (now - senders[i].last_used > now - senders[lru].last_used) lru = i;
+	}
+	SENDER_t *sender = &senders[lru];
+	flush_sender(mqtt_client, sender);
+	sender->used = true;
+	sender->address = address;
+	snprintf(sender->topic, sizeof(sender->topic), "%s/%02x", CONFIG_MQTT_PUB_TOPIC, address);
+	sender->alias = (lru < TOPIC_ALIAS_MAX) ? lru + 1 : 0;
+	ESP_LOGI(TAG, "new sender topic=[%s] alias=%d", sender->topic, sender->alias);
+#else
+	SENDER_t *sender = &senders[0];
+	if (sender->used == false) {
+		sender->used = true;
+		strlcpy(sender->topic, CONFIG_MQTT_PUB_TOPIC, sizeof(sender->topic));
+		sender->alias = (TOPIC_ALIAS_MAX > 0) ? 1 : 0;
+	}
+#endif
+	sender->last_used = now;
+	return sender;
+}
+
+// Wait for a packet from the radio, or from the benchmark task
+static bool receive_packet(BRIDGE_PACKET_t *packet, TickType_t wait)
+{
+#if CONFIG_MQTT_PUB_BENCHMARK
+	return xQueueReceive(xQueueBench, packet, wait) == pdTRUE;
+#else
+	return bridge_receive(packet, wait) == ESP_OK;
+#endif
+}
 
 void mqtt_pub(void *pvParameters)
 {
@@ -87,24 +321,20 @@ void mqtt_pub(void *pvParameters)
 	ESP_LOGI(TAG, "client_id=[%s]", client_id);
 
 	// Resolve mDNS host name
-	char ip[128];
 	char uri[138];
 	ESP_LOGI(TAG, "CONFIG_MQTT_BROKER=[%s]", CONFIG_MQTT_BROKER);
-	convert_mdns_host(CONFIG_MQTT_BROKER, ip);
-	ESP_LOGI(TAG, "ip=[%s]", ip);
+	resolver_resolve(CONFIG_MQTT_BROKER, broker_ip, sizeof(broker_ip));
+	ESP_LOGI(TAG, "ip=[%s]", broker_ip);
 #if CONFIG_MQTT_TRANSPORT_OVER_TCP
 	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_TCP");
-	sprintf(uri, "mqtt://%.60s:%d", ip, CONFIG_MQTT_PORT_TCP);
 #elif CONFIG_MQTT_TRANSPORT_OVER_SSL
 	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_SSL");
-	sprintf(uri, "mqtts://%.60s:%d", ip, CONFIG_MQTT_PORT_SSL);
 #elif CONFIG_MQTT_TRANSPORT_OVER_WS
 	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_WS");
-	sprintf(uri, "ws://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WS);
 #elif CONFIG_MQTT_TRANSPORT_OVER_WSS
 	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_WSS");
-	sprintf(uri, "wss://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WSS);
 #endif
+	make_uri(broker_ip, uri);
 	ESP_LOGI(TAG, "uri=[%s]", uri);
 
 	// Initialize MQTT configuration structure
@@ -132,29 +362,70 @@ void mqtt_pub(void *pvParameters)
 	mqtt_cfg.session.protocol_ver = MQTT_PROTOCOL_V_5;
 #endif
 
+	// Create outbox semaphore
+	xOutboxSemaphore = xSemaphoreCreateCounting(CONFIG_MQTT_PUB_OUTBOX_LIMIT, CONFIG_MQTT_PUB_OUTBOX_LIMIT);
+	configASSERT( xOutboxSemaphore );
+
 	esp_mqtt_client_handle_t mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
 	esp_mqtt_client_register_event(mqtt_client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL);
 	esp_mqtt_client_start(mqtt_client);
 	xEventGroupWaitBits(mqtt_status_event_group, MQTT_CONNECTED_BIT, false, true, portMAX_DELAY);
 	ESP_LOGI(TAG, "Connected to MQTT Broker");
 
-	char buffer[xItemSize];
+	BRIDGE_PACKET_t packet;
+	TickType_t window_start = xTaskGetTickCount();
+	TickType_t stats_start = window_start;
+	uint32_t window_packets = 0;
+	bool batching = false;
 	while (1) {
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buffer, sizeof(buffer), portMAX_DELAY);
-		ESP_LOGI(TAG, "xMessageBufferReceive received=%d", received);
+		TickType_t timeout = batching ? next_flush(xTaskGetTickCount()) : portMAX_DELAY;
+		uint8_t encoded[BRIDGE_ENCODED_MAX];
+		size_t received = receive_packet(&packet, timeout) ? bridge_encode(&packet, encoded, sizeof(encoded)) : 0;
+		char *buffer = (char *)encoded;
+		TickType_t now = xTaskGetTickCount();
+
+		// Measure the packet rate in one second windows and switch batching on and off
+		if (now - window_start >= pdMS_TO_TICKS(1000)) {
+			bool _batching = (window_packets * 1000 / pdTICKS_TO_MS(now - window_start)) > CONFIG_MQTT_PUB_BATCH_RATE;
+			if (_batching != batching) {
+				ESP_LOGI(TAG, "batching %s (%"PRIu32" packets in %"PRIu32" ms)", _batching ? "on" : "off",
+					window_packets, pdTICKS_TO_MS(now - window_start));
+			}
+			batching = _batching;
+			window_start = now;
+			window_packets = 0;
+		}
+
 		if (received > 0) {
-			ESP_LOGI(TAG, "xMessageBufferReceive buffer=[%.*s]",received, buffer);
-			EventBits_t EventBits = xEventGroupGetBits(mqtt_status_event_group);
-			ESP_LOGI(TAG, "EventBits=0x%"PRIx32, EventBits);
-			if (EventBits & MQTT_CONNECTED_BIT) {
-				int msg_id = esp_mqtt_client_publish(mqtt_client, CONFIG_MQTT_PUB_TOPIC, buffer, received, 1, 0);
-				ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+			ESP_LOGD(TAG, "packet=[%.*s] rssi=%d lqi=%d", packet.length, packet.data, packet.rssi, packet.lqi);
+			stats.packets++;
+			window_packets++;
+			SENDER_t *sender = get_sender(mqtt_client, packet.data[0], now);
+			if (batching) {
+				int needed = received + (sender->readings ? SEPARATOR_SIZE : 0);
+				if (sender->length + needed > sizeof(sender->batch)) flush_sender(mqtt_client, sender);
+				if (sender->readings == 0) sender->started = now;
+				if (sender->readings && SEPARATOR_SIZE) sender->batch[sender->length++] = '\n';
+				memcpy(&sender->batch[sender->length], buffer, received);
+				sender->length += received;
+				sender->readings++;
 			} else {
-				ESP_LOGW(TAG, "Disconnect to MQTT Broker. Skip to send");
+				// Keep the order: anything still batched for this sender goes first
+				flush_sender(mqtt_client, sender);
+				publish(mqtt_client, sender, buffer, received, 1);
 			}
-		} else {
-			 ESP_LOGE(TAG, "xMessageBufferReceive fail");
-			 break;
+		}
+
+		// Publish batches whose time is up
+		flush_expired(mqtt_client, now, batching ? pdMS_TO_TICKS(CONFIG_MQTT_PUB_BATCH_TIMEOUT) : 0);
+
+		if (now - stats_start >= pdMS_TO_TICKS(CONFIG_MQTT_PUB_STATS_INTERVAL * 1000)) {
+			uint32_t elapsed = pdTICKS_TO_MS(now - stats_start);
+			ESP_LOGI(TAG, "packets=%"PRIu32" publishes=%"PRIu32" readings/publish=%.1f %"PRIu32" packets/s %"PRIu32" bytes/s dropped=%"PRIu32" inflight_waits=%"PRIu32,
+				stats.packets, stats.publishes, stats.publishes ? (float)stats.readings / stats.publishes : 0.0,
+				stats.packets * 1000 / elapsed, stats.bytes * 1000 / elapsed, stats.dropped, stats.inflight_waits);
+			memset(&stats, 0, sizeof(stats));
+			stats_start = now;
 		}
 	} // end while
 
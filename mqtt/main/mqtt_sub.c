@@ -14,7 +14,6 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 #include "esp_event.h"
 #include "lwip/dns.h"
@@ -22,14 +21,29 @@
 #include "mqtt_client.h"
 
 #include "mqtt.h"
+#include "bridge.h"
+#include "resolver.h"
 
 static const char *TAG = "SUB";
 
 extern const uint8_t root_cert_pem_start[] asm("_binary_root_cert_pem_start");
 extern const uint8_t root_cert_pem_end[] asm("_binary_root_cert_pem_end");
 
-extern MessageBufferHandle_t xMessageBufferRecv;
-extern size_t xItemSize;
+// Address of the broker used by the client
+static char broker_ip[128];
+
+static void make_uri(const char *ip, char *uri)
+{
+#if CONFIG_MQTT_TRANSPORT_OVER_TCP
+	sprintf(uri, "mqtt://%.60s:%d", ip, CONFIG_MQTT_PORT_TCP);
+#elif CONFIG_MQTT_TRANSPORT_OVER_SSL
+	sprintf(uri, "mqtts://%.60s:%d", ip, CONFIG_MQTT_PORT_SSL);
+#elif CONFIG_MQTT_TRANSPORT_OVER_WS
+	sprintf(uri, "ws://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WS);
+#elif CONFIG_MQTT_TRANSPORT_OVER_WSS
+	sprintf(uri, "wss://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WSS);
+#endif
+}
 
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
@@ -44,6 +58,17 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 			break;
 		case MQTT_EVENT_DISCONNECTED:
 			ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+			// The broker may have moved to another address.
+			// The address is refreshed in the background and used on a later reconnect.
+			resolver_invalidate(CONFIG_MQTT_BROKER);
+			char ip[128];
+			if (resolver_get(CONFIG_MQTT_BROKER, ip, sizeof(ip)) == ESP_OK && strcmp(ip, broker_ip) != 0) {
+				char uri[138];
+				make_uri(ip, uri);
+				ESP_LOGI(TAG, "Broker moved. uri=[%s]", uri);
+				esp_mqtt_client_set_uri(event->client, uri);
+				strcpy(broker_ip, ip);
+			}
 			xTaskNotifyGive( mqttBuf->taskHandle );
 			break;
 		case MQTT_EVENT_SUBSCRIBED:
@@ -82,9 +107,6 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 	return;
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip);
-void convert_mdns_host(char * from, char * to);
-
 void mqtt_sub(void *pvParameters)
 {
 	ESP_LOGI(TAG, "Start");
@@ -101,24 +123,11 @@ void mqtt_sub(void *pvParameters)
 	ESP_LOGI(TAG, "client_id=[%s]", client_id);
 
 	// Resolve mDNS host name
-	char ip[128];
-	char uri[128];
+	char uri[138];
 	ESP_LOGI(TAG, "CONFIG_MQTT_BROKER=[%s]", CONFIG_MQTT_BROKER);
-	convert_mdns_host(CONFIG_MQTT_BROKER, ip);
-	ESP_LOGI(TAG, "ip=[%s]", ip);
-#if CONFIG_MQTT_TRANSPORT_OVER_TCP
-	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_TCP");
-	sprintf(uri, "mqtt://%.60s:%d", ip, CONFIG_MQTT_PORT_TCP);
-#elif CONFIG_MQTT_TRANSPORT_OVER_SSL
-	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_SSL");
-	sprintf(uri, "mqtts://%.60s:%d", ip, CONFIG_MQTT_PORT_SSL);
-#elif CONFIG_MQTT_TRANSPORT_OVER_WS
-	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_WS");
-	sprintf(uri, "ws://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WS);
-#elif CONFIG_MQTT_TRANSPORT_OVER_WSS
-	ESP_LOGI(TAG, "MQTT_TRANSPORT_OVER_WSS");
-	sprintf(uri, "wss://%.60s:%d/mqtt", ip, CONFIG_MQTT_PORT_WSS);
-#endif
+	resolver_resolve(CONFIG_MQTT_BROKER, broker_ip, sizeof(broker_ip));
+	ESP_LOGI(TAG, "ip=[%s]", broker_ip);
+	make_uri(broker_ip, uri);
 	ESP_LOGI(TAG, "uri=[%s]", uri);
 
 	// Initialize user context
@@ -169,13 +178,10 @@ void mqtt_sub(void *pvParameters)
 			ESP_LOGI(TAG, "TOPIC=[%.*s]\r", mqttBuf.topic_len, mqttBuf.topic);
 			ESP_LOGI(TAG, "DATA=[%.*s]\r", mqttBuf.data_len, mqttBuf.data);
 
-			// Queries a message buffer to see how much free space it contains
-			size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferRecv );
-			ESP_LOGI(TAG, "spacesAvailable=%d", spacesAvailable);
-			if (mqttBuf.data_len > xItemSize) mqttBuf.data_len = xItemSize;
-			size_t sended = xMessageBufferSend(xMessageBufferRecv, mqttBuf.data, mqttBuf.data_len, 100);
-			if (sended != mqttBuf.data_len) {
-				ESP_LOGE(TAG, "xMessageBufferSend fail mqttBuf.data_len=%d sended=%d", mqttBuf.data_len, sended);
+			if (mqttBuf.data_len > BRIDGE_PAYLOAD_MAX) mqttBuf.data_len = BRIDGE_PAYLOAD_MAX;
+			esp_err_t err = bridge_transmit((uint8_t *)mqttBuf.data, mqttBuf.data_len, 100);
+			if (err != ESP_OK) {
+				ESP_LOGE(TAG, "bridge_transmit fail mqttBuf.data_len=%d %s", mqttBuf.data_len, esp_err_to_name(err));
 				break;
 			}
 		} else if (mqttBuf.event_id == MQTT_EVENT_ERROR) {
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+# python3 -m pip install paho-mqtt
+#
+# Subscribe to the topics published by the ESP32 and report the throughput.
+# Batched messages carry several readings separated by a newline.
+
+import argparse
+import time
+import paho.mqtt.client as mqtt
+
+class Stats:
+	def __init__(self):
+		self.messages = 0
+		self.readings = 0
+		self.bytes = 0
+		self.addresses = {}
+
+def on_connect(client, userdata, flags, rc, properties=None):
+	print("connected rc={}".format(rc))
+	client.subscribe(userdata['topic'], qos=1)
+
+def on_message(client, userdata, msg):
+	stats = userdata['stats']
+	readings = msg.payload.count(b'\n') + 1
+	stats.messages += 1
+	stats.readings += readings
+	stats.bytes += len(msg.payload)
+	stats.addresses[msg.topic] = stats.addresses.get(msg.topic, 0) + readings
+	if userdata['verbose']:
+		print("{} {}".format(msg.topic, msg.payload))
+
+if __name__=='__main__':
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--host', help='mqtt broker', default='localhost')
+	parser.add_argument('--port', type=int, help='mqtt port', default=1883)
+	parser.add_argument('--topic', help='subscribe topic', default='/topic/radio/test/#')
+	parser.add_argument('--interval', type=int, help='report interval', default=10)
+	parser.add_argument('--v5', action='store_true', help='use MQTT v5')
+	parser.add_argument('--verbose', action='store_true', help='print every message')
+	args = parser.parse_args()
+
+	stats = Stats()
+	userdata = {'topic': args.topic, 'stats': stats, 'verbose': args.verbose}
+	protocol = mqtt.MQTTv5 if args.v5 else mqtt.MQTTv311
+	try:
+		client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, userdata=userdata, protocol=protocol)
+	except AttributeError:
+		# paho-mqtt 1.x
+		client = mqtt.Client(userdata=userdata, protocol=protocol)
+	client.on_connect = on_connect
+	client.on_message = on_message
+	client.connect(args.host, args.port)
+	client.loop_start()
+
+	started = time.time()
+	last = time.time()
+	total_messages = 0
+	total_readings = 0
+	try:
+		while True:
+			time.sleep(args.interval)
+			now = time.time()
+			elapsed = now - last
+			print("{:.1f} messages/s {:.1f} readings/s {:.1f} bytes/s {:.2f} readings/message addresses={}".format(
+				stats.messages / elapsed, stats.readings / elapsed, stats.bytes / elapsed,
+				stats.readings / stats.messages if stats.messages else 0, len(stats.addresses)))
+			total_messages += stats.messages
+			total_readings += stats.readings
+			stats.messages = stats.readings = stats.bytes = 0
+			last = now
+	except KeyboardInterrupt:
+		pass
+	client.loop_stop()
+	elapsed = time.time() - started
+	print("summary: {} messages {} readings in {:.1f}s".format(total_messages, total_readings, elapsed))
+	for topic, readings in sorted(stats.addresses.items()):
+		print("  {} {} readings".format(topic, readings))
@@ -9,102 +9,11 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
 
-#include <cc1101.h>
-
-static const char *TAG = "MAIN";
-
-MessageBufferHandle_t xMessageBufferTrans;
-MessageBufferHandle_t xMessageBufferRecv;
-
-// The total number of bytes (not single messages) the message buffer will be able to hold at any one time.
-size_t xBufferSizeBytes = 1024;
-// The size, in bytes, required to hold each item in the message,
-size_t xItemSize = 64; // Maximum Payload size of CC1101 is 64
-
-#if CONFIG_SENDER
-void tx_task(void *pvParameter)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	while(1) {
-		packet.length = xMessageBufferReceive(xMessageBufferRecv, packet.data, sizeof(packet.data), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "packet.length=%d", packet.length);
-		sendData(packet);
-	} // end while
-
-	// never reach here
-	vTaskDelete( NULL );
-}
-#endif // CONFIG_SENDER
-
-#if CONFIG_RECEIVER
-// Get signal strength indicator in dBm.
-// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
-int rssi(char raw) {
-	uint8_t rssi_dec;
-	// TODO: This rssi_offset is dependent on baud and MHz; this is for 38.4kbps and 433 MHz.
-	uint8_t rssi_offset = 74;
-	rssi_dec = (uint8_t) raw;
-	if (rssi_dec >= 128)
-		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
-	else
-		return (rssi_dec / 2) - rssi_offset;
-}
-
-// Get link quality indicator.
-int lqi(char raw) {
-	return 0x3F - raw;
-}
-
-void rx_task(void *pvParameter)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	while(1) {
-		if(packet_available()) {
-			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
-				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
-					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *) packet.data);
-						size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferTrans );
-						ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-						size_t sended = xMessageBufferSend(xMessageBufferTrans, packet.data, packet.length, 100);
-						if (sended != packet.length) {
-							ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail packet.length=%d sended=%d", packet.length, sended);
-							break;
-						}
-					}
-				}
-			} // end receiveData
-		} // end packet_available
-		vTaskDelay(1); // Avoid Watchdog asserts
-	} // end while
-
-	vTaskDelete( NULL );
-}
-
-void dummy(void *pvParameters)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	uint8_t buf[xItemSize];
-	while(1) {
-		size_t received = xMessageBufferReceive(xMessageBufferRecv, buf, sizeof(buf), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "xMessageBufferReceive received=%d", received);
-	} // end while
-	vTaskDelete(NULL);
-}
-#endif // CONFIG_RECEIVER
+#include "bridge.h"
 
 void nimble_spp_task(void * pvParameters);
 
@@ -119,71 +28,25 @@ void app_main()
 	}
 	ESP_ERROR_CHECK(ret);
 
-	// Create MessageBuffer
-	xMessageBufferTrans = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferTrans );
-	xMessageBufferRecv = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferRecv );
-
-	uint8_t freq;
-#if CONFIG_CC1101_FREQ_315
-	freq = CFREQ_315;
-	ESP_LOGW(TAG, "Set frequency to 315MHz");
-#elif CONFIG_CC1101_FREQ_433
-	freq = CFREQ_433;
-	ESP_LOGW(TAG, "Set frequency to 433MHz");
-#elif CONFIG_CC1101_FREQ_868
-	freq = CFREQ_868;
-	ESP_LOGW(TAG, "Set frequency to 868MHz");
-#elif CONFIG_CC1101_FREQ_915
-	freq = CFREQ_915;
-	ESP_LOGW(TAG, "Set frequency to 915MHz");
-#endif
-
-	uint8_t mode;
-#if CONFIG_CC1101_SPEED_4800
-	mode = CSPEED_4800;
-	ESP_LOGW(TAG, "Set speed to 4800bps");
-#elif CONFIG_CC1101_SPEED_9600
-	mode = CSPEED_9600;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_19200
-	mode = CSPEED_19200;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_38400
-	mode = CSPEED_38400;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#endif
-
-	//init(CFREQ_433, 0);
-	ret = init(freq, mode);
+	// Initialize CC1101
+	ret = bridge_radio_init();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "CC1101 not installed");
 		while(1) { vTaskDelay(1); }
 	}
 
-	uint8_t syncWord[2] = {199, 10};
-	setSyncWordArray(syncWord);
-	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
-	setChannel(CONFIG_CC1101_CHANNEL);
-	disableAddressCheck();
-#if CONFIG_CC1101_POWER_MIN
-	ESP_LOGW(TAG, "Set Minimum power level");
-	setTxPowerAmp(POWER_MIN);
-#elif CONFIG_CC1101_POWER_0db
-	ESP_LOGW(TAG, "Set 0 dBm power level");
-	setTxPowerAmp(POWER_0db);
-#elif CONFIG_CC1101_POWER_MAX
-	ESP_LOGW(TAG, "Set Maximum power level");
-	setTxPowerAmp(POWER_MAX);
-#endif
-
-	xTaskCreate(nimble_spp_task, "NIMBLE_SPP", 1024*4, NULL, 5, NULL);
 #if CONFIG_SENDER
-	xTaskCreate(&tx_task, "TX", 1024*3, NULL, 5, NULL);
+	// The SPP server pushes packets with bridge_transmit()
+	static const BRIDGE_TRANSPORT_t spp_transport = {
+		.name = "nimble_spp",
+	};
 #endif
 #if CONFIG_RECEIVER
-	xTaskCreate(&rx_task, "RX", 1024*3, NULL, 5, NULL);
-	xTaskCreate(&dummy, "DUMMY", 1024*4, NULL, 5, NULL);
+	// The SPP server takes packets with bridge_receive()
+	static const BRIDGE_TRANSPORT_t spp_transport = {
+		.name = "nimble_spp",
+		.pull = true,
+	};
 #endif
+	ESP_ERROR_CHECK(bridge_start(&spp_transport));
+	xTaskCreate(nimble_spp_task, "NIMBLE_SPP", 1024*4, NULL, 5, NULL);
 }
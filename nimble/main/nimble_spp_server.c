@@ -9,10 +9,10 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 
 /* BLE */
@@ -23,10 +23,14 @@
 #include "services/gap/ble_svc_gap.h"
 #include "services/gatt/ble_svc_gatt.h"
 
+#include "bridge.h"
+
 static int ble_spp_server_gap_event(struct ble_gap_event *event, void *arg);
 static uint8_t own_addr_type;
 int gatt_svr_register(void);
 static bool conn_handle_subs[CONFIG_BT_NIMBLE_MAX_CONNECTIONS + 1];
+static uint16_t conn_handle_mtu[CONFIG_BT_NIMBLE_MAX_CONNECTIONS + 1];
+static TaskHandle_t spp_task_handle;
 static uint16_t ble_spp_svc_gatt_read_val_handle;
 
 #define DEVICE_NAME "ESP_NIMBLE_SERVER" //The Device Name Characteristics in GAP
@@ -39,9 +43,11 @@ static uint16_t ble_spp_svc_gatt_read_val_handle;
 
 static const char *TAG = "SPP";
 
-extern MessageBufferHandle_t xMessageBufferTrans;
-extern MessageBufferHandle_t xMessageBufferRecv;
-extern size_t xItemSize;
+// Wait up to NOTIFY_RETRY_MAX * 10ms for free mbufs before dropping
+#define NOTIFY_RETRY_MAX 50
+
+// Interval of throughput statistics
+#define STATS_INTERVAL_MS 10000
 
 void ble_store_config_init(void);
 
@@ -169,6 +175,17 @@ ble_spp_server_gap_event(struct ble_gap_event *event, void *arg)
 			rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
 			assert(rc == 0);
 			ble_spp_server_print_conn_desc(&desc);
+			conn_handle_mtu[event->connect.conn_handle] = BLE_ATT_MTU_DFLT;
+
+			/* Ask for a larger MTU, 2M PHY and longer link layer packets. */
+			/* These fail harmlessly when the controller or the peer doesn't support them. */
+			rc = ble_gattc_exchange_mtu(event->connect.conn_handle, NULL, NULL);
+			ESP_LOGI(__FUNCTION__, "ble_gattc_exchange_mtu rc=%d", rc);
+			rc = ble_gap_set_prefered_le_phy(event->connect.conn_handle,
+				BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_2M_MASK, BLE_GAP_LE_PHY_CODED_ANY);
+			ESP_LOGI(__FUNCTION__, "ble_gap_set_prefered_le_phy rc=%d", rc);
+			rc = ble_gap_set_data_len(event->connect.conn_handle, 251, 2120);
+			ESP_LOGI(__FUNCTION__, "ble_gap_set_data_len rc=%d", rc);
 		}
 		if (event->connect.status != 0 || CONFIG_BT_NIMBLE_MAX_CONNECTIONS > 1) {
 			/* Connection failed or if multiple connection allowed; resume advertising. */
@@ -181,6 +198,8 @@ ble_spp_server_gap_event(struct ble_gap_event *event, void *arg)
 		ble_spp_server_print_conn_desc(&event->disconnect.conn);
 
 		conn_handle_subs[event->disconnect.conn.conn_handle] = false;
+		conn_handle_mtu[event->disconnect.conn.conn_handle] = BLE_ATT_MTU_DFLT;
+		if (spp_task_handle) xTaskNotifyGive(spp_task_handle);
 
 		/* Connection terminated; resume advertising. */
 		ble_spp_server_advertise();
@@ -204,6 +223,15 @@ ble_spp_server_gap_event(struct ble_gap_event *event, void *arg)
 			event->mtu.conn_handle,
 			event->mtu.channel_id,
 			event->mtu.value);
+		conn_handle_mtu[event->mtu.conn_handle] = event->mtu.value;
+		return 0;
+
+	case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+		ESP_LOGI(__FUNCTION__, "phy update event; conn_handle=%d status=%d tx_phy=%d rx_phy=%d",
+			event->phy_updated.conn_handle,
+			event->phy_updated.status,
+			event->phy_updated.tx_phy,
+			event->phy_updated.rx_phy);
 		return 0;
 
 	case BLE_GAP_EVENT_SUBSCRIBE:
@@ -267,7 +295,7 @@ void ble_spp_server_host_task(void *param)
 /* Callback function for custom service */
 static int ble_svc_gatt_handler(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg)
 {
-	uint8_t buf[xItemSize];
+	uint8_t buf[BRIDGE_PAYLOAD_MAX];
 	int length = 0;
 	switch (ctxt->op) {
 	case BLE_GATT_ACCESS_OP_READ_CHR:
@@ -286,16 +314,17 @@ static int ble_svc_gatt_handler(uint16_t conn_handle, uint16_t attr_handle, stru
 		for (int i=0;i<ctxt->om->om_len;i++) {
 			if (ctxt->om->om_data[i] == 0x0d) continue;
 			if (ctxt->om->om_data[i] == 0x0a) continue;
-			if (length < xItemSize) {
+			if (length < sizeof(buf)) {
 				buf[length] = ctxt->om->om_data[i];
 				length++;
 			}
 		}
 		ESP_LOG_BUFFER_HEXDUMP(__FUNCTION__, buf, length, ESP_LOG_INFO);
-		size_t sended = xMessageBufferSendFromISR(xMessageBufferRecv, buf, length, NULL);
-		if (sended != length) {
-			ESP_LOGE(__FUNCTION__, "xQueueSendFromISR Fail");
+#if CONFIG_SENDER
+		if (bridge_transmit(buf, length, 0) != ESP_OK) {
+			ESP_LOGE(__FUNCTION__, "bridge_transmit Fail");
 		}
+#endif
 		break;
 
 	default:
@@ -380,6 +409,94 @@ int gatt_svr_init(void)
 	return 0;
 }
 
+/*
+ * Send one notification.
+ * ble_gatts_notify_custom() hands the notification to the controller before it returns,
+ * so the host keeps no count of notifications in flight. They hold mbufs until
+ * the controller sends them. When fewer than CONFIG_SPP_NOTIFY_MBUF_RESERVE mbufs
+ * are free, or the host is out of memory, wait for the controller.
+ */
+static int spp_notify(uint16_t conn_handle, const uint8_t *data, size_t len)
+{
+	int rc = BLE_HS_ENOMEM;
+	for (int retry=0;retry<NOTIFY_RETRY_MAX;retry++) {
+		if (conn_handle_subs[conn_handle] == false) return BLE_HS_ENOTCONN;
+
+		if (os_msys_num_free() > CONFIG_SPP_NOTIFY_MBUF_RESERVE) {
+			struct os_mbuf *txom = ble_hs_mbuf_from_flat(data, len);
+			if (txom == NULL) {
+				rc = BLE_HS_ENOMEM;
+			} else {
+				/* txom is consumed even on failure */
+				rc = ble_gatts_notify_custom(conn_handle, ble_spp_svc_gatt_read_val_handle, txom);
+				if (rc == 0) return 0;
+			}
+			if (rc != BLE_HS_ENOMEM) return rc;
+		}
+		// Woken early by a disconnect
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(10));
+	}
+	return rc;
+}
+
+/*
+ * Send the packed data to every subscribed connection.
+ * The data is split to fit the MTU of each connection.
+ */
+static size_t spp_notify_all(const uint8_t *data, size_t len)
+{
+	size_t sent = 0;
+	for (int i = 0; i <= CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+		/* Check if client has subscribed to notifications */
+		if (conn_handle_subs[i] == false) continue;
+		size_t chunk = conn_handle_mtu[i] - 3;
+		for (size_t pos = 0; pos < len; pos += chunk) {
+			size_t _len = (len - pos) < chunk ? (len - pos) : chunk;
+			int rc = spp_notify(i, data + pos, _len);
+			if (rc != 0) {
+				ESP_LOGW(pcTaskGetName(NULL), "Error in sending notification conn_handle=%d rc=%d", i, rc);
+				break;
+			}
+			sent += _len;
+		}
+	}
+	return sent;
+}
+
+/*
+ * Largest notification payload that fits every subscribed connection.
+ */
+static size_t spp_payload_max(void)
+{
+	uint16_t mtu = 0;
+	for (int i = 0; i <= CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
+		if (conn_handle_subs[i] == false) continue;
+		if (mtu == 0 || conn_handle_mtu[i] < mtu) mtu = conn_handle_mtu[i];
+	}
+	if (mtu == 0) mtu = BLE_ATT_MTU_DFLT;
+	return mtu - 3;
+}
+
+/*
+ * Put one packet and its separator at out. Returns the number of bytes.
+ * Text packets end with CR LF. Envelopes need no separator.
+ */
+#if CONFIG_BRIDGE_ENVELOPE
+#define SEPARATOR_SIZE 0
+#else
+#define SEPARATOR_SIZE 2
+#endif
+
+static size_t pack(uint8_t *out, size_t out_size, const BRIDGE_PACKET_t *packet)
+{
+	size_t length = bridge_encode(packet, out, out_size - SEPARATOR_SIZE);
+#if !CONFIG_BRIDGE_ENVELOPE
+	out[length++] = 0x0d;
+	out[length++] = 0x0a;
+#endif
+	return length;
+}
+
 void nimble_spp_task(void * pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
@@ -392,7 +509,9 @@ void nimble_spp_task(void * pvParameters)
 	/* Initialize connection_handle array */
 	for (int i = 0; i <= CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
 		conn_handle_subs[i] = false;
+		conn_handle_mtu[i] = BLE_ATT_MTU_DFLT;
 	}
+	spp_task_handle = xTaskGetCurrentTaskHandle();
 
 	/* Initialize the NimBLE host configuration. */
 	ble_hs_cfg.reset_cb = ble_spp_server_on_reset;
@@ -433,26 +552,50 @@ void nimble_spp_task(void * pvParameters)
 
 	nimble_port_freertos_init(ble_spp_server_host_task);
 
-	uint8_t buf[xItemSize+2];
+	uint8_t buf[BLE_ATT_MTU_MAX];
+	BRIDGE_PACKET_t packet;
+	uint32_t stats_packets = 0;
+	uint32_t stats_notifies = 0;
+	uint32_t stats_bytes = 0;
+	TickType_t stats_start = xTaskGetTickCount();
 	while(1){
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buf, xItemSize, portMAX_DELAY);
 		/*
-		[61 62 63 64 65 66 67] to [61 62 63 64 65 66 67 0d 0a]
+		Wait for the first packet, then pack the packets that are already waiting up to the MTU.
+		[61 62 63] [64 65] to [61 62 63 0d 0a 64 65 0d 0a]
+		Envelopes are packed as a CBOR sequence without a separator.
 		*/
-		buf[received++] = 0x0d;
-		buf[received++] = 0x0a;
-		for (int i = 0; i <= CONFIG_BT_NIMBLE_MAX_CONNECTIONS; i++) {
-			/* Check if client has subscribed to notifications */
-			if (conn_handle_subs[i]) {
-				struct os_mbuf *txom;
-				txom = ble_hs_mbuf_from_flat(buf, received);
-				int rc = ble_gatts_notify_custom(i, ble_spp_svc_gatt_read_val_handle, txom);
-				if (rc == 0) {
-					ESP_LOGD(pcTaskGetName(NULL), "Notification sent successfully");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL), "Error in sending notification rc = %d", rc);
-				}
+		esp_err_t err = bridge_receive(&packet, pdMS_TO_TICKS(STATS_INTERVAL_MS));
+		if (err == ESP_ERR_INVALID_STATE) {
+			// Nothing is received from the radio in the sender mode
+			vTaskDelay(pdMS_TO_TICKS(STATS_INTERVAL_MS));
+		}
+		if (err == ESP_OK) {
+			size_t packed = pack(buf, sizeof(buf), &packet);
+			int packets = 1;
+			size_t payload_max = spp_payload_max();
+			while (1) {
+				size_t next = bridge_next_length();
+				if (next == 0 || packed + next + SEPARATOR_SIZE > payload_max || packed + next + SEPARATOR_SIZE > sizeof(buf)) break;
+				if (bridge_receive(&packet, 0) != ESP_OK) break;
+				packed += pack(&buf[packed], sizeof(buf) - packed, &packet);
+				packets++;
+			}
+			ESP_LOGD(pcTaskGetName(NULL), "packets=%d packed=%d payload_max=%d", packets, packed, payload_max);
+			size_t sent = spp_notify_all(buf, packed);
+			stats_packets += packets;
+			stats_notifies++;
+			stats_bytes += sent;
+		}
+
+		TickType_t now = xTaskGetTickCount();
+		if (now - stats_start >= pdMS_TO_TICKS(STATS_INTERVAL_MS)) {
+			uint32_t elapsed = pdTICKS_TO_MS(now - stats_start);
+			if (stats_packets) {
+				ESP_LOGI(pcTaskGetName(NULL), "%"PRIu32" bytes/s %"PRIu32" packets/s packets/notification=%.1f",
+					stats_bytes * 1000 / elapsed, stats_packets * 1000 / elapsed, (float)stats_packets / stats_notifies);
 			}
+			stats_packets = stats_notifies = stats_bytes = 0;
+			stats_start = now;
 		}
 	} // end while
 
@@ -1,44 +1,111 @@
+/*
+	TLS test client for the ssl example.
+
+	Without options it sends "hello world" once and prints the reply.
+	With -n it becomes a load generator: N connections are driven
+	concurrently using epoll and non-blocking OpenSSL, each sending
+	M messages, and handshakes per second and messages per second are
+	reported. Use "./server -k" when M is greater than 1.
+
+	usage: ./client [-h host] [-p port] [-n connections] [-m messages] [-c concurrency] [-r]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
-#include <unistd.h>
 
 #include <openssl/ssl.h>
+#include <openssl/err.h>
 
-#define SERVER_PORT "8000"
+#define SERVER_PORT "8080"
 #define SERVER_HOST "localhost"
+#define CLIENT_MESSAGE "hello world"
 
-int main()
-{
-	SSL_library_init();
-	SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
+#define MAX_EVENTS 256
 
-	struct addrinfo hints;
-	struct addrinfo *res, *ai;
+enum CONN_STATE {
+	CONN_CONNECTING = 0,
+	CONN_HANDSHAKE,
+	CONN_WRITE,
+	CONN_READ,
+	CONN_DONE
+};
 
-	memset(&hints, sizeof(hints), 0);
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
-	getaddrinfo(SERVER_HOST, SERVER_PORT, &hints, &res);
+typedef struct {
+	int fd;
+	SSL *ssl;
+	int state;
+	int sent;
+	double started;
+	double sent_at;		// time the current message was written
+	uint32_t events;
+} CONNECTION;
 
-	int sockfd;
+static struct {
+	unsigned long started;
+	unsigned long handshakes;
+	unsigned long resumed;
+	unsigned long messages;
+	unsigned long failed;
+	double handshake_time;
+	double rtt_time;
+} stats;
+
+static int messages_per_conn = 1;
+static bool reuse_session = false;
+static SSL_SESSION *saved_session = NULL;
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int single_shot(SSL_CTX *ctx, struct addrinfo *res)
+{
+	struct addrinfo *ai;
+	int sockfd = -1;
 	for(ai=res; ai; ai=ai->ai_next) {
 		sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
 		if(!connect(sockfd, ai->ai_addr, ai->ai_addrlen))
 			break;
 		close(sockfd);
+		sockfd = -1;
+	}
+	if (sockfd < 0) {
+		printf("connect fail\n");
+		return 1;
 	}
-	freeaddrinfo(res);
 
 	SSL *ssl = SSL_new(ctx);
 	SSL_set_options(ssl, SSL_OP_NO_TICKET);
 	SSL_set_fd(ssl, sockfd);
 
-	SSL_connect(ssl);
+	if (SSL_connect(ssl) <= 0) {
+		printf("SSL_connect fail\n");
+		ERR_print_errors_fp(stdout);
+		SSL_free(ssl);
+		close(sockfd);
+		return 1;
+	}
 
 	while (1) {
 		char buf[512];
-		sprintf(buf, "%s", "hello world");
+		sprintf(buf, "%s", CLIENT_MESSAGE);
 		size_t nwritten;
 		if (SSL_write_ex(ssl, buf, strlen(buf), &nwritten) <= 0) {
 			printf("SSL_write_ex operation was not successful\n");
@@ -60,6 +127,273 @@ int main()
 	SSL_free(ssl);
 
 	close(sockfd);
+	return 0;
+}
+
+static void update_events(int epfd, CONNECTION *conn, uint32_t events)
+{
+	if (conn->events == events) return;
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	conn->events = events;
+}
+
+static CONNECTION *open_connection(int epfd, SSL_CTX *ctx, struct addrinfo *ai)
+{
+	int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK, ai->ai_protocol);
+	if (fd < 0) {
+		perror("socket");
+		return NULL;
+	}
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0 && errno != EINPROGRESS) {
+		perror("connect");
+		close(fd);
+		return NULL;
+	}
+
+	CONNECTION *conn = calloc(1, sizeof(CONNECTION));
+	conn->fd = fd;
+	conn->state = CONN_CONNECTING;
+	conn->started = now();
+	conn->ssl = SSL_new(ctx);
+	SSL_set_fd(conn->ssl, fd);
+	if (reuse_session && saved_session != NULL)
+		SSL_set_session(conn->ssl, saved_session);
+
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLOUT;
+	ev.data.ptr = conn;
+	conn->events = EPOLLOUT;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	stats.started++;
+	return conn;
+}
+
+static void close_connection(int epfd, CONNECTION *conn, bool failed)
+{
+	if (failed) stats.failed++;
+	if (!failed) SSL_shutdown(conn->ssl);
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	SSL_free(conn->ssl);
+	close(conn->fd);
+	free(conn);
+}
+
+/*
+ * Drive the connection as far as possible without blocking.
+ * Return false when the connection is finished.
+ */
+static bool process(int epfd, CONNECTION *conn)
+{
+	int ret;
+	int err;
+
+	if (conn->state == CONN_CONNECTING) {
+		int so_error = 0;
+		socklen_t len = sizeof(so_error);
+		getsockopt(conn->fd, SOL_SOCKET, SO_ERROR, &so_error, &len);
+		if (so_error != 0) {
+			printf("connect fail: %s\n", strerror(so_error));
+			close_connection(epfd, conn, true);
+			return false;
+		}
+		conn->state = CONN_HANDSHAKE;
+	}
+
+	if (conn->state == CONN_HANDSHAKE) {
+		ret = SSL_connect(conn->ssl);
+		if (ret <= 0) {
+			err = SSL_get_error(conn->ssl, ret);
+			if (err == SSL_ERROR_WANT_READ) {
+				update_events(epfd, conn, EPOLLIN);
+				return true;
+			}
+			if (err == SSL_ERROR_WANT_WRITE) {
+				update_events(epfd, conn, EPOLLOUT);
+				return true;
+			}
+			printf("SSL_connect fail err=%d\n", err);
+			ERR_print_errors_fp(stdout);
+			close_connection(epfd, conn, true);
+			return false;
+		}
+		stats.handshakes++;
+		stats.handshake_time += now() - conn->started;
+		if (SSL_session_reused(conn->ssl)) stats.resumed++;
+		conn->state = CONN_WRITE;
+	}
+
+	while (1) {
+		if (conn->state == CONN_WRITE) {
+			size_t nwritten;
+			conn->sent_at = now();
+			if (SSL_write_ex(conn->ssl, CLIENT_MESSAGE, strlen(CLIENT_MESSAGE), &nwritten) <= 0) {
+				err = SSL_get_error(conn->ssl, 0);
+				if (err == SSL_ERROR_WANT_WRITE) {
+					update_events(epfd, conn, EPOLLOUT);
+					return true;
+				}
+				if (err == SSL_ERROR_WANT_READ) {
+					update_events(epfd, conn, EPOLLIN);
+					return true;
+				}
+				printf("SSL_write_ex fail err=%d\n", err);
+				close_connection(epfd, conn, true);
+				return false;
+			}
+			conn->state = CONN_READ;
+		}
+
+		if (conn->state == CONN_READ) {
+			char buf[512];
+			size_t nread;
+			if (SSL_read_ex(conn->ssl, buf, sizeof(buf), &nread) <= 0) {
+				err = SSL_get_error(conn->ssl, 0);
+				if (err == SSL_ERROR_WANT_READ) {
+					update_events(epfd, conn, EPOLLIN);
+					return true;
+				}
+				if (err == SSL_ERROR_WANT_WRITE) {
+					update_events(epfd, conn, EPOLLOUT);
+					return true;
+				}
+				printf("SSL_read_ex fail err=%d\n", err);
+				close_connection(epfd, conn, true);
+				return false;
+			}
+			stats.messages++;
+			stats.rtt_time += now() - conn->sent_at;
+			conn->sent++;
+
+			// With TLS 1.3 the session ticket arrives after the handshake,
+			// and a ticket should only be used once, so keep the newest one
+			if (reuse_session && conn->sent == 1) {
+				if (saved_session) SSL_SESSION_free(saved_session);
+				saved_session = SSL_get1_session(conn->ssl);
+			}
+
+			if (conn->sent >= messages_per_conn) {
+				conn->state = CONN_DONE;
+				close_connection(epfd, conn, false);
+				return false;
+			}
+			conn->state = CONN_WRITE;
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-h host] [-p port] [-n connections] [-m messages] [-c concurrency] [-r]\n", prog);
+	printf("  -h host        server host (default %s)\n", SERVER_HOST);
+	printf("  -p port        server port (default %s)\n", SERVER_PORT);
+	printf("  -n connections load mode: total number of connections to open\n");
+	printf("  -m messages    messages per connection (default 1)\n");
+	printf("  -c concurrency connections open at the same time (default all)\n");
+	printf("  -r             resume the TLS session of the first connection\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *host = SERVER_HOST;
+	const char *port = SERVER_PORT;
+	long connections = 0;
+	long concurrency = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "h:p:n:m:c:r")) != -1) {
+		switch (opt) {
+			case 'h': host = optarg; break;
+			case 'p': port = optarg; break;
+			case 'n': connections = atol(optarg); break;
+			case 'm': messages_per_conn = atoi(optarg); break;
+			case 'c': concurrency = atol(optarg); break;
+			case 'r': reuse_session = true; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (messages_per_conn < 1) messages_per_conn = 1;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	SSL_library_init();
+	SSL_CTX *ctx = SSL_CTX_new(SSLv23_client_method());
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT);
+
+	struct addrinfo hints;
+	struct addrinfo *res;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0) {
+		printf("getaddrinfo fail\n");
+		return 1;
+	}
+
+	if (connections == 0) {
+		int ret = single_shot(ctx, res);
+		freeaddrinfo(res);
+		SSL_CTX_free(ctx);
+		return ret;
+	}
+
+	// Load generator
+	if (concurrency <= 0 || concurrency > connections) concurrency = connections;
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	int epfd = epoll_create1(0);
+	long active = 0;
+	printf("Connecting to %s:%s connections=%ld concurrency=%ld messages=%d resume=%d\n",
+		host, port, connections, concurrency, messages_per_conn, reuse_session);
+
+	double started = now();
+	struct epoll_event events[MAX_EVENTS];
+	while (stats.started < connections || active > 0) {
+		while (active < concurrency && stats.started < connections) {
+			// With -r the first connection must finish before the others can resume it
+			if (reuse_session && saved_session == NULL && active > 0) break;
+			if (open_connection(epfd, ctx, res) == NULL) {
+				stats.started++;
+				stats.failed++;
+				continue;
+			}
+			active++;
+		}
+
+		int nfds = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+		if (nfds < 0) {
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
+			break;
+		}
+		for (int i = 0; i < nfds; i++) {
+			CONNECTION *conn = events[i].data.ptr;
+			if (process(epfd, conn) == false) active--;
+		}
+	}
+	double elapsed = now() - started;
+
+	printf("connections=%lu handshakes=%lu(resumed=%lu) failed=%lu messages=%lu elapsed=%.3fs\n",
+		stats.started, stats.handshakes, stats.resumed, stats.failed, stats.messages, elapsed);
+	printf("%.1f handshakes/s (avg %.3fms) %.1f messages/s (avg rtt %.3fms)\n",
+		stats.handshakes / elapsed,
+		stats.handshakes ? stats.handshake_time * 1000.0 / stats.handshakes : 0.0,
+		stats.messages / elapsed,
+		stats.messages ? stats.rtt_time * 1000.0 / stats.messages : 0.0);
+
+	if (saved_session) SSL_SESSION_free(saved_session);
+	close(epfd);
+	freeaddrinfo(res);
 	SSL_CTX_free(ctx);
 
 	return 0;
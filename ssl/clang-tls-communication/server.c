@@ -1,87 +1,443 @@
+/*
+	TLS test server for the ssl example.
+
+	A single thread serves many concurrent TLS connections using epoll and
+	non-blocking OpenSSL. Every message received from a client is answered
+	with a short reply. By default the connection is closed after the reply,
+	which is what the ESP32 ssl_client expects. With -k the connection is kept
+	open so that a load generator can send many messages on it.
+
+	usage: ./server [-p port] [-k] [-i interval] [-c cache_size] [-v]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
-#include <unistd.h>
 
 #include <openssl/evp.h>
 #include <openssl/ssl.h>
+#include <openssl/err.h>
 
 #define SERVER_PORT "8080"
 #define SERVER_CERT_FILE "server.crt"
 #define SERVER_PRIVATE_KEY_FILE "server.key"
+#define SERVER_REPLY "Hello, secure world!\n"
+
+#define MAX_EVENTS 256
+#define SESSION_CACHE_SIZE 20480
+#define STAT_INTERVAL 10
+
+enum CONN_STATE {
+	CONN_HANDSHAKE = 0,
+	CONN_ESTABLISHED,
+	CONN_SHUTDOWN
+};
 
-int main()
+typedef struct {
+	int fd;
+	SSL *ssl;
+	int state;
+	bool resumed;
+	double accepted;		// time of accept
+	double handshaked;		// time handshake finished
+	unsigned long messages;
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+	size_t wpos;			// pending reply
+	size_t wlen;
+	unsigned char wbuf[64];
+	uint32_t events;		// events registered with epoll
+} CONNECTION;
+
+typedef struct {
+	unsigned long accepted;
+	unsigned long closed;
+	unsigned long active;
+	unsigned long peak;
+	unsigned long handshakes;
+	unsigned long resumed;
+	unsigned long failed;
+	unsigned long messages;
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+	double handshake_time;	// sum of handshake times
+} STATISTICS;
+
+static STATISTICS total;
+static STATISTICS last;
+static volatile sig_atomic_t stop = 0;
+static bool keep_alive = false;
+static bool verbose = false;
+
+static double now(void)
 {
-	SSL_library_init();
-	SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-	SSL_CTX_use_certificate_file(ctx, SERVER_CERT_FILE, SSL_FILETYPE_PEM);
-	SSL_CTX_use_PrivateKey_file(ctx, SERVER_PRIVATE_KEY_FILE, SSL_FILETYPE_PEM);
+static void on_signal(int sig)
+{
+	stop = 1;
+}
 
-	struct addrinfo hints;
-	struct addrinfo *ai = NULL;
+static int set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
 
-	memset(&hints, sizeof(hints), 0);
-	hints.ai_family = AF_INET6;
-	hints.ai_socktype = SOCK_STREAM;
-	hints.ai_flags = AI_PASSIVE;
-	getaddrinfo(NULL, SERVER_PORT, &hints, &ai);
+static void raise_fd_limit(void)
+{
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+	rl.rlim_cur = rl.rlim_max;
+	if (setrlimit(RLIMIT_NOFILE, &rl) != 0) return;
+	printf("open file limit=%lu\n", (unsigned long)rl.rlim_cur);
+}
 
-	int server_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-	bind(server_fd, ai->ai_addr, ai->ai_addrlen);
-	freeaddrinfo(ai);
-	listen(server_fd, 10);
+static void update_events(int epfd, CONNECTION *conn, uint32_t events)
+{
+	if (conn->events == events) return;
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = conn;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+	conn->events = events;
+}
+
+static void close_connection(int epfd, CONNECTION *conn)
+{
+	if (verbose) {
+		double lifetime = now() - conn->accepted;
+		printf("close fd=%d resumed=%d handshake=%.3fms lifetime=%.3fs messages=%lu in=%lu out=%lu\n",
+			conn->fd, conn->resumed,
+			conn->handshaked > 0 ? (conn->handshaked - conn->accepted) * 1000.0 : 0.0,
+			lifetime, conn->messages, conn->bytes_in, conn->bytes_out);
+	}
+	epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+	SSL_free(conn->ssl);
+	close(conn->fd);
+	free(conn);
+	total.closed++;
+	total.active--;
+}
+
+static void print_statistics(double elapsed, const char *title)
+{
+	unsigned long handshakes = total.handshakes - last.handshakes;
+	unsigned long messages = total.messages - last.messages;
+	unsigned long bytes = (total.bytes_in - last.bytes_in) + (total.bytes_out - last.bytes_out);
+	double avg_handshake = 0.0;
+	if (handshakes > 0)
+		avg_handshake = (total.handshake_time - last.handshake_time) * 1000.0 / handshakes;
+
+	printf("[%s] active=%lu peak=%lu accepted=%lu handshakes=%lu(resumed=%lu) failed=%lu\n",
+		title, total.active, total.peak, total.accepted, total.handshakes, total.resumed, total.failed);
+	printf("[%s] %.1f handshakes/s (avg %.3fms) %.1f messages/s %.1f KB/s\n",
+		title, handshakes / elapsed, avg_handshake, messages / elapsed, bytes / elapsed / 1024.0);
+	last = total;
+}
+
+/*
+ * Drive the connection as far as possible without blocking.
+ * Return false when the connection must be closed.
+ */
+static bool process(int epfd, CONNECTION *conn)
+{
+	int ret;
+	int err;
+
+	if (conn->state == CONN_HANDSHAKE) {
+		ret = SSL_accept(conn->ssl);
+		if (ret <= 0) {
+			err = SSL_get_error(conn->ssl, ret);
+			if (err == SSL_ERROR_WANT_READ) {
+				update_events(epfd, conn, EPOLLIN);
+				return true;
+			}
+			if (err == SSL_ERROR_WANT_WRITE) {
+				update_events(epfd, conn, EPOLLOUT);
+				return true;
+			}
+			if (verbose) {
+				printf("SSL_accept fail fd=%d err=%d\n", conn->fd, err);
+				ERR_print_errors_fp(stdout);
+			}
+			ERR_clear_error();
+			total.failed++;
+			return false;
+		}
+		conn->state = CONN_ESTABLISHED;
+		conn->handshaked = now();
+		conn->resumed = SSL_session_reused(conn->ssl);
+		total.handshakes++;
+		total.handshake_time += conn->handshaked - conn->accepted;
+		if (conn->resumed) total.resumed++;
+	}
+
+	while (conn->state == CONN_ESTABLISHED) {
+		// Flush pending reply first
+		while (conn->wpos < conn->wlen) {
+			size_t nwritten;
+			if (SSL_write_ex(conn->ssl, conn->wbuf + conn->wpos, conn->wlen - conn->wpos, &nwritten) <= 0) {
+				err = SSL_get_error(conn->ssl, 0);
+				if (err == SSL_ERROR_WANT_WRITE) {
+					update_events(epfd, conn, EPOLLOUT);
+					return true;
+				}
+				if (err == SSL_ERROR_WANT_READ) {
+					update_events(epfd, conn, EPOLLIN);
+					return true;
+				}
+				ERR_clear_error();
+				return false;
+			}
+			conn->wpos += nwritten;
+			conn->bytes_out += nwritten;
+			total.bytes_out += nwritten;
+		}
+		conn->wpos = conn->wlen = 0;
+
+		if (conn->messages > 0 && keep_alive == false) {
+			conn->state = CONN_SHUTDOWN;
+			break;
+		}
 
+		unsigned char buf[1024];
+		size_t nread;
+		if (SSL_read_ex(conn->ssl, buf, sizeof(buf), &nread) <= 0) {
+			err = SSL_get_error(conn->ssl, 0);
+			if (err == SSL_ERROR_WANT_READ) {
+				update_events(epfd, conn, EPOLLIN);
+				return true;
+			}
+			if (err == SSL_ERROR_WANT_WRITE) {
+				update_events(epfd, conn, EPOLLOUT);
+				return true;
+			}
+			// SSL_ERROR_ZERO_RETURN is a clean close_notify from the peer
+			ERR_clear_error();
+			if (err == SSL_ERROR_ZERO_RETURN) SSL_shutdown(conn->ssl);
+			return false;
+		}
+		if (verbose) printf("fd=%d buf=[%.*s]\n", conn->fd, (int)nread, buf);
+		conn->messages++;
+		conn->bytes_in += nread;
+		total.messages++;
+		total.bytes_in += nread;
+
+		conn->wlen = strlen(SERVER_REPLY);
+		memcpy(conn->wbuf, SERVER_REPLY, conn->wlen);
+		conn->wpos = 0;
+	}
+
+	if (conn->state == CONN_SHUTDOWN) {
+		// Send close_notify; we don't wait for the peer's reply
+		ret = SSL_shutdown(conn->ssl);
+		if (ret < 0) {
+			err = SSL_get_error(conn->ssl, ret);
+			if (err == SSL_ERROR_WANT_WRITE) {
+				update_events(epfd, conn, EPOLLOUT);
+				return true;
+			}
+			ERR_clear_error();
+		}
+		return false;
+	}
+	return true;
+}
+
+static void accept_connections(int epfd, int server_fd, SSL_CTX *ctx)
+{
 	while (1) {
-		printf("Waiting for a connect from client\n");
 		int session_fd = accept(server_fd, NULL, NULL);
-		printf("accept\n");
+		if (session_fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				perror("accept");
+			return;
+		}
+		set_nonblocking(session_fd);
+		int one = 1;
+		setsockopt(session_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
 
-		SSL *ssl = NULL;
-		ssl = SSL_new(ctx);
-		if (ssl == NULL) {
+		CONNECTION *conn = calloc(1, sizeof(CONNECTION));
+		if (conn == NULL) {
+			printf("calloc fail\n");
+			close(session_fd);
+			continue;
+		}
+		conn->fd = session_fd;
+		conn->accepted = now();
+		conn->ssl = SSL_new(ctx);
+		if (conn->ssl == NULL) {
 			printf("SSL_new fail\n");
+			close(session_fd);
+			free(conn);
 			continue;
 		}
+		SSL_set_fd(conn->ssl, session_fd);
 
-		int ret;
-		ret = SSL_set_fd(ssl, session_fd);
-		if (ret == 0) {
-			printf("SSL_set_fd fail\n");
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = conn;
+		conn->events = EPOLLIN;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, session_fd, &ev) != 0) {
+			perror("epoll_ctl");
+			SSL_free(conn->ssl);
+			close(session_fd);
+			free(conn);
 			continue;
 		}
 
-		ret = SSL_accept(ssl);
-		if (ret <= 0) {
-			printf("SSL_accept fail\n");
-			continue;
+		total.accepted++;
+		total.active++;
+		if (total.active > total.peak) total.peak = total.active;
+		if (process(epfd, conn) == false) close_connection(epfd, conn);
+	}
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [-p port] [-k] [-i interval] [-c cache_size] [-v]\n", prog);
+	printf("  -p port       listen port (default %s)\n", SERVER_PORT);
+	printf("  -k            keep connections open after reply\n");
+	printf("  -i interval   statistics interval in seconds (default %d, 0 to disable)\n", STAT_INTERVAL);
+	printf("  -c cache_size TLS session cache size (default %d)\n", SESSION_CACHE_SIZE);
+	printf("  -v            print every message and connection\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *port = SERVER_PORT;
+	int interval = STAT_INTERVAL;
+	long cache_size = SESSION_CACHE_SIZE;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:ki:c:v")) != -1) {
+		switch (opt) {
+			case 'p': port = optarg; break;
+			case 'k': keep_alive = true; break;
+			case 'i': interval = atoi(optarg); break;
+			case 'c': cache_size = atol(optarg); break;
+			case 'v': verbose = true; break;
+			default: usage(argv[0]); return 1;
 		}
-		printf("Handshaked\n");
+	}
 
-		unsigned char buf[1024];
-		size_t nread;
-		size_t nwritten;
-		size_t total = 0;
-		if (SSL_read_ex(ssl, buf, sizeof(buf), &nread) <= 0) {
-			printf("SSL_read_ex operation was not successful\n");
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	raise_fd_limit();
+
+	SSL_library_init();
+	SSL_CTX *ctx = SSL_CTX_new(SSLv23_server_method());
+
+	if (SSL_CTX_use_certificate_file(ctx, SERVER_CERT_FILE, SSL_FILETYPE_PEM) <= 0 ||
+		SSL_CTX_use_PrivateKey_file(ctx, SERVER_PRIVATE_KEY_FILE, SSL_FILETYPE_PEM) <= 0) {
+		printf("Can't load %s or %s\n", SERVER_CERT_FILE, SERVER_PRIVATE_KEY_FILE);
+		ERR_print_errors_fp(stdout);
+		return 1;
+	}
+
+	// Session cache for resumption (session id and stateless tickets)
+	static const unsigned char sid_ctx[] = "cc1101-tls-server";
+	SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx, cache_size);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+
+	struct addrinfo hints;
+	struct addrinfo *ai = NULL;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET6;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(NULL, port, &hints, &ai) != 0) {
+		printf("getaddrinfo fail\n");
+		return 1;
+	}
+
+	int server_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	int one = 1;
+	int zero = 0;
+	setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(server_fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+	if (bind(server_fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+		perror("bind");
+		return 1;
+	}
+	freeaddrinfo(ai);
+	listen(server_fd, SOMAXCONN);
+	set_nonblocking(server_fd);
+
+	int epfd = epoll_create1(0);
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL; // NULL means listening socket
+	epoll_ctl(epfd, EPOLL_CTL_ADD, server_fd, &ev);
+
+	printf("Listening on port %s keep_alive=%d session_cache=%ld\n", port, keep_alive, cache_size);
+	double started = now();
+	double reported = started;
+	struct epoll_event events[MAX_EVENTS];
+	while (stop == 0) {
+		int timeout = interval > 0 ? 1000 : -1;
+		int nfds = epoll_wait(epfd, events, MAX_EVENTS, timeout);
+		if (nfds < 0) {
+			if (errno == EINTR) continue;
+			perror("epoll_wait");
 			break;
 		}
-		printf("nread=%ld\n", nread);
-		printf("buf=[%.*s]\n", (int)nread, buf);
-		strcpy(buf, "Hello, secure world!\n");
-		if (SSL_write_ex(ssl, buf, strlen(buf), &nwritten) <= 0) {
-			printf("SSL_write_ex operation was not successful\n");
+		for (int i = 0; i < nfds; i++) {
+			CONNECTION *conn = events[i].data.ptr;
+			if (conn == NULL) {
+				accept_connections(epfd, server_fd, ctx);
+				continue;
+			}
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				if (conn->state == CONN_HANDSHAKE) total.failed++;
+				close_connection(epfd, conn);
+				continue;
+			}
+			if (process(epfd, conn) == false) close_connection(epfd, conn);
 		}
 
-		SSL_shutdown(ssl);
-		SSL_free(ssl);
-
-		close(session_fd);
+		double current = now();
+		if (interval > 0 && current - reported >= interval) {
+			print_statistics(current - reported, "interval");
+			reported = current;
+		}
 	}
 
+	// Throughput summary for the whole run
+	double elapsed = now() - started;
+	memset(&last, 0, sizeof(last));
+	printf("\n");
+	print_statistics(elapsed, "summary");
+	printf("[summary] elapsed=%.1fs messages=%lu in=%lu out=%lu session_cache_hits=%ld\n",
+		elapsed, total.messages, total.bytes_in, total.bytes_out, SSL_CTX_sess_hits(ctx));
+
+	close(epfd);
 	close(server_fd);
 	SSL_CTX_free(ctx);
 
 	return 0;
 }
-
@@ -16,7 +16,6 @@
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 
 #include "mbedtls/platform.h"
@@ -33,9 +32,7 @@
 #endif
 #include "esp_crt_bundle.h"
 
-extern MessageBufferHandle_t xMessageBufferTrans;
-extern MessageBufferHandle_t xMessageBufferRecv;
-extern size_t xItemSize;
+#include "bridge.h"
 
 extern const uint8_t server_crt_start[] asm("_binary_server_crt_start");
 extern const uint8_t server_crt_end[]	asm("_binary_server_crt_end");
@@ -218,13 +215,13 @@ void ssl_client(void *pvParameters)
 		vTaskDelete(NULL);
 	}
 
-	char buffer[xItemSize];
+	BRIDGE_PACKET_t packet;
+	uint8_t encoded[BRIDGE_ENCODED_MAX];
+	char buffer[64];
 	char work[512];
 	while(1) {
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buffer, sizeof(buffer), portMAX_DELAY);
-		ESP_LOGI(TAG, "xMessageBufferReceive received=%d", received);
-		if (received <= 0) {
-			ESP_LOGE(TAG, "xMessageBufferReceive fail");
+		if (bridge_receive(&packet, portMAX_DELAY) != ESP_OK) {
+			ESP_LOGE(TAG, "bridge_receive fail");
 			ssl_terminate(&ssl, &server_fd, 0);
 			break;
 		}
@@ -273,7 +270,8 @@ void ssl_client(void *pvParameters)
 		ESP_LOGI(TAG, "Cipher suite is %s", mbedtls_ssl_get_ciphersuite(&ssl));
 
 		ESP_LOGI(TAG, "Writing...");
-		ret = ssl_write(&ssl, (const unsigned char *)buffer, received);
+		// The data as it is, or an envelope with CONFIG_BRIDGE_ENVELOPE
+		ret = ssl_write(&ssl, encoded, bridge_encode(&packet, encoded, sizeof(encoded)));
 		if (ret != 0) {
 			ESP_LOGE(TAG, "ssl_write returned -%x", -ret);
 			ssl_terminate(&ssl, &server_fd, ret);
@@ -282,8 +280,8 @@ void ssl_client(void *pvParameters)
 
 		ESP_LOGI(TAG, "Reading...");
 		size_t readed;
-		bzero(buffer, xItemSize);
-		ret = ssl_read(&ssl, (unsigned char *)buffer, xItemSize, &readed);
+		bzero(buffer, sizeof(buffer));
+		ret = ssl_read(&ssl, (unsigned char *)buffer, sizeof(buffer), &readed);
 		if (ret != 0) {
 			ESP_LOGE(TAG, "ssl_read returned -%x", -ret);
 			ssl_terminate(&ssl, &server_fd, ret);
@@ -293,11 +291,8 @@ void ssl_client(void *pvParameters)
 		ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, readed, ESP_LOG_DEBUG);
 
 #if 0
-		size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferRecv );
-		ESP_LOGI(TAG, "spacesAvailable=%d", spacesAvailable);
-		size_t sended = xMessageBufferSend(xMessageBufferRecv, buffer, readed, 100);
-		if (sended != readed) {
-			ESP_LOGE(TAG, "xMessageBufferSend fail readed=%d sended=%d", readed, sended);
+		if (bridge_transmit((uint8_t *)buffer, readed, 100) != ESP_OK) {
+			ESP_LOGE(TAG, "bridge_transmit fail readed=%d", readed);
 			ssl_terminate(&ssl, &server_fd, 0);
 			break;
 		}
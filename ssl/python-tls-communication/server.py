@@ -1,5 +1,11 @@
+import os
 import socket
 import ssl
+import sys
+
+# Decoder of the binary envelope
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '../../components/envelope'))
+import envelope
 
 # 1.Configuring SSL context
 # Use a secure protocol (TLS) for the server.
@@ -25,7 +31,12 @@ with socket.socket(socket.AF_INET, socket.SOCK_STREAM, 0) as sock:
 				with client_sock:
 					print(f"Connection from: {client_addr}")
 					data = client_sock.recv(1024)
-					print(f"Received: {data.decode()}")
+					try:
+						# Sent as an envelope when "Send the packets as binary envelopes" is enabled
+						for item in envelope.decode_seq(data):
+							envelope.print_envelope(item)
+					except ValueError:
+						print(f"Received: {data.decode()}")
 					client_sock.sendall(b"Hello, secure world!\n")
 					client_sock.close()
 			except Exception as e:
@@ -0,0 +1,68 @@
+#!/usr/bin/python3
+#-*- encoding: utf-8 -*-
+# Save the packet capture to a pcap file, or pass it to Wireshark.
+# Select "pcap capture" in menuconfig.
+#
+# python3 ./capture.py --output capture.pcap
+# python3 ./capture.py | wireshark -k -i -
+import sys
+import argparse
+import serial
+import signal
+
+PCAP_MAGIC = b'\xd4\xc3\xb2\xa1'
+
+def handler(signal, frame):
+	global running
+	running = False
+
+if __name__=='__main__':
+	signal.signal(signal.SIGINT, handler)
+	running = True
+
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--device', help='usb device', default="/dev/ttyACM0")
+	parser.add_argument('--output', help='pcap file. The default is the standard output')
+	args = parser.parse_args()
+	print("args.device={}".format(args.device), file=sys.stderr)
+
+	try:
+		# Opening the port raises DTR, and the ESP32 starts with the pcap file header
+		ser = serial.Serial(args.device, 115200, timeout=1)
+	except:
+		print("Unable to open {}".format(args.device), file=sys.stderr)
+		sys.exit()
+
+	if args.output:
+		out = open(args.output, 'wb')
+	else:
+		out = sys.stdout.buffer
+
+	# Skip the end of a record that was on the way when the port was opened
+	synced = False
+	pending = b''
+	total = 0
+	while running:
+		data = ser.read(4096)
+		if len(data) == 0: continue
+		if not synced:
+			pending += data
+			index = pending.find(PCAP_MAGIC)
+			if index < 0:
+				pending = pending[-3:]
+				continue
+			data = pending[index:]
+			synced = True
+		try:
+			out.write(data)
+			out.flush()
+		except BrokenPipeError:
+			break
+		total += len(data)
+		if args.output:
+			print("\r{} bytes".format(total), end='', file=sys.stderr)
+
+	ser.close()
+	if args.output:
+		print('', file=sys.stderr)
+		out.close()
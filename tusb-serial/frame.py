@@ -0,0 +1,153 @@
+#!/usr/bin/python3
+#-*- encoding: utf-8 -*-
+# Read and write binary frames.
+# Enable "Binary frames" in menuconfig.
+#
+# Frame before encoding:
+# type(1) length(1) rssi(1) lqi(1) data(length) crc16(2, little endian)
+# The frame is COBS encoded and terminated with 0x00.
+import sys
+import argparse
+import time
+import struct
+import serial
+import signal
+
+FRAME_TYPE_RX = 0x01
+FRAME_TYPE_TX = 0x02
+
+def handler(signal, frame):
+	global running
+	print('handler')
+	running = False
+
+def crc16(data):
+	crc = 0xFFFF
+	for b in data:
+		crc ^= b << 8
+		for _ in range(8):
+			if crc & 0x8000:
+				crc = ((crc << 1) ^ 0x1021) & 0xFFFF
+			else:
+				crc = (crc << 1) & 0xFFFF
+	return crc
+
+def cobs_encode(data):
+	out = bytearray()
+	block = bytearray()
+	for b in data:
+		if b == 0:
+			out.append(len(block) + 1)
+			out += block
+			block = bytearray()
+		else:
+			block.append(b)
+			if len(block) == 254:
+				out.append(255)
+				out += block
+				block = bytearray()
+	out.append(len(block) + 1)
+	out += block
+	out.append(0)
+	return bytes(out)
+
+def cobs_decode(data):
+	out = bytearray()
+	i = 0
+	while i < len(data):
+		code = data[i]
+		if code == 0 or i + code > len(data):
+			return None
+		out += data[i+1:i+code]
+		i += code
+		if code != 255 and i < len(data):
+			out.append(0)
+	return bytes(out)
+
+def encode(ftype, data, rssi=0, lqi=0):
+	raw = struct.pack('<BBbB', ftype, len(data), rssi, lqi) + data
+	return cobs_encode(raw + struct.pack('<H', crc16(raw)))
+
+def decode(encoded):
+	raw = cobs_decode(encoded)
+	if raw is None or len(raw) < 6: return None
+	ftype, length, rssi, lqi = struct.unpack('<BBbB', raw[:4])
+	if len(raw) != length + 6: return None
+	if struct.unpack('<H', raw[-2:])[0] != crc16(raw[:-2]): return None
+	return (ftype, rssi, lqi, raw[4:-2])
+
+def read(ser, args):
+	frames = 0
+	errors = 0
+	received = 0
+	started = time.time()
+	pending = bytearray()
+	while running:
+		chunk = ser.read(ser.in_waiting or 1)
+		if len(chunk) == 0: continue
+		pending += chunk
+		while True:
+			pos = pending.find(b'\x00')
+			if pos < 0: break
+			encoded = bytes(pending[:pos])
+			del pending[:pos+1]
+			if len(encoded) == 0: continue
+			frame = decode(encoded)
+			if frame is None:
+				errors += 1
+				continue
+			frames += 1
+			received += len(frame[3])
+			if args.verbose:
+				print("type={} rssi={}dBm lqi={} data={}".format(frame[0], frame[1], frame[2], frame[3]))
+		elapsed = time.time() - started
+		if elapsed >= args.report:
+			print("{:.1f} frames/s {:.1f} bytes/s errors={}".format(frames / elapsed, received / elapsed, errors))
+			frames = received = 0
+			started = time.time()
+
+def write(ser, args):
+	count = 0
+	started = time.time()
+	while running:
+		if args.payload:
+			data = bytes(range(args.payload))
+		else:
+			data = bytes(time.asctime(time.localtime()), 'utf-8')
+		ser.write(encode(FRAME_TYPE_TX, data))
+		count += 1
+		if args.interval:
+			time.sleep(args.interval)
+		elapsed = time.time() - started
+		if elapsed >= args.report:
+			print("{:.1f} frames/s".format(count / elapsed))
+			count = 0
+			started = time.time()
+
+if __name__=='__main__':
+	signal.signal(signal.SIGINT, handler)
+	running = True
+
+	parser = argparse.ArgumentParser()
+	parser.add_argument('mode', choices=['read', 'write'])
+	parser.add_argument('--device', help='usb device', default="/dev/ttyACM0")
+	parser.add_argument('--baudrate', type=int, help='baudrate', default=115200)
+	parser.add_argument('--interval', type=float, help='send interval', default=1)
+	parser.add_argument('--payload', type=int, help='binary payload size. 0 sends the time as text', default=0)
+	parser.add_argument('--report', type=int, help='report interval', default=10)
+	parser.add_argument('--verbose', action='store_true', help='print every frame')
+	args = parser.parse_args()
+	print("args.device={}".format(args.device))
+
+	try:
+		ser = serial.Serial(args.device, args.baudrate, timeout=1)
+	except:
+		print("Unable to open {}".format(args.device))
+		sys.exit()
+
+	if args.mode == 'read':
+		ser.reset_input_buffer()
+		read(ser, args)
+	else:
+		write(ser, args)
+	ser.close()
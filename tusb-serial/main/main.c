@@ -9,24 +9,33 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
+#include "freertos/queue.h"
+#include "freertos/stream_buffer.h"
 #include "tinyusb.h"
 #include "tinyusb_default_config.h"
 #include "tinyusb_cdc_acm.h"
 #include "esp_log.h"
 
-#include <cc1101.h>
+#include "bridge.h"
+#if CONFIG_SERIAL_FRAMED
+#include "frame.h"
+#endif
+#if CONFIG_SERIAL_PCAP
+#include "capture.h"
+#endif
 
 static const char *TAG = "MAIN";
 
-MessageBufferHandle_t xMessageBufferTrans;
-MessageBufferHandle_t xMessageBufferRecv;
-QueueHandle_t xQueueTinyusb;
+#if CONFIG_SERIAL_PCAP
+// The USB host opened the port
+static bool usb_dtr = false;
+#endif
 
-// The total number of bytes (not single messages) the message buffer will be able to hold at any one time.
-size_t xBufferSizeBytes = 1024;
-// The size, in bytes, required to hold each item in the message,
-size_t xItemSize = 64; // Maximum Payload size of CC1101 is 64
+#if CONFIG_SENDER && CONFIG_SERIAL_FRAMED
+StreamBufferHandle_t xStreamBufferTinyusb;
+#elif CONFIG_SENDER
+QueueHandle_t xQueueTinyusb;
+#endif
 
 void tinyusb_cdc_rx_callback(int itf, cdcacm_event_t *event)
 {
@@ -39,8 +48,13 @@ void tinyusb_cdc_rx_callback(int itf, cdcacm_event_t *event)
 	esp_err_t ret = tinyusb_cdcacm_read(itf, buf, CONFIG_TINYUSB_CDC_RX_BUFSIZE, &rx_size);
 	if (ret == ESP_OK) {
 		ESP_LOGD(TAG, "Data from channel=%d rx_size=%d", itf, rx_size);
-		ESP_LOG_BUFFER_HEXDUMP(TAG, buf, rx_size, ESP_LOG_INFO);
-#if CONFIG_SENDER
+		ESP_LOG_BUFFER_HEXDUMP(TAG, buf, rx_size, ESP_LOG_DEBUG);
+#if CONFIG_SENDER && CONFIG_SERIAL_FRAMED
+		size_t sended = xStreamBufferSend(xStreamBufferTinyusb, buf, rx_size, 0);
+		if (sended != rx_size) {
+			ESP_LOGE(TAG, "xStreamBufferSend fail rx_size=%d sended=%d", rx_size, sended);
+		}
+#elif CONFIG_SENDER
 		for(int i=0;i<rx_size;i++) {
 			xQueueSendFromISR(xQueueTinyusb, &buf[i], NULL);
 		}
@@ -55,27 +69,47 @@ void tinyusb_cdc_line_state_changed_callback(int itf, cdcacm_event_t *event)
 	int dtr = event->line_state_changed_data.dtr;
 	int rts = event->line_state_changed_data.rts;
 	ESP_LOGI(TAG, "Line state changed on channel %d: DTR:%d, RTS:%d", itf, dtr, rts);
+#if CONFIG_SERIAL_PCAP
+	if (itf != TINYUSB_CDC_ACM_0) return;
+	// A new reader needs the pcap file header first
+	if (dtr && !usb_dtr) capture_header();
+	usb_dtr = dtr;
+#endif
 }
 
 #if CONFIG_SENDER
-void tx_task(void *pvParameter)
+#if CONFIG_SERIAL_FRAMED
+void usb_rx(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
+	FRAME_DECODER_t decoder;
+	frame_decoder_init(&decoder);
+	FRAME_t frame;
+	uint8_t buf[CONFIG_TINYUSB_CDC_RX_BUFSIZE];
+	uint32_t errors = 0;
 	while(1) {
-		packet.length = xMessageBufferReceive(xMessageBufferRecv, packet.data, sizeof(packet.data), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "xMessageBufferReceive packet.length=%d", packet.length);
-		sendData(packet);
+		size_t received = xStreamBufferReceive(xStreamBufferTinyusb, buf, sizeof(buf), portMAX_DELAY);
+		for (int i=0;i<received;i++) {
+			if (frame_decoder_put(&decoder, buf[i], &frame) == false) continue;
+			if (frame.type != FRAME_TYPE_TX || frame.length == 0) continue;
+			ESP_LOGD(pcTaskGetName(NULL), "frame.length=%d", frame.length);
+			esp_err_t err = bridge_transmit(frame.data, frame.length, 100);
+			if (err != ESP_OK) {
+				ESP_LOGE(pcTaskGetName(NULL), "bridge_transmit fail frame.length=%d %s", frame.length, esp_err_to_name(err));
+			}
+		}
+		if (decoder.errors != errors) {
+			errors = decoder.errors;
+			ESP_LOGW(pcTaskGetName(NULL), "frames=%"PRIu32" errors=%"PRIu32, decoder.frames, decoder.errors);
+		}
 	} // end while
-
-	// never reach here
-	vTaskDelete( NULL );
+	vTaskDelete(NULL);
 }
-
+#else
 void usb_rx(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	char buffer[xItemSize];
+	char buffer[BRIDGE_PAYLOAD_MAX];
 	int index = 0;
 	while(1) {
 		char ch;
@@ -83,91 +117,112 @@ void usb_rx(void *pvParameters)
 			ESP_LOGD(pcTaskGetName(NULL), "ch=0x%x",ch);
 			if (ch == 0x0d || ch == 0x0a) {
 				if (index > 0) {
-					ESP_LOGI(pcTaskGetName(NULL), "[%.*s]", index, buffer);
-					size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferRecv );
-					ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-					size_t sended = xMessageBufferSend(xMessageBufferRecv, buffer, index, 100);
-					if (sended != index) {
-						ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail index=%d sended=%d", index, sended);
+					ESP_LOGD(pcTaskGetName(NULL), "[%.*s]", index, buffer);
+					esp_err_t err = bridge_transmit((uint8_t *)buffer, index, 100);
+					if (err != ESP_OK) {
+						ESP_LOGE(pcTaskGetName(NULL), "bridge_transmit fail index=%d %s", index, esp_err_to_name(err));
 						break;
 					}
 					index = 0;
 				}
 			} else {
-				if (index == xItemSize) continue;
+				if (index == sizeof(buffer)) continue;
 				buffer[index++] = ch;
 			}
 		}
 	} // end while
 	vTaskDelete(NULL);
 }
+#endif // CONFIG_SERIAL_FRAMED
 #endif // CONFIG_SENDER
 
 #if CONFIG_RECEIVER
-// Get signal strength indicator in dBm.
-// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
-int rssi(char raw) {
-	uint8_t rssi_dec;
-	// TODO: This rssi_offset is dependent on baud and MHz; this is for 38.4kbps and 433 MHz.
-	uint8_t rssi_offset = 74;
-	rssi_dec = (uint8_t) raw;
-	if (rssi_dec >= 128)
-		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
-	else
-		return (rssi_dec / 2) - rssi_offset;
+#if CONFIG_SERIAL_FRAMED || CONFIG_SERIAL_PCAP
+// Queue all bytes. When the FIFO is full, flush it and queue the rest.
+static void usb_write(const uint8_t *buf, size_t len)
+{
+	size_t queued = 0;
+	while (queued < len) {
+		size_t ret = tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, buf + queued, len - queued);
+		queued += ret;
+		if (queued < len) {
+			esp_err_t err = tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, pdMS_TO_TICKS(100));
+			if (err != ESP_OK && ret == 0) {
+				ESP_LOGW(pcTaskGetName(NULL), "USB host is not reading. %d bytes dropped", len - queued);
+				return;
+			}
+		}
+	}
 }
+#endif
 
-// Get link quality indicator.
-int lqi(char raw) {
-	return 0x3F - raw;
+#if CONFIG_SERIAL_PCAP
+// Write function of the capture
+static size_t usb_capture_write(const void *data, size_t length, void *ctx)
+{
+	if (data == NULL) {
+		tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, 0);
+		return 0;
+	}
+	// Nobody is reading. Discard the records.
+	if (!usb_dtr) return length;
+	usb_write(data, length);
+	return length;
 }
-
-void rx_task(void *pvParameter)
+#elif CONFIG_SERIAL_FRAMED
+void usb_tx(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
+	uint8_t buf[CONFIG_TINYUSB_CDC_TX_BUFSIZE];
+	BRIDGE_PACKET_t packet;
+	FRAME_t frame;
+	frame.type = FRAME_TYPE_RX;
 	while(1) {
-		if(packet_available()) {
-			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
-				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
-					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *) packet.data);
-						size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferTrans );
-						ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-						size_t sended = xMessageBufferSend(xMessageBufferTrans, packet.data, packet.length, 100);
-						if (sended != packet.length) {
-							ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail packet.length=%d sended=%d", packet.length, sended);
-							break;
-						}
-					}
-				}
-			} // end receiveData
-		} // end packet_available
-		vTaskDelay(1);
+		// Wait for the first packet, then batch the packets that are already waiting.
+		// Each packet is sent as an encoded frame with RSSI and LQI.
+		if (bridge_receive(&packet, portMAX_DELAY) != ESP_OK) continue;
+		size_t batched = 0;
+		int frames = 0;
+		while(1) {
+			frame.length = packet.length;
+			frame.rssi = packet.rssi;
+			frame.lqi = packet.lqi;
+			memcpy(frame.data, packet.data, packet.length);
+			batched += frame_encode(&frame, &buf[batched], sizeof(buf) - batched);
+			frames++;
+			if (bridge_next_length() == 0 || batched + FRAME_ENCODED_MAX > sizeof(buf)) break;
+			if (bridge_receive(&packet, 0) != ESP_OK) break;
+		}
+		ESP_LOGD(pcTaskGetName(NULL), "%d frames %d bytes", frames, batched);
+		usb_write(buf, batched);
+		// Flush only when there is nothing more to send
+		if (bridge_next_length() == 0) {
+			tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, 0);
+		}
 	} // end while
-	vTaskDelete( NULL );
+	vTaskDelete(NULL);
 }
-
+#else
 void usb_tx(void *pvParameters)
 {
 	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	uint8_t buf[xItemSize];
+	BRIDGE_PACKET_t packet;
+	uint8_t buf[BRIDGE_ENCODED_MAX];
 	uint8_t crlf[2] = { 0x0d, 0x0a };
 	while(1) {
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buf, sizeof(buf), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "%d byte packet received:[%.*s]", received, received, buf);
-		tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, buf, received);
+		if (bridge_receive(&packet, portMAX_DELAY) != ESP_OK) continue;
+		ESP_LOGD(pcTaskGetName(NULL), "%d byte packet received:[%.*s]", packet.length, packet.length, packet.data);
+		size_t length = bridge_encode(&packet, buf, sizeof(buf));
+		tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, buf, length);
+#if !CONFIG_BRIDGE_ENVELOPE
+		// Envelopes are a CBOR sequence and need no separator
 		tinyusb_cdcacm_write_queue(TINYUSB_CDC_ACM_0, crlf, 2);
+#endif
 		tinyusb_cdcacm_write_flush(TINYUSB_CDC_ACM_0, 0);
 	} // end while
 	vTaskDelete(NULL);
 }
+#endif // CONFIG_SERIAL_FRAMED
 
 #endif // CONFIG_RECEIVER
 
@@ -198,76 +253,46 @@ void app_main()
 		&tinyusb_cdc_line_state_changed_callback));
 #endif
 
-	// Create MessageBuffer
-	xMessageBufferTrans = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferTrans );
-	xMessageBufferRecv = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferRecv );
-
+#if CONFIG_SENDER && CONFIG_SERIAL_FRAMED
+	// Create StreamBuffer
+	xStreamBufferTinyusb = xStreamBufferCreate(1024, 1);
+	configASSERT( xStreamBufferTinyusb );
+#elif CONFIG_SENDER
 	// Create Queue
 	xQueueTinyusb = xQueueCreate(100, sizeof(char));
 	configASSERT( xQueueTinyusb );
-
-	uint8_t freq;
-#if CONFIG_CC1101_FREQ_315
-	freq = CFREQ_315;
-	ESP_LOGW(TAG, "Set frequency to 315MHz");
-#elif CONFIG_CC1101_FREQ_433
-	freq = CFREQ_433;
-	ESP_LOGW(TAG, "Set frequency to 433MHz");
-#elif CONFIG_CC1101_FREQ_868
-	freq = CFREQ_868;
-	ESP_LOGW(TAG, "Set frequency to 868MHz");
-#elif CONFIG_CC1101_FREQ_915
-	freq = CFREQ_915;
-	ESP_LOGW(TAG, "Set frequency to 915MHz");
-#endif
-
-	uint8_t mode;
-#if CONFIG_CC1101_SPEED_4800
-	mode = CSPEED_4800;
-	ESP_LOGW(TAG, "Set speed to 4800bps");
-#elif CONFIG_CC1101_SPEED_9600
-	mode = CSPEED_9600;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_19200
-	mode = CSPEED_19200;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_38400
-	mode = CSPEED_38400;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
 #endif
 
-	//init(CFREQ_433, 0);
-	esp_err_t ret = init(freq, mode);
+	// Initialize CC1101
+	esp_err_t ret = bridge_radio_init();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "CC1101 not installed");
 		while(1) { vTaskDelay(1); }
 	}
 
-	uint8_t syncWord[2] = {199, 10};
-	setSyncWordArray(syncWord);
-	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
-	setChannel(CONFIG_CC1101_CHANNEL);
-	disableAddressCheck();
-#if CONFIG_CC1101_POWER_MIN
-	ESP_LOGW(TAG, "Set Minimum power level");
-	setTxPowerAmp(POWER_MIN);
-#elif CONFIG_CC1101_POWER_0db
-	ESP_LOGW(TAG, "Set 0 dBm power level");
-	setTxPowerAmp(POWER_0db);
-#elif CONFIG_CC1101_POWER_MAX
-	ESP_LOGW(TAG, "Set Maximum power level");
-	setTxPowerAmp(POWER_MAX);
-#endif
-
 #if CONFIG_SENDER
-	xTaskCreate(&tx_task, "TX", 1024*3, NULL, 5, NULL);
+	// The USB task pushes packets with bridge_transmit()
+	static const BRIDGE_TRANSPORT_t usb_transport = {
+		.name = "tusb_serial",
+	};
+	ESP_ERROR_CHECK(bridge_start(&usb_transport));
 	xTaskCreate(&usb_rx, "USB_RX", 1024*4, NULL, 5, NULL);
 #endif
 #if CONFIG_RECEIVER
-	xTaskCreate(&rx_task, "RX", 1024*3, NULL, 5, NULL);
+#if CONFIG_SERIAL_PCAP
+	// receiveData() of the radio task captures the packets. Nothing else reads them.
+	static const BRIDGE_TRANSPORT_t usb_transport = {
+		.name = "tusb_pcap",
+	};
+	ESP_ERROR_CHECK(capture_start(usb_capture_write, NULL, false));
+	ESP_ERROR_CHECK(bridge_start(&usb_transport));
+#else
+	// The USB task takes packets with bridge_receive()
+	static const BRIDGE_TRANSPORT_t usb_transport = {
+		.name = "tusb_serial",
+		.pull = true,
+	};
+	ESP_ERROR_CHECK(bridge_start(&usb_transport));
 	xTaskCreate(&usb_tx, "USB_TX", 1024*4, NULL, 5, NULL);
 #endif
+#endif
 }
-
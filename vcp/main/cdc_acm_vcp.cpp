@@ -14,8 +14,9 @@
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+#include "esp_timer.h"
 
 #include "usb/cdc_acm_host.h"
 #include "usb/vcp_ch34x.hpp"
@@ -23,10 +24,14 @@
 #include "usb/vcp_ftdi.hpp"
 #include "usb/vcp.hpp"
 #include "usb/usb_host.h"
+#include "bridge.h"
+#if CONFIG_SERIAL_FRAMED
+#include "frame.h"
+#endif
 
-extern MessageBufferHandle_t xMessageBufferTx;
-extern MessageBufferHandle_t xMessageBufferRx;
-extern size_t xItemSize;
+// The radio side in main.c
+extern "C" esp_err_t radio_send(const uint8_t *data, size_t length);
+extern "C" size_t radio_receive(uint8_t *buf, size_t size, TickType_t wait);
 
 using namespace esp_usb;
 
@@ -46,10 +51,28 @@ static EventGroupHandle_t device_connected_group;
 
 #define VCP_CONNECTED_BIT BIT0
 
+#if CONFIG_SENDER
+// Bytes received from the VCP device. Filled by handle_rx and consumed by vcp_rx_task.
+static RingbufHandle_t rx_ringbuf;
+
+// A partial line is sent to the radio when no more data arrives within this time
+#define LINE_IDLE_MS 20
+#define STATS_INTERVAL_MS 10000
+
+typedef struct {
+	uint32_t bytes;
+	uint32_t packets;
+	uint32_t ring_drops;	// Bytes dropped because vcp_rx_task is behind
+	uint32_t radio_drops;	// Packets dropped because the radio is behind
+} RX_STATS_t;
+
+static RX_STATS_t rx_stats;
+#endif
+
 /**
  * @brief Data received callback
  *
- * Just pass received data to stdout
+ * Hand off received data to vcp_rx_task. Nothing else is done here.
  *
  * @param[in] data	   Pointer to received data
  * @param[in] data_len Length of received data in bytes
@@ -61,29 +84,110 @@ static EventGroupHandle_t device_connected_group;
 static bool handle_rx(const uint8_t *data, size_t data_len, void *arg)
 {
 #if CONFIG_SENDER
-	//printf("%.*s", data_len, data);
-	ESP_LOGI(TAG, "Receiving data through CdcAcmDevice");
-	ESP_LOG_BUFFER_HEXDUMP(TAG, data, data_len, ESP_LOG_INFO);
-
-	// The VCP termination character is CR+LF. So Remove CR/LF.
-	size_t _data_len = 0;
-	for (int i=0;i<data_len;i++) {
-		if (data[i] == 0x0d) continue;
-		if (data[i] == 0x0a) continue;
-		_data_len++;
+	if (xRingbufferSend(rx_ringbuf, data, data_len, 0) != pdTRUE) {
+		rx_stats.ring_drops += data_len;
 	}
+#endif
+	return true;
+}
 
-	// Send to radio task
-	char buffer[xItemSize];
-	if (_data_len > xItemSize) _data_len = xItemSize;
-	memcpy(buffer, (char *)data, _data_len);
-	size_t sended = xMessageBufferSendFromISR(xMessageBufferRx, buffer, _data_len, NULL);
-	if (sended != _data_len) {
-		ESP_LOGE(__FUNCTION__, "xMessageBufferSendFromISR Fail");
+#if CONFIG_SENDER
+/**
+ * @brief Send to radio task
+ *
+ * Data longer than the radio packet is split into several packets.
+ */
+static void send_radio(const uint8_t *data, size_t data_len)
+{
+	while (data_len > 0) {
+		size_t length = data_len > BRIDGE_PAYLOAD_MAX ? BRIDGE_PAYLOAD_MAX : data_len;
+		esp_err_t err = radio_send(data, length);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "radio_send fail length=%d %s", length, esp_err_to_name(err));
+			rx_stats.radio_drops++;
+		} else {
+			rx_stats.packets++;
+		}
+		data += length;
+		data_len -= length;
 	}
+}
+
+/**
+ * @brief Parse the data received from the VCP device
+ *
+ * Text lines: CR and LF terminate a packet. A partial line is sent when the line stops.
+ * Binary frames: COBS frames are decoded.
+ *
+ * @param pvParameters Unused
+ */
+void vcp_rx_task(void *pvParameters)
+{
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+#if CONFIG_SERIAL_FRAMED
+	FRAME_DECODER_t decoder;
+	frame_decoder_init(&decoder);
+	FRAME_t frame;
+	uint32_t errors = 0;
+#else
+	uint8_t line[BRIDGE_PAYLOAD_MAX];
+	size_t index = 0;
 #endif
-	return true;
+	int64_t stats_start = esp_timer_get_time();
+	while (1) {
+		size_t received = 0;
+		// Take the data in place. No copy is made.
+		uint8_t *data = (uint8_t *)xRingbufferReceiveUpTo(rx_ringbuf, &received, pdMS_TO_TICKS(LINE_IDLE_MS), 512);
+		if (data != NULL) {
+			rx_stats.bytes += received;
+#if CONFIG_SERIAL_FRAMED
+			for (int i=0;i<received;i++) {
+				if (frame_decoder_put(&decoder, data[i], &frame) == false) continue;
+				if (frame.type != FRAME_TYPE_TX || frame.length == 0) continue;
+				send_radio(frame.data, frame.length);
+			}
+#else
+			for (int i=0;i<received;i++) {
+				if (data[i] == 0x0d || data[i] == 0x0a) {
+					if (index > 0) send_radio(line, index);
+					index = 0;
+					continue;
+				}
+				line[index++] = data[i];
+				if (index == sizeof(line)) {
+					send_radio(line, index);
+					index = 0;
+				}
+			}
+#endif
+			vRingbufferReturnItem(rx_ringbuf, data);
+		}
+#if CONFIG_SERIAL_FRAMED
+		if (decoder.errors != errors) {
+			errors = decoder.errors;
+			ESP_LOGW(pcTaskGetName(NULL), "frames=%" PRIu32 " errors=%" PRIu32, decoder.frames, decoder.errors);
+		}
+#else
+		else if (index > 0) {
+			// The line stopped without a terminator
+			send_radio(line, index);
+			index = 0;
+		}
+#endif
+
+		int64_t now = esp_timer_get_time();
+		if (now - stats_start >= STATS_INTERVAL_MS * 1000LL) {
+			if (rx_stats.bytes || rx_stats.ring_drops) {
+				uint32_t elapsed = (now - stats_start) / 1000;
+				ESP_LOGI(pcTaskGetName(NULL), "%" PRIu32 " bytes/s %" PRIu32 " packets/s ring_drops=%" PRIu32 " radio_drops=%" PRIu32,
+					rx_stats.bytes * 1000 / elapsed, rx_stats.packets * 1000 / elapsed, rx_stats.ring_drops, rx_stats.radio_drops);
+			}
+			memset(&rx_stats, 0, sizeof(rx_stats));
+			stats_start = now;
+		}
+	}
 }
+#endif // CONFIG_SENDER
 
 /**
  * @brief Device event callback
@@ -159,6 +263,14 @@ extern "C" void cdc_acm_vcp_task(void *pvParameters)
 	ESP_LOGI(TAG, "Installing CDC-ACM driver");
 	ESP_ERROR_CHECK(cdc_acm_host_install(NULL));
 
+#if CONFIG_SENDER
+	// Create a task that will parse the received data
+	rx_ringbuf = xRingbufferCreate(CONFIG_VCP_RX_BUFFER_SIZE, RINGBUF_TYPE_BYTEBUF);
+	assert(rx_ringbuf != NULL);
+	task_created = xTaskCreate(vcp_rx_task, "VCP_RX", 4096, NULL, 6, NULL);
+	assert(task_created == pdTRUE);
+#endif
+
 	// Register VCP drivers to VCP service
 	VCP::register_driver<FT23x>();
 	VCP::register_driver<CP210x>();
@@ -207,25 +319,50 @@ extern "C" void cdc_acm_vcp_task(void *pvParameters)
 		ESP_ERROR_CHECK(vcp->set_control_line_state(true, true));
 		ESP_LOGI(TAG, "Done. You can reconnect the VCP device to run again.");
 
-		// Receive from radio task
-		char buffer[xItemSize];
+#if CONFIG_SERIAL_FRAMED
+		// Receive frames from radio and send the frames that are already waiting in one transfer
+		uint8_t buffer[dev_config.out_buffer_size];
+		while(1) {
+			size_t batched = radio_receive(buffer, sizeof(buffer), 100);
+			if (batched > 0) {
+				int frames = 1;
+				while(1) {
+					if (bridge_next_length() == 0 || batched + FRAME_ENCODED_MAX > sizeof(buffer)) break;
+					size_t length = radio_receive(&buffer[batched], sizeof(buffer) - batched, 0);
+					if (length == 0) break;
+					batched += length;
+					frames++;
+				}
+				ESP_LOGI(TAG, "Sending %d frames %d bytes through CdcAcmDevice", frames, batched);
+				ESP_ERROR_CHECK(vcp->tx_blocking(buffer, batched));
+			}
+			EventBits_t connected = xEventGroupGetBits(device_connected_group);
+			if (connected == 0) break;
+		}
+#else
+		// Receive from radio. One byte is left for the newline.
+		char buffer[BRIDGE_ENCODED_MAX + 1];
 		while(1) {
-			size_t received = xMessageBufferReceive(xMessageBufferTx, buffer, sizeof(buffer), 100);
-			ESP_LOGD(TAG, "xMessageBufferReceive received=%d", received);
+			size_t received = radio_receive((uint8_t *)buffer, sizeof(buffer) - 1, 100);
+			ESP_LOGD(TAG, "radio_receive received=%d", received);
 			if (received > 0) {
 				ESP_LOGI(TAG, "Sending data through CdcAcmDevice");
 				ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, received, ESP_LOG_INFO);
+				// Envelopes are a CBOR sequence and need no newline
+#if !CONFIG_BRIDGE_ENVELOPE
 				if (buffer[received-1] != 0x0a) {
 					buffer[received] = 0x0a;
 					received++;
 					ESP_LOG_BUFFER_HEXDUMP(TAG, buffer, received, ESP_LOG_INFO);
 				}
+#endif
 				ESP_ERROR_CHECK(vcp->tx_blocking((uint8_t*)buffer, received));
 			}
 			EventBits_t connected = xEventGroupGetBits(device_connected_group);
 			ESP_LOGD(TAG, "connected=0x%lx", connected);
 			if (connected == 0) break;
 		}
+#endif
 	} // end while
 
 	// Never reach here
@@ -9,169 +9,84 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 
-#include <cc1101.h>
-
-static const char *TAG = "MAIN";
-
-MessageBufferHandle_t xMessageBufferTx;
-MessageBufferHandle_t xMessageBufferRx;
-
-// The total number of bytes (not messages) the message buffer will be able to hold at any one time.
-size_t xBufferSizeBytes = 1024;
-// The size, in bytes, required to hold each item in the message,
-size_t xItemSize = 64; // Maximum Payload size of CC1101 is 64
+#include "bridge.h"
+#include "dlog.h"
+#if CONFIG_SERIAL_FRAMED
+#include "frame.h"
+#endif
 
 #if CONFIG_SENDER
-void tx_task(void *pvParameter)
+// Send the data from the VCP device to the radio.
+// Called by the VCP task. The packets are logged here, because DLOG is for C.
+esp_err_t radio_send(const uint8_t *data, size_t length)
 {
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	uint8_t buf[xItemSize];
-	while(1) {
-		size_t received = xMessageBufferReceive(xMessageBufferRx, buf, sizeof(buf), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "xMessageBufferReceive received=%d", received);
-		packet.length = received;
-		memcpy(packet.data, buf, packet.length);
-		ESP_LOG_BUFFER_HEXDUMP(pcTaskGetName(NULL), packet.data, packet.length, ESP_LOG_INFO);
-		sendData(packet);
-		ESP_LOGI(pcTaskGetName(NULL), "Sent packet. length=%d", packet.length);
-	} // end while
-
-	vTaskDelete( NULL );
+	DLOGI(pcTaskGetName(NULL), "Send to radio length=%d", length);
+	DLOG_HEX(pcTaskGetName(NULL), data, length, ESP_LOG_INFO);
+	return bridge_transmit(data, length, pdMS_TO_TICKS(100));
 }
 #endif // CONFIG_SENDER
 
-#if CONFIG_RECEIVER
-// Get signal strength indicator in dBm.
-// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
-int rssi(char raw) {
-	uint8_t rssi_dec;
-	// TODO: This rssi_offset is dependent on baud and MHz; this is for 38.4kbps and 433 MHz.
-	uint8_t rssi_offset = 74;
-	rssi_dec = (uint8_t) raw;
-	if (rssi_dec >= 128)
-		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
-	else
-		return (rssi_dec / 2) - rssi_offset;
-}
-
-// Get link quality indicator.
-int lqi(char raw) {
-	return 0x3F - raw;
-}
-
-void rx_task(void *pvParameter)
+// Take a packet from the radio and write it to buf as it is sent to the VCP device.
+// Returns the length, 0 when no packet arrived within wait.
+size_t radio_receive(uint8_t *buf, size_t size, TickType_t wait)
 {
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	uint8_t buf[xItemSize];
-	while(1) {
-		if(packet_available()) {
-			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
-				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
-					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *)packet.data);
-						ESP_LOG_BUFFER_HEXDUMP(pcTaskGetName(NULL), packet.data, packet.length, ESP_LOG_INFO);
-
-						memcpy(buf, packet.data, packet.length);
-						int rxLen = packet.length;
-						size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferTx );
-						ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-						size_t sended = xMessageBufferSend(xMessageBufferTx, buf, rxLen, 100);
-						if (sended != rxLen) {
-							ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail rxLen=%d sended=%d", rxLen, sended);
-							break;
-						}
-					}
-				}
-			} // end receiveData
-		} // end packet_available
-		vTaskDelay(1); // Avoid WatchDog alerts
-	} // end while
-
-	vTaskDelete( NULL );
+	BRIDGE_PACKET_t packet;
+	esp_err_t err = bridge_receive(&packet, wait);
+	if (err == ESP_ERR_INVALID_STATE) {
+		// Nothing is received from the radio in the sender mode
+		vTaskDelay(wait);
+	}
+	if (err != ESP_OK) return 0;
+	DLOGI(pcTaskGetName(NULL), "packet.lqi: %d", packet.lqi);
+	DLOGI(pcTaskGetName(NULL), "packet.rssi: %ddBm", packet.rssi);
+	DLOGI(pcTaskGetName(NULL), "packet.length: %d", packet.length);
+	DLOG_TEXT(pcTaskGetName(NULL), "data: %.*s", packet.data, packet.length, ESP_LOG_INFO);
+	DLOG_HEX(pcTaskGetName(NULL), packet.data, packet.length, ESP_LOG_INFO);
+#if CONFIG_SERIAL_FRAMED
+	// Send the encoded frame with RSSI and LQI
+	FRAME_t frame;
+	frame.type = FRAME_TYPE_RX;
+	frame.length = packet.length;
+	frame.rssi = packet.rssi;
+	frame.lqi = packet.lqi;
+	memcpy(frame.data, packet.data, packet.length);
+	return frame_encode(&frame, buf, size);
+#else
+	// The data as it is, or an envelope with CONFIG_BRIDGE_ENVELOPE
+	return bridge_encode(&packet, buf, size);
+#endif
 }
-#endif // CONFIG_RECEIVER
 
 void cdc_acm_vcp_task(void *pvParameters);
 
 void app_main()
 {
-	// Create MessageBuffer
-	xMessageBufferTx = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferTx );
-	xMessageBufferRx = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferRx );
-
-	uint8_t freq;
-#if CONFIG_CC1101_FREQ_315
-	freq = CFREQ_315;
-	ESP_LOGW(TAG, "Set frequency to 315MHz");
-#elif CONFIG_CC1101_FREQ_433
-	freq = CFREQ_433;
-	ESP_LOGW(TAG, "Set frequency to 433MHz");
-#elif CONFIG_CC1101_FREQ_868
-	freq = CFREQ_868;
-	ESP_LOGW(TAG, "Set frequency to 868MHz");
-#elif CONFIG_CC1101_FREQ_915
-	freq = CFREQ_915;
-	ESP_LOGW(TAG, "Set frequency to 915MHz");
-#endif
-
-	uint8_t mode;
-#if CONFIG_CC1101_SPEED_4800
-	mode = CSPEED_4800;
-	ESP_LOGW(TAG, "Set speed to 4800bps");
-#elif CONFIG_CC1101_SPEED_9600
-	mode = CSPEED_9600;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_19200
-	mode = CSPEED_19200;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_38400
-	mode = CSPEED_38400;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#endif
+	// Print the logs of the packets in the background
+	ESP_ERROR_CHECK(dlog_init());
 
 	// Initialize CC1101
-	esp_err_t ret = init(freq, mode);
+	esp_err_t ret = bridge_radio_init();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "CC1101 not installed");
 		while(1) { vTaskDelay(1); }
 	}
 
-	uint8_t syncWord[2] = {199, 10};
-	setSyncWordArray(syncWord);
-	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
-	setChannel(CONFIG_CC1101_CHANNEL);
-	disableAddressCheck();
-#if CONFIG_CC1101_POWER_MIN
-	ESP_LOGW(TAG, "Set Minimum power level");
-	setTxPowerAmp(POWER_MIN);
-#elif CONFIG_CC1101_POWER_0db
-	ESP_LOGW(TAG, "Set 0 dBm power level");
-	setTxPowerAmp(POWER_0db);
-#elif CONFIG_CC1101_POWER_MAX
-	ESP_LOGW(TAG, "Set Maximum power level");
-	setTxPowerAmp(POWER_MAX);
-#endif
-
 #if CONFIG_SENDER
-	xTaskCreate(&tx_task, "TX", 1024*3, NULL, 5, NULL);
+	// The VCP task pushes packets with radio_send()
+	static const BRIDGE_TRANSPORT_t vcp_transport = {
+		.name = "vcp",
+	};
 #endif
 #if CONFIG_RECEIVER
-	xTaskCreate(&rx_task, "RX", 1024*3, NULL, 5, NULL);
+	// The VCP task takes packets with radio_receive()
+	static const BRIDGE_TRANSPORT_t vcp_transport = {
+		.name = "vcp",
+		.pull = true,
+	};
 #endif
+	ESP_ERROR_CHECK(bridge_start(&vcp_transport));
+
 	// Start CDC_ACM_VCP
 	xTaskCreate(cdc_acm_vcp_task, "CDC_ACM_VCP", 1024*4, NULL, 5, NULL);
 }
-
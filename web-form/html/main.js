@@ -3,6 +3,15 @@
 var websocket = new WebSocket('ws://'+location.hostname+'/');
 var maxLine = 10;
 var currentLine = 0;
+var receivedPackets = 0;
+var droppedPackets = 0;
+
+// Show the packet rate every second
+setInterval(function() {
+	var rate = document.getElementById('rate');
+	if (rate) rate.innerText = receivedPackets + " packets/s, " + droppedPackets + " dropped";
+	receivedPackets = 0;
+}, 1000);
 
 function getTextValueByName(name) {
 	var textbox = document.getElementsByName(name)
@@ -106,32 +115,35 @@ websocket.onopen = function(evt) {
 
 websocket.onmessage = function(evt) {
 	var msg = evt.data;
-	console.log("msg=" + msg);
+	//console.log("msg=" + msg);
 	var values = msg.split('\4'); // \4 is EOT
-	console.log("values=" + values);
+	//console.log("values=" + values);
 	switch(values[0]) {
 		case 'RECEIVE':
-			console.log("RECEIVE currentLine=%d maxLine=%d" , currentLine, maxLine);
-			if (currentLine >= maxLine) {
-				while(1) {
-					var object = document.getElementById('article');
-					object.removeChild(object.childNodes.item(1));
-					//console.log("removeChild");
-					currentLine = currentLine - 1;
-					if (currentLine == (maxLine -1)) break;
-				}
+			// Several packets are coalesced into one message
+			var object = document.getElementById('article');
+			var fragment = document.createDocumentFragment();
+			for (var i=1;i<values.length;i++) {
+				var msg = document.createElement('div')
+				//msg.className = 'message-body';
+				//msg.className = 'message-body-frame';
+				msg.className = 'message-body-no-frame';
+				//msg.style.cssText = "color: red;" + "display:inline-block;" + "_display: inline;"
+				msg.innerText = values[i];
+				fragment.appendChild(msg);
+				currentLine = currentLine + 1;
+				receivedPackets = receivedPackets + 1;
+			}
+			object.appendChild(fragment);
+			while (currentLine > maxLine) {
+				object.removeChild(object.firstElementChild);
+				currentLine = currentLine - 1;
 			}
-			console.log("RECEIVE values[1]=" + values[1]);
-			var msg = document.createElement('div')
-			//msg.className = 'message-body';
-			//msg.className = 'message-body-frame';
-			msg.className = 'message-body-no-frame';
-			//msg.style.cssText = "color: red;" + "display:inline-block;" + "_display: inline;"
-			msg.innerText = values[1];
-			document.getElementById('article').appendChild(msg);
-
-			currentLine = currentLine + 1;
-			console.log("RECEIVE currentLine =", currentLine);
+			//console.log("RECEIVE currentLine =", currentLine);
+			break;
+
+		case 'DROPPED':
+			droppedPackets = droppedPackets + parseInt(values[1], 10);
 			break;
 
 		default:
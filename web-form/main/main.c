@@ -19,8 +19,8 @@
 #include "mdns.h"
 #include "cJSON.h"
 
-#include <cc1101.h>
 #include "websocket_server.h"
+#include "bridge.h"
 
 /* FreeRTOS event group to signal when we are connected*/
 static EventGroupHandle_t s_wifi_event_group;
@@ -35,7 +35,6 @@ static const char *TAG = "MAIN";
 static int s_retry_num = 0;
 
 MessageBufferHandle_t xMessageBufferTrans;
-MessageBufferHandle_t xMessageBufferRecv;
 
 // The total number of bytes (not single messages) the message buffer will be able to hold at any one time.
 size_t xBufferSizeBytes = 1024;
@@ -149,115 +148,8 @@ void initialize_mdns(void)
 #endif
 }
 
-#if CONFIG_SENDER
-void tx_task(void *pvParameter)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	while(1) {
-		packet.length = xMessageBufferReceive(xMessageBufferRecv, packet.data, sizeof(packet.data), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "packet.length=%d", packet.length);
-		sendData(packet);
-	} // end while
-
-	// never reach here
-	vTaskDelete( NULL );
-}
-#endif // CONFIG_SENDER
-
-#if CONFIG_RECEIVER
-// Get signal strength indicator in dBm.
-// See: http://www.ti.com/lit/an/swra114d/swra114d.pdf
-int rssi(char raw) {
-	uint8_t rssi_dec;
-	// TODO: This rssi_offset is dependent on baud and MHz; this is for 38.4kbps and 433 MHz.
-	uint8_t rssi_offset = 74;
-	rssi_dec = (uint8_t) raw;
-	if (rssi_dec >= 128)
-		return ((int)( rssi_dec - 256) / 2) - rssi_offset;
-	else
-		return (rssi_dec / 2) - rssi_offset;
-}
-
-// Get link quality indicator.
-int lqi(char raw) {
-	return 0x3F - raw;
-}
-
-void rx_task(void *pvParameter)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	CCPACKET packet;
-	while(1) {
-		if(packet_available()) {
-			if (receiveData(&packet) > 0) {
-				ESP_LOGI(pcTaskGetName(NULL), "Received packet...");
-				if (!packet.crc_ok) {
-					ESP_LOGE(pcTaskGetName(NULL), "crc not ok");
-				} else {
-					ESP_LOGI(pcTaskGetName(NULL),"packet.lqi: %d", lqi(packet.lqi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.rssi: %ddBm", rssi(packet.rssi));
-					ESP_LOGI(pcTaskGetName(NULL),"packet.length: %d", packet.length);
-					if (packet.length > 0) {
-						ESP_LOGI(pcTaskGetName(NULL),"data: %.*s", packet.length, (char *) packet.data);
-
-						// WebSockets can only handle printable characters.
-						// Therefore, determine whether the characters are printable.
-						bool printable = true;
-						for (int i=0;i<packet.length;i++) {
-							int c = packet.data[i];
-							if (!isprint(c)) printable = false;
-						}
-						ESP_LOGI(pcTaskGetName(NULL), "printable=%d", printable);
-						if (!printable) {
-							ESP_LOGW(TAG, "Contains characters that cannot be printed");
-							continue;
-						}
-
-						char buf[xItemSize+1];
-						strncpy(buf, (char *)packet.data, packet.length);
-						buf[packet.length] = 0;
-						cJSON *root;
-						root = cJSON_CreateObject();
-						cJSON_AddStringToObject(root, "id", "recv-request");
-						cJSON_AddStringToObject(root, "payload", buf);
-						//char *my_json_string = cJSON_Print(root);
-						char *my_json_string = cJSON_PrintUnformatted(root);
-						int my_json_length = strlen(my_json_string);
-						ESP_LOGD(pcTaskGetName(NULL), "my_json_string=[%s]",my_json_string);
-						cJSON_Delete(root);
-
-						size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferTrans );
-						ESP_LOGI(pcTaskGetName(NULL), "spacesAvailable=%d", spacesAvailable);
-						size_t sended = xMessageBufferSend(xMessageBufferTrans, my_json_string, my_json_length, 100);
-						if (sended != my_json_length) {
-							ESP_LOGE(pcTaskGetName(NULL), "xMessageBufferSend fail my_json_length=%d sended=%d", my_json_length, sended);
-							break;
-						}
-						cJSON_free(my_json_string);
-					}
-				}
-			} // end receiveData
-		} // end packet_available
-		vTaskDelay(1); // Avoid Watchdog asserts
-	} // end while
-
-	vTaskDelete( NULL );
-}
-
-void task_dummy(void *pvParameters)
-{
-	ESP_LOGI(pcTaskGetName(NULL), "Start");
-	uint8_t buf[xItemSize];
-	while(1) {
-		size_t received = xMessageBufferReceive(xMessageBufferRecv, buf, sizeof(buf), portMAX_DELAY);
-		ESP_LOGI(pcTaskGetName(NULL), "xMessageBufferReceive received=[%.*s]", received, buf);
-	} // end while
-	vTaskDelete(NULL);
-}
-#endif // CONFIG_RECEIVER
-
 void client_task(void* pvParameters);
+void feed_task(void* pvParameters);
 void server_task(void* pvParameters);
 
 void app_main()
@@ -276,64 +168,29 @@ void app_main()
 	// Create MessageBuffer
 	xMessageBufferTrans = xMessageBufferCreate(xBufferSizeBytes);
 	configASSERT( xMessageBufferTrans );
-	xMessageBufferRecv = xMessageBufferCreate(xBufferSizeBytes);
-	configASSERT( xMessageBufferRecv );
 
 	// Initialize mDNS
 	initialize_mdns();
 
-	uint8_t freq;
-#if CONFIG_CC1101_FREQ_315
-	freq = CFREQ_315;
-	ESP_LOGW(TAG, "Set frequency to 315MHz");
-#elif CONFIG_CC1101_FREQ_433
-	freq = CFREQ_433;
-	ESP_LOGW(TAG, "Set frequency to 433MHz");
-#elif CONFIG_CC1101_FREQ_868
-	freq = CFREQ_868;
-	ESP_LOGW(TAG, "Set frequency to 868MHz");
-#elif CONFIG_CC1101_FREQ_915
-	freq = CFREQ_915;
-	ESP_LOGW(TAG, "Set frequency to 915MHz");
-#endif
-
-	uint8_t mode;
-#if CONFIG_CC1101_SPEED_4800
-	mode = CSPEED_4800;
-	ESP_LOGW(TAG, "Set speed to 4800bps");
-#elif CONFIG_CC1101_SPEED_9600
-	mode = CSPEED_9600;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_19200
-	mode = CSPEED_19200;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#elif CONFIG_CC1101_SPEED_38400
-	mode = CSPEED_38400;
-	ESP_LOGW(TAG, "Set speed to 38400bps");
-#endif
-
-	//init(CFREQ_433, 0);
-	ret = init(freq, mode);
+	// Initialize CC1101
+	ret = bridge_radio_init();
 	if (ret != ESP_OK) {
-		ESP_LOGE(TAG, "CC1101 not installed");
 		while(1) { vTaskDelay(1); }
 	}
 
-	uint8_t syncWord[2] = {199, 10};
-	setSyncWordArray(syncWord);
-	ESP_LOGW(TAG, "Set channel to %d", CONFIG_CC1101_CHANNEL);
-	setChannel(CONFIG_CC1101_CHANNEL);
-	disableAddressCheck();
-#if CONFIG_CC1101_POWER_MIN
-	ESP_LOGW(TAG, "Set Minimum power level");
-	setTxPowerAmp(POWER_MIN);
-#elif CONFIG_CC1101_POWER_0db
-	ESP_LOGW(TAG, "Set 0 dBm power level");
-	setTxPowerAmp(POWER_0db);
-#elif CONFIG_CC1101_POWER_MAX
-	ESP_LOGW(TAG, "Set Maximum power level");
-	setTxPowerAmp(POWER_MAX);
+#if CONFIG_SENDER
+	// The browser pushes packets with bridge_transmit()
+	static const BRIDGE_TRANSPORT_t web_form_transport = {
+		.name = "web_form",
+	};
+#else
+	// The feed task takes packets with bridge_receive()
+	static const BRIDGE_TRANSPORT_t web_form_transport = {
+		.name = "web_form",
+		.pull = true,
+	};
 #endif
+	ESP_ERROR_CHECK(bridge_start(&web_form_transport));
 
 	// Get the local IP address
 	esp_netif_ip_info_t ip_info;
@@ -351,12 +208,8 @@ void app_main()
 	// Start web client
 	xTaskCreate(&client_task, "client_task", 1024*4, NULL, 5, NULL);
 
-#if CONFIG_SENDER
-	xTaskCreate(&tx_task, "TX", 1024*3, NULL, 5, NULL);
-#endif
 #if CONFIG_RECEIVER
-	xTaskCreate(&rx_task, "RX", 1024*3, NULL, 5, NULL);
-	xTaskCreate(&task_dummy, "DUMMY", 1024*4, NULL, 5, NULL);
+	xTaskCreate(&feed_task, "FEED", 1024*4, NULL, 5, NULL);
 #endif
 
 	while(1) {
@@ -8,7 +8,9 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
@@ -20,9 +22,9 @@
 static const char *TAG = "CLIENT";
 
 #include "websocket_server.h"
+#include "bridge.h"
 
 extern MessageBufferHandle_t xMessageBufferTrans;
-extern MessageBufferHandle_t xMessageBufferRecv;
 extern size_t xItemSize;
 
 void client_task(void* pvParameters) {
@@ -42,20 +44,142 @@ void client_task(void* pvParameters) {
 
 			if ( strcmp (id, "send-request") == 0) {
 				char *payload = cJSON_GetObjectItem(root,"payload")->valuestring;
-				xMessageBufferSend(xMessageBufferRecv, payload, strlen(payload), portMAX_DELAY);
+				size_t length = strlen(payload);
+				if (length > BRIDGE_PAYLOAD_MAX) length = BRIDGE_PAYLOAD_MAX;
+#if CONFIG_SENDER
+				bridge_transmit((uint8_t *)payload, length, portMAX_DELAY);
+#else
+				ESP_LOGI(TAG, "send-request discarded=[%.*s]", length, payload);
+#endif
 			} // end of send-request
 
-			if ( strcmp (id, "recv-request") == 0) {
-				char *payload = cJSON_GetObjectItem(root,"payload")->valuestring;
-				char out[256];
-				char DEL = 0x04;
-				int outlen = sprintf(out,"RECEIVE%c%s", DEL, payload);
-				ESP_LOGD(TAG,"outlen=%d out-[%s]", outlen, out);
-				ws_server_send_text_all(out, outlen);
-			} // end of recv-request
-
 		}
 		cJSON_Delete(root);
 	}
 	vTaskDelete(NULL);
 }
+
+#if CONFIG_RECEIVER
+// Connected clients. Bit n is client n.
+static uint32_t feed_clients;
+// Clients that connected or disconnected since feed_task looked. Their pending message is cleared.
+static uint32_t feed_reset;
+static portMUX_TYPE feed_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#define FEED_MAX_CLIENTS (WEBSOCKET_SERVER_MAX_CLIENTS < 32 ? WEBSOCKET_SERVER_MAX_CLIENTS : 32)
+
+typedef struct {
+	char *buf;
+	size_t len;
+	TickType_t last_sent;
+	uint32_t dropped;
+} FEED_CLIENT_t;
+
+void feed_client_connect(int num)
+{
+	if (num >= FEED_MAX_CLIENTS) return;
+	taskENTER_CRITICAL(&feed_mux);
+	feed_clients |= (1 << num);
+	feed_reset |= (1 << num);
+	taskEXIT_CRITICAL(&feed_mux);
+}
+
+void feed_client_disconnect(int num)
+{
+	if (num >= FEED_MAX_CLIENTS) return;
+	taskENTER_CRITICAL(&feed_mux);
+	feed_clients &= ~(1 << num);
+	feed_reset |= (1 << num);
+	taskEXIT_CRITICAL(&feed_mux);
+}
+
+// Append one packet to the client's pending message.
+// The message is "RECEIVE" followed by the packets separated by EOT.
+static void feed_append(FEED_CLIENT_t *client, char *payload, size_t length)
+{
+	const char DEL = 0x04;
+	if (client->buf == NULL) {
+		client->buf = malloc(CONFIG_WEB_FEED_BUFFER_SIZE);
+		if (client->buf == NULL) {
+			client->dropped++;
+			return;
+		}
+		client->len = 0;
+	}
+	if (client->len == 0) {
+		client->len = sprintf(client->buf, "RECEIVE");
+	}
+	if (client->len + length + 1 > CONFIG_WEB_FEED_BUFFER_SIZE) {
+		// The client is behind. Drop the packet for this client only.
+		client->dropped++;
+		return;
+	}
+	client->buf[client->len++] = DEL;
+	memcpy(&client->buf[client->len], payload, length);
+	client->len += length;
+}
+
+static void feed_send(int num, FEED_CLIENT_t *client)
+{
+	if (client->dropped) {
+		char out[32];
+		int outlen = sprintf(out, "DROPPED%c%"PRIu32, 0x04, client->dropped);
+		ws_server_send_text_client(num, out, outlen);
+		ESP_LOGW(TAG, "client %d dropped %"PRIu32" packets", num, client->dropped);
+		client->dropped = 0;
+	}
+	if (client->len) {
+		ESP_LOGD(TAG, "client %d send %d bytes", num, client->len);
+		ws_server_send_text_client(num, client->buf, client->len);
+		client->len = 0;
+	}
+	client->last_sent = xTaskGetTickCount();
+}
+
+// Send received packets to all clients.
+// Packets are coalesced per client and each client gets at most one message per interval.
+void feed_task(void* pvParameters) {
+	ESP_LOGI(pcTaskGetName(NULL), "Start");
+	FEED_CLIENT_t clients[FEED_MAX_CLIENTS];
+	memset(clients, 0, sizeof(clients));
+	const TickType_t interval = pdMS_TO_TICKS(CONFIG_WEB_FEED_INTERVAL);
+	BRIDGE_PACKET_t packet;
+	char *payload = (char *)packet.data;
+	while(1) {
+		size_t received = bridge_receive(&packet, interval) == ESP_OK ? packet.length : 0;
+		if (received) {
+			ESP_LOGD(TAG, "packet lqi=%d rssi=%ddBm length=%d", packet.lqi, packet.rssi, packet.length);
+			// WebSockets can only handle printable characters.
+			for (int i=0;i<received;i++) {
+				if (!isprint((int)packet.data[i])) {
+					ESP_LOGW(TAG, "Contains characters that cannot be printed");
+					received = 0;
+					break;
+				}
+			}
+		}
+		taskENTER_CRITICAL(&feed_mux);
+		uint32_t connected = feed_clients;
+		uint32_t reset = feed_reset;
+		feed_reset = 0;
+		taskEXIT_CRITICAL(&feed_mux);
+
+		TickType_t now = xTaskGetTickCount();
+		for (int num=0;num<FEED_MAX_CLIENTS;num++) {
+			FEED_CLIENT_t *client = &clients[num];
+			// The slot may be reused by a new client within one interval.
+			// The packets and the drop count of the old client are not sent to it.
+			if (reset & (1 << num)) {
+				free(client->buf);
+				memset(client, 0, sizeof(FEED_CLIENT_t));
+			}
+			if ((connected & (1 << num)) == 0) continue;
+			if (received) feed_append(client, payload, received);
+			if (client->len == 0 && client->dropped == 0) continue;
+			if (now - client->last_sent < interval) continue;
+			feed_send(num, client);
+		}
+	}
+	vTaskDelete(NULL);
+}
+#endif // CONFIG_RECEIVER
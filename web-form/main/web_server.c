@@ -16,10 +16,16 @@
 #include "esp_log.h"
 
 #include "websocket_server.h"
+#include "bridge.h"
 
 static QueueHandle_t client_queue;
 extern MessageBufferHandle_t xMessageBufferTrans;
 
+#if CONFIG_RECEIVER
+void feed_client_connect(int num);
+void feed_client_disconnect(int num);
+#endif
+
 const static int client_queue_size = 10;
 
 // handles websocket events
@@ -30,27 +36,47 @@ void websocket_callback(uint8_t num,WEBSOCKET_TYPE_t type,char* msg,uint64_t len
 	switch(type) {
 		case WEBSOCKET_CONNECT:
 			ESP_LOGI(TAG,"client %i connected!",num);
+#if CONFIG_RECEIVER
+			feed_client_connect(num);
+#endif
 			break;
 		case WEBSOCKET_DISCONNECT_EXTERNAL:
 			ESP_LOGI(TAG,"client %i sent a disconnect message",num);
+#if CONFIG_RECEIVER
+			feed_client_disconnect(num);
+#endif
 			break;
 		case WEBSOCKET_DISCONNECT_INTERNAL:
 			ESP_LOGI(TAG,"client %i was disconnected",num);
+#if CONFIG_RECEIVER
+			feed_client_disconnect(num);
+#endif
 			break;
 		case WEBSOCKET_DISCONNECT_ERROR:
 			ESP_LOGI(TAG,"client %i was disconnected due to an error",num);
+#if CONFIG_RECEIVER
+			feed_client_disconnect(num);
+#endif
 			break;
 		case WEBSOCKET_TEXT:
 			if(len) { // if the message length was greater than zero
 				ESP_LOGI(TAG, "got message length %i: %s", (int)len, msg);
-				size_t xBytesSent = xMessageBufferSendFromISR(xMessageBufferTrans, msg, len, NULL);
+				size_t xBytesSent = xMessageBufferSend(xMessageBufferTrans, msg, len, 0);
 				if (xBytesSent != len) {
 					ESP_LOGE(TAG, "xMessageBufferSend fail");
 				}
 			}
 			break;
 		case WEBSOCKET_BIN:
-			ESP_LOGI(TAG,"client %i sent binary message of size %"PRIu32":\n%s",num,(uint32_t)len,msg);
+			ESP_LOGI(TAG,"client %i sent binary message of size %"PRIu32,num,(uint32_t)len);
+#if CONFIG_SENDER
+			// Binary message is sent to radio as it is
+			if(len && len <= BRIDGE_PAYLOAD_MAX) {
+				if (bridge_transmit((uint8_t *)msg, len, 0) != ESP_OK) {
+					ESP_LOGE(TAG, "bridge_transmit fail");
+				}
+			}
+#endif
 			break;
 		case WEBSOCKET_PING:
 			ESP_LOGI(TAG,"client %i pinged us with message of size %"PRIu32":\n%s",num,(uint32_t)len,msg);
@@ -17,15 +17,15 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_websocket_client.h"
 
+#include "bridge.h"
+#include "resolver.h"
+
 static const char *TAG = "CLIENT";
 
-extern MessageBufferHandle_t xMessageBufferTrans;
-extern size_t xItemSize;
 
 typedef struct {
 	TaskHandle_t taskHandle;
@@ -36,6 +36,14 @@ typedef struct {
 	char data[256];
 } SOCKET_t;
 
+// Address of the server used by the client
+static char server_ip[128];
+
+static void make_url(const char *ip, char *url)
+{
+	sprintf(url, "ws://%.120s:%d", ip, CONFIG_WEB_SERVER_PORT);
+}
+
 #if 0
 typedef enum ws_transport_opcodes {
 	WS_TRANSPORT_OPCODES_CONT =  0x00,
@@ -61,6 +69,17 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
 		break;
 	case WEBSOCKET_EVENT_DISCONNECTED:
 		ESP_LOGI(TAG, "WEBSOCKET_EVENT_DISCONNECTED");
+		// The server may have moved to another address.
+		// The address is refreshed in the background and used on a later reconnect.
+		resolver_invalidate(CONFIG_WEB_SERVER_HOST);
+		char ip[128];
+		if (resolver_get(CONFIG_WEB_SERVER_HOST, ip, sizeof(ip)) == ESP_OK && strcmp(ip, server_ip) != 0) {
+			char url[142];
+			make_url(ip, url);
+			ESP_LOGI(TAG, "Server moved. url=[%s]", url);
+			esp_websocket_client_set_uri((esp_websocket_client_handle_t)handler_args, url);
+			strcpy(server_ip, ip);
+		}
 		break;
 	case WEBSOCKET_EVENT_DATA:
 		ESP_LOGI(TAG, "WEBSOCKET_EVENT_DATA");
@@ -101,20 +120,16 @@ static void websocket_event_handler(void *handler_args, esp_event_base_t base, i
 	}
 }
 
-esp_err_t query_mdns_host(const char * host_name, char *ip);
-void convert_mdns_host(char * from, char * to);
-
 void ws_client(void *pvParameters)
 {
 	ESP_LOGI(TAG, "Start WEB_SERVER_HOST:%s WEB_SERVER_PORT:%d", CONFIG_WEB_SERVER_HOST, CONFIG_WEB_SERVER_PORT);
 
 	// Resolve mDNS host name
-	char ip[128];
 	ESP_LOGI(TAG, "CONFIG_WEB_SERVER_HOST=[%s]", CONFIG_WEB_SERVER_HOST);
-	convert_mdns_host(CONFIG_WEB_SERVER_HOST, ip);
-	ESP_LOGI(TAG, "ip=[%s]", ip);
+	resolver_resolve(CONFIG_WEB_SERVER_HOST, server_ip, sizeof(server_ip));
+	ESP_LOGI(TAG, "ip=[%s]", server_ip);
 	char url[142];
-	sprintf(url, "ws://%s:%d", ip, CONFIG_WEB_SERVER_PORT);
+	make_url(server_ip, url);
 	ESP_LOGI(TAG, "url=[%s]", url);
 
 	TaskHandle_t taskHandle = xTaskGetCurrentTaskHandle();
@@ -141,11 +156,20 @@ void ws_client(void *pvParameters)
 	}
 	ESP_LOGI(TAG, "Connected to %s...", websocket_cfg.uri);
 
-	char buffer[xItemSize];
+	BRIDGE_PACKET_t packet;
+#if CONFIG_BRIDGE_ENVELOPE
+	char buffer[BRIDGE_ENCODED_MAX];
+#else
+	char *buffer = (char *)packet.data;
+#endif
 	while (1) {
-		size_t received = xMessageBufferReceive(xMessageBufferTrans, buffer, sizeof(buffer), portMAX_DELAY);
-		ESP_LOGI(TAG, "xMessageBufferReceive received=%d", received);
+		size_t received = bridge_receive(&packet, portMAX_DELAY) == ESP_OK ? packet.length : 0;
+		ESP_LOGD(TAG, "bridge_receive received=%d rssi=%d lqi=%d", received, packet.rssi, packet.lqi);
 		if (received > 0) {
+#if CONFIG_BRIDGE_ENVELOPE
+			// An envelope is sent in a binary frame
+			received = bridge_encode(&packet, (uint8_t *)buffer, sizeof(buffer));
+#else
 			// WebSockets can only handle printable characters.
 			// Therefore, determine whether the characters are printable.
 			bool printable = true;
@@ -159,12 +183,18 @@ void ws_client(void *pvParameters)
 				continue;
 			}
 
-			ESP_LOGI(TAG, "xMessageBufferReceive buffer=[%.*s]",received, buffer);
+			ESP_LOGI(TAG, "packet=[%.*s]", received, buffer);
+#endif
 			if (esp_websocket_client_is_connected(client)) {
+#if CONFIG_BRIDGE_ENVELOPE
+				ESP_LOGD(TAG, "esp_websocket_client_send_bin");
+				int sended = esp_websocket_client_send_bin(client, buffer, received, 100);
+#else
 				ESP_LOGI(TAG, "esp_websocket_client_send_text");
 				int sended = esp_websocket_client_send_text(client, buffer, received, 100);
+#endif
 				if (sended != received) {
-					ESP_LOGE(TAG," esp_websocket_client_send_text fail sended=%d received=%d", sended, received);
+					ESP_LOGE(TAG," esp_websocket_client_send fail sended=%d received=%d", sended, received);
 					break;
 				}
 
@@ -180,7 +210,7 @@ void ws_client(void *pvParameters)
 				break;
 			}
 		} else {
-			 ESP_LOGE(TAG, "xMessageBufferReceive fail");
+			 ESP_LOGE(TAG, "bridge_receive fail");
 			 break;
 		}
 	} // end while
@@ -0,0 +1,23 @@
+/*
+ * Binary frame sent to WebSocket clients for every received radio packet.
+ * All fields are little endian.
+ *
+ *  0      version (WS_FRAME_VERSION)
+ *  1      payload length
+ *  2      RSSI in dBm (signed)
+ *  3      LQI
+ *  4..7   timestamp in milliseconds since boot
+ *  8..    payload
+ */
+
+#define WS_FRAME_VERSION 1
+#define WS_FRAME_HEADER_LEN 8
+
+typedef struct __attribute__((packed)) {
+	uint8_t version;
+	uint8_t length;
+	int8_t rssi;
+	uint8_t lqi;
+	uint32_t timestamp;
+	uint8_t data[CCPACKET_DATA_LEN];
+} WS_FRAME_t;
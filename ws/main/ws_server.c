@@ -9,19 +9,192 @@
 
 #include <stdio.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/message_buffer.h"
 #include "esp_log.h"
 #include "esp_http_server.h"
 
+#include "bridge.h"
+#include "ws_frame.h"
+
 static const char *TAG = "SERVER";
 
-extern MessageBufferHandle_t xMessageBufferRecv;
-extern size_t xItemSize;
+
+#if CONFIG_BIDIRECTIONAL
+#define MAX_CLIENTS 7 // Same as max_open_sockets of HTTPD_DEFAULT_CONFIG
+
+/*
+ * Per-client send state.
+ * pending is the number of frames queued to the httpd task and not yet sent.
+ * The fd of a closed client can be given to the next one, so the frames
+ * carry the generation of the connection they were queued for.
+ */
+typedef struct {
+	int fd;
+	uint32_t generation;
+	int pending;
+	uint32_t sent;
+	uint32_t dropped;
+} CLIENT_t;
+
+static CLIENT_t clients[MAX_CLIENTS];
+static portMUX_TYPE clients_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t clients_generation;
+
+typedef struct {
+	httpd_handle_t hd;
+	int fd;
+	uint32_t generation;
+	size_t len;
+	uint8_t payload[];
+} ASYNC_FRAME_t;
+
+/*
+ * Reserve a send slot for the client.
+ * Return false when the client already has CONFIG_WEB_MAX_PENDING_FRAMES frames waiting.
+ */
+static bool client_reserve(int fd, uint32_t *generation)
+{
+	bool ret = false;
+	taskENTER_CRITICAL(&clients_mux);
+	CLIENT_t *client = NULL;
+	for (int i=0;i<MAX_CLIENTS;i++) {
+		if (clients[i].fd == fd) {
+			client = &clients[i];
+			break;
+		}
+		if (client == NULL && clients[i].fd < 0) client = &clients[i];
+	}
+	if (client != NULL) {
+		if (client->fd != fd) {
+			client->fd = fd;
+			client->generation = ++clients_generation;
+			client->pending = 0;
+			client->sent = 0;
+			client->dropped = 0;
+		}
+		if (client->pending < CONFIG_WEB_MAX_PENDING_FRAMES) {
+			client->pending++;
+			*generation = client->generation;
+			ret = true;
+		} else {
+			client->dropped++;
+		}
+	}
+	taskEXIT_CRITICAL(&clients_mux);
+	return ret;
+}
+
+/*
+ * Nothing is counted when the connection of the generation is closed,
+ * so a new client that got the same fd keeps its own count.
+ */
+static void client_release(int fd, uint32_t generation, bool sent)
+{
+	taskENTER_CRITICAL(&clients_mux);
+	for (int i=0;i<MAX_CLIENTS;i++) {
+		if (clients[i].fd != fd || clients[i].generation != generation) continue;
+		if (clients[i].pending > 0) clients[i].pending--;
+		if (sent) clients[i].sent++;
+		break;
+	}
+	taskEXIT_CRITICAL(&clients_mux);
+}
+
+static bool client_current(int fd, uint32_t generation)
+{
+	bool ret = false;
+	taskENTER_CRITICAL(&clients_mux);
+	for (int i=0;i<MAX_CLIENTS;i++) {
+		if (clients[i].fd == fd && clients[i].generation == generation) ret = true;
+	}
+	taskEXIT_CRITICAL(&clients_mux);
+	return ret;
+}
+
+static void client_close(httpd_handle_t hd, int fd)
+{
+	taskENTER_CRITICAL(&clients_mux);
+	CLIENT_t client = { .fd = -1 };
+	for (int i=0;i<MAX_CLIENTS;i++) {
+		if (clients[i].fd != fd) continue;
+		client = clients[i];
+		clients[i].fd = -1;
+		break;
+	}
+	taskEXIT_CRITICAL(&clients_mux);
+	if (client.fd >= 0) {
+		ESP_LOGI(TAG, "client fd=%d closed sent=%"PRIu32" dropped=%"PRIu32, fd, client.sent, client.dropped);
+	}
+	close(fd);
+}
+
+/*
+ * Runs in the httpd task.
+ */
+static void ws_async_send(void *arg)
+{
+	ASYNC_FRAME_t *frame = arg;
+	// Queued for a client that is closed. The fd may belong to a new client now.
+	if (client_current(frame->fd, frame->generation) == false) {
+		free(frame);
+		return;
+	}
+	httpd_ws_frame_t ws_pkt;
+	memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
+	ws_pkt.payload = frame->payload;
+	ws_pkt.len = frame->len;
+	ws_pkt.type = HTTPD_WS_TYPE_BINARY;
+	ws_pkt.final = true;
+	esp_err_t ret = httpd_ws_send_frame_async(frame->hd, frame->fd, &ws_pkt);
+	client_release(frame->fd, frame->generation, ret == ESP_OK);
+	if (ret != ESP_OK) {
+		ESP_LOGW(TAG, "httpd_ws_send_frame_async fd=%d failed with %d", frame->fd, ret);
+		httpd_sess_trigger_close(frame->hd, frame->fd);
+	}
+	free(frame);
+}
+
+/*
+ * Queue the frame to every WebSocket client.
+ */
+static void ws_broadcast(httpd_handle_t server, const uint8_t *payload, size_t len)
+{
+	size_t fds = MAX_CLIENTS;
+	int client_fds[MAX_CLIENTS];
+	if (httpd_get_client_list(server, &fds, client_fds) != ESP_OK) return;
+	for (int i=0;i<fds;i++) {
+		int fd = client_fds[i];
+		if (httpd_ws_get_fd_info(server, fd) != HTTPD_WS_CLIENT_WEBSOCKET) continue;
+		uint32_t generation;
+		if (client_reserve(fd, &generation) == false) {
+			ESP_LOGD(TAG, "client fd=%d is too slow, frame dropped", fd);
+			continue;
+		}
+		ASYNC_FRAME_t *frame = malloc(sizeof(ASYNC_FRAME_t) + len);
+		if (frame == NULL) {
+			ESP_LOGE(TAG, "Failed to malloc memory for frame");
+			client_release(fd, generation, false);
+			continue;
+		}
+		frame->hd = server;
+		frame->fd = fd;
+		frame->generation = generation;
+		frame->len = len;
+		memcpy(frame->payload, payload, len);
+		if (httpd_queue_work(server, ws_async_send, frame) != ESP_OK) {
+			ESP_LOGW(TAG, "httpd_queue_work fd=%d fail", fd);
+			client_release(fd, generation, false);
+			free(frame);
+		}
+	}
+}
+#endif // CONFIG_BIDIRECTIONAL
 
 static esp_err_t root_get_handler(httpd_req_t *req)
 {
@@ -32,7 +205,6 @@ static esp_err_t root_get_handler(httpd_req_t *req)
 	httpd_ws_frame_t ws_pkt;
 	uint8_t *buf = NULL;
 	memset(&ws_pkt, 0, sizeof(httpd_ws_frame_t));
-	ws_pkt.type = HTTPD_WS_TYPE_TEXT;
 	/* Set max_len = 0 to get the frame len */
 	esp_err_t ret = httpd_ws_recv_frame(req, &ws_pkt, 0);
 	if (ret != ESP_OK) {
@@ -42,7 +214,8 @@ static esp_err_t root_get_handler(httpd_req_t *req)
 	ESP_LOGI(TAG, "frame len is %d", ws_pkt.len);
 	if (ws_pkt.len) {
 		/* ws_pkt.len + 1 is for NULL termination as we are expecting a string */
-		buf = calloc(1, ws_pkt.len + 1);
+		/* At least 3 bytes are needed for the "ok" reply */
+		buf = calloc(1, ws_pkt.len + 3);
 		if (buf == NULL) {
 			ESP_LOGE(TAG, "Failed to calloc memory for buf");
 			return ESP_ERR_NO_MEM;
@@ -55,21 +228,28 @@ static esp_err_t root_get_handler(httpd_req_t *req)
 			free(buf);
 			return ret;
 		}
-		ESP_LOGI(TAG, "Got packet with message: [%.*s]", ws_pkt.len, ws_pkt.payload);
-
-		// Queries a message buffer to see how much free space it contains
-		size_t spacesAvailable = xMessageBufferSpacesAvailable( xMessageBufferRecv );
-		ESP_LOGI(TAG, "spacesAvailable=%d", spacesAvailable);
-		if (ws_pkt.len > xItemSize) ws_pkt.len = xItemSize;
-		size_t sended = xMessageBufferSend(xMessageBufferRecv, ws_pkt.payload, ws_pkt.len, 100);
-		if (sended != ws_pkt.len) {
-			ESP_LOGE(TAG, "xMessageBufferSend fail. ws_pkt.len=%d sended=%d", ws_pkt.len, sended);
+		if (ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+			ESP_LOGI(TAG, "Got packet with %d bytes", ws_pkt.len);
+		} else {
+			ESP_LOGI(TAG, "Got packet with message: [%.*s]", ws_pkt.len, ws_pkt.payload);
+		}
+
+		if (ws_pkt.len > BRIDGE_PAYLOAD_MAX) ws_pkt.len = BRIDGE_PAYLOAD_MAX;
+		esp_err_t err = bridge_transmit(ws_pkt.payload, ws_pkt.len, 100);
+		if (err != ESP_OK) {
+			ESP_LOGE(TAG, "bridge_transmit fail. ws_pkt.len=%d %s", ws_pkt.len, esp_err_to_name(err));
 		}
 
 		ESP_LOGD(TAG, "Packet final: %d", ws_pkt.final);
 		ESP_LOGD(TAG, "Packet fragmented: %d", ws_pkt.fragmented);
 		ESP_LOGD(TAG, "Packet type: %d", ws_pkt.type);
 
+		// Binary frames are a stream, only text frames are acknowledged
+		if (ws_pkt.type == HTTPD_WS_TYPE_BINARY) {
+			free(buf);
+			return ESP_OK;
+		}
+
 		strcpy((char *)ws_pkt.payload, "ok");
 		ws_pkt.len = 2;
 		ret = httpd_ws_send_frame(req, &ws_pkt);
@@ -82,11 +262,18 @@ static esp_err_t root_get_handler(httpd_req_t *req)
 }
 
 /* Function to start the web server */
-esp_err_t start_server(int port)
+esp_err_t start_server(int port, httpd_handle_t *handle)
 {
 	httpd_handle_t server = NULL;
 	httpd_config_t config = HTTPD_DEFAULT_CONFIG();
 	config.server_port = port;
+#if CONFIG_BIDIRECTIONAL
+	config.max_open_sockets = MAX_CLIENTS;
+	config.close_fn = client_close;
+	// Don't let one slow client hold the httpd task for long
+	config.send_wait_timeout = 1;
+	for (int i=0;i<MAX_CLIENTS;i++) clients[i].fd = -1;
+#endif
 
 	// Start the httpd server
 	if (httpd_start(&server, &config) != ESP_OK) {
@@ -105,6 +292,7 @@ esp_err_t start_server(int port)
 	};
 	httpd_register_uri_handler(server, &_root_get_handler);
 
+	*handle = server;
 	return ESP_OK;
 }
 
@@ -116,6 +304,23 @@ void ws_server(void *pvParameters)
 	int port = CONFIG_WEB_LISTEN_PORT;
 	sprintf(url, "ws://%s:%d", task_parameter, port);
 	ESP_LOGI(TAG, "Starting HTTP server on %s", url);
-	ESP_ERROR_CHECK(start_server(port));
+	httpd_handle_t server;
+	ESP_ERROR_CHECK(start_server(port, &server));
+
+#if CONFIG_BIDIRECTIONAL
+	// Send every received packet with metadata to all connected clients
+	BRIDGE_PACKET_t packet;
+	WS_FRAME_t frame;
+	while(1) {
+		if (bridge_receive(&packet, portMAX_DELAY) != ESP_OK) continue;
+		frame.version = WS_FRAME_VERSION;
+		frame.length = packet.length;
+		frame.rssi = packet.rssi;
+		frame.lqi = packet.lqi;
+		frame.timestamp = packet.rx_time / 1000;
+		memcpy(frame.data, packet.data, packet.length);
+		ws_broadcast(server, (uint8_t *)&frame, WS_FRAME_HEADER_LEN + packet.length);
+	}
+#endif
 	vTaskDelete(NULL);
 }
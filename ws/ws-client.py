@@ -4,6 +4,8 @@
 
 import time
 import socket
+import struct
+import threading
 from websockets.sync.client import connect
 import argparse
 import signal
@@ -13,6 +15,26 @@ def handler(signal, frame):
 	print('handler')
 	running = False
 
+# Binary frame of a received radio packet. See main/ws_frame.h
+def decode_frame(message):
+	version, length, rssi, lqi, timestamp = struct.unpack_from('<BBbBI', message)
+	payload = message[8:8+length]
+	return version, rssi, lqi, timestamp, payload
+
+def receiver(websocket):
+	while running:
+		try:
+			message = websocket.recv(timeout=1.0)
+		except TimeoutError:
+			continue
+		except Exception:
+			break
+		if isinstance(message, bytes):
+			version, rssi, lqi, timestamp, payload = decode_frame(message)
+			print("radio: rssi={}dBm lqi={} timestamp={}ms payload={}".format(rssi, lqi, timestamp, payload))
+		else:
+			print("responce: {}".format(message))
+
 if __name__=='__main__':
 	signal.signal(signal.SIGINT, handler)
 	running = True
@@ -20,6 +42,7 @@ if __name__=='__main__':
 	parser = argparse.ArgumentParser()
 	parser.add_argument('--host', help='socket host', default="esp32-server.local")
 	parser.add_argument('--port', type=int, help='socket port', default=8080)
+	parser.add_argument('--duplex', action='store_true', help='send binary frames and print received radio packets')
 	args = parser.parse_args()
 	print("args.host={}".format(args.host))
 	print("args.port={}".format(args.port))
@@ -34,6 +57,20 @@ if __name__=='__main__':
 	print("uri={}".format(uri))
 	websocket = connect(uri)
 
+	if args.duplex:
+		thread = threading.Thread(target=receiver, args=(websocket,))
+		thread.start()
+		while running:
+			t = time.time()
+			local_time = time.localtime(t)
+			payload = time.asctime(local_time)
+			websocket.send(payload.encode())
+			print("{}-->".format(payload))
+			time.sleep(1.0)
+		thread.join()
+		websocket.close()
+		exit()
+
 	while running:
 		t = time.time()
 		local_time = time.localtime(t)
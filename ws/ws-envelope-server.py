@@ -0,0 +1,40 @@
+#!/usr/bin/env python
+# WS Server for the binary envelopes. ws-server.py only accepts text frames.
+# python3 -m pip install websockets
+# https://github.com/python-websockets/websockets
+
+import argparse
+import asyncio
+import os
+import sys
+import websockets
+
+# Decoder of the binary envelope
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), '../components/envelope'))
+import envelope
+
+# Called for every client connecting
+async def handler(websocket):
+	print("new client connected from {}".format(websocket.remote_address))
+	try:
+		async for message in websocket:
+			if isinstance(message, bytes):
+				for item in envelope.decode_seq(message):
+					envelope.print_envelope(item)
+			else:
+				print("text frame: {}".format(message))
+			await websocket.send("ok")
+	except websockets.ConnectionClosed:
+		pass
+	print("client {} disconnected".format(websocket.remote_address))
+
+async def main(port):
+	async with websockets.serve(handler, "0.0.0.0", port):
+		await asyncio.Future()
+
+if __name__=='__main__':
+	parser = argparse.ArgumentParser()
+	parser.add_argument('--port', type=int, help='listen port', default=8080)
+	args = parser.parse_args()
+	print("args.port={}".format(args.port))
+	asyncio.run(main(args.port))